@@ -0,0 +1,348 @@
+/**
+ * @file tensor_bench.c
+ * @brief Microbenchmarks of the core tensor operations.
+ * @details Times Tensor_clone, Tensor_contiguous, Tensor_write_to, Tensor_slice, Tensor_get and Tensor_set,
+ * the constant constructors and the dispatch of the parallel loops, over several shapes and ranks,
+ * contiguous and strided (transposed) views, and thread counts.
+ * Every case reports ns per element, GB/s of memory moved and, for loops, the latency of a single job.
+ *
+ * The results are written to stdout as JSON, so two versions can be compared,
+ * and a readable summary is written to stderr.
+ *
+ * @code{.sh}
+ * make bench
+ * ./build/bench.out write_to > write_to.json
+ * TENSOR_BENCH_THREADS=1,4,16 ./build/bench.out
+ * @endcode
+ *
+ * The optional argument only runs the cases whose name contains it.
+ * TENSOR_BENCH_THREADS is a comma separated list of thread counts, defaulting to the powers of two
+ * up to the default size of the pool, and that size.
+ * TENSOR_BENCH_MIN_MS is the minimum time spent repeating every case, 50 by default.
+ *
+*/
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "tensor.h"
+#include "tensor/constants.h"
+#include "tensor/layout.h"
+#include "tensor/parallel.h"
+
+/**
+ * @brief Maximum rank of the benchmarked shapes.
+*/
+#define BENCH_MAX_DIMS 4
+
+/**
+ * @brief Maximum number of thread counts to run.
+*/
+#define BENCH_MAX_THREAD_COUNTS 16
+
+/**
+ * @brief Minimum and maximum number of timed repetitions of a case.
+*/
+#define BENCH_MIN_REPEATS 3
+#define BENCH_MAX_REPEATS 100000
+
+/**
+ * @brief Shape the cases run on, with the layout of the source tensor.
+ * @details A strided shape is allocated with its axes reversed and transposed back,
+ * 	   so it has the same shape as the contiguous one but is read against its memory order.
+*/
+struct BenchShape {
+	TensorShape_t ndim;
+	TensorIndex_t shape[BENCH_MAX_DIMS];
+	int strided;
+};
+
+/**
+ * @brief Tensors and parameters shared by a case and its timed function.
+*/
+struct BenchState {
+	struct BenchShape shape;
+	TensorObject src;
+	TensorObject dst;
+	TensorIndex_t size;
+	TensorData_t sink;
+};
+
+/**
+ * @brief Benchmarked operation.
+ * @details elements, bytes and jobs are the amounts one call processes, moves and dispatches,
+ * 	   the reported rates are derived from them. A case with no bytes or jobs reports null for the rate.
+*/
+struct BenchCase {
+	const char *name;
+	int parallel; ///< Whether the case depends on the number of threads.
+	int (*setup)(struct BenchState *state); ///< Returns 0 if the case applies to the shape.
+	void (*run)(struct BenchState *state);
+	TensorIndex_t (*elements)(const struct BenchState *state);
+	TensorIndex_t (*bytes)(const struct BenchState *state);
+	TensorIndex_t (*jobs)(const struct BenchState *state);
+};
+
+static long long Bench_min_ns = 50000000;
+static int Bench_first_result = 1;
+
+static long long Bench_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static TensorObject Bench_source(const struct BenchShape *shape) {
+	if(!shape->strided) return Tensor_new(shape->ndim, shape->shape);
+	TensorIndex_t reversed[BENCH_MAX_DIMS];
+	for(TensorShape_t i = 0; i < shape->ndim; i++) reversed[i] = shape->shape[shape->ndim - 1 - i];
+	TensorObject tensor = Tensor_new(shape->ndim, reversed);
+	for(TensorShape_t i = 0; i < shape->ndim / 2; i++) Tensor_swapaxis(&tensor, i, shape->ndim - 1 - i);
+	return tensor;
+}
+
+static void Bench_fill(TensorObject *tensor) {
+	for(TensorIndex_t i = 0; i < tensor->storage->size / sizeof(TensorData_t); i++) tensor->data[i] = i % 251;
+}
+
+static TensorIndex_t Bench_size(const struct BenchState *state) {
+	return state->size;
+}
+
+static TensorIndex_t Bench_read_bytes(const struct BenchState *state) {
+	return state->size * sizeof(TensorData_t);
+}
+
+static TensorIndex_t Bench_copy_bytes(const struct BenchState *state) {
+	return 2 * state->size * sizeof(TensorData_t);
+}
+
+// Tensor_contiguous only copies a strided source, a contiguous one is returned as a view.
+static TensorIndex_t Bench_strided_copy_bytes(const struct BenchState *state) {
+	return state->shape.strided ? Bench_copy_bytes(state) : 0;
+}
+
+static TensorIndex_t Bench_none(const struct BenchState *state) {
+	return 0;
+}
+
+static TensorIndex_t Bench_outer(const struct BenchState *state) {
+	return state->shape.shape[0];
+}
+
+static int Bench_setup_src(struct BenchState *state) {
+	state->src = Bench_source(&state->shape);
+	Bench_fill(&state->src);
+	return 0;
+}
+
+static int Bench_setup_copy(struct BenchState *state) {
+	Bench_setup_src(state);
+	state->dst = Tensor_new(state->shape.ndim, state->shape.shape);
+	return 0;
+}
+
+static int Bench_setup_contiguous(struct BenchState *state) {
+	return state->shape.strided ? -1 : 0;
+}
+
+static int Bench_setup_matrix(struct BenchState *state) {
+	return state->shape.strided || state->shape.ndim != 2 ? -1 : 0;
+}
+
+static void Bench_clone(struct BenchState *state) {
+	TensorObject clone = Tensor_clone(state->src);
+	Tensor_free(&clone);
+}
+
+static void Bench_contiguous(struct BenchState *state) {
+	TensorObject copy = Tensor_contiguous(state->src);
+	Tensor_free(&copy);
+}
+
+static void Bench_write_to(struct BenchState *state) {
+	Tensor_write_to(&state->src, &state->dst);
+}
+
+static void Bench_slice(struct BenchState *state) {
+	for(TensorIndex_t i = 0; i < state->shape.shape[0]; i++) {
+		TensorObject slice = Tensor_slice(&state->src, 0, i);
+		Tensor_free(&slice);
+	}
+}
+
+// Advance a row-major multi-index over shape, returning 0 after the last one.
+static int Bench_next_index(const struct BenchShape *shape, TensorIndex_t *idx) {
+	for(TensorShape_t i = shape->ndim; i-- > 0;) {
+		if(++idx[i] < shape->shape[i]) return 1;
+		idx[i] = 0;
+	}
+	return 0;
+}
+
+static void Bench_get(struct BenchState *state) {
+	TensorIndex_t idx[BENCH_MAX_DIMS] = {0};
+	TensorData_t sum = 0;
+	do sum += *Tensor_get(&state->src, idx);
+	while(Bench_next_index(&state->shape, idx));
+	state->sink += sum;
+}
+
+static void Bench_set(struct BenchState *state) {
+	TensorIndex_t idx[BENCH_MAX_DIMS] = {0};
+	TensorData_t value = 0;
+	do Tensor_set(&state->src, idx, value++);
+	while(Bench_next_index(&state->shape, idx));
+}
+
+static void Bench_zeros(struct BenchState *state) {
+	TensorObject tensor = Tensor_zeros(state->shape.ndim, state->shape.shape);
+	Tensor_free(&tensor);
+}
+
+static void Bench_ones(struct BenchState *state) {
+	TensorObject tensor = Tensor_ones(state->shape.ndim, state->shape.shape);
+	Tensor_free(&tensor);
+}
+
+static void Bench_eye(struct BenchState *state) {
+	TensorObject tensor = Tensor_eye(state->shape.shape[0], state->shape.shape[1], 1);
+	Tensor_free(&tensor);
+}
+
+static void* Bench_nop(void *args) {
+	return NULL;
+}
+
+static void Bench_loop_over_dim(struct BenchState *state) {
+	Tensor_loop_over_dim(state->src, 0, Bench_nop, NULL);
+}
+
+static void Bench_loop_chunked(struct BenchState *state) {
+	Tensor_loop_over_dim_chunked(state->src, 0, 1, Bench_nop, NULL);
+}
+
+static void Bench_parallel_for(struct BenchState *state) {
+	Tensor_parallel_for(state->shape.shape[0], 1, Bench_nop, NULL);
+}
+
+static const struct BenchCase Bench_cases[] = {
+	{"clone", 1, Bench_setup_src, Bench_clone, Bench_size, Bench_copy_bytes, Bench_none},
+	{"contiguous", 1, Bench_setup_src, Bench_contiguous, Bench_size, Bench_strided_copy_bytes, Bench_none},
+	{"write_to", 1, Bench_setup_copy, Bench_write_to, Bench_size, Bench_copy_bytes, Bench_none},
+	{"slice", 0, Bench_setup_src, Bench_slice, Bench_outer, Bench_none, Bench_none},
+	{"get", 0, Bench_setup_src, Bench_get, Bench_size, Bench_read_bytes, Bench_none},
+	{"set", 0, Bench_setup_src, Bench_set, Bench_size, Bench_read_bytes, Bench_none},
+	{"zeros", 1, Bench_setup_contiguous, Bench_zeros, Bench_size, Bench_none, Bench_none},
+	{"ones", 1, Bench_setup_contiguous, Bench_ones, Bench_size, Bench_read_bytes, Bench_none},
+	{"eye", 1, Bench_setup_matrix, Bench_eye, Bench_size, Bench_read_bytes, Bench_none},
+	{"loop_over_dim", 1, Bench_setup_src, Bench_loop_over_dim, Bench_outer, Bench_none, Bench_outer},
+	{"loop_over_dim_chunked", 1, Bench_setup_src, Bench_loop_chunked, Bench_outer, Bench_none, Bench_outer},
+	{"parallel_for", 1, Bench_setup_contiguous, Bench_parallel_for, Bench_outer, Bench_none, Bench_outer},
+};
+
+// Every shape has about a million elements, except for a small one showing the fixed overheads.
+static const struct BenchShape Bench_shapes[] = {
+	{1, {1 << 20}, 0},
+	{2, {64, 64}, 0},
+	{2, {1024, 1024}, 0},
+	{2, {1024, 1024}, 1},
+	{3, {128, 128, 64}, 0},
+	{3, {128, 128, 64}, 1},
+	{4, {32, 32, 32, 32}, 0},
+	{4, {32, 32, 32, 32}, 1},
+};
+
+// Time a case, returning the fastest call in ns. Calls are repeated for at least Bench_min_ns.
+static long long Bench_time(const struct BenchCase *bench, struct BenchState *state, long long *repeats) {
+	bench->run(state);
+	long long best = -1;
+	const long long start = Bench_now();
+	for(*repeats = 0; *repeats < BENCH_MAX_REPEATS; (*repeats)++) {
+		const long long before = Bench_now();
+		bench->run(state);
+		const long long elapsed = Bench_now() - before;
+		if(best < 0 || elapsed < best) best = elapsed;
+		if(*repeats + 1 >= BENCH_MIN_REPEATS && before + elapsed - start >= Bench_min_ns) {
+			(*repeats)++;
+			break;
+		}
+	}
+	return best > 0 ? best : 1;
+}
+
+static void Bench_print_rate(const char *key, TensorIndex_t amount, double value) {
+	if(amount) printf(", \"%s\": %.4f", key, value);
+	else printf(", \"%s\": null", key);
+}
+
+static void Bench_report(const struct BenchCase *bench, const struct BenchState *state, TensorShape_t threads, long long ns, long long repeats) {
+	const TensorIndex_t elements = bench->elements(state), bytes = bench->bytes(state), jobs = bench->jobs(state);
+	printf("%s    {\"name\": \"%s\", \"shape\": [", Bench_first_result ? "" : ",\n", bench->name);
+	Bench_first_result = 0;
+	for(TensorShape_t i = 0; i < state->shape.ndim; i++) printf(i ? ", %" PRIu64 : "%" PRIu64, state->shape.shape[i]);
+	printf("], \"ndim\": %u, \"layout\": \"%s\", \"threads\": %u", state->shape.ndim, state->shape.strided ? "strided" : "contiguous", threads);
+	printf(", \"repeats\": %lld, \"ns\": %lld, \"elements\": %" PRIu64 ", \"bytes\": %" PRIu64 ", \"jobs\": %" PRIu64, repeats, ns, elements, bytes, jobs);
+	Bench_print_rate("ns_per_element", elements, (double)ns / elements);
+	Bench_print_rate("gb_per_s", bytes, (double)bytes / ns);
+	Bench_print_rate("ns_per_job", jobs, (double)ns / jobs);
+	printf("}");
+
+	char shape[64] = "";
+	for(TensorShape_t i = 0; i < state->shape.ndim; i++) snprintf(shape + strlen(shape), sizeof(shape) - strlen(shape), i ? "x%" PRIu64 : "%" PRIu64, state->shape.shape[i]);
+	fprintf(stderr, "%-22s %-16s %-10s %3u threads %12.3f ns/element", bench->name, shape, state->shape.strided ? "strided" : "contiguous", threads, (double)ns / elements);
+	if(bytes) fprintf(stderr, " %9.2f GB/s", (double)bytes / ns);
+	if(jobs) fprintf(stderr, " %10.1f ns/job", (double)ns / jobs);
+	fprintf(stderr, "\n");
+}
+
+static TensorShape_t Bench_thread_counts(TensorShape_t *counts) {
+	TensorShape_t count = 0;
+	const char *env = getenv("TENSOR_BENCH_THREADS");
+	if(env != NULL) {
+		for(char *end; *env && count < BENCH_MAX_THREAD_COUNTS; env = *end ? end + 1 : end) {
+			const unsigned long threads = strtoul(env, &end, 10);
+			if(end == env) break;
+			if(threads > 0) counts[count++] = threads;
+		}
+		if(count > 0) return count;
+	}
+	const TensorShape_t available = Tensor_num_threads();
+	for(TensorShape_t threads = 1; threads < available && count < BENCH_MAX_THREAD_COUNTS - 1; threads *= 2) counts[count++] = threads;
+	counts[count++] = available;
+	return count;
+}
+
+int main(int argc, char **argv) {
+	const char *filter = argc > 1 ? argv[1] : "";
+	const char *min_ms = getenv("TENSOR_BENCH_MIN_MS");
+	if(min_ms != NULL && atoll(min_ms) > 0) Bench_min_ns = atoll(min_ms) * 1000000;
+	Tensor_init();
+	TensorShape_t counts[BENCH_MAX_THREAD_COUNTS];
+	const TensorShape_t ncounts = Bench_thread_counts(counts);
+	Tensor_cleanup();
+
+	printf("{\n  \"format\": 1,\n  \"element_bytes\": %zu,\n  \"compiler\": \"%s\",\n  \"results\": [\n", sizeof(TensorData_t), __VERSION__);
+	for(TensorShape_t t = 0; t < ncounts; t++) {
+		Tensor_init_threads(counts[t], TENSOR_AFFINITY_NONE);
+		for(size_t c = 0; c < sizeof(Bench_cases) / sizeof(*Bench_cases); c++) {
+			const struct BenchCase *bench = &Bench_cases[c];
+			if(strstr(bench->name, filter) == NULL || (!bench->parallel && t > 0)) continue;
+			for(size_t s = 0; s < sizeof(Bench_shapes) / sizeof(*Bench_shapes); s++) {
+				struct BenchState state = {.shape = Bench_shapes[s], .size = 1};
+				for(TensorShape_t i = 0; i < state.shape.ndim; i++) state.size *= state.shape.shape[i];
+				if(bench->setup(&state) == 0) {
+					long long repeats;
+					const long long ns = Bench_time(bench, &state, &repeats);
+					Bench_report(bench, &state, counts[t], ns, repeats);
+				}
+				if(state.src.storage != NULL) Tensor_free(&state.src);
+				if(state.dst.storage != NULL) Tensor_free(&state.dst);
+			}
+		}
+		Tensor_cleanup();
+	}
+	printf("\n  ]\n}\n");
+	return 0;
+}
@@ -7,13 +7,24 @@
  * @see Tensor_new
  * @see Tensor_free
  * @see Tensor_clone
+ * @see Tensor_clone_lazy
+ * @see Tensor_astype
  * @see Tensor_slice
  * @see Tensor_get
  * @see Tensor_set
  * @see Tensor_write_to
  * @see Tensor_swapaxis
+ * @see Tensor_slice_range
+ * @see Tensor_permute
+ * @see Tensor_reshape
+ * @see Tensor_squeeze
+ * @see Tensor_unsqueeze
+ * @see Tensor_broadcast_to
  * @see TensorShape_t
+ * @see TensorIndex_t
  * @see TensorData_t
+ * @see TensorDType
+ * @see TensorIter
 */
 
 /** @mainpage
@@ -26,6 +37,9 @@
  * - N-dimensional arrays.
  * - Sliceable.
  * - Clonable.
+ * - float64, float32, float16, bfloat16, int32 and int8 elements.
+ * - Saved to and memory-mapped from .npy files.
+ * - Fused elementwise expressions.
  * - Parallel computation.
  * - Fast.
  * - Easy to use.
@@ -43,13 +57,13 @@
  * 
  * int main(void) {
  * 	// Create a new tensor of size 2x3.
- * 	TensorObject tensor = Tensor_new(2, (TensorShape_t[]){2, 3});
+ * 	TensorObject tensor = Tensor_new(2, (TensorIndex_t[]){2, 3});
  * 
  * 	// Set the value at index 0, 1 to 2.
- * 	Tensor_set(&tensor, (TensorShape_t[]){0, 1}, 2);
+ * 	Tensor_set(&tensor, (TensorIndex_t[]){0, 1}, 2);
  * 
  * 	// Print the value at index 0, 1.
- * 	printf("%f\n", *Tensor_get(&tensor, (TensorShape_t[]){0, 1}));
+ * 	printf("%f\n", *Tensor_get(&tensor, (TensorIndex_t[]){0, 1}));
  * 
  * 	// Free the tensor.
  * 	Tensor_free(&tensor);
@@ -68,39 +82,124 @@
 
 
 #pragma once
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
 
 /**
  * @brief Type definition for the data type used in the Tensor class.
  * 
  * This typedef defines the data type used in the Tensor class. By default, it is set to double.
- * Later, this can be changed to float or long double, or even a union of all three.
+ * It is the element type of TENSOR_FLOAT64 tensors, and the type values of any dtype are read and written as.
+ * @see TensorDType
  */
 typedef double TensorData_t;
 
+/**
+ * @enum TensorDType
+ * @brief Element type of a tensor.
+ * @details The element type is a runtime property of each tensor, see Tensor_new_dtype.
+ * 	   TENSOR_FLOAT64 is 0, so tensors created without a dtype hold TensorData_t.
+ * 	   Smaller types need less memory and bandwidth, at the cost of precision or range.
+ * @see Tensor_dtype_size
+*/
+enum TensorDType {
+	TENSOR_FLOAT64, ///< double, the same as TensorData_t.
+	TENSOR_FLOAT32, ///< float.
+	TENSOR_FLOAT16, ///< IEEE 754 half precision, stored as uint16_t.
+	TENSOR_BFLOAT16, ///< bfloat16, float with the low 16 bits of the mantissa dropped, stored as uint16_t.
+	TENSOR_INT32, ///< int32_t, values are rounded to nearest and saturated when written.
+	TENSOR_INT8, ///< int8_t, values are rounded to nearest and saturated when written.
+};
+
+/**
+ * @brief Number of different dtypes.
+*/
+#define TENSOR_DTYPE_COUNT 6
+
+/**
+ * @brief Size in bytes of one element of a dtype.
+*/
+size_t Tensor_dtype_size(enum TensorDType dtype);
+
 
 /**
  * @typedef unsigned int TensorShape_t
  * @brief Tensor shape type.
- * @details This is the type used for the shape of a tensor.
+ * @details This is the type used for small counts, like the number of dimensions, axes and reference counts.
  * 	   It is unsigned to prevent negative values.
  * 	   It is typedef'd to allow for easy changing of the type.
- * 	   It is used for the shape, strides, and reference count.
  * @see TensorObject
+ * @see TensorIndex_t
 */
 typedef unsigned int TensorShape_t;
 
+/**
+ * @typedef uint64_t TensorIndex_t
+ * @brief Tensor index type.
+ * @details This is the type used for the shape, strides, offset and indices of a tensor, and for element counts.
+ * 	   It is 64 bits wide, so tensors may hold more than 2^32 elements.
+ * @see TensorObject
+*/
+typedef uint64_t TensorIndex_t;
+
+/**
+ * @brief Maximum number of dimensions of a tensor.
+ * @details Shape and strides are stored inline in TensorObject, so creating views never allocates.
+ * 	   Can be raised at compile time for higher ranks, at the cost of a larger TensorObject.
+*/
+#ifndef TENSOR_MAX_NDIM
+#define TENSOR_MAX_NDIM 8
+#endif
+
+/**
+ * @brief Alignment of tensor data, in bytes.
+ * @details The buffer of every storage starts on a cache line, so Tensor_data(tensor) is aligned to
+ * 	   TENSOR_ALIGNMENT, and so is the first element of a contiguous tensor with a zero offset.
+ * 	   Kernels may use aligned loads on such data. Slices and other views keep the alignment
+ * 	   of the element they start at.
+*/
+#define TENSOR_ALIGNMENT 64
+
+/**
+ * @struct TensorStorage
+ * @brief Reference counted data buffer shared by a tensor and its views.
+ * @details The header and the buffer are usually a single allocation, the buffer starts right after the header,
+ * 	   aligned to TENSOR_ALIGNMENT. The buffer of a storage loaded from a file points into the file mapping instead.
+ * 	   A storage reads the buffer of its source, which is itself unless it is a lazy clone or has been
+ * 	   copied on write. When the buffer of the source is read by other storages too, the first write through
+ * 	   the API copies it, and the storage switches its source to the copy.
+ * @see Tensor_alloc_storage
+ * @see Tensor_clone_lazy
+*/
+struct TensorStorage {
+	_Atomic TensorShape_t ref_count; ///< Number of tensor objects using the storage, updated atomically.
+	_Atomic TensorShape_t readers; ///< Number of storages whose source is this one.
+	_Atomic TensorShape_t holds; ///< Keeps the allocation alive: readers, plus 1 while ref_count isn't 0.
+	TensorShape_t size_class; ///< Size class of the allocation, used by the buffer pool.
+	struct TensorStorage *_Atomic source; ///< Storage whose buffer holds the data.
+	size_t size; ///< Number of bytes of buffer.
+	void *allocation; ///< Start of the memory block or mapping holding the buffer.
+	TensorData_t *buffer; ///< The elements, of the dtype of the tensors using the storage.
+};
+
 /** 
  * @struct TensorObject
  * @brief Tensor object.
  * 
  * 
  * @details This struct represents a tensor object. It contains the shape, strides, data, and reference count.
- * 	   The tensor object is reference counted. When a tensor object is created, the reference count is set to 1.
- * 	   When a tensor object is cloned, the reference count is incremented by 1.
+ * 	   Shape and strides are stored inline, up to TENSOR_MAX_NDIM dimensions.
+ * 	   The data is reference counted through its storage. When a tensor object is created, the reference count is set to 1.
  * 	   When a tensor object is freed, the reference count is decremented by 1.
  * 	   When a tensor object is sliced, the reference count is incremented by 1.
- * 	   Clones and slices share the same data and reference counter.
- * 	   Multi-threaded slicing is not supported.
+ * 	   Slices share the same storage, and don't allocate.
+ * 	   The reference count is atomic, so views of a shared tensor may be created and freed from any thread,
+ * 	   as long as each TensorObject value itself is only used by one thread at a time.
+ * 	   Lazy clones share the data until one side writes through the API, see Tensor_clone_lazy.
+ * 	   Writes through the data field directly are not detected, call Tensor_make_writable first.
+ * 	   The elements are of type dtype. The data field points to the start of the buffer whatever the dtype,
+ * 	   strides and offset count elements, not bytes.
  * 
  * @see Tensor_new
  * @see Tensor_free
@@ -111,7 +210,9 @@ typedef unsigned int TensorShape_t;
  * @see Tensor_write_to
  * @see Tensor_swapaxis
  * @see TensorShape_t
+ * @see TensorIndex_t
  * @see TensorData_t
+ * @see TensorDType
  * @see Tensor_zeros
  * @see Tensor_zeros_like
  * @see Tensor_ones
@@ -123,12 +224,12 @@ typedef unsigned int TensorShape_t;
 */
 struct TensorObject {
 	TensorShape_t ndim; ///< Number of dimensions.
-	TensorShape_t *shape; ///< Array of length ndim containing the size of each dimension.
-	TensorShape_t *strides; ///< Array of length ndim containing the stride of each dimension.
-	TensorData_t *data; ///< Array of length total_size containing the data.
-	// TODO: Make refcount atomic for thread safety.
-	TensorShape_t *ref_count; ///< Reference count pointer.
-	TensorShape_t offset; ///< Offset of the first element.
+	TensorIndex_t shape[TENSOR_MAX_NDIM]; ///< The size of each dimension, the first ndim are used.
+	TensorIndex_t strides[TENSOR_MAX_NDIM]; ///< The stride of each dimension, the first ndim are used.
+	enum TensorDType dtype; ///< Element type of the data.
+	TensorData_t *data; ///< The data of storage, cached for direct access. Refreshed by Tensor_get, Tensor_set and Tensor_make_writable.
+	struct TensorStorage *storage; ///< Reference counted data buffer.
+	TensorIndex_t offset; ///< Offset of the first element.
 		///< This is used when slicing a tensor to retain same data field for freeing.
 };
 
@@ -141,14 +242,30 @@ typedef struct TensorObject TensorObject;
  * 	   The shape of the tensor is specified by the ndim and shape_template parameters.
  * 	   The ndim parameter specifies the number of dimensions.
  * 	   The shape_template parameter is an array of length ndim containing the size of each dimension.
+ * 	   If the data can't be allocated, the tensor has no storage and its data is NULL.
 */
-TensorObject Tensor_new(const TensorShape_t ndim, const TensorShape_t *const shape_template);
+TensorObject Tensor_new(const TensorShape_t ndim, const TensorIndex_t *const shape_template);
+
+/**
+ * @brief Create a new tensor of a given dtype.
+ * @details Like Tensor_new, which creates TENSOR_FLOAT64 tensors. The data is zeroed.
+*/
+TensorObject Tensor_new_dtype(const TensorShape_t ndim, const TensorIndex_t *const shape_template, const enum TensorDType dtype);
+
+/**
+ * @brief Create a new tensor without initializing its data.
+ * @details Like Tensor_new_dtype, but the contents of the data are undefined. Large buffers come as fresh pages
+ * 	   from the system, which are only placed in memory when first written, so the threads that fill the tensor
+ * 	   decide on which NUMA node its pages live.
+*/
+TensorObject Tensor_empty(const TensorShape_t ndim, const TensorIndex_t *const shape_template, const enum TensorDType dtype);
 
 /**
  * @brief Free a tensor.
  * @details This function frees a tensor object.
  * 	   If the reference count is 1, the tensor object is freed.
  * 	   If the reference count is greater than 1, the reference count is decremented by 1.
+ * 	   Views of the same data may be freed from different threads at once.
 */
 void Tensor_free(TensorObject *tensor);
 
@@ -156,9 +273,45 @@ void Tensor_free(TensorObject *tensor);
  * @brief Clone a tensor.
  * @details This function clones a tensor object.
  *     The data isn't shared between the two tensors, only copied over.
+ *     The clone has the dtype of tensor.
 */
 TensorObject Tensor_clone(TensorObject tensor);
 
+/**
+ * @brief Clone a tensor into another dtype.
+ * @details Like Tensor_clone, but every element is converted to dtype.
+ * 	   Conversions to floating point types round to nearest even, conversions to integer types
+ * 	   round to nearest and saturate, NaN becomes 0.
+ * @see Tensor_write_to
+*/
+TensorObject Tensor_astype(TensorObject tensor, const enum TensorDType dtype);
+
+/**
+ * @brief Clone a tensor, copying the data only when it is written.
+ * @details The clone shares the data of tensor until either of them, or one of their views, is written
+ * 	   through Tensor_set, Tensor_get, Tensor_write_to, Tensor_make_writable or an operation writing to it.
+ * 	   The writer then copies the whole buffer, so the other side keeps the old values.
+ * 	   Tensors that don't cover their whole buffer, like slices or broadcast views, are copied right away.
+ * 	   The clone requires freeing.
+*/
+TensorObject Tensor_clone_lazy(TensorObject tensor);
+
+/**
+ * @brief Make sure writes to a tensor aren't seen by lazy clones.
+ * @details Copies the data first if it is shared with a lazy clone, and refreshes the data field.
+ * 	   Every function writing to a tensor calls this, it only needs to be called before writing
+ * 	   through the data field directly. Views created from the tensor before the call must be refreshed too.
+ * @return 0 on success, -1 if the copy couldn't be allocated.
+*/
+int Tensor_make_writable(TensorObject *tensor);
+
+/**
+ * @brief Current data of a tensor.
+ * @details Returns the start of the buffer the storage reads, without the offset.
+ * 	   Unlike the data field, this is always up to date, but must only be used for reading.
+*/
+TensorData_t* Tensor_data(const TensorObject *tensor);
+
 /**
  * @brief Swap two axes of a tensor.
  * @details This function swaps two axes of a tensor object.
@@ -175,8 +328,73 @@ int Tensor_swapaxis(TensorObject *tensor, const TensorShape_t axis1, const Tenso
  * 	   The idx parameter specifies the index to slice at.
  * 	   The idx parameter must be less than the size of the axis.
  * 	   A new tensor object is created sharing the original data.
+ * 	   Several threads may slice the same tensor at once.
+*/
+TensorObject Tensor_slice(TensorObject *tensor, const TensorShape_t axis, const TensorIndex_t idx);
+
+/**
+ * @brief Slice a range of indices along an axis.
+ * @details Creates, through view, a tensor object sharing the original data that keeps the indices
+ * 	   start, start + step, ... below stop along axis, like x[start:stop:step] in Python.
+ * 	   start and stop are clamped to the size of the axis, so a range past the end is empty.
+ * 	   Strides are unsigned, so step must be positive. The view requires freeing.
+ * @return 0 on success, -1 if axis is out of range or step is 0.
+*/
+int Tensor_slice_range(TensorObject *tensor, const TensorShape_t axis, const TensorIndex_t start, const TensorIndex_t stop, const TensorIndex_t step, TensorObject *view);
+
+/**
+ * @brief Reorder the axes of a tensor.
+ * @details Creates, through view, a tensor object sharing the original data whose axis i is axis axes[i] of tensor.
+ * 	   Swapping two axes is the special case done in-place by Tensor_swapaxis. The view requires freeing.
+ * @param axes Array of tensor->ndim axes, every axis appearing once.
+ * @return 0 on success, -1 if axes isn't a permutation of the axes of tensor.
 */
-TensorObject Tensor_slice(TensorObject *tensor, const TensorShape_t axis, const TensorShape_t idx);
+int Tensor_permute(TensorObject *tensor, const TensorShape_t *const axes, TensorObject *view);
+
+/**
+ * @brief Give a tensor another shape with the same number of elements.
+ * @details Creates, through view, a tensor object sharing the original data, whose elements in row-major order
+ * 	   are the elements of tensor in row-major order. This is possible whenever every group of axes that is
+ * 	   merged or split is laid out contiguously, which is always the case for contiguous tensors.
+ * 	   Other tensors, like most swapped views, have to be copied with Tensor_contiguous first. The view requires freeing.
+ * @return 0 on success, -1 if the number of elements differs, ndim is above TENSOR_MAX_NDIM,
+ * 	   or the strides of tensor don't allow the shape without a copy.
+*/
+int Tensor_reshape(TensorObject *tensor, const TensorShape_t ndim, const TensorIndex_t *const shape, TensorObject *view);
+
+/**
+ * @brief Remove an axis of size 1.
+ * @details Creates, through view, a tensor object sharing the original data without the axis. The view requires freeing.
+ * @return 0 on success, -1 if axis is out of range or its size isn't 1.
+*/
+int Tensor_squeeze(TensorObject *tensor, const TensorShape_t axis, TensorObject *view);
+
+/**
+ * @brief Insert an axis of size 1.
+ * @details Creates, through view, a tensor object sharing the original data with a new axis of size 1,
+ * 	   which becomes axis axis of the view. The view requires freeing.
+ * @return 0 on success, -1 if axis is above tensor->ndim or the view would have more than TENSOR_MAX_NDIM axes.
+*/
+int Tensor_unsqueeze(TensorObject *tensor, const TensorShape_t axis, TensorObject *view);
+
+/**
+ * @brief Broadcast a tensor to a larger shape.
+ * @details This function creates a view of a tensor object with the given shape, sharing the original data.
+ * 	   Dimensions are aligned from the right. Every dimension of the tensor must either equal
+ * 	   the matching dimension of shape or be 1, missing leading dimensions are added.
+ * 	   Expanded dimensions get a stride of 0, so nothing is allocated or copied for the data.
+ * 	   The view requires freeing, and must not be written to, since its elements alias each other.
+ * @return 0 on success, -1 if the tensor can't be broadcast to shape.
+*/
+int Tensor_broadcast_to(TensorObject *tensor, const TensorShape_t ndim, const TensorIndex_t *const shape, TensorObject *view);
+
+/**
+ * @brief Broadcast shape of two tensors.
+ * @details Computes the shape binary operations between a and b produce, following the rules of Tensor_broadcast_to.
+ * 	   shape must have room for the larger of the two ndim.
+ * @return 0 on success, -1 if the shapes are incompatible.
+*/
+int Tensor_broadcast_shape(const TensorObject *a, const TensorObject *b, TensorShape_t *ndim, TensorIndex_t *shape);
 
 /**
  * @brief Get a value from a tensor.
@@ -184,8 +402,23 @@ TensorObject Tensor_slice(TensorObject *tensor, const TensorShape_t axis, const
  * 	   The idx parameter specifies the index to get.
  * 	   The idx parameter must be less than the size of each dimension.
  * 	   The returned pointer is valid until the tensor object is freed.
+ * 	   The value may be written through the pointer, so shared data is copied first, see Tensor_make_writable.
+ * 	   Returns NULL if the dtype of the tensor isn't TENSOR_FLOAT64, see Tensor_get_value.
+*/
+TensorData_t* Tensor_get(TensorObject *tensor, const TensorIndex_t *const idx);
+
+/**
+ * @brief Get a read-only pointer to a value of a tensor.
+ * @details Like Tensor_get, but never copies data shared with a lazy clone.
+*/
+const TensorData_t* Tensor_get_const(const TensorObject *tensor, const TensorIndex_t *const idx);
+
+/**
+ * @brief Read a value of a tensor of any dtype.
+ * @details The element at idx is converted to TensorData_t.
+ * 	   The idx parameter must be less than the size of each dimension.
 */
-TensorData_t* Tensor_get(TensorObject *tensor, const TensorShape_t *const idx);
+TensorData_t Tensor_get_value(const TensorObject *tensor, const TensorIndex_t *const idx);
 
 /**
  * @brief Set a value in a tensor.
@@ -193,17 +426,107 @@ TensorData_t* Tensor_get(TensorObject *tensor, const TensorShape_t *const idx);
  * 	   The idx parameter specifies the index to set.
  * 	   The idx parameter must be less than the size of each dimension.
  * 	   The value parameter specifies the value to set.
- * 	   The value parameter is copied into the tensor object.
+ * 	   The value parameter is converted to the dtype of the tensor, and copied into the tensor object.
 */
-void Tensor_set(TensorObject *tensor, const TensorShape_t *const idx, const TensorData_t value);
+void Tensor_set(TensorObject *tensor, const TensorIndex_t *const idx, const TensorData_t value);
 
 /**
  * @brief Write a tensor to another tensor.
  * @details This function writes a tensor object to another tensor object.
  *    This is similar to Tensor_clone, but the destination tensor object is used instead of creating a new one.
- *    The destination tensor object must have the same shape as the source tensor object.
+ *    The destination tensor object must have the same shape as the source tensor object,
+ *    or the source must be broadcastable to it (see Tensor_broadcast_to).
+ *    The tensors may have different dtypes, the elements are converted like Tensor_astype does.
  *    Useful when copying into slices. 
 */
 int Tensor_write_to(TensorObject *src_tensor, TensorObject *dst_tensor);
 
 
+
+/**
+ * @brief Maximum number of tensors a TensorIter can walk at once.
+*/
+#define TENSOR_ITER_MAX_OPERANDS 8
+
+/**
+ * @brief Maximum number of dimensions a TensorIter supports.
+*/
+#define TENSOR_ITER_MAX_NDIM TENSOR_MAX_NDIM
+
+/**
+ * @struct TensorIter
+ * @brief Strided iterator over one or more tensors of the same shape.
+ * 
+ * @details The iterator walks all operands in lockstep, in row-major order of their logical indices.
+ * 	   The other operands are broadcast to the shape of the first one, so their inner stride may be 0.
+ * 	   Adjacent dimensions that are laid out contiguously in every operand are merged, and dimensions
+ * 	   of size 1 are dropped, so the innermost dimension is the longest run that can be walked with a
+ * 	   single stride per operand.
+ * 	   Every call to TensorIter_next yields such a run: count elements starting at ptr[k], inner_strides[k]
+ * 	   elements apart. When contiguous is set, all runs are dense and can be handed to memcpy or a SIMD loop.
+ * 	   The operands may have different dtypes, so the pointers are untyped and strides count elements of each operand.
+ * 
+ * @code{.c}
+ * TensorIter it;
+ * if(TensorIter_init(&it, 2, (TensorObject*[]){&dst, &src}) != 0) return -1;
+ * while(TensorIter_next(&it)) {
+ * 	TensorData_t *d = it.ptr[0];
+ * 	const TensorData_t *s = it.ptr[1];
+ * 	for(TensorIndex_t i = 0; i < it.count; i++) {
+ * 		d[i * it.inner_strides[0]] = s[i * it.inner_strides[1]];
+ * 	}
+ * }
+ * @endcode
+ * 
+ * @see TensorIter_init
+ * @see TensorIter_range
+ * @see TensorIter_next
+*/
+struct TensorIter {
+	TensorShape_t noperands; ///< Number of tensors walked.
+	TensorIndex_t size; ///< Total number of elements.
+	TensorShape_t ndim; ///< Number of outer dimensions left after coalescing, innermost first.
+	TensorIndex_t shape[TENSOR_ITER_MAX_NDIM]; ///< Size of each outer dimension.
+	TensorIndex_t strides[TENSOR_ITER_MAX_OPERANDS][TENSOR_ITER_MAX_NDIM]; ///< Stride of each outer dimension, per operand.
+	TensorIndex_t inner_size; ///< Length of the innermost run.
+	TensorIndex_t inner_strides[TENSOR_ITER_MAX_OPERANDS]; ///< Stride along the innermost run, per operand.
+	int contiguous; ///< 1 if every operand has an inner stride of 1.
+	enum TensorDType dtype[TENSOR_ITER_MAX_OPERANDS]; ///< Element type of each operand.
+	size_t item_size[TENSOR_ITER_MAX_OPERANDS]; ///< Size in bytes of an element of each operand.
+	void *base[TENSOR_ITER_MAX_OPERANDS]; ///< First element of each operand.
+
+	void *ptr[TENSOR_ITER_MAX_OPERANDS]; ///< First element of the current run, per operand.
+	TensorIndex_t count; ///< Number of elements in the current run.
+	TensorIndex_t pos; ///< Linear index of the first element of the current run.
+	TensorIndex_t end; ///< One past the last linear index to visit.
+	TensorIndex_t idx[TENSOR_ITER_MAX_NDIM]; ///< Index into the outer dimensions of the current run.
+	char *run[TENSOR_ITER_MAX_OPERANDS]; ///< Start of the current full inner run, per operand.
+	int started; ///< 0 until the first run has been produced.
+};
+
+typedef struct TensorIter TensorIter;
+
+/**
+ * @brief Initialize an iterator over tensors of the same shape.
+ * @details The iterator covers every element, see TensorIter_range to restrict it.
+ * 	   Operands after the first are broadcast to its shape, see Tensor_broadcast_to.
+ * 	   Returns -1 if an operand can't be broadcast, or there are too many operands or dimensions, 0 otherwise.
+ * @param iter The iterator to initialize.
+ * @param noperands Number of tensors, at most TENSOR_ITER_MAX_OPERANDS.
+ * @param operands Array of noperands tensors.
+*/
+int TensorIter_init(TensorIter *iter, const TensorShape_t noperands, TensorObject *const *operands);
+
+/**
+ * @brief Restrict an iterator to the linear indices [begin, end).
+ * @details Linear indices are row-major positions in the logical shape.
+ * 	   This resets the iterator, the next call to TensorIter_next yields the run containing begin.
+ * 	   Useful for splitting the iteration between threads.
+*/
+void TensorIter_range(TensorIter *iter, const TensorIndex_t begin, const TensorIndex_t end);
+
+/**
+ * @brief Advance to the next run.
+ * @details Returns 1 and updates ptr and count if there is another run, 0 when the iteration is finished.
+*/
+int TensorIter_next(TensorIter *iter);
@@ -0,0 +1,138 @@
+/**
+ * @file alloc.h
+ * @brief Data allocation header file.
+ * @details This file contains the function declarations centered around allocating tensor data.
+ * Every storage of Tensor_new and Tensor_clone goes through Tensor_alloc_storage and is released
+ * by Tensor_free through Tensor_free_storage.
+ * The opt-in buffer pool keeps released buffers in free lists by size class, so loops that
+ * create and free the same shapes reuse warm memory instead of calling the system allocator
+ * and faulting in fresh pages every time.
+ * Buffers are aligned to TENSOR_ALIGNMENT. Large buffers can be backed by huge pages, see
+ * Tensor_alloc_configure_huge, which cuts the TLB misses of walking them.
+ * 
+ * @see Tensor_alloc_configure
+ * @see Tensor_alloc_trim
+ * @see Tensor_alloc_stats
+ * @see Tensor_alloc_configure_huge
+ * 
+*/
+
+#include "tensor.h"
+#include <stddef.h>
+#pragma once
+
+/**
+ * @brief Default limit on the total size of the buffers kept by the pool, in bytes.
+ * @see Tensor_alloc_configure
+*/
+#define TENSOR_ALLOC_MAX_CACHED ((size_t)256 << 20)
+
+/**
+ * @brief Default size above which released buffers are returned to the system, in bytes.
+ * @see Tensor_alloc_configure
+*/
+#define TENSOR_ALLOC_MAX_BUFFER ((size_t)64 << 20)
+
+/**
+ * @brief Size of a huge page, in bytes.
+ * @details Huge page mappings are rounded up to, and aligned on, this size.
+*/
+#define TENSOR_ALLOC_HUGE_PAGE ((size_t)2 << 20)
+
+/**
+ * @brief Default size from which buffers are backed by huge pages, in bytes.
+ * @see Tensor_alloc_configure_huge
+*/
+#define TENSOR_ALLOC_HUGE_MIN TENSOR_ALLOC_HUGE_PAGE
+
+/**
+ * @brief Counters of the buffer pool.
+ * @see Tensor_alloc_stats
+*/
+struct TensorAllocStats {
+	size_t hits; ///< Allocations served from the pool.
+	size_t misses; ///< Allocations made by the system allocator while the pool was enabled.
+	size_t cached_bytes; ///< Total size of the buffers currently kept by the pool.
+	size_t cached_buffers; ///< Number of buffers currently kept by the pool.
+	size_t huge_bytes; ///< Total size of the mappings of the buffers currently backed by huge pages.
+	size_t huge_buffers; ///< Number of buffers currently backed by huge pages.
+};
+
+/**
+ * @brief Enable or disable the buffer pool.
+ * @details The pool is disabled by default. Sizes are rounded up to size classes of
+ * 	   at most 25% overhead, and buffers are reused only for their own class.
+ * 	   Disabling the pool releases every cached buffer.
+ * 	   The pool is thread-safe, and can be configured while buffers are in use.
+ * @param enabled 1 to enable the pool, 0 to disable it.
+ * @param max_cached_bytes Limit on the total size of cached buffers, 0 for TENSOR_ALLOC_MAX_CACHED.
+ * @param max_buffer_bytes Buffers larger than this are never cached, 0 for TENSOR_ALLOC_MAX_BUFFER.
+*/
+void Tensor_alloc_configure(int enabled, size_t max_cached_bytes, size_t max_buffer_bytes);
+
+/**
+ * @brief Back large buffers with huge pages.
+ * @details Disabled by default. When enabled, buffers of at least min_bytes get a mapping of their own,
+ * 	   aligned on TENSOR_ALLOC_HUGE_PAGE. The mapping asks for reserved huge pages with MAP_HUGETLB first,
+ * 	   and falls back to transparent huge pages through madvise(MADV_HUGEPAGE).
+ * 	   Those buffers bypass the pool, and are unmapped when released. They are zero-filled by the system,
+ * 	   so zeroed allocations don't touch their pages up front.
+ * 	   Only affects buffers allocated afterwards. Does nothing where mmap isn't available.
+ * @param enabled 1 to enable huge pages, 0 to disable them.
+ * @param min_bytes Size from which buffers are backed by huge pages, 0 for TENSOR_ALLOC_HUGE_MIN.
+*/
+void Tensor_alloc_configure_huge(int enabled, size_t min_bytes);
+
+/**
+ * @brief Release cached buffers to the system.
+ * @details The largest buffers are released first, until at most keep_bytes stay cached.
+ * @return Number of bytes released.
+*/
+size_t Tensor_alloc_trim(size_t keep_bytes);
+
+/**
+ * @brief Read the counters of the buffer pool.
+*/
+void Tensor_alloc_stats(struct TensorAllocStats *stats);
+
+/**
+ * @brief Allocate a storage with a buffer of the given size in bytes.
+ * @details The header and the data are allocated at once, the reference count starts at 1
+ * 	   and the storage is its own source.
+ * 	   The storage comes from the pool when it is enabled and has one of the right size class.
+ * 	   The storage must be released with Tensor_free_storage, not free.
+ * @param bytes Size of the data, see Tensor_dtype_size.
+ * @param zero 1 to zero the data, 0 to leave its contents undefined.
+ * @return The storage, or NULL if the allocation failed.
+*/
+struct TensorStorage* Tensor_alloc_storage(size_t bytes, int zero);
+
+/**
+ * @brief Wrap a region of a file in a storage.
+ * @details The file is mapped from its start, and the buffer of the storage points offset bytes into the
+ * 	   mapping, so the data isn't copied. With shared, writes to the buffer go to the file,
+ * 	   otherwise they stay private to the process. The file descriptor can be closed afterwards.
+ * 	   The reference count starts at 1, and Tensor_free_storage unmaps the file.
+ * 	   The buffer is only aligned to TENSOR_ALIGNMENT if offset is.
+ * @param fd File descriptor opened for reading, and writing too if shared.
+ * @param offset Position of the data in the file, in bytes.
+ * @param bytes Size of the data, the file must be at least offset + bytes long.
+ * @param shared 1 to write through to the file, 0 for a private copy-on-write mapping.
+ * @return The storage, or NULL if the file couldn't be mapped or mmap isn't available.
+ * @see Tensor_load_npy
+*/
+struct TensorStorage* Tensor_map_storage(int fd, size_t offset, size_t bytes, int shared);
+
+/**
+ * @brief Write the buffer of a storage mapping a file back to the file.
+ * @details Blocks until the data is written. Does nothing for other storages.
+ * @return 0 on success, -1 on failure.
+*/
+int Tensor_sync_storage(struct TensorStorage *storage);
+
+/**
+ * @brief Release a storage returned by Tensor_alloc_storage or Tensor_map_storage.
+ * @details The storage is kept by the pool if it is enabled and the limits allow, otherwise freed.
+ * 	   The reference counts are not checked. storage may be NULL.
+*/
+void Tensor_free_storage(struct TensorStorage *storage);
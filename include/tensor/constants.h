@@ -11,12 +11,22 @@
  * @see Tensor_eye_like
  * @see Tensor_random_uniform
  * @see Tensor_random_normal
+ * @see Tensor_random_seed
  * 
 */
 #include "tensor.h"
+#include <stdint.h>
+#pragma once
+
+/**
+ * @brief Seed of the random generator until Tensor_random_seed is called.
+*/
+#define TENSOR_RANDOM_DEFAULT_SEED 0x5EED
 
 /**
  * @brief Create a new tensor object with all elements set to 0.
+ * @details Large tensors get fresh zeroed pages from the system, nothing is written until they are used,
+ * 	   so the pages are placed on the NUMA node of the threads that first write them.
  * @param ndim Number of dimensions.
  * @param shape Array of length ndim containing the size of each dimension.
  * @return A new tensor object.
@@ -25,6 +35,8 @@ TensorObject Tensor_zeros(TensorShape_t ndim, const TensorIndex_t *shape);
 
 /**
  * @brief Create a new tensor object with all elements set to 1.
+ * @details Large tensors are filled by the thread pool in chunks of whole pages, whatever their shape,
+ * 	   so every page is first written, and placed, by a single worker.
  * @param ndim Number of dimensions.
  * @param shape Array of length ndim containing the size of each dimension.
  * @return A new tensor object.
@@ -41,8 +53,9 @@ TensorObject Tensor_ones(TensorShape_t ndim, const TensorIndex_t *shape);
  * 	   col_count is the number of columns in the identity matrix.
  * 	   It is required that size <= col_count.
  * 	   The identity matrix is batched by repeating it batch_size times.
+ * 	   The diagonals of large tensors are written by the thread pool, like Tensor_ones.
 */
-TensorObject Tensor_eye(TensorShape_t size, TensorShape_t col_count, TensorShape_t batch_size);
+TensorObject Tensor_eye(TensorIndex_t size, TensorIndex_t col_count, TensorIndex_t batch_size);
 
 /**
  * @brief Create a new tensor object with all elements set to 0.
@@ -65,12 +78,28 @@ TensorObject Tensor_ones_like(TensorObject a);
 */
 TensorObject Tensor_eye_like(TensorObject a);
 
+/**
+ * @brief Seed the random generator.
+ * @details Random values come from the counter-based Philox4x32-10 generator. Every call to a Tensor_random_
+ * 	   function gets a stream of its own, numbered in call order since the last seeding, and each element is
+ * 	   computed from the seed, the stream and its position alone. Large tensors are filled in parallel,
+ * 	   and the values don't depend on the number of threads.
+ * 	   Seeding resets the stream numbers, so the same seed and the same sequence of calls give the same tensors.
+ * 	   The generator is thread-safe. The seed is TENSOR_RANDOM_DEFAULT_SEED until this is called.
+ * @param seed Key of the generator.
+*/
+void Tensor_random_seed(uint64_t seed);
+
 /**
  * @brief Create a new tensor object with all elements set to a random uniform value between min and max.
  * @param ndim Number of dimensions.
  * @param shape Array of length ndim containing the size of each dimension.
+ * @param min Minimum value of the uniform distribution.
+ * @param max Maximum value of the uniform distribution, excluded.
+ * @return A new tensor object.
+ * @see Tensor_random_seed
 */
-TensorObject Tensor_random_uniform(TensorShape_t ndim, const TensorShape_t *shape, float min, float max);
+TensorObject Tensor_random_uniform(TensorShape_t ndim, const TensorIndex_t *shape, float min, float max);
 
 /**
  * @brief Create a new tensor object with all elements set to a random normal value with mean and stddev.
@@ -79,8 +108,10 @@ TensorObject Tensor_random_uniform(TensorShape_t ndim, const TensorShape_t *shap
  * @param mean Mean of the normal distribution.
  * @param stddev Standard deviation of the normal distribution.
  * @return A new tensor object.
+ * @details Values come from the Box-Muller transform of pairs of uniform values.
+ * @see Tensor_random_seed
 */
-TensorObject Tensor_random_normal(TensorShape_t ndim, const TensorShape_t *shape, float mean, float stddev);
+TensorObject Tensor_random_normal(TensorShape_t ndim, const TensorIndex_t *shape, float mean, float stddev);
 
 /**
  * @brief Create a new tensor object with all elements set to a random uniform value between min and max.
@@ -95,18 +126,18 @@ TensorObject Tensor_random_normal(TensorShape_t ndim, const TensorShape_t *shape
 TensorObject Tensor_random_uniform_like(TensorObject a, float min, float max);
 
 /**
- * @brief Create a new tensor object with all elements set to a random uniform value between min and max.
- * @param shape Shape of the new tensor.
- * @param min Minimum value of the uniform distribution.
- * @param max Maximum value of the uniform distribution.
+ * @brief Create a new tensor object with all elements set to a random normal value with mean and stddev.
+ * @param a Tensor object to copy the shape from.
+ * @param mean Mean of the normal distribution.
+ * @param stddev Standard deviation of the normal distribution.
  * @return A new tensor object.
- * @details The new tensor object will have the same data type as the template parameter.
- * 	   The new tensor object will have all elements set to a random uniform value between min and max.
+ * @details The new tensor object will have the same shape and data type as a.
 */
 TensorObject Tensor_random_normal_like(TensorObject a, float mean, float stddev);
 
 /**
  * @brief Generate a random normal value with mean and stddev.
+ * @details Thread-safe, every call takes the next value of a stream kept apart from the tensors.
  * @param mean Mean of the normal distribution.
  * @param stddev Standard deviation of the normal distribution.
  * @return A random normal value.
@@ -115,6 +146,7 @@ float generate_random_normal(float mean, float stddev);
 
 /**
  * @brief Generate a random uniform value between min and max.
+ * @details Thread-safe, every call takes the next value of a stream kept apart from the tensors.
  * @param min Minimum value of the uniform distribution.
  * @param max Maximum value of the uniform distribution.
  * @return A random uniform value.
@@ -0,0 +1,86 @@
+/**
+ * @file dtype.h
+ * @brief Element type conversion header file.
+ * @details This file contains the function declarations centered around converting elements between dtypes.
+ * Every dtype is read as TensorData_t and written from it, so any pair of dtypes can be converted.
+ * Dense runs between the common pairs use dedicated loops, other pairs go through TensorData_t.
+ *
+ * @see TensorDType
+ * @see Tensor_dtype_load
+ * @see Tensor_dtype_store
+ * @see Tensor_dtype_convert
+ * @see Tensor_astype
+ *
+*/
+#include "tensor.h"
+#pragma once
+
+/**
+ * @brief Storage type of TENSOR_FLOAT16 elements.
+*/
+typedef uint16_t TensorHalf_t;
+
+/**
+ * @brief Storage type of TENSOR_BFLOAT16 elements.
+*/
+typedef uint16_t TensorBFloat16_t;
+
+/**
+ * @brief Name of a dtype, like "float32".
+*/
+const char* Tensor_dtype_name(enum TensorDType dtype);
+
+/**
+ * @brief Convert a value to half precision.
+ * @details Rounds to nearest even. Values too large become infinity, NaN stays NaN.
+*/
+TensorHalf_t Tensor_to_half(TensorData_t value);
+
+/**
+ * @brief Convert a half precision value, exactly.
+*/
+TensorData_t Tensor_from_half(TensorHalf_t value);
+
+/**
+ * @brief Convert a value to bfloat16.
+ * @details Rounds to nearest even. Values too large become infinity, NaN stays NaN.
+*/
+TensorBFloat16_t Tensor_to_bfloat16(TensorData_t value);
+
+/**
+ * @brief Convert a bfloat16 value, exactly.
+*/
+TensorData_t Tensor_from_bfloat16(TensorBFloat16_t value);
+
+/**
+ * @brief Read one element of a dtype.
+ * @param dtype Element type of ptr.
+ * @param ptr Address of the element.
+ * @return The element, converted to TensorData_t.
+*/
+TensorData_t Tensor_dtype_load(enum TensorDType dtype, const void *ptr);
+
+/**
+ * @brief Write one element of a dtype.
+ * @details Conversions to floating point types round to nearest even, conversions to integer types
+ * 	   round to nearest and saturate, NaN becomes 0.
+ * @param dtype Element type of ptr.
+ * @param ptr Address of the element.
+ * @param value The value to convert and write.
+*/
+void Tensor_dtype_store(enum TensorDType dtype, void *ptr, TensorData_t value);
+
+/**
+ * @brief Convert a strided run of elements between dtypes.
+ * @details Converts n elements of src, src_stride elements apart, to the n elements of dst, dst_stride elements apart.
+ * 	   The dtypes may be equal, the elements are then copied. The runs must not overlap unless they are equal.
+ * @param dst First element to write.
+ * @param dst_dtype Element type of dst.
+ * @param dst_stride Distance between elements of dst, in elements.
+ * @param src First element to read.
+ * @param src_dtype Element type of src.
+ * @param src_stride Distance between elements of src, in elements.
+ * @param n Number of elements.
+*/
+void Tensor_dtype_convert(void *dst, enum TensorDType dst_dtype, TensorIndex_t dst_stride,
+	const void *src, enum TensorDType src_dtype, TensorIndex_t src_stride, TensorIndex_t n);
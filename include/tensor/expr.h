@@ -0,0 +1,139 @@
+/**
+ * @file expr.h
+ * @brief Deferred elementwise expression header file.
+ * @details This file contains the function declarations centered around fused elementwise expressions.
+ * A chain like a * b + c followed by a max makes a pass over memory and allocates a temporary
+ * for every step when written with Tensor_mul, Tensor_add and Tensor_max_all.
+ * A TensorExpr records the steps instead, and evaluates them in a single strided pass:
+ * every input is read once, and intermediate values only live in small blocks that stay in cache.
+ *
+ * @code{.c}
+ * TensorExpr expr;
+ * Tensor_expr_init(&expr);
+ * const int x = Tensor_expr_input(&expr, &a);
+ * const int y = Tensor_expr_binary(&expr, TENSOR_OP_MUL, x, Tensor_expr_input(&expr, &b));
+ * const int z = Tensor_expr_binary(&expr, TENSOR_OP_ADD, y, Tensor_expr_input(&expr, &c));
+ * TensorData_t max;
+ * if(Tensor_expr_reduce_all(&expr, TENSOR_REDUCE_MAX, z, &max) != 0) return -1;
+ * @endcode
+ *
+ * @see TensorExpr
+ * @see Tensor_expr_eval
+ * @see Tensor_expr_reduce_all
+ *
+*/
+#include "tensor.h"
+#include "tensor/math.h"
+#include "tensor/reduce.h"
+#pragma once
+
+/**
+ * @brief Maximum number of nodes of an expression.
+*/
+#define TENSOR_EXPR_MAX_NODES 16
+
+/**
+ * @brief Maximum number of tensors an expression reads.
+ * @details One operand of the iterator is left for the destination.
+*/
+#define TENSOR_EXPR_MAX_INPUTS (TENSOR_ITER_MAX_OPERANDS - 1)
+
+/**
+ * @brief Number of elements computed at once by every node during evaluation.
+*/
+#define TENSOR_EXPR_BLOCK 256
+
+/**
+ * @brief Kinds of expression nodes.
+*/
+enum TensorExprKind {
+	TENSOR_EXPR_INPUT, ///< Elements of an input tensor.
+	TENSOR_EXPR_SCALAR, ///< A constant.
+	TENSOR_EXPR_BINARY, ///< A binary operation between two nodes.
+	TENSOR_EXPR_FMA, ///< Fused multiply-add of three nodes.
+};
+
+/**
+ * @brief Node of an expression.
+*/
+struct TensorExprNode {
+	enum TensorExprKind kind;
+	enum TensorBinaryOp op; ///< Operation of a TENSOR_EXPR_BINARY node.
+	TensorShape_t args[3]; ///< Operand nodes, or the index of the input of a TENSOR_EXPR_INPUT node.
+	TensorData_t value; ///< Value of a TENSOR_EXPR_SCALAR node.
+};
+
+/**
+ * @struct TensorExpr
+ * @brief Elementwise expression over tensors, evaluated lazily.
+ * @details Nodes are added with the Tensor_expr_ functions, which return the index of the new node,
+ * 	   or -1 if the expression is full or an operand is invalid. An invalid operand gives -1 again,
+ * 	   so nested calls need a single check at the end.
+ * 	   Nodes only refer to earlier nodes, so an expression is a graph evaluated in the order it was built,
+ * 	   and a node used several times is computed once.
+ * 	   Inputs are broadcast against each other, like in Tensor_binary_op, and may have any dtype.
+ * 	   Values are computed as TensorData_t. Nothing is read until the expression is evaluated,
+ * 	   so the inputs must stay valid until then. The expression holds no resources and needs no freeing.
+ * @see Tensor_expr_init
+*/
+struct TensorExpr {
+	TensorShape_t nnodes; ///< Number of nodes.
+	struct TensorExprNode nodes[TENSOR_EXPR_MAX_NODES]; ///< The nodes, in the order they were added.
+	TensorShape_t ninputs; ///< Number of input tensors.
+	TensorObject *inputs[TENSOR_EXPR_MAX_INPUTS]; ///< The input tensors.
+};
+
+typedef struct TensorExpr TensorExpr;
+
+/**
+ * @brief Initialize an empty expression.
+*/
+void Tensor_expr_init(TensorExpr *expr);
+
+/**
+ * @brief Add a node reading the elements of a tensor.
+ * @details Adding the same tensor again gives a new node reading the same input.
+ * @return The index of the node, or -1 if the expression is full.
+*/
+int Tensor_expr_input(TensorExpr *expr, TensorObject *tensor);
+
+/**
+ * @brief Add a constant node.
+ * @return The index of the node, or -1 if the expression is full.
+*/
+int Tensor_expr_scalar(TensorExpr *expr, const TensorData_t value);
+
+/**
+ * @brief Add a node computing a op b.
+ * @return The index of the node, or -1 if the expression is full or a or b isn't a node.
+*/
+int Tensor_expr_binary(TensorExpr *expr, enum TensorBinaryOp op, const int a, const int b);
+
+/**
+ * @brief Add a node computing a * b + c.
+ * @details The product is not rounded before the addition.
+ * @return The index of the node, or -1 if the expression is full or an operand isn't a node.
+*/
+int Tensor_expr_fma(TensorExpr *expr, const int a, const int b, const int c);
+
+/**
+ * @brief Evaluate a node into a tensor.
+ * @details Computes the node for every element of dst, in a single pass over the inputs and dst.
+ * 	   The inputs are broadcast to the shape of dst. dst may be one of the inputs, which performs
+ * 	   the expression in-place, but must not otherwise overlap them. Large tensors are split between
+ * 	   the threads of the pool.
+ * @return 0 on success, -1 if node isn't a node of expr or an input can't be broadcast to the shape of dst.
+*/
+int Tensor_expr_eval(TensorExpr *expr, const int node, TensorObject *dst);
+
+/**
+ * @brief Reduce every element of a node.
+ * @details Computes the node over the broadcast shape of the inputs and reduces it on the fly,
+ * 	   without storing it anywhere. The results follow Tensor_reduce_all, sums are compensated.
+ * @param expr The expression.
+ * @param op The reduction.
+ * @param node The node to reduce.
+ * @param result Set to the result on success.
+ * @return 0 on success, -1 if node isn't a node of expr, the expression has no input or the inputs can't be broadcast together.
+*/
+int Tensor_expr_reduce_all(TensorExpr *expr, enum TensorReduceOp op, const int node, TensorData_t *result);
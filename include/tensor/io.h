@@ -0,0 +1,94 @@
+/**
+ * @file io.h
+ * @brief File input and output header file.
+ * @details This file contains the function declarations centered around storing tensors in files.
+ * Tensors are stored in the .npy format of NumPy, version 1.0: a short header describing
+ * the dtype and the shape, followed by the raw elements in row-major order.
+ * The header is padded so the elements start on TENSOR_ALIGNMENT.
+ * Loading maps the file instead of reading it, the tensor points into the mapping and the pages
+ * are read from disk as they are touched, so opening a large file costs almost nothing and
+ * several processes loading the same file share its page cache.
+ * Files larger than memory can be streamed through a few slabs, see Tensor_loop_over_npy.
+ *
+ * @see Tensor_save_npy
+ * @see Tensor_load_npy
+ * @see Tensor_open_npy
+ * @see Tensor_sync
+ * @see Tensor_loop_over_npy
+ *
+*/
+#include "tensor.h"
+#include "tensor/parallel.h"
+#pragma once
+
+/**
+ * @brief Default size of the slabs of Tensor_loop_over_npy, in bytes.
+*/
+#define TENSOR_STREAM_SLAB_BYTES ((size_t)16 << 20)
+
+/**
+ * @brief Write a tensor to a .npy file.
+ * @details The file is created or truncated. Any view can be saved, the elements are written in
+ * 	   row-major order of the logical shape, in the byte order of the machine.
+ * 	   TENSOR_BFLOAT16 has no .npy type, and can't be saved.
+ * @param path Path of the file.
+ * @param tensor The tensor to save.
+ * @return 0 on success, -1 if the dtype can't be saved or the file couldn't be written.
+*/
+int Tensor_save_npy(const char *path, TensorObject *tensor);
+
+/**
+ * @brief Load a .npy file without copying it.
+ * @details The file is mapped privately and tensor reads its elements from the mapping, which is unmapped
+ * 	   when the last tensor using it is freed. Writes to the tensor stay private to the process,
+ * 	   pages that are written get copied by the system. Files in Fortran order give a tensor with
+ * 	   reversed strides.
+ * 	   Files whose data isn't aligned to TENSOR_ALIGNMENT, or where mmap isn't available, are read into
+ * 	   a new buffer instead.
+ * 	   The file must hold float64, float32, float16, int32 or int8 elements in the byte order of the machine,
+ * 	   with at most TENSOR_MAX_NDIM dimensions.
+ * 	   The tensor requires freeing.
+ * @param path Path of the file.
+ * @param tensor Set to the loaded tensor on success, left untouched otherwise.
+ * @return 0 on success, -1 if the file couldn't be read or isn't a supported .npy file.
+*/
+int Tensor_load_npy(const char *path, TensorObject *tensor);
+
+/**
+ * @brief Map a .npy file for reading and writing.
+ * @details Like Tensor_load_npy, but the mapping is shared, so writes to the tensor go to the file.
+ * 	   The system writes modified pages back on its own, see Tensor_sync to wait for it.
+ * 	   Lazy clones of the tensor share the mapping until one side writes, and the writer gets a copy
+ * 	   as usual, so writes to the tensor only reach the file once its lazy clones have copied or been freed.
+ * @param path Path of the file, which must be writable.
+ * @param tensor Set to the mapped tensor on success, left untouched otherwise.
+ * @return 0 on success, -1 if the file couldn't be mapped or isn't a supported .npy file.
+*/
+int Tensor_open_npy(const char *path, TensorObject *tensor);
+
+/**
+ * @brief Write the changes to a tensor opened with Tensor_open_npy back to its file.
+ * @details Blocks until the data is on disk. Does nothing for tensors that don't map a file.
+ * @return 0 on success, -1 on failure.
+*/
+int Tensor_sync(TensorObject *tensor);
+
+/**
+ * @brief Loop over the outer axis of a .npy file in slabs, without loading the whole file.
+ * @details The file is read slab by slab, each slab holding rows indices of the first axis, and func is called
+ * 	   once per slab, in order, on the calling thread. func gets a loop_range_args whose obj is the slab, a contiguous
+ * 	   tensor with the shape of the file except for its first axis, and whose begin and end give the rows of the file
+ * 	   it holds. The slab is only valid during the call, and must not be freed. func may use the thread pool itself.
+ * 	   While func runs, the next slab is read, and the previous one written back when writable is set,
+ * 	   by a background thread, so the disk and the computation overlap.
+ * 	   Only three slabs are allocated whatever the size of the file.
+ * 	   The file must be in C order, with the same dtypes as Tensor_load_npy.
+ * @param path Path of the file, which must be writable if writable is set.
+ * @param rows Number of indices of the first axis per slab, 0 for slabs of about TENSOR_STREAM_SLAB_BYTES.
+ * @param writable 1 to write every slab back to the file after func, 0 to only read the file.
+ * @param func The function, called with a loop_range_args.
+ * @param args Arguments for the function, passed as loop_range_args.args.
+ * @return 0 on success, -1 if the file isn't a supported .npy file or couldn't be read or written.
+ * @see Tensor_loop_over_dim_chunked
+*/
+int Tensor_loop_over_npy(const char *path, TensorIndex_t rows, int writable, void* (*func)(void *args), void *args);
@@ -0,0 +1,56 @@
+/**
+ * @file layout.h
+ * @brief Memory layout header file.
+ * @details This file contains the function declarations centered around the layout of tensors in memory.
+ * Tensor_swapaxis and Tensor_slice only change the shape and strides of a view, so every later pass
+ * over a swapped tensor walks memory with large strides. Tensor_contiguous rearranges the data
+ * once into row-major order, after which every access is sequential again.
+ *
+ * @code{.c}
+ * Tensor_swapaxis(&a, 0, 1);
+ * TensorObject at = Tensor_contiguous(a);
+ * // ... many passes over at ...
+ * Tensor_free(&at);
+ * @endcode
+ *
+ * @see Tensor_is_contiguous
+ * @see Tensor_contiguous
+ * @see Tensor_transpose_copy
+ *
+*/
+#include "tensor.h"
+#pragma once
+
+/**
+ * @brief Side of the square tiles a transposing copy works on, in elements.
+ * @details A tile of the source and of the destination stay in L1 together while it is transposed,
+ * so both are read and written a cache line at a time. Tiles are the unit of work split between threads.
+*/
+#define TENSOR_TRANSPOSE_TILE 32
+
+/**
+ * @brief Check whether a tensor is laid out in row-major order without gaps.
+ * @details Dimensions of size 1 are ignored, and the tensor may start at an offset into its buffer,
+ * 	   like a slice along the first axis. Broadcast views aren't contiguous.
+ * @return 1 if the elements are contiguous in row-major order, 0 otherwise.
+*/
+int Tensor_is_contiguous(const TensorObject *tensor);
+
+/**
+ * @brief Get a row-major contiguous tensor with the contents of tensor.
+ * @details A tensor that is already contiguous is returned as a new view of the same data.
+ * 	   Otherwise the data is copied into a new tensor of the same dtype, which is done
+ * 	   with a tiled transpose when the source is contiguous along another axis than the last one,
+ * 	   as after Tensor_swapaxis. The tiles are split between the threads of the pool.
+ * 	   The result requires freeing either way.
+ * @see Tensor_is_contiguous
+*/
+TensorObject Tensor_contiguous(TensorObject tensor);
+
+/**
+ * @brief Copy a tensor with two axes swapped.
+ * @details Same as swapping the axes of a view with Tensor_swapaxis and making it contiguous,
+ * 	   but the result is always a new copy, never a view of tensor.
+ * @return The copy, or a tensor without storage if an axis is out of range.
+*/
+TensorObject Tensor_transpose_copy(TensorObject tensor, const TensorShape_t axis1, const TensorShape_t axis2);
@@ -0,0 +1,47 @@
+/**
+ * @file linalg.h
+ * @brief Linear algebra header file.
+ * @details This file contains the function declarations centered around linear algebra.
+ * 
+ * @see Tensor_matmul
+ * 
+*/
+#include "tensor.h"
+#pragma once
+
+/**
+ * @brief Depth of the panels packed by Tensor_matmul.
+ * @details A packed micro-panel of A and B, MR x TENSOR_MATMUL_KC and TENSOR_MATMUL_KC x NR, stays in L1.
+*/
+#define TENSOR_MATMUL_KC 256
+
+/**
+ * @brief Rows of A packed together by Tensor_matmul.
+ * @details The packed TENSOR_MATMUL_MC x TENSOR_MATMUL_KC block of A stays in L2.
+ * Must be a multiple of every micro-kernel's row count.
+*/
+#define TENSOR_MATMUL_MC 96
+
+/**
+ * @brief Columns of B packed together by Tensor_matmul.
+ * @details The packed TENSOR_MATMUL_KC x TENSOR_MATMUL_NC panel of B stays in L3.
+ * Must be a multiple of every micro-kernel's column count.
+*/
+#define TENSOR_MATMUL_NC 1024
+
+/**
+ * @brief Matrix multiplication.
+ * @details Computes dst = a @ b.
+ * 	   For 2 dimensional tensors the shapes are {M, K} @ {K, N} -> {M, N}.
+ * 	   For 3 dimensional tensors the first dimension is a batch, {B, M, K} @ {B, K, N} -> {B, M, N},
+ * 	   the layout produced by Tensor_eye.
+ * 	   Any of the tensors may be a slice or a swapped view, a transposed operand is read
+ * 	   through its strides when it is packed, so no transposed copy is made.
+ * 	   The work is split between the threads of the pool over batches and tiles of dst.
+ * 	   The kernels work on TENSOR_FLOAT64, operands of other dtypes are multiplied as converted copies.
+ * @param a Left operand.
+ * @param b Right operand.
+ * @param dst Destination, overwritten. Must not share data with a or b.
+ * @return 0 on success, -1 if the shapes do not match, dst shares data with an operand or the packing buffers can't be allocated.
+*/
+int Tensor_matmul(TensorObject *a, TensorObject *b, TensorObject *dst);
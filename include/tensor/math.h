@@ -0,0 +1,135 @@
+/**
+ * @file math.h
+ * @brief Elementwise arithmetic header file.
+ * @details This file contains the function declarations centered around elementwise arithmetic.
+ * Dense runs are processed with SSE2, AVX2 or AVX-512 kernels, chosen at runtime,
+ * other layouts fall back to a strided loop.
+ * The kernels exist for TENSOR_FLOAT64 and TENSOR_FLOAT32 operands of a single dtype. Other dtypes, and operands
+ * of mixed dtypes, are computed as TensorData_t element by element, and converted to the dtype of dst.
+ * Large tensors are split between the threads of the pool.
+ * 
+ * @see Tensor_add
+ * @see Tensor_sub
+ * @see Tensor_mul
+ * @see Tensor_div
+ * @see Tensor_fma
+ * @see Tensor_add_scalar
+ * 
+*/
+#include "tensor.h"
+#pragma once
+
+/**
+ * @brief Number of elements above which elementwise operations run on the thread pool.
+ * @details Smaller tensors are processed on the calling thread, as dispatch would cost more than it saves.
+*/
+#define TENSOR_MATH_PARALLEL_THRESHOLD 32768
+
+/**
+ * @brief Instruction set used by the vectorized kernels.
+ * @see Tensor_simd_level
+*/
+enum TensorSimd {
+	TENSOR_SIMD_SCALAR, ///< Plain C loops.
+	TENSOR_SIMD_SSE2, ///< 128 bit vectors.
+	TENSOR_SIMD_AVX2, ///< 256 bit vectors with fused multiply-add.
+	TENSOR_SIMD_AVX512, ///< 512 bit vectors.
+};
+
+/**
+ * @brief Get the instruction set used by the vectorized kernels.
+ * @details The best level supported by the CPU is used.
+ * It can be lowered with the TENSOR_SIMD environment variable, one of "scalar", "sse2", "avx2" or "avx512".
+ * The level is determined once, on the first call.
+*/
+enum TensorSimd Tensor_simd_level(void);
+
+/**
+ * @brief Elementwise binary operations.
+ * @see Tensor_binary_op
+ * @see Tensor_scalar_op
+*/
+enum TensorBinaryOp {
+	TENSOR_OP_ADD, ///< a + b
+	TENSOR_OP_SUB, ///< a - b
+	TENSOR_OP_MUL, ///< a * b
+	TENSOR_OP_DIV, ///< a / b
+};
+
+/**
+ * @brief Apply a binary operation elementwise.
+ * @details Computes dst = a op b for every element.
+ * 	   a and b are broadcast to the shape of dst without copying, see Tensor_broadcast_to,
+ * 	   so dst usually has the shape given by Tensor_broadcast_shape(a, b).
+ * 	   All three tensors may be slices or swapped views.
+ * 	   dst may be a or b, which performs the operation in-place.
+ * 	   dst must not otherwise overlap a or b, and must not be a broadcast view.
+ * @return 0 on success, -1 if a or b can't be broadcast to the shape of dst.
+*/
+int Tensor_binary_op(enum TensorBinaryOp op, TensorObject *a, TensorObject *b, TensorObject *dst);
+
+/**
+ * @brief Apply a binary operation between every element and a scalar.
+ * @details Computes dst = a op value for every element.
+ * 	   dst may be a, which performs the operation in-place.
+ * @return 0 on success, -1 if the shapes do not match.
+*/
+int Tensor_scalar_op(enum TensorBinaryOp op, TensorObject *a, const TensorData_t value, TensorObject *dst);
+
+/**
+ * @brief Elementwise addition, dst = a + b.
+ * @see Tensor_binary_op
+*/
+int Tensor_add(TensorObject *a, TensorObject *b, TensorObject *dst);
+
+/**
+ * @brief Elementwise subtraction, dst = a - b.
+ * @see Tensor_binary_op
+*/
+int Tensor_sub(TensorObject *a, TensorObject *b, TensorObject *dst);
+
+/**
+ * @brief Elementwise multiplication, dst = a * b.
+ * @see Tensor_binary_op
+*/
+int Tensor_mul(TensorObject *a, TensorObject *b, TensorObject *dst);
+
+/**
+ * @brief Elementwise division, dst = a / b.
+ * @see Tensor_binary_op
+*/
+int Tensor_div(TensorObject *a, TensorObject *b, TensorObject *dst);
+
+/**
+ * @brief Add a scalar to every element, dst = a + value.
+ * @see Tensor_scalar_op
+*/
+int Tensor_add_scalar(TensorObject *a, const TensorData_t value, TensorObject *dst);
+
+/**
+ * @brief Subtract a scalar from every element, dst = a - value.
+ * @see Tensor_scalar_op
+*/
+int Tensor_sub_scalar(TensorObject *a, const TensorData_t value, TensorObject *dst);
+
+/**
+ * @brief Multiply every element by a scalar, dst = a * value.
+ * @see Tensor_scalar_op
+*/
+int Tensor_mul_scalar(TensorObject *a, const TensorData_t value, TensorObject *dst);
+
+/**
+ * @brief Divide every element by a scalar, dst = a / value.
+ * @see Tensor_scalar_op
+*/
+int Tensor_div_scalar(TensorObject *a, const TensorData_t value, TensorObject *dst);
+
+/**
+ * @brief Elementwise fused multiply-add, dst = a * b + c.
+ * @details The product is not rounded before the addition when Tensor_simd_level is TENSOR_SIMD_AVX2 or above,
+ * 	   whatever the layout and dtypes of the operands, and is rounded on the other levels.
+ * 	   a, b and c are broadcast to the shape of dst, like in Tensor_binary_op.
+ * 	   dst may be a, b or c, which performs the operation in-place.
+ * @return 0 on success, -1 if an operand can't be broadcast to the shape of dst.
+*/
+int Tensor_fma(TensorObject *a, TensorObject *b, TensorObject *c, TensorObject *dst);
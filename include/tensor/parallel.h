@@ -4,26 +4,48 @@
  * @details This file contains the tensor object and function declarations centered around parallel computation.
  * 
  * @see Tensor_loop_over_dim
+ * @see Tensor_loop_over_dim_async
+ * @see Tensor_loop_over_dim_chunked
+ * @see Tensor_parallel_for
  * @see Tensor_init
+ * @see Tensor_init_threads
  * @see Tensor_cleanup
+ * @see Tensor_stats_get
+ * @see Tensor_trace_begin
  * 
 */
 
 #include "tensor.h"
+#include <stddef.h>
 #pragma once
 /**
- * @brief Number of threads to use for parallel computation.
- * @details This macro defines the number of threads to use for parallel computation.
- * It is used in the thread pool.
- * It is set to 4 by default.
- * @todo Make this configurable at runtime.
+ * @brief Fallback number of threads to use for parallel computation.
+ * @details The thread pool defaults to the number of online CPUs.
+ * This value is only used when that number cannot be determined.
  * 
  * @see Tensor_init
- * @see Tensor_cleanup
- * @see Tensor_loop_over_dim
+ * @see Tensor_init_threads
 */
 #define TENSOR_LOOP_NUM_THREADS 4
 
+/**
+ * @brief Maximum number of NUMA nodes considered when pinning worker threads.
+ * @see TENSOR_AFFINITY_NUMA
+*/
+#define TENSOR_MAX_NUMA_NODES 64
+
+/**
+ * @brief How worker threads are pinned to CPUs.
+ * @details Pinning keeps a worker's caches and local memory warm across successive loops.
+ * 
+ * @see Tensor_init_threads
+*/
+enum TensorAffinity {
+	TENSOR_AFFINITY_NONE, ///< Let the OS schedule workers freely.
+	TENSOR_AFFINITY_CORE, ///< Pin every worker to its own CPU, wrapping around when there are more workers than CPUs.
+	TENSOR_AFFINITY_NUMA, ///< Pin workers to the CPUs of a NUMA node, neighbouring workers sharing a node.
+};
+
 /**
  * @brief Arguments for the loop function.
  * @details This struct contains the arguments for the loop function.
@@ -37,7 +59,53 @@
 */
 struct loop_args {
 	TensorObject obj;
-	TensorShape_t idx;
+	TensorIndex_t idx;
+	void *args;
+};
+
+/**
+ * @brief Number of chunks per worker thread used when the grain size is chosen automatically.
+ * @details A few chunks per thread let work stealing even out imbalanced chunks,
+ * while keeping the per-chunk scheduling overhead negligible.
+ * 
+ * @see Tensor_loop_grain
+*/
+#define TENSOR_LOOP_CHUNKS_PER_THREAD 4
+
+/**
+ * @brief Arguments for the range loop function.
+ * @details This struct contains the arguments for the function passed to Tensor_parallel_for.
+ * 
+ * @param begin First index of the chunk.
+ * @param end One past the last index of the chunk.
+ * @param args Arguments for the function, passed by the user.
+ * 
+ * @see Tensor_parallel_for
+*/
+struct range_args {
+	TensorIndex_t begin;
+	TensorIndex_t end;
+	void *args;
+};
+
+/**
+ * @brief Arguments for the chunked loop function.
+ * @details This struct contains the arguments for the function passed to Tensor_loop_over_dim_chunked.
+ * The tensor is not sliced, the function is responsible for the indices [begin, end) along axis.
+ * 
+ * @param obj The whole tensor object, shared between all chunks.
+ * @param axis The axis that is being looped over.
+ * @param begin First index of the chunk along axis.
+ * @param end One past the last index of the chunk along axis.
+ * @param args Arguments for the function, passed by the user.
+ * 
+ * @see Tensor_loop_over_dim_chunked
+*/
+struct loop_range_args {
+	TensorObject obj;
+	TensorShape_t axis;
+	TensorIndex_t begin;
+	TensorIndex_t end;
 	void *args;
 };
 
@@ -47,17 +115,125 @@ struct loop_args {
  * The function will call the function func with the arguments args wrapped inside loop_args.
  * The function func should return NULL.
  * The function func is allowed to modify only the given slice of the tensor.
+ * Data shared with a lazy clone is copied first, see Tensor_make_writable.
  * 
 */
 void Tensor_loop_over_dim(TensorObject obj, TensorShape_t axis, void* (*func)(void *args), void *args);
 
+/**
+ * @brief Handle of a loop running in the background.
+ * @details Returned by the asynchronous loop functions.
+ * Every handle must be passed to Tensor_loop_wait or Tensor_loop_wait_all exactly once,
+ * which waits for the loop and releases the handle.
+ * 
+ * @see Tensor_loop_over_dim_async
+ * @see Tensor_loop_over_dim_chunked_async
+*/
+typedef struct TensorLoopHandle TensorLoopHandle;
+
+/**
+ * @brief Start a loop over a dimension of a tensor without waiting for it.
+ * @details Same as Tensor_loop_over_dim, but returns as soon as all slices are submitted.
+ * The tensor and args must stay valid until the loop is waited on.
+ * Several loops may run at the same time, as long as they do not write to the same data.
+ * 
+ * @see Tensor_loop_wait
+*/
+TensorLoopHandle* Tensor_loop_over_dim_async(TensorObject obj, TensorShape_t axis, void* (*func)(void *args), void *args);
+
+/**
+ * @brief Test whether a loop has finished.
+ * @details Returns 1 if every job of the loop has finished, 0 otherwise. Never blocks.
+ * The handle still has to be waited on to release it.
+*/
+int Tensor_loop_test(TensorLoopHandle* handle);
+
+/**
+ * @brief Wait for a loop to finish and release its handle.
+ * @details The handle must not be used afterwards.
+ * When called from inside a loop function, the calling worker runs pending jobs while it waits.
+*/
+void Tensor_loop_wait(TensorLoopHandle* handle);
+
+/**
+ * @brief Wait for several loops to finish and release their handles.
+ * @param handles Array of count handles.
+ * @param count Number of handles.
+*/
+void Tensor_loop_wait_all(TensorLoopHandle** handles, size_t count);
+
+/**
+ * @brief Loop over a dimension of a tensor in contiguous chunks.
+ * @details This function splits the axis into ranges of grain indices and runs one job per range.
+ * The function func is called with a loop_range_args describing the range.
+ * No slices are created, so the per-index overhead of Tensor_loop_over_dim is avoided.
+ * The function func is allowed to modify only its range of the tensor.
+ * Data shared with a lazy clone is copied first, see Tensor_make_writable.
+ * If grain is 0, it is chosen so that every thread gets TENSOR_LOOP_CHUNKS_PER_THREAD chunks.
+ * 
+ * @see Tensor_loop_over_dim
+*/
+void Tensor_loop_over_dim_chunked(TensorObject obj, TensorShape_t axis, TensorIndex_t grain, void* (*func)(void *args), void *args);
+
+/**
+ * @brief Start a chunked loop over a dimension of a tensor without waiting for it.
+ * @details Same as Tensor_loop_over_dim_chunked, but returns as soon as all chunks are submitted.
+ * 
+ * @see Tensor_loop_wait
+*/
+TensorLoopHandle* Tensor_loop_over_dim_chunked_async(TensorObject obj, TensorShape_t axis, TensorIndex_t grain, void* (*func)(void *args), void *args);
+
+/**
+ * @brief Run a function over the range [0, count) in parallel.
+ * @details The range is split into chunks of grain indices and func is called once per chunk
+ * with a range_args describing the chunk.
+ * If grain is 0, it is chosen so that every thread gets TENSOR_LOOP_CHUNKS_PER_THREAD chunks.
+ * A range that fits in a single chunk is run on the calling thread.
+ * 
+ * @see Tensor_loop_grain
+*/
+void Tensor_parallel_for(TensorIndex_t count, TensorIndex_t grain, void* (*func)(void *args), void *args);
+
+/**
+ * @brief Get the grain size used for a loop of count indices.
+ * @details Returns grain if it is not 0, otherwise the automatically tuned grain size.
+ * The result is never 0.
+*/
+TensorIndex_t Tensor_loop_grain(TensorIndex_t count, TensorIndex_t grain);
+
 
 /**
  * @brief Initialize the thread pool.
  * @details This function should be called before any thread pool functions are called.
+ * The number of threads is read from the TENSOR_NUM_THREADS environment variable,
+ * defaulting to the number of online CPUs.
+ * The affinity is read from the TENSOR_AFFINITY environment variable, one of "none", "core" or "numa",
+ * defaulting to none.
+ * Calling it while the pool is running does nothing.
+ * 
+ * @see Tensor_init_threads
 */
 void Tensor_init(void);
 
+/**
+ * @brief Initialize the thread pool with a given number of threads.
+ * @details Same as Tensor_init, but the number of threads and the affinity are given explicitly.
+ * A thread_count of 0 selects the default of Tensor_init.
+ * To resize a running pool, call Tensor_cleanup first.
+ * Threads calling it at once build a single pool. If fewer workers can be started than asked for,
+ * the pool keeps the ones that did, and without any the loops run on the calling thread.
+ * 
+ * @param thread_count Number of worker threads, or 0 for the default.
+ * @param affinity How the worker threads are pinned to CPUs.
+*/
+void Tensor_init_threads(TensorShape_t thread_count, enum TensorAffinity affinity);
+
+/**
+ * @brief Get the number of worker threads.
+ * @details Initializes the thread pool if it isn't running yet.
+*/
+TensorShape_t Tensor_num_threads(void);
+
 /**
  * @brief Cleanup the thread pool.
  * @details This function should be called after all thread pool functions are called.
@@ -66,4 +242,90 @@ void Tensor_init(void);
  * Although this function is not strictly necessary as the OS will free all memory allocated by the thread pool,
  * it is recommended to call this function.
 */
-void Tensor_cleanup(void);
\ No newline at end of file
+void Tensor_cleanup(void);
+
+/**
+ * @brief Statistics of a worker thread.
+ * @details Times are in nanoseconds.
+ * 
+ * @see Tensor_stats_worker
+*/
+struct TensorWorkerStats {
+	uint64_t jobs; ///< Jobs run by the worker.
+	uint64_t stolen; ///< Jobs the worker took from the queue of another worker.
+	uint64_t busy_ns; ///< Time spent running jobs. Jobs run while waiting on a nested loop count towards the job waiting.
+	uint64_t idle_ns; ///< Time spent asleep, waiting for jobs to be submitted.
+	uint64_t queue_wait_ns; ///< Time the jobs run by the worker spent queued before they started.
+};
+
+/**
+ * @brief Statistics of the thread pool.
+ * @details Totals over all workers, plus the counters of the queues themselves. Times are in nanoseconds.
+ * 
+ * @see Tensor_stats_get
+*/
+struct TensorPoolStats {
+	TensorShape_t num_threads; ///< Number of worker threads.
+	uint64_t jobs_submitted; ///< Jobs submitted to the pool.
+	uint64_t jobs_completed; ///< Jobs run to completion.
+	uint64_t jobs_stolen; ///< Jobs taken from the queue of another worker.
+	uint64_t queue_depth; ///< Jobs queued right now.
+	uint64_t queue_depth_max; ///< Highest number of jobs queued at once.
+	uint64_t queue_wait_ns; ///< Time jobs spent queued before they started.
+	uint64_t busy_ns; ///< Time workers spent running jobs.
+	uint64_t idle_ns; ///< Time workers spent asleep.
+	uint64_t lock_contended; ///< Number of times a queue lock was found taken.
+	uint64_t lock_wait_ns; ///< Time spent waiting for queue locks that were taken.
+};
+
+/**
+ * @brief Turn the collection of thread pool statistics on or off.
+ * @details Statistics are off by default, and then cost a single load per job.
+ * When on, every job reads the clock twice, and the counters are updated with relaxed atomics
+ * on data owned by the worker, so the overhead stays in the tens of nanoseconds per job.
+ * Jobs submitted before the statistics were turned on are counted as completed but not as submitted.
+ * 
+ * @see Tensor_stats_get
+*/
+void Tensor_stats_enable(int enabled);
+
+/**
+ * @brief Set every statistic back to zero.
+ * @details Counters of the workers live in the pool, so they are reset by Tensor_cleanup too.
+*/
+void Tensor_stats_reset(void);
+
+/**
+ * @brief Get the statistics of the thread pool.
+ * @details The counters are read one by one while workers may update them,
+ * so totals are only consistent with each other when no loop is running.
+*/
+void Tensor_stats_get(struct TensorPoolStats* stats);
+
+/**
+ * @brief Get the statistics of a worker thread.
+ * @details Comparing the busy time of the workers shows how evenly the work is spread.
+ * @return 0 on success, -1 if worker isn't a worker of the pool.
+*/
+int Tensor_stats_worker(TensorShape_t worker, struct TensorWorkerStats* stats);
+
+/**
+ * @brief Start recording a trace of the jobs run by the pool.
+ * @details Every job run from now on is recorded as a span on the timeline of its worker,
+ * with the time it spent queued. Spans are stored in a buffer of max_events entries allocated up front,
+ * later spans are dropped and counted.
+ * 
+ * @return 0 on success, -1 if a trace is already being recorded, max_events is 0 or the buffer can't be allocated.
+ * @see Tensor_trace_end
+*/
+int Tensor_trace_begin(size_t max_events);
+
+/**
+ * @brief Stop recording a trace and write it to a file.
+ * @details The file is in the Chrome trace event format, which chrome://tracing and Perfetto open.
+ * Loops may still be running: jobs that finish after the trace is stopped are left out of it.
+ * The buffer is released even if writing fails.
+ * 
+ * @return 0 on success, -1 if no trace is being recorded or the file can't be written.
+*/
+int Tensor_trace_end(const char* path);
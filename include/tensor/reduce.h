@@ -0,0 +1,113 @@
+/**
+ * @file reduce.h
+ * @brief Reduction header file.
+ * @details This file contains the function declarations centered around reductions.
+ * Sums are compensated (Kahan-Babuska), with several compensated sums in vector lanes
+ * along contiguous runs, so large reductions stay accurate.
+ * Large reductions are split between the threads of the pool and the partial results
+ * are combined with a tree reduction.
+ * The kernels work on TENSOR_FLOAT64, tensors of other dtypes are converted to it first.
+ * 
+ * @see Tensor_reduce
+ * @see Tensor_reduce_all
+ * 
+*/
+#include "tensor.h"
+#pragma once
+
+/**
+ * @brief Number of elements read above which reductions run on the thread pool.
+*/
+#define TENSOR_REDUCE_PARALLEL_THRESHOLD 65536
+
+/**
+ * @brief Reduction operations.
+*/
+enum TensorReduceOp {
+	TENSOR_REDUCE_SUM, ///< Sum of the elements.
+	TENSOR_REDUCE_MEAN, ///< Mean of the elements.
+	TENSOR_REDUCE_MAX, ///< Largest element.
+	TENSOR_REDUCE_MIN, ///< Smallest element.
+	TENSOR_REDUCE_ARGMAX, ///< Index of the first largest element.
+};
+
+/**
+ * @brief Reduce a tensor along one axis.
+ * @details The shape of dst is the shape of a with axis removed, or with axis set to 1.
+ * 	   For TENSOR_REDUCE_ARGMAX the index along axis is stored.
+ * 	   a and dst may be slices or swapped views.
+ * @param op The reduction.
+ * @param a The tensor to reduce.
+ * @param axis The axis to reduce.
+ * @param dst Destination of the reduction.
+ * @return 0 on success, -1 if the axis or the shape of dst is invalid or the partial results can't be allocated.
+*/
+int Tensor_reduce(enum TensorReduceOp op, TensorObject *a, const TensorShape_t axis, TensorObject *dst);
+
+/**
+ * @brief Reduce every element of a tensor.
+ * @details For TENSOR_REDUCE_ARGMAX the row-major linear index is returned.
+ * 	   The sum of an empty tensor is 0, its max is -INFINITY and its min is INFINITY.
+ * @return The reduction, or NAN if a converted copy or the partial results can't be allocated.
+*/
+TensorData_t Tensor_reduce_all(enum TensorReduceOp op, TensorObject *a);
+
+/**
+ * @brief Sum along an axis.
+ * @see Tensor_reduce
+*/
+int Tensor_sum(TensorObject *a, const TensorShape_t axis, TensorObject *dst);
+
+/**
+ * @brief Mean along an axis.
+ * @see Tensor_reduce
+*/
+int Tensor_mean(TensorObject *a, const TensorShape_t axis, TensorObject *dst);
+
+/**
+ * @brief Maximum along an axis.
+ * @see Tensor_reduce
+*/
+int Tensor_max(TensorObject *a, const TensorShape_t axis, TensorObject *dst);
+
+/**
+ * @brief Minimum along an axis.
+ * @see Tensor_reduce
+*/
+int Tensor_min(TensorObject *a, const TensorShape_t axis, TensorObject *dst);
+
+/**
+ * @brief Index of the first maximum along an axis.
+ * @see Tensor_reduce
+*/
+int Tensor_argmax(TensorObject *a, const TensorShape_t axis, TensorObject *dst);
+
+/**
+ * @brief Sum of every element.
+ * @see Tensor_reduce_all
+*/
+TensorData_t Tensor_sum_all(TensorObject *a);
+
+/**
+ * @brief Mean of every element.
+ * @see Tensor_reduce_all
+*/
+TensorData_t Tensor_mean_all(TensorObject *a);
+
+/**
+ * @brief Largest element.
+ * @see Tensor_reduce_all
+*/
+TensorData_t Tensor_max_all(TensorObject *a);
+
+/**
+ * @brief Smallest element.
+ * @see Tensor_reduce_all
+*/
+TensorData_t Tensor_min_all(TensorObject *a);
+
+/**
+ * @brief Row-major linear index of the first largest element.
+ * @see Tensor_reduce_all
+*/
+TensorIndex_t Tensor_argmax_all(TensorObject *a);
@@ -1,55 +1,236 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <pthread.h>
 #include "tensor.h"
+#include "tensor/alloc.h"
+#include "tensor/dtype.h"
+
+// ---Iteration---
+
+int TensorIter_init(TensorIter *iter, const TensorShape_t noperands, TensorObject *const *operands) {
+	if(noperands == 0 || noperands > TENSOR_ITER_MAX_OPERANDS) {
+		return -1;
+	}
+	const TensorObject *first = operands[0];
+	if(first->ndim > TENSOR_ITER_MAX_NDIM) {
+		return -1;
+	}
+	// Broadcast every operand to the shape of the first one: dimensions are aligned from the right,
+	// missing dimensions and dimensions of size 1 are walked with stride 0.
+	TensorIndex_t op_strides[TENSOR_ITER_MAX_OPERANDS][TENSOR_ITER_MAX_NDIM];
+	for(TensorShape_t k = 0; k < noperands; k++) {
+		const TensorObject *operand = operands[k];
+		if(operand->ndim > first->ndim) {
+			return -1;
+		}
+		const TensorShape_t lead = first->ndim - operand->ndim;
+		for(TensorShape_t d = 0; d < first->ndim; d++) {
+			if(d < lead) {
+				op_strides[k][d] = 0;
+			} else if(operand->shape[d - lead] == first->shape[d]) {
+				op_strides[k][d] = operand->strides[d - lead];
+			} else if(operand->shape[d - lead] == 1) {
+				op_strides[k][d] = 0;
+			} else {
+				return -1;
+			}
+		}
+	}
+	iter->noperands = noperands;
+	iter->size = 1;
+	for(TensorShape_t k = 0; k < noperands; k++) {
+		iter->dtype[k] = operands[k]->dtype;
+		iter->item_size[k] = Tensor_dtype_size(operands[k]->dtype);
+		iter->base[k] = (char*)Tensor_data(operands[k]) + operands[k]->offset * iter->item_size[k];
+	}
+	// Coalesce from the innermost dimension outwards. dims[0] ends up being the inner run.
+	TensorShape_t n = 0;
+	TensorIndex_t shape[TENSOR_ITER_MAX_NDIM];
+	TensorIndex_t strides[TENSOR_ITER_MAX_OPERANDS][TENSOR_ITER_MAX_NDIM];
+	for(int d = (int)first->ndim - 1; d >= 0; d--) {
+		iter->size *= first->shape[d];
+		if(first->shape[d] == 1) {
+			continue;
+		}
+		int mergeable = n > 0;
+		for(TensorShape_t k = 0; k < noperands && mergeable; k++) {
+			mergeable = op_strides[k][d] == strides[k][n - 1] * shape[n - 1];
+		}
+		if(mergeable) {
+			shape[n - 1] *= first->shape[d];
+			continue;
+		}
+		shape[n] = first->shape[d];
+		for(TensorShape_t k = 0; k < noperands; k++) {
+			strides[k][n] = op_strides[k][d];
+		}
+		n++;
+	}
+	iter->inner_size = n > 0 ? shape[0] : 1;
+	iter->contiguous = 1;
+	for(TensorShape_t k = 0; k < noperands; k++) {
+		iter->inner_strides[k] = n > 0 ? strides[k][0] : 1;
+		iter->contiguous &= iter->inner_strides[k] == 1;
+	}
+	iter->ndim = n > 0 ? n - 1 : 0;
+	for(TensorShape_t j = 0; j < iter->ndim; j++) {
+		iter->shape[j] = shape[j + 1];
+		for(TensorShape_t k = 0; k < noperands; k++) {
+			iter->strides[k][j] = strides[k][j + 1];
+		}
+	}
+	TensorIter_range(iter, 0, iter->size);
+	return 0;
+}
+
+void TensorIter_range(TensorIter *iter, const TensorIndex_t begin, const TensorIndex_t end) {
+	iter->pos = begin;
+	iter->end = end < iter->size ? end : iter->size;
+	iter->count = 0;
+	iter->started = 0;
+}
+
+// Positions the iterator at an arbitrary linear index.
+static void TensorIter_locate(TensorIter *iter) {
+	TensorIndex_t inner = iter->pos % iter->inner_size;
+	TensorIndex_t rest = iter->pos / iter->inner_size;
+	for(TensorShape_t k = 0; k < iter->noperands; k++) {
+		iter->run[k] = iter->base[k];
+	}
+	for(TensorShape_t j = 0; j < iter->ndim; j++) {
+		iter->idx[j] = rest % iter->shape[j];
+		rest /= iter->shape[j];
+		for(TensorShape_t k = 0; k < iter->noperands; k++) {
+			iter->run[k] += iter->idx[j] * iter->strides[k][j] * iter->item_size[k];
+		}
+	}
+	for(TensorShape_t k = 0; k < iter->noperands; k++) {
+		iter->ptr[k] = iter->run[k] + inner * iter->inner_strides[k] * iter->item_size[k];
+	}
+	iter->count = iter->inner_size - inner;
+}
+
+int TensorIter_next(TensorIter *iter) {
+	if(!iter->started) {
+		iter->started = 1;
+		if(iter->pos >= iter->end) {
+			return 0;
+		}
+		TensorIter_locate(iter);
+	} else {
+		iter->pos += iter->count;
+		if(iter->pos >= iter->end) {
+			return 0;
+		}
+		// the previous run ended at the end of an inner run, step the outer indices like an odometer.
+		for(TensorShape_t j = 0; j < iter->ndim; j++) {
+			for(TensorShape_t k = 0; k < iter->noperands; k++) {
+				iter->run[k] += iter->strides[k][j] * iter->item_size[k];
+			}
+			if(++iter->idx[j] < iter->shape[j]) {
+				break;
+			}
+			for(TensorShape_t k = 0; k < iter->noperands; k++) {
+				iter->run[k] -= iter->strides[k][j] * iter->shape[j] * iter->item_size[k];
+			}
+			iter->idx[j] = 0;
+		}
+		for(TensorShape_t k = 0; k < iter->noperands; k++) {
+			iter->ptr[k] = iter->run[k];
+		}
+		iter->count = iter->inner_size;
+	}
+	if(iter->count > iter->end - iter->pos) {
+		iter->count = iter->end - iter->pos;
+	}
+	return 1;
+}
+
+// Copies every element walked by an iterator from operand 1 to operand 0, converting between their dtypes.
+static void TensorIter_copy(TensorIter *iter) {
+	while(TensorIter_next(iter)) {
+		// contiguous runs of the same dtype are moved, the operands may be views of the same data.
+		Tensor_dtype_convert(iter->ptr[0], iter->dtype[0], iter->inner_strides[0],
+			iter->ptr[1], iter->dtype[1], iter->inner_strides[1], iter->count);
+	}
+}
 
 // ---Allocations---
 
+// Contiguous tensor with a storage of its own. Ranks above TENSOR_MAX_NDIM give an empty tensor without storage,
+// a failed allocation gives the shape without storage.
+static TensorObject Tensor_allocate(TensorShape_t ndim, const TensorIndex_t *const shape, enum TensorDType dtype, int zero) {
+	TensorObject tensor = {0};
+	if(ndim > TENSOR_MAX_NDIM) {
+		return tensor;
+	}
+	tensor.ndim = ndim;
+	tensor.dtype = dtype;
+	// a size that doesn't fit in size_t can't be allocated either.
+	size_t bytes = Tensor_dtype_size(dtype);
+	int overflow = 0;
+	for(TensorShape_t i = 0; i < ndim; i++) {
+		tensor.shape[i] = shape[i];
+		overflow |= __builtin_mul_overflow(bytes, shape[i], &bytes);
+	}
+	TensorIndex_t stride = 1;
+	for(int i = (int)ndim - 1; i >= 0; i--) {
+		tensor.strides[i] = stride;
+		stride *= tensor.shape[i];
+	}
+	tensor.storage = overflow ? NULL : Tensor_alloc_storage(bytes, zero);
+	tensor.data = tensor.storage != NULL ? tensor.storage->buffer : NULL;
+	return tensor;
+}
+
+static void Tensor_releaseHold(struct TensorStorage *storage) {
+	if(atomic_fetch_sub_explicit(&storage->holds, 1, memory_order_acq_rel) == 1) {
+		Tensor_free_storage(storage);
+	}
+}
+
+static void Tensor_releaseReader(struct TensorStorage *source) {
+	atomic_fetch_sub_explicit(&source->readers, 1, memory_order_acq_rel);
+	Tensor_releaseHold(source);
+}
+
 /**
  * @brief      Allocates a new tensor object.
  * @details    This function allocates a new tensor object. The tensor object
  * 		   is initialized with the given shape template. The shape template
- * 		   is an array of TensorShape_t, which is an unsigned integer type.
+ * 		   is an array of TensorIndex_t, which is an unsigned integer type.
  * 		   The shape template is copied into the tensor object, so the
  * 		   shape template can be freed after the tensor object is created.
+ * 		   The reference count and the data are a single allocation.
  * 		   The tensor object requires freeing when it is no longer needed.
  * @see 	  Tensor_free
 */
-TensorObject Tensor_new(const TensorShape_t ndim, const TensorShape_t *const shape_template) {
-	TensorObject tensor;
-	tensor.ndim = ndim;
-	TensorShape_t total_size = 1;
-	for(TensorShape_t i = 0; i < ndim; i++) {
-		total_size *= shape_template[i];
-	}
-	tensor.shape = (TensorShape_t*)calloc(tensor.ndim, sizeof(TensorShape_t));
-	for(TensorShape_t i = 0; i < tensor.ndim; i++) {
-		tensor.shape[i] = shape_template[i];
-	}
-	tensor.strides = (TensorShape_t*)calloc(tensor.ndim, sizeof(TensorShape_t));
-	tensor.strides[tensor.ndim - 1] = 1;
-	for(int i = tensor.ndim - 2; i >= 0; i--) {
-		tensor.strides[i] = tensor.strides[i + 1] * tensor.shape[i + 1];
-	}
-	tensor.data = (TensorData_t*)calloc(total_size, sizeof(TensorData_t));
-	tensor.offset = 0;
-	tensor.ref_count = (TensorShape_t*)malloc(sizeof(TensorShape_t));
-	*tensor.ref_count = 1;
-	return tensor;
+TensorObject Tensor_new(const TensorShape_t ndim, const TensorIndex_t *const shape_template) {
+	return Tensor_allocate(ndim, shape_template, TENSOR_FLOAT64, 1);
+}
+
+TensorObject Tensor_new_dtype(const TensorShape_t ndim, const TensorIndex_t *const shape_template, const enum TensorDType dtype) {
+	return Tensor_allocate(ndim, shape_template, dtype, 1);
+}
+
+TensorObject Tensor_empty(const TensorShape_t ndim, const TensorIndex_t *const shape_template, const enum TensorDType dtype) {
+	return Tensor_allocate(ndim, shape_template, dtype, 0);
 }
 
 void Tensor_free(TensorObject *tensor) {
-	free(tensor->shape);
-	tensor->shape = NULL;
-	free(tensor->strides);
-	tensor->strides = NULL;
-	if(*tensor->ref_count > 1) {
-		*tensor->ref_count -= 1;
+	tensor->ndim = 0;
+	tensor->data = NULL;
+	if(tensor->storage == NULL) {
 		return;
 	}
-	free(tensor->data);
-	tensor->data = NULL;
-	free(tensor->ref_count);
-	tensor->ref_count = NULL;
+	// the release orders this thread's writes to the data before the free in whichever thread drops the last reference.
+	struct TensorStorage *storage = tensor->storage;
+	if(atomic_fetch_sub_explicit(&storage->ref_count, 1, memory_order_acq_rel) == 1) {
+		Tensor_releaseReader(atomic_load_explicit(&storage->source, memory_order_acquire));
+		Tensor_releaseHold(storage);
+	}
+	tensor->storage = NULL;
 }
 
 /**
@@ -60,46 +241,96 @@ void Tensor_free(TensorObject *tensor) {
  * @see 	  Tensor_free
 */
 TensorObject Tensor_clone(TensorObject tensor) {
-	TensorObject clone;
-	clone.ndim = tensor.ndim;
-	clone.shape = (TensorShape_t*)calloc(clone.ndim, sizeof(TensorShape_t));
-	clone.strides = (TensorShape_t*)calloc(clone.ndim, sizeof(TensorShape_t));
-	clone.offset = 0;
-	clone.ref_count = (TensorShape_t*)malloc(sizeof(TensorShape_t));
-	*clone.ref_count = 1;
-	// copy shape and calculate total size
-	TensorShape_t total_size = 1;
-	for(TensorShape_t i = 0; i < clone.ndim; i++) {
-		clone.shape[i] = tensor.shape[i];
-		total_size *= clone.shape[i];
-	}
-	// allocate data
-	clone.data = (TensorData_t*)calloc(total_size, sizeof(TensorData_t));
-	// generate strides
-	clone.strides[clone.ndim - 1] = 1;
-	for(int i = clone.ndim - 2; i >= 0; i--) {
-		clone.strides[i] = clone.strides[i + 1] * clone.shape[i + 1];
+	return Tensor_astype(tensor, tensor.dtype);
+}
+
+TensorObject Tensor_astype(TensorObject tensor, const enum TensorDType dtype) {
+	// every element is overwritten, so the data isn't zeroed
+	TensorObject clone = Tensor_allocate(tensor.ndim, tensor.shape, dtype, 0);
+	if(clone.storage == NULL) {
+		return clone;
 	}
 	// copy data taking into account offset and strides
-	TensorData_t *original_iter = tensor.data + tensor.offset;
-	TensorData_t *clone_iter = clone.data;
-	TensorShape_t *idx = (TensorShape_t*)calloc(clone.ndim, sizeof(TensorShape_t));
-	for(TensorShape_t i = 0; i < total_size; i++) {
-		*clone_iter = *original_iter;
-		clone_iter++;
-		original_iter+= tensor.strides[tensor.ndim - 1];
-		idx[clone.ndim - 1]++;
-		for(TensorShape_t j = clone.ndim - 1; j > 0; j--) {
-			if(idx[j] == clone.shape[j]) {
-				idx[j] = 0;
-				original_iter -= tensor.strides[j] * tensor.shape[j];
-				original_iter += tensor.strides[j - 1];
-				idx[j - 1]++;
+	TensorIter iter;
+	TensorIter_init(&iter, 2, (TensorObject*[]){&clone, &tensor});
+	TensorIter_copy(&iter);
+	return clone;
+}
+
+// ---Copy on write---
+
+// Serializes the copies, so concurrent writers to views of the same storage copy only once.
+static pthread_mutex_t copyMutex = PTHREAD_MUTEX_INITIALIZER;
+
+TensorData_t* Tensor_data(const TensorObject *tensor) {
+	if(tensor->storage == NULL) {
+		return tensor->data;
+	}
+	return atomic_load_explicit(&tensor->storage->source, memory_order_acquire)->buffer;
+}
+
+/**
+ * @brief      Clones a tensor lazily.
+ * @details    The clone gets a storage of its own without data, whose source is the
+ * 		   source of tensor. The buffer is copied by whichever side writes first.
+*/
+TensorObject Tensor_clone_lazy(TensorObject tensor) {
+	if(tensor.storage == NULL) {
+		return Tensor_clone(tensor);
+	}
+	pthread_mutex_lock(&copyMutex);
+	struct TensorStorage *source = atomic_load_explicit(&tensor.storage->source, memory_order_acquire);
+	// sharing is only worth it when the clone would copy the whole buffer, with the same layout.
+	size_t total_size = 1;
+	int dense = 1;
+	for(TensorShape_t i = 0; i < tensor.ndim; i++) {
+		total_size *= tensor.shape[i];
+		dense &= tensor.shape[i] <= 1 || tensor.strides[i] != 0;
+	}
+	TensorObject clone = tensor;
+	clone.storage = dense && total_size * Tensor_dtype_size(tensor.dtype) == source->size ? Tensor_alloc_storage(0, 0) : NULL;
+	if(clone.storage == NULL) {
+		pthread_mutex_unlock(&copyMutex);
+		return Tensor_clone(tensor);
+	}
+	// the empty storage doesn't read its own buffer.
+	atomic_store_explicit(&clone.storage->readers, 0, memory_order_relaxed);
+	atomic_store_explicit(&clone.storage->holds, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&source->readers, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&source->holds, 1, memory_order_relaxed);
+	atomic_store_explicit(&clone.storage->source, source, memory_order_release);
+	pthread_mutex_unlock(&copyMutex);
+	clone.data = source->buffer;
+	return clone;
+}
+
+int Tensor_make_writable(TensorObject *tensor) {
+	struct TensorStorage *storage = tensor->storage;
+	if(storage == NULL) {
+		return 0;
+	}
+	struct TensorStorage *source = atomic_load_explicit(&storage->source, memory_order_acquire);
+	if(atomic_load_explicit(&source->readers, memory_order_acquire) > 1) {
+		pthread_mutex_lock(&copyMutex);
+		source = atomic_load_explicit(&storage->source, memory_order_acquire);
+		if(atomic_load_explicit(&source->readers, memory_order_acquire) > 1) {
+			struct TensorStorage *copy = Tensor_alloc_storage(source->size, 0);
+			if(copy == NULL) {
+				pthread_mutex_unlock(&copyMutex);
+				return -1;
 			}
+			memcpy(copy->buffer, source->buffer, source->size);
+			// the copy is only held through being the source of storage.
+			atomic_store_explicit(&copy->ref_count, 0, memory_order_relaxed);
+			atomic_store_explicit(&copy->holds, 1, memory_order_relaxed);
+			atomic_store_explicit(&storage->source, copy, memory_order_release);
+			Tensor_releaseReader(source);
+			source = copy;
 		}
+		pthread_mutex_unlock(&copyMutex);
 	}
-	free(idx);
-	return clone;
+	tensor->data = source->buffer;
+	return 0;
 }
 
 // ---Manipulations---
@@ -116,7 +347,7 @@ int Tensor_swapaxis(TensorObject *tensor, const TensorShape_t axis1, const Tenso
 	if(axis1 >= tensor->ndim || axis2 >= tensor->ndim) {
 		return -1;
 	}
-	TensorShape_t temp = tensor->shape[axis1];
+	TensorIndex_t temp = tensor->shape[axis1];
 	tensor->shape[axis1] = tensor->shape[axis2];
 	tensor->shape[axis2] = temp;
 	temp = tensor->strides[axis1];
@@ -125,6 +356,20 @@ int Tensor_swapaxis(TensorObject *tensor, const TensorShape_t axis1, const Tenso
 	return 0;
 }
 
+// New reference to the data of tensor, with its dtype and offset. The shape and strides are left to the caller.
+// A tensor without storage gives a view without storage.
+static TensorObject Tensor_share(TensorObject *tensor) {
+	TensorObject view = {0};
+	view.dtype = tensor->dtype;
+	view.data = Tensor_data(tensor);
+	view.offset = tensor->offset;
+	view.storage = tensor->storage;
+	if(view.storage != NULL) {
+		atomic_fetch_add_explicit(&view.storage->ref_count, 1, memory_order_relaxed);
+	}
+	return view;
+}
+
 /**
  * @brief      Slices a tensor along a given axis.
  * @details    This function returns a new tensor object that is a slice of the
@@ -132,15 +377,10 @@ int Tensor_swapaxis(TensorObject *tensor, const TensorShape_t axis1, const Tenso
  * 		   shares the same data as the original tensor object, but increases ref count
  * 		   thus requires freeing.
 */
-TensorObject Tensor_slice(TensorObject *tensor, const TensorShape_t axis, const TensorShape_t idx) {
-	TensorObject slice;
+TensorObject Tensor_slice(TensorObject *tensor, const TensorShape_t axis, const TensorIndex_t idx) {
+	TensorObject slice = Tensor_share(tensor);
 	slice.ndim = tensor->ndim - 1;
-	slice.shape = (TensorShape_t*)calloc(slice.ndim, sizeof(TensorShape_t));
-	slice.strides = (TensorShape_t*)calloc(slice.ndim, sizeof(TensorShape_t));
-	slice.data = tensor->data;
-	slice.offset = tensor->offset + idx * tensor->strides[axis];
-	slice.ref_count = tensor->ref_count;
-	(*slice.ref_count)++;
+	slice.offset += idx * tensor->strides[axis];
 	for(TensorShape_t i = 0; i < axis; i++) {
 		slice.shape[i] = tensor->shape[i];
 		slice.strides[i] = tensor->strides[i];
@@ -152,48 +392,242 @@ TensorObject Tensor_slice(TensorObject *tensor, const TensorShape_t axis, const
 	return slice;
 }
 
-// ---Data access---
+int Tensor_slice_range(TensorObject *tensor, const TensorShape_t axis, const TensorIndex_t start, const TensorIndex_t stop, const TensorIndex_t step, TensorObject *view) {
+	if(axis >= tensor->ndim || step == 0) {
+		return -1;
+	}
+	const TensorIndex_t first = start < tensor->shape[axis] ? start : tensor->shape[axis];
+	const TensorIndex_t last = stop < tensor->shape[axis] ? stop : tensor->shape[axis];
+	TensorObject result = Tensor_share(tensor);
+	result.ndim = tensor->ndim;
+	for(TensorShape_t i = 0; i < tensor->ndim; i++) {
+		result.shape[i] = tensor->shape[i];
+		result.strides[i] = tensor->strides[i];
+	}
+	// rounded up without adding step, which may be close to the largest index.
+	result.shape[axis] = first < last ? (last - first - 1) / step + 1 : 0;
+	result.strides[axis] *= step;
+	result.offset += first * tensor->strides[axis];
+	*view = result;
+	return 0;
+}
 
-TensorData_t* Tensor_get(TensorObject *tensor, const TensorShape_t *const idx) {
-	TensorData_t *data = tensor->data + tensor->offset;
+int Tensor_permute(TensorObject *tensor, const TensorShape_t *const axes, TensorObject *view) {
+	int seen[TENSOR_MAX_NDIM] = {0};
 	for(TensorShape_t i = 0; i < tensor->ndim; i++) {
-		data += idx[i] * tensor->strides[i];
+		if(axes[i] >= tensor->ndim || seen[axes[i]]) {
+			return -1;
+		}
+		seen[axes[i]] = 1;
 	}
-	return data;
+	TensorObject result = Tensor_share(tensor);
+	result.ndim = tensor->ndim;
+	for(TensorShape_t i = 0; i < tensor->ndim; i++) {
+		result.shape[i] = tensor->shape[axes[i]];
+		result.strides[i] = tensor->strides[axes[i]];
+	}
+	*view = result;
+	return 0;
 }
 
-void Tensor_set(TensorObject *tensor, const TensorShape_t *const idx, const TensorData_t value) {
-	TensorData_t *data = tensor->data + tensor->offset;
+/**
+ * @brief      Reshapes a tensor without copying.
+ * @details    Axes of size 1 are dropped from the old shape, then the old and new axes are split
+ * 		   into the smallest groups with the same number of elements. Each group of old axes
+ * 		   must be contiguous within itself, the new axes of the group then get row-major strides
+ * 		   ending at the stride of its innermost old axis.
+*/
+int Tensor_reshape(TensorObject *tensor, const TensorShape_t ndim, const TensorIndex_t *const shape, TensorObject *view) {
+	if(ndim > TENSOR_MAX_NDIM) {
+		return -1;
+	}
+	TensorIndex_t old_size = 1, new_size = 1;
+	TensorShape_t old_ndim = 0;
+	TensorIndex_t old_shape[TENSOR_MAX_NDIM], old_strides[TENSOR_MAX_NDIM];
 	for(TensorShape_t i = 0; i < tensor->ndim; i++) {
-		data += idx[i] * tensor->strides[i];
+		old_size *= tensor->shape[i];
+		if(tensor->shape[i] != 1) {
+			old_shape[old_ndim] = tensor->shape[i];
+			old_strides[old_ndim] = tensor->strides[i];
+			old_ndim++;
+		}
+	}
+	for(TensorShape_t i = 0; i < ndim; i++) {
+		new_size *= shape[i];
+	}
+	if(old_size != new_size) {
+		return -1;
+	}
+	TensorIndex_t strides[TENSOR_MAX_NDIM];
+	TensorIndex_t stride = 1;
+	for(int i = (int)ndim - 1; i >= 0; i--) {
+		// the layout of an empty tensor doesn't matter, and axes left after the groups have size 1.
+		strides[i] = stride;
+		stride *= shape[i];
+	}
+	if(new_size != 0) {
+		TensorShape_t old_begin = 0, new_begin = 0;
+		while(new_begin < ndim && old_begin < old_ndim) {
+			TensorShape_t old_end = old_begin + 1, new_end = new_begin + 1;
+			TensorIndex_t old_count = old_shape[old_begin], new_count = shape[new_begin];
+			while(old_count != new_count) {
+				if(new_count < old_count) {
+					new_count *= shape[new_end++];
+				} else {
+					old_count *= old_shape[old_end++];
+				}
+			}
+			for(TensorShape_t k = old_begin; k + 1 < old_end; k++) {
+				if(old_strides[k] != old_strides[k + 1] * old_shape[k + 1]) {
+					return -1;
+				}
+			}
+			strides[new_end - 1] = old_strides[old_end - 1];
+			for(TensorShape_t k = new_end - 1; k > new_begin; k--) {
+				strides[k - 1] = strides[k] * shape[k];
+			}
+			old_begin = old_end;
+			new_begin = new_end;
+		}
+	}
+	TensorObject result = Tensor_share(tensor);
+	result.ndim = ndim;
+	for(TensorShape_t i = 0; i < ndim; i++) {
+		result.shape[i] = shape[i];
+		result.strides[i] = strides[i];
 	}
-	*data = value;
+	*view = result;
+	return 0;
+}
+
+int Tensor_squeeze(TensorObject *tensor, const TensorShape_t axis, TensorObject *view) {
+	if(axis >= tensor->ndim || tensor->shape[axis] != 1) {
+		return -1;
+	}
+	TensorObject result = Tensor_share(tensor);
+	result.ndim = tensor->ndim - 1;
+	for(TensorShape_t i = 0; i < result.ndim; i++) {
+		result.shape[i] = tensor->shape[i < axis ? i : i + 1];
+		result.strides[i] = tensor->strides[i < axis ? i : i + 1];
+	}
+	*view = result;
+	return 0;
+}
+
+int Tensor_unsqueeze(TensorObject *tensor, const TensorShape_t axis, TensorObject *view) {
+	if(axis > tensor->ndim || tensor->ndim == TENSOR_MAX_NDIM) {
+		return -1;
+	}
+	TensorObject result = Tensor_share(tensor);
+	result.ndim = tensor->ndim + 1;
+	for(TensorShape_t i = 0; i < result.ndim; i++) {
+		if(i == axis) {
+			// the stride of a size 1 axis is never used, this one keeps the view contiguous.
+			result.shape[i] = 1;
+			result.strides[i] = i < tensor->ndim ? tensor->strides[i] * tensor->shape[i] : 1;
+			continue;
+		}
+		result.shape[i] = tensor->shape[i < axis ? i : i - 1];
+		result.strides[i] = tensor->strides[i < axis ? i : i - 1];
+	}
+	*view = result;
+	return 0;
 }
 
 /**
- * @brief      Writes a tensor to another tensor.
- * @details    This function writes a tensor to another tensor. The two tensors
- * 		   must have the same shape. The two tensors can be the same
- * 		   tensor object.
+ * @brief      Broadcasts a tensor to a larger shape.
+ * @details    This function returns, through view, a tensor object with the given shape
+ * 		   that shares the data of the original. Dimensions that are added or expanded
+ * 		   from size 1 get a stride of 0. Like slices, the view increases the ref count
+ * 		   and requires freeing.
 */
-int Tensor_write_to(TensorObject *src_tensor, TensorObject *dst_tensor) {
-	if(src_tensor->ndim != dst_tensor->ndim) {
+int Tensor_broadcast_to(TensorObject *tensor, const TensorShape_t ndim, const TensorIndex_t *const shape, TensorObject *view) {
+	if(tensor->ndim > ndim || ndim > TENSOR_MAX_NDIM) {
 		return -1;
 	}
-	for(TensorShape_t i = 0; i < src_tensor->ndim; i++) {
-		if(src_tensor->shape[i] != dst_tensor->shape[i]) {
+	const TensorShape_t lead = ndim - tensor->ndim;
+	for(TensorShape_t i = lead; i < ndim; i++) {
+		if(tensor->shape[i - lead] != shape[i] && tensor->shape[i - lead] != 1) {
 			return -1;
 		}
 	}
-	TensorData_t *src_data = src_tensor->data + src_tensor->offset;
-	TensorData_t *dst_data = dst_tensor->data + dst_tensor->offset;
-	TensorShape_t total_size = 1;
-	for(TensorShape_t i = 0; i < src_tensor->ndim; i++) {
-		total_size *= src_tensor->shape[i];
+	TensorObject result = Tensor_share(tensor);
+	result.ndim = ndim;
+	for(TensorShape_t i = 0; i < ndim; i++) {
+		result.shape[i] = shape[i];
+		result.strides[i] = i >= lead && tensor->shape[i - lead] == shape[i] ? tensor->strides[i - lead] : 0;
 	}
-	for(TensorShape_t i = 0; i < total_size; i++) {
-		dst_data[i] = src_data[i];
+	*view = result;
+	return 0;
+}
+
+int Tensor_broadcast_shape(const TensorObject *a, const TensorObject *b, TensorShape_t *ndim, TensorIndex_t *shape) {
+	const TensorShape_t n = a->ndim > b->ndim ? a->ndim : b->ndim;
+	for(TensorIndex_t i = 0; i < n; i++) {
+		// walk both shapes from the right.
+		const TensorIndex_t da = i < a->ndim ? a->shape[a->ndim - 1 - i] : 1;
+		const TensorIndex_t db = i < b->ndim ? b->shape[b->ndim - 1 - i] : 1;
+		if(da != db && da != 1 && db != 1) {
+			return -1;
+		}
+		shape[n - 1 - i] = da == 1 ? db : da;
 	}
+	*ndim = n;
 	return 0;
 }
 
+// ---Data access---
+
+// Address of the element at idx, in data.
+static char* Tensor_element(const TensorObject *tensor, TensorData_t *data, const TensorIndex_t *const idx) {
+	TensorIndex_t offset = tensor->offset;
+	for(TensorShape_t i = 0; i < tensor->ndim; i++) {
+		offset += idx[i] * tensor->strides[i];
+	}
+	return (char*)data + offset * Tensor_dtype_size(tensor->dtype);
+}
+
+TensorData_t* Tensor_get(TensorObject *tensor, const TensorIndex_t *const idx) {
+	if(tensor->dtype != TENSOR_FLOAT64) {
+		return NULL;
+	}
+	Tensor_make_writable(tensor);
+	return (TensorData_t*)Tensor_element(tensor, tensor->data, idx);
+}
+
+const TensorData_t* Tensor_get_const(const TensorObject *tensor, const TensorIndex_t *const idx) {
+	if(tensor->dtype != TENSOR_FLOAT64) {
+		return NULL;
+	}
+	return (const TensorData_t*)Tensor_element(tensor, Tensor_data(tensor), idx);
+}
+
+TensorData_t Tensor_get_value(const TensorObject *tensor, const TensorIndex_t *const idx) {
+	return Tensor_dtype_load(tensor->dtype, Tensor_element(tensor, Tensor_data(tensor), idx));
+}
+
+void Tensor_set(TensorObject *tensor, const TensorIndex_t *const idx, const TensorData_t value) {
+	Tensor_make_writable(tensor);
+	Tensor_dtype_store(tensor->dtype, Tensor_element(tensor, tensor->data, idx), value);
+}
+
+/**
+ * @brief      Writes a tensor to another tensor.
+ * @details    This function writes a tensor to another tensor. The two tensors
+ * 		   must have the same shape, or the source must broadcast to the
+ * 		   shape of the destination. The two tensors can be the same
+ * 		   tensor object. Both tensors may be slices or swapped views,
+ * 		   their strides and offsets are respected.
+*/
+int Tensor_write_to(TensorObject *src_tensor, TensorObject *dst_tensor) {
+	// the iterator broadcasts the source, and rejects incompatible shapes.
+	TensorIter iter;
+	if(Tensor_make_writable(dst_tensor) != 0) {
+		return -1;
+	}
+	if(TensorIter_init(&iter, 2, (TensorObject*[]){dst_tensor, src_tensor}) != 0) {
+		return -1;
+	}
+	TensorIter_copy(&iter);
+	return 0;
+}
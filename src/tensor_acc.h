@@ -0,0 +1,98 @@
+/**
+ * @file tensor_acc.h
+ * @brief Reduction accumulator, internal to the library.
+ * @details The accumulator shared by the reductions of tensor_reduce.c and tensor_expr.c,
+ * so both round sums the same way and combine the partial results of their jobs with the same tree.
+*/
+#include "tensor.h"
+#include "tensor/reduce.h"
+#include <math.h>
+#include <stddef.h>
+#pragma once
+
+struct TensorReduceAcc {
+	TensorData_t value;
+	TensorData_t comp; ///< Running compensation of a sum.
+	TensorIndex_t index; ///< Index of value, for max, min and argmax.
+};
+
+static inline void TensorReduce_init(enum TensorReduceOp op, struct TensorReduceAcc *acc) {
+	acc->comp = 0;
+	acc->index = 0;
+	switch(op) {
+		case TENSOR_REDUCE_SUM:
+		case TENSOR_REDUCE_MEAN: acc->value = 0; break;
+		case TENSOR_REDUCE_MAX:
+		case TENSOR_REDUCE_ARGMAX: acc->value = -INFINITY; break;
+		case TENSOR_REDUCE_MIN: acc->value = INFINITY; break;
+	}
+}
+
+// Kahan-Babuska (Neumaier) summation step.
+static inline void TensorReduce_addCompensated(struct TensorReduceAcc *acc, TensorData_t x) {
+	TensorData_t t = acc->value + x;
+	if(fabs(acc->value) >= fabs(x)) {
+		acc->comp += (acc->value - t) + x;
+	} else {
+		acc->comp += (x - t) + acc->value;
+	}
+	acc->value = t;
+}
+
+static inline void TensorReduce_addOne(enum TensorReduceOp op, struct TensorReduceAcc *acc, TensorData_t x, TensorIndex_t index) {
+	switch(op) {
+		case TENSOR_REDUCE_SUM:
+		case TENSOR_REDUCE_MEAN:
+			TensorReduce_addCompensated(acc, x);
+			break;
+		case TENSOR_REDUCE_MAX:
+		case TENSOR_REDUCE_ARGMAX:
+			if(x > acc->value) {
+				acc->value = x;
+				acc->index = index;
+			}
+			break;
+		case TENSOR_REDUCE_MIN:
+			if(x < acc->value) {
+				acc->value = x;
+				acc->index = index;
+			}
+			break;
+	}
+}
+
+// Merges the partial result of a later part of the data into acc.
+static inline void TensorReduce_combine(enum TensorReduceOp op, struct TensorReduceAcc *acc, const struct TensorReduceAcc *other) {
+	switch(op) {
+		case TENSOR_REDUCE_SUM:
+		case TENSOR_REDUCE_MEAN:
+			TensorReduce_addCompensated(acc, other->value);
+			acc->comp += other->comp;
+			break;
+		case TENSOR_REDUCE_MAX:
+		case TENSOR_REDUCE_ARGMAX:
+		case TENSOR_REDUCE_MIN:
+			TensorReduce_addOne(op, acc, other->value, other->index);
+			break;
+	}
+}
+
+static inline TensorData_t TensorReduce_result(enum TensorReduceOp op, const struct TensorReduceAcc *acc, TensorIndex_t count) {
+	switch(op) {
+		case TENSOR_REDUCE_SUM: return acc->value + acc->comp;
+		case TENSOR_REDUCE_MEAN: return (acc->value + acc->comp) / count;
+		case TENSOR_REDUCE_MAX:
+		case TENSOR_REDUCE_MIN: return acc->value;
+		case TENSOR_REDUCE_ARGMAX: return acc->index;
+	}
+	return 0;
+}
+
+// Combines count partial results in place into the first one, pairing neighbours at doubling distances.
+static inline void TensorReduce_tree(enum TensorReduceOp op, struct TensorReduceAcc *partials, size_t count, size_t stride) {
+	for(size_t step = 1; step < count; step *= 2) {
+		for(size_t i = 0; i + step < count; i += 2 * step) {
+			TensorReduce_combine(op, &partials[i * stride], &partials[(i + step) * stride]);
+		}
+	}
+}
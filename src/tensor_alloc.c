@@ -0,0 +1,344 @@
+#include "tensor.h"
+#include "tensor/alloc.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__unix__) || defined(__APPLE__)
+#define TENSOR_MMAP 1
+#include <sys/mman.h>
+#endif
+
+// Size classes: 64 bytes, then four classes per power of two, so rounding wastes at most 25%.
+#define TENSOR_ALLOC_CLASSES (1 + (64 - 6) * 4)
+#define TENSOR_ALLOC_UNPOOLED ((TensorShape_t)-1)
+#define TENSOR_ALLOC_MAPPED ((TensorShape_t)-2)
+#define TENSOR_ALLOC_FILE ((TensorShape_t)-3)
+
+// The buffer follows the header, on the next TENSOR_ALIGNMENT boundary.
+#define TENSOR_HEADER_BYTES ((sizeof(struct TensorStorage) + TENSOR_ALIGNMENT - 1) & ~(size_t)(TENSOR_ALIGNMENT - 1))
+
+// Cached storages are linked through the first bytes of their data, every class holds at least 64.
+#define TENSOR_NEXT(storage) (*(struct TensorStorage**)(storage)->buffer)
+
+struct TensorFreeList {
+	pthread_mutex_t mutex;
+	struct TensorStorage *head;
+};
+
+static struct TensorFreeList freeLists[TENSOR_ALLOC_CLASSES] = {
+	[0 ... TENSOR_ALLOC_CLASSES - 1] = {PTHREAD_MUTEX_INITIALIZER, NULL},
+};
+
+static atomic_int poolEnabled = 0;
+static atomic_size_t maxCachedBytes = TENSOR_ALLOC_MAX_CACHED;
+static atomic_size_t maxBufferBytes = TENSOR_ALLOC_MAX_BUFFER;
+static atomic_size_t cachedBytes = 0;
+static atomic_size_t cachedBuffers = 0;
+static atomic_size_t poolHits = 0;
+static atomic_size_t poolMisses = 0;
+static atomic_int hugeEnabled = 0;
+static atomic_size_t hugeMinBytes = TENSOR_ALLOC_HUGE_MIN;
+static atomic_size_t hugeBytes = 0;
+static atomic_size_t hugeBuffers = 0;
+
+// ---System memory---
+
+// The header is placed so the buffer right after it starts on TENSOR_ALIGNMENT, the block keeps calloc's zeroing.
+static struct TensorStorage* Tensor_allocAligned(size_t bytes, int zero) {
+	size_t total;
+	if(__builtin_add_overflow(bytes, TENSOR_HEADER_BYTES + TENSOR_ALIGNMENT - 1, &total)) {
+		return NULL;
+	}
+	void *allocation = zero ? calloc(1, total) : malloc(total);
+	if(allocation == NULL) {
+		return NULL;
+	}
+	struct TensorStorage *storage = (struct TensorStorage*)(((uintptr_t)allocation + TENSOR_ALIGNMENT - 1) & ~(uintptr_t)(TENSOR_ALIGNMENT - 1));
+	storage->allocation = allocation;
+	storage->buffer = (TensorData_t*)((char*)storage + TENSOR_HEADER_BYTES);
+	return storage;
+}
+
+static void Tensor_freeAligned(struct TensorStorage *storage) {
+	free(storage->allocation);
+}
+
+static size_t Tensor_mappedLength(size_t bytes) {
+	return (TENSOR_HEADER_BYTES + bytes + TENSOR_ALLOC_HUGE_PAGE - 1) & ~(TENSOR_ALLOC_HUGE_PAGE - 1);
+}
+
+// A mapping of its own, on huge pages if the system gives them. NULL if it can't be mapped.
+static struct TensorStorage* Tensor_mapHuge(size_t bytes) {
+#ifdef TENSOR_MMAP
+	// the length is rounded up and a huge page more may be mapped, neither may wrap.
+	size_t limit;
+	if(__builtin_add_overflow(bytes, TENSOR_HEADER_BYTES + 2 * TENSOR_ALLOC_HUGE_PAGE, &limit)) {
+		return NULL;
+	}
+	const size_t length = Tensor_mappedLength(bytes);
+	void *start = MAP_FAILED;
+	#ifdef MAP_HUGETLB
+		// only succeeds when huge pages have been reserved.
+		start = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	#endif
+	if(start == MAP_FAILED) {
+		// map a huge page more than needed, and trim it so the mapping is aligned on a huge page.
+		char *raw = mmap(NULL, length + TENSOR_ALLOC_HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(raw == MAP_FAILED) {
+			return NULL;
+		}
+		char *aligned = (char*)(((uintptr_t)raw + TENSOR_ALLOC_HUGE_PAGE - 1) & ~(uintptr_t)(TENSOR_ALLOC_HUGE_PAGE - 1));
+		if(aligned > raw) {
+			munmap(raw, aligned - raw);
+		}
+		if(raw + TENSOR_ALLOC_HUGE_PAGE > aligned) {
+			munmap(aligned + length, raw + TENSOR_ALLOC_HUGE_PAGE - aligned);
+		}
+		#ifdef MADV_HUGEPAGE
+			madvise(aligned, length, MADV_HUGEPAGE);
+		#endif
+		start = aligned;
+	}
+	struct TensorStorage *storage = start;
+	storage->allocation = start;
+	storage->buffer = (TensorData_t*)((char*)start + TENSOR_HEADER_BYTES);
+	storage->size_class = TENSOR_ALLOC_MAPPED;
+	atomic_fetch_add_explicit(&hugeBytes, length, memory_order_relaxed);
+	atomic_fetch_add_explicit(&hugeBuffers, 1, memory_order_relaxed);
+	return storage;
+#else
+	(void)bytes;
+	return NULL;
+#endif
+}
+
+static void Tensor_unmapHuge(struct TensorStorage *storage) {
+#ifdef TENSOR_MMAP
+	const size_t length = Tensor_mappedLength(storage->size);
+	atomic_fetch_sub_explicit(&hugeBytes, length, memory_order_relaxed);
+	atomic_fetch_sub_explicit(&hugeBuffers, 1, memory_order_relaxed);
+	munmap(storage->allocation, length);
+#else
+	(void)storage;
+#endif
+}
+
+// A storage reading bytes at offset of the file, the header is allocated apart from the mapping.
+struct TensorStorage* Tensor_map_storage(int fd, size_t offset, size_t bytes, int shared) {
+#ifdef TENSOR_MMAP
+	struct TensorStorage *storage = malloc(sizeof(struct TensorStorage));
+	if(storage == NULL) {
+		return NULL;
+	}
+	// the mapping starts at the beginning of the file, so offset needs no page alignment.
+	void *start = mmap(NULL, offset + bytes, PROT_READ | PROT_WRITE, shared ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+	if(start == MAP_FAILED) {
+		free(storage);
+		return NULL;
+	}
+	storage->allocation = start;
+	storage->buffer = (TensorData_t*)((char*)start + offset);
+	storage->size_class = TENSOR_ALLOC_FILE;
+	atomic_init(&storage->ref_count, 1);
+	atomic_init(&storage->readers, 1);
+	atomic_init(&storage->holds, 2);
+	atomic_init(&storage->source, storage);
+	storage->size = bytes;
+	return storage;
+#else
+	(void)fd;
+	(void)offset;
+	(void)bytes;
+	(void)shared;
+	return NULL;
+#endif
+}
+
+int Tensor_sync_storage(struct TensorStorage *storage) {
+#ifdef TENSOR_MMAP
+	if(storage->size_class != TENSOR_ALLOC_FILE) {
+		return 0;
+	}
+	return msync(storage->allocation, (size_t)((char*)storage->buffer - (char*)storage->allocation) + storage->size, MS_SYNC) == 0 ? 0 : -1;
+#else
+	(void)storage;
+	return 0;
+#endif
+}
+
+static void Tensor_unmapFile(struct TensorStorage *storage) {
+#ifdef TENSOR_MMAP
+	munmap(storage->allocation, (size_t)((char*)storage->buffer - (char*)storage->allocation) + storage->size);
+#endif
+	free(storage);
+}
+
+// ---Pool---
+
+static size_t Tensor_sizeClass(size_t bytes) {
+	if(bytes <= 64) {
+		return 0;
+	}
+	const int p = 63 - __builtin_clzll((unsigned long long)bytes - 1); // 2^p < bytes <= 2^(p + 1)
+	const size_t quarter = (size_t)1 << (p - 2);
+	const size_t k = (bytes + quarter - 1) / quarter; // 5 to 8 quarters
+	return 1 + (size_t)(p - 6) * 4 + (k - 5);
+}
+
+static size_t Tensor_classBytes(size_t size_class) {
+	if(size_class == 0) {
+		return 64;
+	}
+	const int p = 6 + (int)(size_class - 1) / 4;
+	return ((size_t)(size_class - 1) % 4 + 5) << (p - 2);
+}
+
+static struct TensorStorage* Tensor_poolPop(size_t size_class) {
+	struct TensorFreeList *list = &freeLists[size_class];
+	pthread_mutex_lock(&list->mutex);
+	struct TensorStorage *storage = list->head;
+	if(storage != NULL) {
+		list->head = TENSOR_NEXT(storage);
+	}
+	pthread_mutex_unlock(&list->mutex);
+	return storage;
+}
+
+// Takes a cached storage of the class, or allocates the whole class so the storage can serve any size of it later.
+static struct TensorStorage* Tensor_poolGet(size_t size_class, size_t bytes, int zero) {
+	const size_t class_bytes = Tensor_classBytes(size_class);
+	struct TensorStorage *storage = Tensor_poolPop(size_class);
+	if(storage != NULL) {
+		atomic_fetch_add_explicit(&poolHits, 1, memory_order_relaxed);
+		atomic_fetch_sub_explicit(&cachedBytes, class_bytes, memory_order_relaxed);
+		atomic_fetch_sub_explicit(&cachedBuffers, 1, memory_order_relaxed);
+		if(zero) {
+			memset(storage->buffer, 0, bytes);
+		}
+		return storage;
+	}
+	atomic_fetch_add_explicit(&poolMisses, 1, memory_order_relaxed);
+	storage = Tensor_allocAligned(class_bytes, zero);
+	if(storage != NULL) {
+		storage->size_class = size_class;
+	}
+	return storage;
+}
+
+struct TensorStorage* Tensor_alloc_storage(size_t bytes, int zero) {
+	struct TensorStorage *storage = NULL;
+	if(atomic_load_explicit(&hugeEnabled, memory_order_relaxed) && bytes >= atomic_load_explicit(&hugeMinBytes, memory_order_relaxed)) {
+		storage = Tensor_mapHuge(bytes);
+	}
+	// mappings come zeroed from the system.
+	if(storage == NULL && (!atomic_load_explicit(&poolEnabled, memory_order_relaxed) || bytes > atomic_load_explicit(&maxBufferBytes, memory_order_relaxed))) {
+		storage = Tensor_allocAligned(bytes, zero);
+		if(storage == NULL) {
+			return NULL;
+		}
+		storage->size_class = TENSOR_ALLOC_UNPOOLED;
+	} else if(storage == NULL) {
+		storage = Tensor_poolGet(Tensor_sizeClass(bytes), bytes, zero);
+		if(storage == NULL) {
+			return NULL;
+		}
+	}
+	atomic_init(&storage->ref_count, 1);
+	atomic_init(&storage->readers, 1);
+	atomic_init(&storage->holds, 2);
+	atomic_init(&storage->source, storage);
+	storage->size = bytes;
+	return storage;
+}
+
+void Tensor_free_storage(struct TensorStorage *storage) {
+	if(storage == NULL) {
+		return;
+	}
+	if(storage->size_class == TENSOR_ALLOC_MAPPED) {
+		Tensor_unmapHuge(storage);
+		return;
+	}
+	if(storage->size_class == TENSOR_ALLOC_FILE) {
+		Tensor_unmapFile(storage);
+		return;
+	}
+	if(storage->size_class == TENSOR_ALLOC_UNPOOLED || !atomic_load_explicit(&poolEnabled, memory_order_relaxed)) {
+		Tensor_freeAligned(storage);
+		return;
+	}
+	const size_t class_bytes = Tensor_classBytes(storage->size_class);
+	if(class_bytes > atomic_load_explicit(&maxBufferBytes, memory_order_relaxed)) {
+		Tensor_freeAligned(storage);
+		return;
+	}
+	// reserve room under the cap before publishing the storage.
+	const size_t cached = atomic_fetch_add_explicit(&cachedBytes, class_bytes, memory_order_relaxed) + class_bytes;
+	if(cached > atomic_load_explicit(&maxCachedBytes, memory_order_relaxed)) {
+		atomic_fetch_sub_explicit(&cachedBytes, class_bytes, memory_order_relaxed);
+		Tensor_freeAligned(storage);
+		return;
+	}
+	atomic_fetch_add_explicit(&cachedBuffers, 1, memory_order_relaxed);
+	struct TensorFreeList *list = &freeLists[storage->size_class];
+	pthread_mutex_lock(&list->mutex);
+	TENSOR_NEXT(storage) = list->head;
+	list->head = storage;
+	pthread_mutex_unlock(&list->mutex);
+}
+
+// Releases cached storages of one class while more than keep_bytes are cached in total.
+static size_t Tensor_releaseClass(size_t size_class, size_t keep_bytes) {
+	const size_t class_bytes = Tensor_classBytes(size_class);
+	size_t released = 0;
+	while(atomic_load_explicit(&cachedBytes, memory_order_relaxed) > keep_bytes) {
+		struct TensorStorage *storage = Tensor_poolPop(size_class);
+		if(storage == NULL) {
+			break;
+		}
+		atomic_fetch_sub_explicit(&cachedBytes, class_bytes, memory_order_relaxed);
+		atomic_fetch_sub_explicit(&cachedBuffers, 1, memory_order_relaxed);
+		Tensor_freeAligned(storage);
+		released += class_bytes;
+	}
+	return released;
+}
+
+size_t Tensor_alloc_trim(size_t keep_bytes) {
+	size_t released = 0;
+	for(size_t c = TENSOR_ALLOC_CLASSES; c-- > 0;) {
+		released += Tensor_releaseClass(c, keep_bytes);
+	}
+	return released;
+}
+
+void Tensor_alloc_configure(int enabled, size_t max_cached_bytes, size_t max_buffer_bytes) {
+	atomic_store(&maxCachedBytes, max_cached_bytes ? max_cached_bytes : TENSOR_ALLOC_MAX_CACHED);
+	atomic_store(&maxBufferBytes, max_buffer_bytes ? max_buffer_bytes : TENSOR_ALLOC_MAX_BUFFER);
+	atomic_store(&poolEnabled, enabled != 0);
+	if(!enabled) {
+		Tensor_alloc_trim(0);
+		return;
+	}
+	// apply the new limits to what is already cached.
+	for(size_t c = TENSOR_ALLOC_CLASSES; c-- > 0 && Tensor_classBytes(c) > atomic_load(&maxBufferBytes);) {
+		Tensor_releaseClass(c, 0);
+	}
+	Tensor_alloc_trim(atomic_load(&maxCachedBytes));
+}
+
+void Tensor_alloc_configure_huge(int enabled, size_t min_bytes) {
+	atomic_store(&hugeMinBytes, min_bytes ? min_bytes : TENSOR_ALLOC_HUGE_MIN);
+	atomic_store(&hugeEnabled, enabled != 0);
+}
+
+void Tensor_alloc_stats(struct TensorAllocStats *stats) {
+	stats->hits = atomic_load(&poolHits);
+	stats->misses = atomic_load(&poolMisses);
+	stats->cached_bytes = atomic_load(&cachedBytes);
+	stats->cached_buffers = atomic_load(&cachedBuffers);
+	stats->huge_bytes = atomic_load(&hugeBytes);
+	stats->huge_buffers = atomic_load(&hugeBuffers);
+}
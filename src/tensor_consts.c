@@ -1,74 +1,365 @@
 #include "tensor/constants.h"
+#include "tensor/dtype.h"
+#include "tensor/math.h"
+#include "tensor/parallel.h"
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <math.h>
+#if defined(__x86_64__) || defined(__i386__)
+#define TENSOR_X86 1
+#include <immintrin.h>
+#endif
 
-float generate_random_uniform(float min, float max) {
-	int r = rand();
-	float f = (float)r / RAND_MAX;
-	return min + f * (max - min);
+// ---Philox---
+// Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3"). Every counter is hashed
+// with the key into 4 random words on its own, so any part of a stream can be generated independently.
+
+#define TENSOR_PHILOX_M0 0xD2511F53u
+#define TENSOR_PHILOX_M1 0xCD9E8D57u
+#define TENSOR_PHILOX_W0 0x9E3779B9u
+#define TENSOR_PHILOX_W1 0xBB67AE85u
+#define TENSOR_PHILOX_ROUNDS 10
+
+// Number of counters generated at once, a multiple of the widest vector.
+#define TENSOR_RANDOM_BLOCK 64
+
+// Stream of generate_random_uniform and generate_random_normal, the tensors use the ones below it.
+#define TENSOR_RANDOM_SCALAR_STREAM UINT64_MAX
+
+static atomic_uint_fast64_t randomSeed = TENSOR_RANDOM_DEFAULT_SEED;
+static atomic_uint_fast64_t randomStream = 0;
+static atomic_uint_fast64_t randomScalarCounter = 0;
+
+static void Tensor_philox(uint32_t ctr[4], uint32_t k0, uint32_t k1) {
+	for(int round = 0; round < TENSOR_PHILOX_ROUNDS; round++) {
+		const uint64_t p0 = (uint64_t)TENSOR_PHILOX_M0 * ctr[0];
+		const uint64_t p1 = (uint64_t)TENSOR_PHILOX_M1 * ctr[2];
+		const uint32_t c1 = ctr[1], c3 = ctr[3];
+		ctr[0] = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+		ctr[1] = (uint32_t)p1;
+		ctr[2] = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+		ctr[3] = (uint32_t)p0;
+		k0 += TENSOR_PHILOX_W0;
+		k1 += TENSOR_PHILOX_W1;
+	}
+}
+
+// The 4 words of counters first to first + n, of one stream, into words[4 * i + j].
+static void Tensor_philox_c(uint32_t *words, uint64_t first, size_t n, uint64_t stream, uint64_t seed) {
+	for(size_t i = 0; i < n; i++) {
+		uint32_t *ctr = words + 4 * i;
+		ctr[0] = (uint32_t)(first + i);
+		ctr[1] = (uint32_t)((first + i) >> 32);
+		ctr[2] = (uint32_t)stream;
+		ctr[3] = (uint32_t)(stream >> 32);
+		Tensor_philox(ctr, (uint32_t)seed, (uint32_t)(seed >> 32));
+	}
+}
+
+#ifdef TENSOR_X86
+// High and low halves of the 32 x 32 bit products of every lane, the odd lanes are multiplied separately.
+#define TENSOR_PHILOX_MULHILO_AVX2(a, m, hi, lo) do { \
+		const __m256i even = _mm256_mul_epu32(a, m); \
+		const __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), m); \
+		hi = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA); \
+		lo = _mm256_mullo_epi32(a, m); \
+	} while(0)
+
+// 8 counters at once, one per lane of each word.
+__attribute__((target("avx2"))) static void Tensor_philox_avx2(uint32_t *words, uint64_t first, size_t n, uint64_t stream, uint64_t seed) {
+	const __m256i m0 = _mm256_set1_epi32((int)TENSOR_PHILOX_M0), m1 = _mm256_set1_epi32((int)TENSOR_PHILOX_M1);
+	const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	size_t i = 0;
+	for(; i + 8 <= n; i += 8) {
+		const uint64_t base = first + i;
+		// the low word may wrap inside the vector, the lanes past the wrap carry into the high word.
+		__m256i c0 = _mm256_add_epi32(_mm256_set1_epi32((int)(uint32_t)base), lanes);
+		const __m256i wrapped = _mm256_cmpgt_epi32(_mm256_xor_si256(_mm256_set1_epi32((int)(uint32_t)base), _mm256_set1_epi32(INT32_MIN)),
+			_mm256_xor_si256(c0, _mm256_set1_epi32(INT32_MIN)));
+		__m256i c1 = _mm256_sub_epi32(_mm256_set1_epi32((int)(uint32_t)(base >> 32)), wrapped);
+		__m256i c2 = _mm256_set1_epi32((int)(uint32_t)stream);
+		__m256i c3 = _mm256_set1_epi32((int)(uint32_t)(stream >> 32));
+		uint32_t k0 = (uint32_t)seed, k1 = (uint32_t)(seed >> 32);
+		for(int round = 0; round < TENSOR_PHILOX_ROUNDS; round++) {
+			__m256i hi0, lo0, hi1, lo1;
+			TENSOR_PHILOX_MULHILO_AVX2(c0, m0, hi0, lo0);
+			TENSOR_PHILOX_MULHILO_AVX2(c2, m1, hi1, lo1);
+			c0 = _mm256_xor_si256(_mm256_xor_si256(hi1, c1), _mm256_set1_epi32((int)k0));
+			c1 = lo1;
+			c2 = _mm256_xor_si256(_mm256_xor_si256(hi0, c3), _mm256_set1_epi32((int)k1));
+			c3 = lo0;
+			k0 += TENSOR_PHILOX_W0;
+			k1 += TENSOR_PHILOX_W1;
+		}
+		// interleave the words back to counter order.
+		const __m256i a = _mm256_unpacklo_epi32(c0, c1), b = _mm256_unpackhi_epi32(c0, c1);
+		const __m256i c = _mm256_unpacklo_epi32(c2, c3), d = _mm256_unpackhi_epi32(c2, c3);
+		const __m256i r0 = _mm256_unpacklo_epi64(a, c), r1 = _mm256_unpackhi_epi64(a, c);
+		const __m256i r2 = _mm256_unpacklo_epi64(b, d), r3 = _mm256_unpackhi_epi64(b, d);
+		__m256i *out = (__m256i*)(words + 4 * i);
+		_mm256_storeu_si256(out, _mm256_permute2x128_si256(r0, r1, 0x20));
+		_mm256_storeu_si256(out + 1, _mm256_permute2x128_si256(r2, r3, 0x20));
+		_mm256_storeu_si256(out + 2, _mm256_permute2x128_si256(r0, r1, 0x31));
+		_mm256_storeu_si256(out + 3, _mm256_permute2x128_si256(r2, r3, 0x31));
+	}
+	Tensor_philox_c(words + 4 * i, first + i, n - i, stream, seed);
+}
+#endif
+
+static void Tensor_philoxBlock(uint32_t *words, uint64_t first, size_t n, uint64_t stream, uint64_t seed) {
+#ifdef TENSOR_X86
+	if(Tensor_simd_level() >= TENSOR_SIMD_AVX2) {
+		Tensor_philox_avx2(words, first, n, stream, seed);
+		return;
+	}
+#endif
+	Tensor_philox_c(words, first, n, stream, seed);
+}
+
+// Uniform in [0, 1) from 53 random bits.
+static double Tensor_unitDouble(uint32_t hi, uint32_t lo) {
+	return ((uint64_t)(hi >> 5) * 67108864.0 + (lo >> 6)) * 0x1p-53;
+}
+
+// ---Random tensors---
+// Element i of a tensor is made from counter i / 2 of the stream of the call, so the values
+// only depend on the seed, the stream and the position, not on how the work is split.
+
+enum TensorRandomDist {
+	TENSOR_RANDOM_UNIFORM,
+	TENSOR_RANDOM_NORMAL,
+};
+
+struct TensorRandomTask {
+	TensorObject tensor; ///< Contiguous tensor to fill.
+	TensorIndex_t size;
+	enum TensorRandomDist dist;
+	TensorData_t a; ///< Minimum, or mean.
+	TensorData_t b; ///< Maximum, or standard deviation.
+	uint64_t stream;
+	uint64_t seed;
+};
+
+// Elements 2 * begin to 2 * end, clipped to the size of the tensor.
+static void Tensor_randomRange(const struct TensorRandomTask *task, TensorIndex_t begin, TensorIndex_t end) {
+	uint32_t words[4 * TENSOR_RANDOM_BLOCK];
+	TensorData_t values[2 * TENSOR_RANDOM_BLOCK];
+	const size_t item_size = Tensor_dtype_size(task->tensor.dtype);
+	for(TensorIndex_t first = begin; first < end; first += TENSOR_RANDOM_BLOCK) {
+		const size_t n = end - first < TENSOR_RANDOM_BLOCK ? end - first : TENSOR_RANDOM_BLOCK;
+		Tensor_philoxBlock(words, first, n, task->stream, task->seed);
+		for(size_t i = 0; i < n; i++) {
+			const uint32_t *w = words + 4 * i;
+			if(task->dist == TENSOR_RANDOM_UNIFORM) {
+				values[2 * i] = task->a + (task->b - task->a) * Tensor_unitDouble(w[0], w[1]);
+				values[2 * i + 1] = task->a + (task->b - task->a) * Tensor_unitDouble(w[2], w[3]);
+				continue;
+			}
+			// Box-Muller, 1 - u keeps the logarithm finite.
+			const double r = sqrt(-2 * log(1 - Tensor_unitDouble(w[0], w[1])));
+			const double theta = 2 * M_PI * Tensor_unitDouble(w[2], w[3]);
+			values[2 * i] = task->a + task->b * r * cos(theta);
+			values[2 * i + 1] = task->a + task->b * r * sin(theta);
+		}
+		const TensorIndex_t start = 2 * first;
+		const TensorIndex_t count = start + 2 * n < task->size ? 2 * n : task->size - start;
+		Tensor_dtype_convert((char*)task->tensor.data + start * item_size, task->tensor.dtype, 1, values, TENSOR_FLOAT64, 1, count);
+	}
+}
+
+static void* Tensor_randomJob(void *args) {
+	struct range_args *range = (struct range_args*)args;
+	Tensor_randomRange((const struct TensorRandomTask*)range->args, range->begin, range->end);
+	return NULL;
+}
+
+static TensorObject Tensor_random(TensorShape_t ndim, const TensorIndex_t *shape, enum TensorDType dtype, enum TensorRandomDist dist, TensorData_t a, TensorData_t b) {
+	struct TensorRandomTask task = {
+		.tensor = Tensor_new_dtype(ndim, shape, dtype),
+		.size = 1,
+		.dist = dist,
+		.a = a,
+		.b = b,
+		.stream = atomic_fetch_add(&randomStream, 1),
+		.seed = atomic_load(&randomSeed),
+	};
+	for(TensorShape_t i = 0; i < ndim; i++) {
+		task.size *= shape[i];
+	}
+	const TensorIndex_t counters = (task.size + 1) / 2;
+	if(task.tensor.storage == NULL || counters == 0) {
+		return task.tensor;
+	}
+	if(task.size < TENSOR_MATH_PARALLEL_THRESHOLD) {
+		Tensor_randomRange(&task, 0, counters);
+		return task.tensor;
+	}
+	TensorIndex_t grain = Tensor_loop_grain(counters, 0);
+	if(grain < TENSOR_MATH_PARALLEL_THRESHOLD / 8) {
+		grain = TENSOR_MATH_PARALLEL_THRESHOLD / 8;
+	}
+	Tensor_parallel_for(counters, grain, Tensor_randomJob, &task);
+	return task.tensor;
+}
+
+void Tensor_random_seed(uint64_t seed) {
+	atomic_store(&randomSeed, seed);
+	atomic_store(&randomStream, 0);
+	atomic_store(&randomScalarCounter, 0);
 }
 
-static int generate_random_normal_initialized = 0;
+TensorObject Tensor_random_uniform(TensorShape_t ndim, const TensorIndex_t *shape, float min, float max) {
+	return Tensor_random(ndim, shape, TENSOR_FLOAT64, TENSOR_RANDOM_UNIFORM, min, max);
+}
+
+TensorObject Tensor_random_normal(TensorShape_t ndim, const TensorIndex_t *shape, float mean, float stddev) {
+	return Tensor_random(ndim, shape, TENSOR_FLOAT64, TENSOR_RANDOM_NORMAL, mean, stddev);
+}
+
+TensorObject Tensor_random_uniform_like(TensorObject a, float min, float max) {
+	return Tensor_random(a.ndim, a.shape, a.dtype, TENSOR_RANDOM_UNIFORM, min, max);
+}
+
+TensorObject Tensor_random_normal_like(TensorObject a, float mean, float stddev) {
+	return Tensor_random(a.ndim, a.shape, a.dtype, TENSOR_RANDOM_NORMAL, mean, stddev);
+}
+
+// Every call takes the next counter of the scalar stream, so concurrent calls get different values.
+static void Tensor_randomScalar(uint32_t words[4]) {
+	Tensor_philox_c(words, atomic_fetch_add(&randomScalarCounter, 1), 1, TENSOR_RANDOM_SCALAR_STREAM, atomic_load(&randomSeed));
+}
+
+float generate_random_uniform(float min, float max) {
+	uint32_t words[4];
+	Tensor_randomScalar(words);
+	return min + (float)Tensor_unitDouble(words[0], words[1]) * (max - min);
+}
 
-static const int GEN_RAN_NOR_MIX_U = 0;
-static const int GEN_RAN_NOR_MIX_V = 1;
-static int generate_random_normal_genval = GEN_RAN_NOR_MIX_U;
 float generate_random_normal(float mean, float stddev) {
-	// Box-Muller transform with polar form
-	static float u, v, s, mul;
-	if(!generate_random_normal_initialized) u = generate_random_uniform(-1, 1);
-	
-	if(generate_random_normal_genval == GEN_RAN_NOR_MIX_U) while(1) {
-		v = generate_random_uniform(-1, 1);
-		s = u * u + v * v;
-		if(s==0 || s >= 1) continue;
-		break;
-	}
-	mul = sqrtf(-2 * logf(s) / s);
-	if(generate_random_normal_genval == GEN_RAN_NOR_MIX_U) {
-		generate_random_normal_genval = GEN_RAN_NOR_MIX_V;
-		return mean + stddev * u * mul;
-	} else {
-		generate_random_normal_genval = GEN_RAN_NOR_MIX_U;
-		return mean + stddev * v * mul;
+	uint32_t words[4];
+	Tensor_randomScalar(words);
+	const double r = sqrt(-2 * log(1 - Tensor_unitDouble(words[0], words[1])));
+	return mean + stddev * (float)(r * cos(2 * M_PI * Tensor_unitDouble(words[2], words[3])));
+}
+
+// ---Constants---
+// Large tensors are filled by the pool. The buffers are allocated without touching them, so every page is
+// placed by the first write, on the NUMA node of the worker filling its chunk. Filling with a value splits
+// the buffer into whole pages, so even a single long row is spread over the threads and no page is
+// written by two of them. The diagonals of Tensor_eye are split in chunks of whole rows.
+
+// Size of the pages a value fill is split on.
+#define TENSOR_FILL_PAGE 4096
+
+enum TensorFillKind {
+	TENSOR_FILL_VALUE, ///< Every element.
+	TENSOR_FILL_EYE, ///< The diagonal of every matrix, the rest is already zero.
+};
+
+struct TensorFillTask {
+	TensorData_t *data;
+	enum TensorFillKind kind;
+	TensorData_t value;
+	TensorIndex_t cols; ///< Elements per row, the last dimension.
+	TensorIndex_t matrix_rows; ///< Rows per matrix, for TENSOR_FILL_EYE.
+	TensorIndex_t size; ///< Elements, for TENSOR_FILL_VALUE.
+	TensorIndex_t lead; ///< Elements before the first page boundary of data, for TENSOR_FILL_VALUE.
+};
+
+static void Tensor_fillRows(const struct TensorFillTask *task, TensorIndex_t begin, TensorIndex_t end) {
+	if(task->kind == TENSOR_FILL_VALUE) {
+		TensorData_t *data = task->data;
+		for(TensorIndex_t i = begin * task->cols; i < end * task->cols; i++) data[i] = task->value;
+		return;
 	}
+	for(TensorIndex_t row = begin; row < end; row++) {
+		const TensorIndex_t j = row % task->matrix_rows;
+		if(j < task->cols) {
+			task->data[row * task->cols + j] = task->value;
+		}
+	}
+}
+
+static void* Tensor_fillJob(void *args) {
+	struct range_args *range = (struct range_args*)args;
+	Tensor_fillRows((const struct TensorFillTask*)range->args, range->begin, range->end);
+	return NULL;
+}
+
+// First element of page unit of a value fill, unit 0 being the part before the first page boundary.
+static TensorIndex_t Tensor_fillPageStart(const struct TensorFillTask *task, TensorIndex_t unit) {
+	const TensorIndex_t start = unit == 0 ? 0 : task->lead + (unit - 1) * (TENSOR_FILL_PAGE / sizeof(TensorData_t));
+	return start < task->size ? start : task->size;
+}
+
+static void* Tensor_fillPagesJob(void *args) {
+	struct range_args *range = (struct range_args*)args;
+	const struct TensorFillTask *task = (const struct TensorFillTask*)range->args;
+	const TensorIndex_t end = Tensor_fillPageStart(task, range->end);
+	for(TensorIndex_t i = Tensor_fillPageStart(task, range->begin); i < end; i++) task->data[i] = task->value;
+	return NULL;
+}
+
+static void Tensor_fill(struct TensorFillTask *task, TensorIndex_t rows) {
+	if(rows * task->cols < TENSOR_MATH_PARALLEL_THRESHOLD) {
+		Tensor_fillRows(task, 0, rows);
+		return;
+	}
+	if(task->kind == TENSOR_FILL_EYE) {
+		Tensor_parallel_for(rows, 0, Tensor_fillJob, task);
+		return;
+	}
+	const TensorIndex_t page = TENSOR_FILL_PAGE / sizeof(TensorData_t);
+	task->size = rows * task->cols;
+	task->lead = (TENSOR_FILL_PAGE - (uintptr_t)task->data % TENSOR_FILL_PAGE) % TENSOR_FILL_PAGE / sizeof(TensorData_t);
+	if(task->lead > task->size) {
+		task->lead = task->size;
+	}
+	Tensor_parallel_for(1 + (task->size - task->lead + page - 1) / page, 0, Tensor_fillPagesJob, task);
+}
+
+static TensorIndex_t Tensor_lastDim(TensorShape_t ndim, const TensorIndex_t *shape) {
+	return ndim > 0 ? shape[ndim - 1] : 1;
 }
 
 TensorObject Tensor_zeros(TensorShape_t ndim, const TensorIndex_t *shape) {
-	TensorObject t = Tensor_create(ndim, shape);
-	TensorShape_t total_size = 1;
-	for(TensorShape_t i=0; i<ndim; i++) total_size *= shape[i];
-	for(TensorShape_t i=0; i<total_size; i++) t->data[i] = 0;
-	return t;
+	// large zeroed buffers are fresh pages from the system, there is nothing to write.
+	return Tensor_new(ndim, shape);
 }
 
 TensorObject Tensor_zeros_like(TensorObject a) {
-	return Tensor_zeros(a->ndim, a->shape);
+	return Tensor_zeros(a.ndim, a.shape);
 }
 
 TensorObject Tensor_ones(TensorShape_t ndim, const TensorIndex_t *shape) {
-	TensorObject t = Tensor_create(ndim, shape);
-	TensorShape_t total_size = 1;
+	TensorObject t = Tensor_empty(ndim, shape, TENSOR_FLOAT64);
+	TensorIndex_t total_size = 1;
 	for(TensorShape_t i=0; i<ndim; i++) total_size *= shape[i];
-	for(TensorShape_t i=0; i<total_size; i++) t->data[i] = 1;
+	const TensorIndex_t cols = Tensor_lastDim(ndim, shape);
+	struct TensorFillTask task = {.data = t.data, .kind = TENSOR_FILL_VALUE, .value = 1, .cols = cols};
+	if(t.storage != NULL && total_size > 0) {
+		Tensor_fill(&task, total_size / cols);
+	}
 	return t;
 }
 
 TensorObject Tensor_ones_like(TensorObject a) {
-	return Tensor_ones(a->ndim, a->shape);
+	return Tensor_ones(a.ndim, a.shape);
 }
 
-TensorObject Tensor_eye(TensorShape_t size, TensorShape_t col_count, TensorShape_t batch_size) {
-	TensorShape_t shape[3] = {batch_size, size, col_count};
+TensorObject Tensor_eye(TensorIndex_t size, TensorIndex_t col_count, TensorIndex_t batch_size) {
+	TensorIndex_t shape[3] = {batch_size, size, col_count};
 	TensorObject t = Tensor_zeros(3, shape);
-	for(TensorShape_t i=0; i<batch_size; i++) {
-		for(TensorShape_t j=0; j<size; j++) t->data[i*size*col_count + j*col_count + j] = 1;
+	struct TensorFillTask task = {.data = t.data, .kind = TENSOR_FILL_EYE, .value = 1, .cols = col_count, .matrix_rows = size};
+	if(t.storage != NULL && col_count > 0) {
+		Tensor_fill(&task, batch_size * size);
 	}
 	return t;
 }
 
 TensorObject Tensor_eye_like(TensorObject a) {
-	if(a->ndim == 1) return Tensor_eye(a->shape[0], a->shape[0], 1);
-	if(a->ndim == 2) return Tensor_eye(a->shape[0], a->shape[1], 1);
-	return Tensor_eye(a->shape[1], a->shape[2], a->shape[0]);
+	if(a.ndim == 1) return Tensor_eye(a.shape[0], a.shape[0], 1);
+	if(a.ndim == 2) return Tensor_eye(a.shape[0], a.shape[1], 1);
+	return Tensor_eye(a.shape[1], a.shape[2], a.shape[0]);
 }
\ No newline at end of file
@@ -0,0 +1,176 @@
+#include "tensor.h"
+#include "tensor/dtype.h"
+#include <math.h>
+#include <string.h>
+
+// ---Element types---
+
+static const size_t dtypeSizes[TENSOR_DTYPE_COUNT] = {
+	[TENSOR_FLOAT64] = sizeof(double),
+	[TENSOR_FLOAT32] = sizeof(float),
+	[TENSOR_FLOAT16] = sizeof(TensorHalf_t),
+	[TENSOR_BFLOAT16] = sizeof(TensorBFloat16_t),
+	[TENSOR_INT32] = sizeof(int32_t),
+	[TENSOR_INT8] = sizeof(int8_t),
+};
+
+static const char *const dtypeNames[TENSOR_DTYPE_COUNT] = {
+	[TENSOR_FLOAT64] = "float64",
+	[TENSOR_FLOAT32] = "float32",
+	[TENSOR_FLOAT16] = "float16",
+	[TENSOR_BFLOAT16] = "bfloat16",
+	[TENSOR_INT32] = "int32",
+	[TENSOR_INT8] = "int8",
+};
+
+size_t Tensor_dtype_size(enum TensorDType dtype) {
+	return dtypeSizes[dtype];
+}
+
+const char* Tensor_dtype_name(enum TensorDType dtype) {
+	return dtypeNames[dtype];
+}
+
+// ---16 bit floats---
+// Both formats are a sign bit, exp_bits of biased exponent and mant_bits of mantissa, like the IEEE 754 types.
+
+// Rounds once, straight from the double, so values aren't rounded twice through float.
+static uint16_t Tensor_packFloat(TensorData_t value, int exp_bits, int mant_bits) {
+	const uint16_t sign = signbit(value) ? (uint16_t)(1u << (exp_bits + mant_bits)) : 0;
+	const uint16_t inf = (uint16_t)(((1u << exp_bits) - 1) << mant_bits);
+	const int bias = (1 << (exp_bits - 1)) - 1;
+	if(isnan(value)) {
+		return sign | inf | (uint16_t)(1u << (mant_bits - 1));
+	}
+	const TensorData_t a = fabs(value);
+	if(a < ldexp(1, 1 - bias)) {
+		// subnormal, rounding up to the smallest normal sets the exponent bit by itself.
+		return sign | (uint16_t)nearbyint(ldexp(a, mant_bits - 1 + bias));
+	}
+	if(isinf(a)) {
+		return sign | inf;
+	}
+	int e = ilogb(a);
+	TensorData_t m = nearbyint(ldexp(a, mant_bits - e));
+	if(m == ldexp(1, mant_bits + 1)) {
+		m /= 2;
+		e++;
+	}
+	if(e > bias) {
+		return sign | inf;
+	}
+	return sign | (uint16_t)((e + bias) << mant_bits) | (uint16_t)(m - (1u << mant_bits));
+}
+
+static TensorData_t Tensor_unpackFloat(uint16_t bits, int exp_bits, int mant_bits) {
+	const int bias = (1 << (exp_bits - 1)) - 1;
+	const unsigned e = (bits >> mant_bits) & ((1u << exp_bits) - 1);
+	const unsigned m = bits & ((1u << mant_bits) - 1);
+	TensorData_t value;
+	if(e == 0) {
+		value = ldexp(m, 1 - bias - mant_bits);
+	} else if(e == (1u << exp_bits) - 1) {
+		value = m != 0 ? NAN : INFINITY;
+	} else {
+		value = ldexp(m + (1u << mant_bits), (int)e - bias - mant_bits);
+	}
+	return bits >> (exp_bits + mant_bits) ? -value : value;
+}
+
+TensorHalf_t Tensor_to_half(TensorData_t value) {
+	return Tensor_packFloat(value, 5, 10);
+}
+
+TensorData_t Tensor_from_half(TensorHalf_t value) {
+	return Tensor_unpackFloat(value, 5, 10);
+}
+
+TensorBFloat16_t Tensor_to_bfloat16(TensorData_t value) {
+	return Tensor_packFloat(value, 8, 7);
+}
+
+TensorData_t Tensor_from_bfloat16(TensorBFloat16_t value) {
+	// the upper half of a float.
+	const uint32_t bits = (uint32_t)value << 16;
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+// ---Single elements---
+
+static TensorData_t Tensor_saturate(TensorData_t value, TensorData_t lo, TensorData_t hi) {
+	if(isnan(value)) {
+		return 0;
+	}
+	value = nearbyint(value);
+	return value < lo ? lo : value > hi ? hi : value;
+}
+
+TensorData_t Tensor_dtype_load(enum TensorDType dtype, const void *ptr) {
+	switch(dtype) {
+		case TENSOR_FLOAT64: return *(const double*)ptr;
+		case TENSOR_FLOAT32: return *(const float*)ptr;
+		case TENSOR_FLOAT16: return Tensor_from_half(*(const TensorHalf_t*)ptr);
+		case TENSOR_BFLOAT16: return Tensor_from_bfloat16(*(const TensorBFloat16_t*)ptr);
+		case TENSOR_INT32: return *(const int32_t*)ptr;
+		case TENSOR_INT8: return *(const int8_t*)ptr;
+	}
+	return 0;
+}
+
+void Tensor_dtype_store(enum TensorDType dtype, void *ptr, TensorData_t value) {
+	switch(dtype) {
+		case TENSOR_FLOAT64: *(double*)ptr = value; break;
+		case TENSOR_FLOAT32: *(float*)ptr = (float)value; break;
+		case TENSOR_FLOAT16: *(TensorHalf_t*)ptr = Tensor_to_half(value); break;
+		case TENSOR_BFLOAT16: *(TensorBFloat16_t*)ptr = Tensor_to_bfloat16(value); break;
+		case TENSOR_INT32: *(int32_t*)ptr = (int32_t)Tensor_saturate(value, INT32_MIN, INT32_MAX); break;
+		case TENSOR_INT8: *(int8_t*)ptr = (int8_t)Tensor_saturate(value, INT8_MIN, INT8_MAX); break;
+	}
+}
+
+// ---Runs---
+
+// Copies elements of the same dtype, only their size matters.
+static void Tensor_copyStrided(char *dst, TensorIndex_t dst_stride, const char *src, TensorIndex_t src_stride, TensorIndex_t n, size_t size) {
+	if(dst_stride == 1 && src_stride == 1) {
+		memmove(dst, src, n * size);
+		return;
+	}
+	dst_stride *= size;
+	src_stride *= size;
+	for(TensorIndex_t i = 0; i < n; i++) {
+		memcpy(dst + i * dst_stride, src + i * src_stride, size);
+	}
+}
+
+void Tensor_dtype_convert(void *dst, enum TensorDType dst_dtype, TensorIndex_t dst_stride,
+	const void *src, enum TensorDType src_dtype, TensorIndex_t src_stride, TensorIndex_t n) {
+	if(dst_dtype == src_dtype) {
+		Tensor_copyStrided(dst, dst_stride, src, src_stride, n, dtypeSizes[dst_dtype]);
+		return;
+	}
+	// the conversions between the two main float types get loops the compiler can vectorize.
+	if(dst_stride == 1 && src_stride == 1) {
+		if(dst_dtype == TENSOR_FLOAT32 && src_dtype == TENSOR_FLOAT64) {
+			float *d = dst;
+			const double *s = src;
+			for(TensorIndex_t i = 0; i < n; i++) d[i] = (float)s[i];
+			return;
+		}
+		if(dst_dtype == TENSOR_FLOAT64 && src_dtype == TENSOR_FLOAT32) {
+			double *d = dst;
+			const float *s = src;
+			for(TensorIndex_t i = 0; i < n; i++) d[i] = s[i];
+			return;
+		}
+	}
+	const size_t dst_step = dst_stride * dtypeSizes[dst_dtype];
+	const size_t src_step = src_stride * dtypeSizes[src_dtype];
+	char *d = dst;
+	const char *s = src;
+	for(TensorIndex_t i = 0; i < n; i++) {
+		Tensor_dtype_store(dst_dtype, d + i * dst_step, Tensor_dtype_load(src_dtype, s + i * src_step));
+	}
+}
@@ -0,0 +1,271 @@
+#include "tensor.h"
+#include "tensor/expr.h"
+#include "tensor/dtype.h"
+#include "tensor/parallel.h"
+#include "tensor_acc.h"
+#include <math.h>
+#include <stdlib.h>
+
+// ---Building---
+
+void Tensor_expr_init(TensorExpr *expr) {
+	expr->nnodes = 0;
+	expr->ninputs = 0;
+}
+
+static int TensorExpr_isNode(const TensorExpr *expr, const int node) {
+	return node >= 0 && (TensorShape_t)node < expr->nnodes;
+}
+
+static int TensorExpr_add(TensorExpr *expr, struct TensorExprNode node) {
+	if(expr->nnodes == TENSOR_EXPR_MAX_NODES) {
+		return -1;
+	}
+	expr->nodes[expr->nnodes] = node;
+	return (int)expr->nnodes++;
+}
+
+int Tensor_expr_input(TensorExpr *expr, TensorObject *tensor) {
+	if(expr->ninputs == TENSOR_EXPR_MAX_INPUTS) {
+		return -1;
+	}
+	const int node = TensorExpr_add(expr, (struct TensorExprNode){.kind = TENSOR_EXPR_INPUT, .args = {expr->ninputs}});
+	if(node >= 0) {
+		expr->inputs[expr->ninputs++] = tensor;
+	}
+	return node;
+}
+
+int Tensor_expr_scalar(TensorExpr *expr, const TensorData_t value) {
+	return TensorExpr_add(expr, (struct TensorExprNode){.kind = TENSOR_EXPR_SCALAR, .value = value});
+}
+
+int Tensor_expr_binary(TensorExpr *expr, enum TensorBinaryOp op, const int a, const int b) {
+	if(!TensorExpr_isNode(expr, a) || !TensorExpr_isNode(expr, b)) {
+		return -1;
+	}
+	return TensorExpr_add(expr, (struct TensorExprNode){.kind = TENSOR_EXPR_BINARY, .op = op, .args = {a, b}});
+}
+
+int Tensor_expr_fma(TensorExpr *expr, const int a, const int b, const int c) {
+	if(!TensorExpr_isNode(expr, a) || !TensorExpr_isNode(expr, b) || !TensorExpr_isNode(expr, c)) {
+		return -1;
+	}
+	return TensorExpr_add(expr, (struct TensorExprNode){.kind = TENSOR_EXPR_FMA, .args = {a, b, c}});
+}
+
+// ---Evaluation---
+
+struct TensorExprTask {
+	const TensorExpr *expr;
+	TensorShape_t root;
+	int needed[TENSOR_EXPR_MAX_NODES]; ///< 1 for the nodes root depends on.
+	TensorIter iter; ///< Operand 0 is the destination, or a view giving the shape of a reduction, input k is operand k + 1.
+	int reduce; ///< 1 to reduce root instead of storing it.
+	enum TensorReduceOp op;
+	TensorIndex_t grain; ///< Elements per job of a parallel reduction.
+	struct TensorReduceAcc *partials; ///< One accumulator per job of a reduction.
+};
+
+// Accumulates n values of root, the first of which is at linear index index.
+static void TensorExpr_accumulate(enum TensorReduceOp op, struct TensorReduceAcc *acc, const TensorData_t *x, TensorIndex_t n, TensorIndex_t index) {
+	if(op == TENSOR_REDUCE_SUM || op == TENSOR_REDUCE_MEAN) {
+		for(TensorIndex_t i = 0; i < n; i++) TensorReduce_addCompensated(acc, x[i]);
+		return;
+	}
+	for(TensorIndex_t i = 0; i < n; i++) TensorReduce_addOne(op, acc, x[i], index + i);
+}
+
+static void TensorExpr_binary(enum TensorBinaryOp op, TensorData_t *d, const TensorData_t *a, const TensorData_t *b, TensorIndex_t n) {
+	switch(op) {
+		case TENSOR_OP_ADD: for(TensorIndex_t i = 0; i < n; i++) d[i] = a[i] + b[i]; break;
+		case TENSOR_OP_SUB: for(TensorIndex_t i = 0; i < n; i++) d[i] = a[i] - b[i]; break;
+		case TENSOR_OP_MUL: for(TensorIndex_t i = 0; i < n; i++) d[i] = a[i] * b[i]; break;
+		case TENSOR_OP_DIV: for(TensorIndex_t i = 0; i < n; i++) d[i] = a[i] / b[i]; break;
+	}
+}
+
+// Computes the needed nodes for n elements from start of the current run, and returns the values of root.
+// A root computed by an operation is written to out when it isn't NULL.
+static const TensorData_t* TensorExpr_block(const struct TensorExprTask *task, const TensorIter *iter, TensorIndex_t start, TensorIndex_t n,
+	TensorData_t (*scratch)[TENSOR_EXPR_BLOCK], TensorData_t *out) {
+	const TensorData_t *values[TENSOR_EXPR_MAX_NODES];
+	for(TensorShape_t k = 0; k <= task->root; k++) {
+		if(!task->needed[k]) {
+			continue;
+		}
+		const struct TensorExprNode *node = &task->expr->nodes[k];
+		TensorData_t *result = k == task->root && out != NULL ? out : scratch[k];
+		switch(node->kind) {
+			case TENSOR_EXPR_INPUT: {
+				const TensorShape_t operand = node->args[0] + 1;
+				const TensorIndex_t stride = iter->inner_strides[operand];
+				const char *ptr = (const char*)iter->ptr[operand] + start * stride * iter->item_size[operand];
+				// dense float64 inputs are read in place.
+				if(iter->dtype[operand] == TENSOR_FLOAT64 && stride == 1 && result != out) {
+					values[k] = (const TensorData_t*)ptr;
+					continue;
+				}
+				Tensor_dtype_convert(result, TENSOR_FLOAT64, 1, ptr, iter->dtype[operand], stride, n);
+				break;
+			}
+			case TENSOR_EXPR_SCALAR:
+				// filled once per job.
+				if(result == out) {
+					for(TensorIndex_t i = 0; i < n; i++) result[i] = node->value;
+				}
+				break;
+			case TENSOR_EXPR_BINARY:
+				TensorExpr_binary(node->op, result, values[node->args[0]], values[node->args[1]], n);
+				break;
+			case TENSOR_EXPR_FMA: {
+				const TensorData_t *a = values[node->args[0]], *b = values[node->args[1]], *c = values[node->args[2]];
+				for(TensorIndex_t i = 0; i < n; i++) result[i] = fma(a[i], b[i], c[i]);
+				break;
+			}
+		}
+		values[k] = result;
+	}
+	return values[task->root];
+}
+
+static void TensorExpr_runIter(const struct TensorExprTask *task, TensorIter *iter, struct TensorReduceAcc *acc) {
+	TensorData_t scratch[TENSOR_EXPR_MAX_NODES][TENSOR_EXPR_BLOCK];
+	for(TensorShape_t k = 0; k <= task->root; k++) {
+		if(task->needed[k] && task->expr->nodes[k].kind == TENSOR_EXPR_SCALAR) {
+			for(TensorIndex_t i = 0; i < TENSOR_EXPR_BLOCK; i++) scratch[k][i] = task->expr->nodes[k].value;
+		}
+	}
+	while(TensorIter_next(iter)) {
+		const TensorIndex_t stride = iter->inner_strides[0];
+		const size_t item_size = iter->item_size[0];
+		for(TensorIndex_t start = 0; start < iter->count; start += TENSOR_EXPR_BLOCK) {
+			const TensorIndex_t n = iter->count - start < TENSOR_EXPR_BLOCK ? iter->count - start : TENSOR_EXPR_BLOCK;
+			if(task->reduce) {
+				TensorExpr_accumulate(task->op, acc, TensorExpr_block(task, iter, start, n, scratch, NULL), n, iter->pos + start);
+				continue;
+			}
+			char *dst = (char*)iter->ptr[0] + start * stride * item_size;
+			// dense float64 destinations get the root written straight to them.
+			TensorData_t *out = iter->dtype[0] == TENSOR_FLOAT64 && stride == 1 ? (TensorData_t*)dst : NULL;
+			const TensorData_t *values = TensorExpr_block(task, iter, start, n, scratch, out);
+			if(values != out) {
+				Tensor_dtype_convert(dst, iter->dtype[0], stride, values, TENSOR_FLOAT64, 1, n);
+			}
+		}
+	}
+}
+
+static void* TensorExpr_job(void *args) {
+	struct range_args *range = (struct range_args*)args;
+	const struct TensorExprTask *task = (const struct TensorExprTask*)range->args;
+	TensorIter iter = task->iter;
+	TensorIter_range(&iter, range->begin, range->end);
+	struct TensorReduceAcc *acc = task->reduce ? &task->partials[range->begin / task->grain] : NULL;
+	if(acc != NULL) {
+		TensorReduce_init(task->op, acc);
+	}
+	TensorExpr_runIter(task, &iter, acc);
+	return NULL;
+}
+
+// Walks the iterator of the task, on the thread pool when it is large. The accumulated result goes to acc.
+static int TensorExpr_run(struct TensorExprTask *task, struct TensorReduceAcc *acc) {
+	for(TensorShape_t k = task->root + 1; k-- > 0;) {
+		const struct TensorExprNode *node = &task->expr->nodes[k];
+		if(k == task->root || task->needed[k]) {
+			task->needed[k] = 1;
+			if(node->kind == TENSOR_EXPR_BINARY || node->kind == TENSOR_EXPR_FMA) {
+				task->needed[node->args[0]] = task->needed[node->args[1]] = 1;
+			}
+			if(node->kind == TENSOR_EXPR_FMA) {
+				task->needed[node->args[2]] = 1;
+			}
+		}
+	}
+	if(task->reduce) {
+		TensorReduce_init(task->op, acc);
+	}
+	if(task->iter.size < TENSOR_MATH_PARALLEL_THRESHOLD) {
+		TensorExpr_runIter(task, &task->iter, acc);
+		return 0;
+	}
+	// the same chunking as the elementwise operations.
+	TensorIndex_t grain = Tensor_loop_grain(task->iter.size, 0);
+	if(grain < TENSOR_MATH_PARALLEL_THRESHOLD / 4) {
+		grain = TENSOR_MATH_PARALLEL_THRESHOLD / 4;
+	}
+	task->grain = (grain + 7) & ~(TensorIndex_t)7;
+	const TensorIndex_t chunks = (task->iter.size + task->grain - 1) / task->grain;
+	if(task->reduce) {
+		task->partials = malloc(chunks * sizeof(struct TensorReduceAcc));
+		if(task->partials == NULL) {
+			return -1;
+		}
+	}
+	Tensor_parallel_for(task->iter.size, task->grain, TensorExpr_job, task);
+	if(task->reduce) {
+		// the same tree as the reductions, so the partials are combined like Tensor_reduce_all does.
+		TensorReduce_tree(task->op, task->partials, chunks, 1);
+		*acc = task->partials[0];
+		free(task->partials);
+	}
+	return 0;
+}
+
+static int TensorExpr_init(struct TensorExprTask *task, TensorExpr *expr, const int node, TensorObject *shape) {
+	if(!TensorExpr_isNode(expr, node)) {
+		return -1;
+	}
+	task->expr = expr;
+	task->root = (TensorShape_t)node;
+	TensorObject *operands[TENSOR_ITER_MAX_OPERANDS] = {shape};
+	for(TensorShape_t k = 0; k < expr->ninputs; k++) {
+		operands[k + 1] = expr->inputs[k];
+	}
+	return TensorIter_init(&task->iter, expr->ninputs + 1, operands);
+}
+
+int Tensor_expr_eval(TensorExpr *expr, const int node, TensorObject *dst) {
+	struct TensorExprTask task = {0};
+	if(Tensor_make_writable(dst) != 0 || TensorExpr_init(&task, expr, node, dst) != 0) {
+		return -1;
+	}
+	return TensorExpr_run(&task, NULL);
+}
+
+int Tensor_expr_reduce_all(TensorExpr *expr, enum TensorReduceOp op, const int node, TensorData_t *result) {
+	if(expr->ninputs == 0) {
+		return -1;
+	}
+	// the first input broadcast to the shape of all of them gives the shape to walk.
+	TensorObject shape = {0};
+	TensorShape_t ndim = expr->inputs[0]->ndim;
+	TensorIndex_t dims[TENSOR_MAX_NDIM];
+	for(TensorShape_t i = 0; i < ndim; i++) {
+		dims[i] = expr->inputs[0]->shape[i];
+	}
+	for(TensorShape_t k = 1; k < expr->ninputs; k++) {
+		TensorObject acc = {.ndim = ndim};
+		for(TensorShape_t i = 0; i < ndim; i++) {
+			acc.shape[i] = dims[i];
+		}
+		if(Tensor_broadcast_shape(&acc, expr->inputs[k], &ndim, dims) != 0) {
+			return -1;
+		}
+	}
+	if(Tensor_broadcast_to(expr->inputs[0], ndim, dims, &shape) != 0) {
+		return -1;
+	}
+	struct TensorExprTask task = {.reduce = 1, .op = op};
+	struct TensorReduceAcc acc;
+	int status = TensorExpr_init(&task, expr, node, &shape);
+	if(status == 0) {
+		status = TensorExpr_run(&task, &acc);
+	}
+	if(status == 0) {
+		*result = TensorReduce_result(op, &acc, task.iter.size);
+	}
+	Tensor_free(&shape);
+	return status;
+}
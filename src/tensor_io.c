@@ -0,0 +1,466 @@
+#include "tensor.h"
+#include "tensor/io.h"
+#include "tensor/alloc.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TENSOR_NPY_MAGIC "\x93NUMPY"
+#define TENSOR_NPY_MAGIC_BYTES 6
+// Longest header accepted, NumPy itself refuses more than 10000 bytes by default.
+#define TENSOR_NPY_MAX_HEADER 65536
+// Longest header written: the dictionary without the shape, 20 digits and ", " per dimension, and the padding.
+#define TENSOR_NPY_WRITE_HEADER (64 + 22 * TENSOR_MAX_NDIM + TENSOR_ALIGNMENT)
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define TENSOR_NPY_ORDER '>'
+#else
+#define TENSOR_NPY_ORDER '<'
+#endif
+
+// Type codes of the descr field without the byte order, indexed by dtype. bfloat16 has none.
+static const char *const npyTypes[TENSOR_DTYPE_COUNT] = {
+	[TENSOR_FLOAT64] = "f8",
+	[TENSOR_FLOAT32] = "f4",
+	[TENSOR_FLOAT16] = "f2",
+	[TENSOR_BFLOAT16] = NULL,
+	[TENSOR_INT32] = "i4",
+	[TENSOR_INT8] = "i1",
+};
+
+// What the header of a file describes.
+struct TensorNpy {
+	enum TensorDType dtype;
+	TensorShape_t ndim;
+	TensorIndex_t shape[TENSOR_MAX_NDIM];
+	int fortran_order;
+	size_t offset; ///< Position of the data in the file.
+	size_t bytes; ///< Size of the data.
+};
+
+// ---Save---
+
+// Writes the preamble and the header, padded with spaces so the data starts on TENSOR_ALIGNMENT.
+static int TensorNpy_writeHeader(FILE *file, const TensorObject *tensor) {
+	char header[TENSOR_NPY_WRITE_HEADER];
+	int length = snprintf(header, sizeof(header), "{'descr': '%c%s', 'fortran_order': False, 'shape': (",
+		Tensor_dtype_size(tensor->dtype) == 1 ? '|' : TENSOR_NPY_ORDER, npyTypes[tensor->dtype]);
+	for(TensorShape_t i = 0; i < tensor->ndim; i++) {
+		// a tuple of one element needs its trailing comma.
+		length += snprintf(header + length, sizeof(header) - length, i + 1 < tensor->ndim || i == 0 ? "%llu," : "%llu",
+			(unsigned long long)tensor->shape[i]);
+		if(i + 1 < tensor->ndim) {
+			header[length++] = ' ';
+		}
+	}
+	length += snprintf(header + length, sizeof(header) - length, "), }");
+	// the padding below needs room, and version 1.0 stores the length on 2 bytes.
+	if(length < 0 || (size_t)length + TENSOR_ALIGNMENT >= sizeof(header) || length + TENSOR_ALIGNMENT > 0xFFFF) {
+		return -1;
+	}
+	const size_t preamble = TENSOR_NPY_MAGIC_BYTES + 4;
+	while((preamble + length + 1) % TENSOR_ALIGNMENT != 0) {
+		header[length++] = ' ';
+	}
+	header[length++] = '\n';
+	const unsigned char version[4] = {1, 0, length & 0xFF, length >> 8};
+	if(fwrite(TENSOR_NPY_MAGIC, 1, TENSOR_NPY_MAGIC_BYTES, file) != TENSOR_NPY_MAGIC_BYTES || fwrite(version, 1, 4, file) != 4) {
+		return -1;
+	}
+	return fwrite(header, 1, length, file) == (size_t)length ? 0 : -1;
+}
+
+// Writes the elements in row-major order, whole runs at once when they are contiguous.
+static int TensorNpy_writeData(FILE *file, TensorObject *tensor) {
+	TensorIter iter;
+	if(TensorIter_init(&iter, 1, (TensorObject*[]){tensor}) != 0) {
+		return -1;
+	}
+	const size_t item_size = iter.item_size[0];
+	while(TensorIter_next(&iter)) {
+		const char *ptr = iter.ptr[0];
+		if(iter.inner_strides[0] == 1) {
+			if(fwrite(ptr, item_size, iter.count, file) != iter.count) {
+				return -1;
+			}
+			continue;
+		}
+		for(TensorIndex_t i = 0; i < iter.count; i++) {
+			if(fwrite(ptr + i * iter.inner_strides[0] * item_size, item_size, 1, file) != 1) {
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+int Tensor_save_npy(const char *path, TensorObject *tensor) {
+	if(npyTypes[tensor->dtype] == NULL) {
+		return -1;
+	}
+	FILE *file = fopen(path, "wb");
+	if(file == NULL) {
+		return -1;
+	}
+	int status = TensorNpy_writeHeader(file, tensor);
+	if(status == 0) {
+		status = TensorNpy_writeData(file, tensor);
+	}
+	if(fclose(file) != 0) {
+		status = -1;
+	}
+	return status;
+}
+
+// ---Load---
+
+// Reads exactly count bytes at offset.
+static int TensorNpy_readAt(int fd, void *buffer, size_t count, size_t offset) {
+	char *dst = buffer;
+	while(count > 0) {
+		const ssize_t n = pread(fd, dst, count, (off_t)offset);
+		if(n <= 0) {
+			return -1;
+		}
+		dst += n;
+		count -= (size_t)n;
+		offset += (size_t)n;
+	}
+	return 0;
+}
+
+// Writes exactly count bytes at offset.
+static int TensorNpy_writeAt(int fd, const void *buffer, size_t count, size_t offset) {
+	const char *src = buffer;
+	while(count > 0) {
+		const ssize_t n = pwrite(fd, src, count, (off_t)offset);
+		if(n <= 0) {
+			return -1;
+		}
+		src += n;
+		count -= (size_t)n;
+		offset += (size_t)n;
+	}
+	return 0;
+}
+
+// Value of a key of the header dictionary, after the colon and spaces. NULL if the key is missing.
+static const char* TensorNpy_value(const char *header, const char *key) {
+	const size_t key_length = strlen(key);
+	for(const char *p = header; (p = strpbrk(p, "'\"")) != NULL; p++) {
+		if(strncmp(p + 1, key, key_length) == 0 && p[key_length + 1] == p[0]) {
+			p += key_length + 2;
+			p += strspn(p, " ");
+			if(*p != ':') {
+				return NULL;
+			}
+			p++;
+			return p + strspn(p, " ");
+		}
+	}
+	return NULL;
+}
+
+static int TensorNpy_parseDescr(const char *value, enum TensorDType *dtype) {
+	if(value == NULL || (value[0] != '\'' && value[0] != '"')) {
+		return -1;
+	}
+	// only the byte order of the machine is mapped as is.
+	const char order = value[1];
+	if(order != TENSOR_NPY_ORDER && order != '=' && order != '|') {
+		return -1;
+	}
+	for(int t = 0; t < TENSOR_DTYPE_COUNT; t++) {
+		if(npyTypes[t] != NULL && strncmp(value + 2, npyTypes[t], 2) == 0 && value[4] == value[0]) {
+			*dtype = (enum TensorDType)t;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static int TensorNpy_parseShape(const char *value, struct TensorNpy *npy) {
+	if(value == NULL || *value != '(') {
+		return -1;
+	}
+	const char *p = value + 1;
+	npy->ndim = 0;
+	for(;;) {
+		p += strspn(p, " ");
+		if(*p == ')') {
+			return 0;
+		}
+		if(*p < '0' || *p > '9' || npy->ndim == TENSOR_MAX_NDIM) {
+			return -1;
+		}
+		char *end;
+		npy->shape[npy->ndim++] = strtoull(p, &end, 10);
+		p = end + strspn(end, " ");
+		if(*p == ',') {
+			p++;
+		} else if(*p != ')') {
+			return -1;
+		}
+	}
+}
+
+// Parses the preamble and the header, and checks the file holds all the data.
+static int TensorNpy_readHeader(int fd, struct TensorNpy *npy) {
+	unsigned char preamble[TENSOR_NPY_MAGIC_BYTES + 6];
+	if(TensorNpy_readAt(fd, preamble, TENSOR_NPY_MAGIC_BYTES + 4, 0) != 0 || memcmp(preamble, TENSOR_NPY_MAGIC, TENSOR_NPY_MAGIC_BYTES) != 0) {
+		return -1;
+	}
+	// version 1.0 has a 16 bit header length, 2.0 and 3.0 a 32 bit one.
+	size_t length = preamble[8] | (size_t)preamble[9] << 8;
+	size_t start = TENSOR_NPY_MAGIC_BYTES + 4;
+	if(preamble[6] == 2 || preamble[6] == 3) {
+		if(TensorNpy_readAt(fd, preamble + 10, 2, 10) != 0) {
+			return -1;
+		}
+		length |= (size_t)preamble[10] << 16 | (size_t)preamble[11] << 24;
+		start += 2;
+	} else if(preamble[6] != 1) {
+		return -1;
+	}
+	if(length > TENSOR_NPY_MAX_HEADER) {
+		return -1;
+	}
+	char *header = malloc(length + 1);
+	if(header == NULL) {
+		return -1;
+	}
+	int status = TensorNpy_readAt(fd, header, length, start);
+	header[status == 0 ? length : 0] = '\0';
+	const char *fortran_order = TensorNpy_value(header, "fortran_order");
+	if(status == 0) {
+		status = TensorNpy_parseDescr(TensorNpy_value(header, "descr"), &npy->dtype);
+	}
+	if(status == 0) {
+		status = TensorNpy_parseShape(TensorNpy_value(header, "shape"), npy);
+	}
+	if(status == 0 && fortran_order != NULL && strncmp(fortran_order, "True", 4) == 0) {
+		npy->fortran_order = 1;
+	} else if(status == 0 && (fortran_order == NULL || strncmp(fortran_order, "False", 5) != 0)) {
+		status = -1;
+	}
+	free(header);
+	if(status != 0) {
+		return -1;
+	}
+	npy->offset = start + length;
+	npy->bytes = Tensor_dtype_size(npy->dtype);
+	for(TensorShape_t i = 0; i < npy->ndim; i++) {
+		if(__builtin_mul_overflow(npy->bytes, npy->shape[i], &npy->bytes)) {
+			return -1;
+		}
+	}
+	struct stat info;
+	if(fstat(fd, &info) != 0 || (size_t)info.st_size < npy->offset || (size_t)info.st_size - npy->offset < npy->bytes) {
+		return -1;
+	}
+	return 0;
+}
+
+static TensorObject TensorNpy_tensor(const struct TensorNpy *npy, struct TensorStorage *storage) {
+	TensorObject tensor = {0};
+	tensor.ndim = npy->ndim;
+	tensor.dtype = npy->dtype;
+	TensorIndex_t stride = 1;
+	for(TensorShape_t k = 0; k < npy->ndim; k++) {
+		// Fortran order is column-major, the first axis is the contiguous one.
+		const TensorShape_t i = npy->fortran_order ? k : npy->ndim - 1 - k;
+		tensor.shape[i] = npy->shape[i];
+		tensor.strides[i] = stride;
+		stride *= npy->shape[i];
+	}
+	tensor.storage = storage;
+	tensor.data = storage->buffer;
+	return tensor;
+}
+
+static int TensorNpy_open(const char *path, TensorObject *tensor, int shared) {
+	const int fd = open(path, shared ? O_RDWR : O_RDONLY);
+	if(fd < 0) {
+		return -1;
+	}
+	struct TensorNpy npy = {0};
+	struct TensorStorage *storage = NULL;
+	if(TensorNpy_readHeader(fd, &npy) == 0) {
+		if(shared) {
+			// the data can't be moved, it only needs aligned elements.
+			if(npy.offset % Tensor_dtype_size(npy.dtype) == 0) {
+				storage = Tensor_map_storage(fd, npy.offset, npy.bytes, 1);
+			}
+		} else {
+			if(npy.offset % TENSOR_ALIGNMENT == 0) {
+				storage = Tensor_map_storage(fd, npy.offset, npy.bytes, 0);
+			}
+			if(storage == NULL) {
+				storage = Tensor_alloc_storage(npy.bytes, 0);
+				if(storage != NULL && TensorNpy_readAt(fd, storage->buffer, npy.bytes, npy.offset) != 0) {
+					Tensor_free_storage(storage);
+					storage = NULL;
+				}
+			}
+		}
+	}
+	// the mapping stays valid after closing the file.
+	close(fd);
+	if(storage == NULL) {
+		return -1;
+	}
+	*tensor = TensorNpy_tensor(&npy, storage);
+	return 0;
+}
+
+int Tensor_load_npy(const char *path, TensorObject *tensor) {
+	return TensorNpy_open(path, tensor, 0);
+}
+
+int Tensor_open_npy(const char *path, TensorObject *tensor) {
+	return TensorNpy_open(path, tensor, 1);
+}
+
+int Tensor_sync(TensorObject *tensor) {
+	if(tensor->storage == NULL) {
+		return 0;
+	}
+	return Tensor_sync_storage(atomic_load_explicit(&tensor->storage->source, memory_order_acquire));
+}
+
+// ---Streaming---
+
+#define TENSOR_STREAM_SLABS 3
+#define TENSOR_STREAM_NONE ((TensorIndex_t)-1)
+
+struct TensorStream {
+	int fd;
+	struct TensorNpy npy;
+	TensorIndex_t rows; ///< Rows of the file.
+	TensorIndex_t slab_rows; ///< Rows per slab.
+	size_t row_bytes;
+	TensorObject slabs[TENSOR_STREAM_SLABS]; ///< Slab i is held by slabs[i % TENSOR_STREAM_SLABS].
+};
+
+// One round of background work: write a slab back, then read another one.
+struct TensorStreamIO {
+	struct TensorStream *stream;
+	TensorIndex_t write;
+	TensorIndex_t read;
+	int status;
+};
+
+static TensorIndex_t TensorStream_end(const struct TensorStream *stream, TensorIndex_t slab) {
+	const TensorIndex_t end = (slab + 1) * stream->slab_rows;
+	return end < stream->rows ? end : stream->rows;
+}
+
+static int TensorStream_transfer(struct TensorStream *stream, TensorIndex_t slab, int write) {
+	TensorObject *tensor = &stream->slabs[slab % TENSOR_STREAM_SLABS];
+	const TensorIndex_t begin = slab * stream->slab_rows;
+	const size_t bytes = (TensorStream_end(stream, slab) - begin) * stream->row_bytes;
+	const size_t offset = stream->npy.offset + begin * stream->row_bytes;
+	if(write) {
+		return TensorNpy_writeAt(stream->fd, Tensor_data(tensor), bytes, offset);
+	}
+	// a lazy clone made by func may have moved the slab to a copy, read into whatever it writes to now.
+	if(Tensor_make_writable(tensor) != 0) {
+		return -1;
+	}
+	return TensorNpy_readAt(stream->fd, tensor->data, bytes, offset);
+}
+
+static void* TensorStream_io(void *args) {
+	struct TensorStreamIO *io = args;
+	io->status = 0;
+	if(io->write != TENSOR_STREAM_NONE) {
+		io->status = TensorStream_transfer(io->stream, io->write, 1);
+	}
+	if(io->status == 0 && io->read != TENSOR_STREAM_NONE) {
+		io->status = TensorStream_transfer(io->stream, io->read, 0);
+	}
+	return NULL;
+}
+
+static int TensorStream_run(struct TensorStream *stream, int writable, void* (*func)(void *args), void *args) {
+	const TensorIndex_t count = (stream->rows + stream->slab_rows - 1) / stream->slab_rows;
+	if(count == 0 || TensorStream_transfer(stream, 0, 0) != 0) {
+		return count == 0 ? 0 : -1;
+	}
+	for(TensorIndex_t slab = 0; slab < count; slab++) {
+		struct TensorStreamIO io = {
+			.stream = stream,
+			.write = writable && slab > 0 ? slab - 1 : TENSOR_STREAM_NONE,
+			.read = slab + 1 < count ? slab + 1 : TENSOR_STREAM_NONE,
+		};
+		pthread_t thread;
+		const int background = (io.write != TENSOR_STREAM_NONE || io.read != TENSOR_STREAM_NONE) && pthread_create(&thread, NULL, TensorStream_io, &io) == 0;
+		struct loop_range_args range = {
+			.obj = stream->slabs[slab % TENSOR_STREAM_SLABS],
+			.axis = 0,
+			.begin = slab * stream->slab_rows,
+			.end = TensorStream_end(stream, slab),
+			.args = args,
+		};
+		if(range.obj.ndim > 0) {
+			range.obj.shape[0] = range.end - range.begin;
+		}
+		func(&range);
+		// func may have refreshed the data of its copy of the slab.
+		stream->slabs[slab % TENSOR_STREAM_SLABS].data = range.obj.data;
+		if(background) {
+			pthread_join(thread, NULL);
+		} else {
+			TensorStream_io(&io);
+		}
+		if(io.status != 0) {
+			return -1;
+		}
+	}
+	return writable ? TensorStream_transfer(stream, count - 1, 1) : 0;
+}
+
+int Tensor_loop_over_npy(const char *path, TensorIndex_t rows, int writable, void* (*func)(void *args), void *args) {
+	struct TensorStream stream = {0};
+	stream.fd = open(path, writable ? O_RDWR : O_RDONLY);
+	if(stream.fd < 0) {
+		return -1;
+	}
+	// the rows of Fortran order files aren't contiguous.
+	if(TensorNpy_readHeader(stream.fd, &stream.npy) != 0 || stream.npy.fortran_order) {
+		close(stream.fd);
+		return -1;
+	}
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise(stream.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	// a file of rank 0 is a single row.
+	stream.rows = stream.npy.ndim > 0 ? stream.npy.shape[0] : 1;
+	stream.row_bytes = stream.rows > 0 ? stream.npy.bytes / stream.rows : 0;
+	if(rows == 0) {
+		rows = stream.row_bytes > 0 ? TENSOR_STREAM_SLAB_BYTES / stream.row_bytes : stream.rows;
+	}
+	stream.slab_rows = rows == 0 ? 1 : rows < stream.rows ? rows : stream.rows;
+	int status = 0;
+	if(stream.slab_rows > 0) {
+		TensorIndex_t shape[TENSOR_MAX_NDIM];
+		memcpy(shape, stream.npy.shape, sizeof(shape));
+		shape[0] = stream.slab_rows;
+		for(int i = 0; i < TENSOR_STREAM_SLABS; i++) {
+			stream.slabs[i] = Tensor_new_dtype(stream.npy.ndim, shape, stream.npy.dtype);
+			status |= stream.slabs[i].storage == NULL ? -1 : 0;
+		}
+		if(status == 0) {
+			status = TensorStream_run(&stream, writable, func, args);
+		}
+		for(int i = 0; i < TENSOR_STREAM_SLABS; i++) {
+			Tensor_free(&stream.slabs[i]);
+		}
+	}
+	close(stream.fd);
+	return status;
+}
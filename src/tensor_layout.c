@@ -0,0 +1,281 @@
+#include "tensor.h"
+#include "tensor/layout.h"
+#include "tensor/dtype.h"
+#include "tensor/math.h"
+#include "tensor/parallel.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#define TENSOR_X86 1
+#include <immintrin.h>
+#endif
+
+// ---Transpose kernels---
+// A kernel writes dst[r * dst_stride + c] = src[c * src_stride + r] for r < rows and c < cols, strides in elements.
+// src is contiguous along the rows and dst along the columns. Elements are only moved, so the kernels
+// only depend on the size of an element, and integer and floating point dtypes share them.
+
+typedef void (*TensorTransposeKernel)(void *dst, TensorIndex_t dst_stride, const void *src, TensorIndex_t src_stride, TensorIndex_t rows, TensorIndex_t cols);
+
+#define TENSOR_DEFINE_TRANSPOSE_C(bits) \
+	static void Tensor_transpose_c##bits(void *dst_, TensorIndex_t dst_stride, const void *src_, TensorIndex_t src_stride, TensorIndex_t rows, TensorIndex_t cols) { \
+		uint##bits##_t *dst = dst_; \
+		const uint##bits##_t *src = src_; \
+		for(TensorIndex_t r = 0; r < rows; r++) { \
+			for(TensorIndex_t c = 0; c < cols; c++) { \
+				dst[r * dst_stride + c] = src[c * src_stride + r]; \
+			} \
+		} \
+	}
+
+TENSOR_DEFINE_TRANSPOSE_C(8)
+TENSOR_DEFINE_TRANSPOSE_C(16)
+TENSOR_DEFINE_TRANSPOSE_C(32)
+TENSOR_DEFINE_TRANSPOSE_C(64)
+
+// Transposes the full width x width blocks of a tile in registers with block, and its edges with the C kernel.
+#define TENSOR_DEFINE_TRANSPOSE_SIMD(isa, attr, bits, width, block) \
+	attr static void Tensor_transpose_##isa##_##bits(void *dst_, TensorIndex_t dst_stride, const void *src_, TensorIndex_t src_stride, TensorIndex_t rows, TensorIndex_t cols) { \
+		uint##bits##_t *dst = dst_; \
+		const uint##bits##_t *src = src_; \
+		const TensorIndex_t full_rows = rows - rows % width, full_cols = cols - cols % width; \
+		for(TensorIndex_t r = 0; r < full_rows; r += width) { \
+			for(TensorIndex_t c = 0; c < full_cols; c += width) { \
+				block(dst + r * dst_stride + c, dst_stride, src + c * src_stride + r, src_stride); \
+			} \
+		} \
+		Tensor_transpose_c##bits(dst + full_cols, dst_stride, src + full_cols * src_stride, src_stride, rows, cols - full_cols); \
+		Tensor_transpose_c##bits(dst + full_rows * dst_stride, dst_stride, src + full_rows, src_stride, rows - full_rows, full_cols); \
+	}
+
+#ifdef TENSOR_X86
+static inline void Tensor_transposeBlock_sse2_64(uint64_t *dst, TensorIndex_t dst_stride, const uint64_t *src, TensorIndex_t src_stride) {
+	__m128d v0 = _mm_loadu_pd((const double*)src);
+	__m128d v1 = _mm_loadu_pd((const double*)(src + src_stride));
+	_mm_storeu_pd((double*)dst, _mm_unpacklo_pd(v0, v1));
+	_mm_storeu_pd((double*)(dst + dst_stride), _mm_unpackhi_pd(v0, v1));
+}
+
+static inline void Tensor_transposeBlock_sse2_32(uint32_t *dst, TensorIndex_t dst_stride, const uint32_t *src, TensorIndex_t src_stride) {
+	__m128 v0 = _mm_loadu_ps((const float*)src);
+	__m128 v1 = _mm_loadu_ps((const float*)(src + src_stride));
+	__m128 v2 = _mm_loadu_ps((const float*)(src + 2 * src_stride));
+	__m128 v3 = _mm_loadu_ps((const float*)(src + 3 * src_stride));
+	_MM_TRANSPOSE4_PS(v0, v1, v2, v3);
+	_mm_storeu_ps((float*)dst, v0);
+	_mm_storeu_ps((float*)(dst + dst_stride), v1);
+	_mm_storeu_ps((float*)(dst + 2 * dst_stride), v2);
+	_mm_storeu_ps((float*)(dst + 3 * dst_stride), v3);
+}
+
+__attribute__((target("avx2")))
+static inline void Tensor_transposeBlock_avx2_64(uint64_t *dst, TensorIndex_t dst_stride, const uint64_t *src, TensorIndex_t src_stride) {
+	__m256d v0 = _mm256_loadu_pd((const double*)src);
+	__m256d v1 = _mm256_loadu_pd((const double*)(src + src_stride));
+	__m256d v2 = _mm256_loadu_pd((const double*)(src + 2 * src_stride));
+	__m256d v3 = _mm256_loadu_pd((const double*)(src + 3 * src_stride));
+	// pairs within the 128 bit lanes, then the lanes across registers.
+	__m256d t0 = _mm256_unpacklo_pd(v0, v1), t1 = _mm256_unpackhi_pd(v0, v1);
+	__m256d t2 = _mm256_unpacklo_pd(v2, v3), t3 = _mm256_unpackhi_pd(v2, v3);
+	_mm256_storeu_pd((double*)dst, _mm256_permute2f128_pd(t0, t2, 0x20));
+	_mm256_storeu_pd((double*)(dst + dst_stride), _mm256_permute2f128_pd(t1, t3, 0x20));
+	_mm256_storeu_pd((double*)(dst + 2 * dst_stride), _mm256_permute2f128_pd(t0, t2, 0x31));
+	_mm256_storeu_pd((double*)(dst + 3 * dst_stride), _mm256_permute2f128_pd(t1, t3, 0x31));
+}
+
+__attribute__((target("avx2")))
+static inline void Tensor_transposeBlock_avx2_32(uint32_t *dst, TensorIndex_t dst_stride, const uint32_t *src, TensorIndex_t src_stride) {
+	__m256 v[8], t[8], u[8];
+	for(int k = 0; k < 8; k++) {
+		v[k] = _mm256_loadu_ps((const float*)(src + k * src_stride));
+	}
+	for(int k = 0; k < 8; k += 2) {
+		t[k] = _mm256_unpacklo_ps(v[k], v[k + 1]);
+		t[k + 1] = _mm256_unpackhi_ps(v[k], v[k + 1]);
+	}
+	for(int k = 0; k < 8; k += 4) {
+		u[k] = _mm256_shuffle_ps(t[k], t[k + 2], _MM_SHUFFLE(1, 0, 1, 0));
+		u[k + 1] = _mm256_shuffle_ps(t[k], t[k + 2], _MM_SHUFFLE(3, 2, 3, 2));
+		u[k + 2] = _mm256_shuffle_ps(t[k + 1], t[k + 3], _MM_SHUFFLE(1, 0, 1, 0));
+		u[k + 3] = _mm256_shuffle_ps(t[k + 1], t[k + 3], _MM_SHUFFLE(3, 2, 3, 2));
+	}
+	for(int k = 0; k < 4; k++) {
+		_mm256_storeu_ps((float*)(dst + k * dst_stride), _mm256_permute2f128_ps(u[k], u[k + 4], 0x20));
+		_mm256_storeu_ps((float*)(dst + (k + 4) * dst_stride), _mm256_permute2f128_ps(u[k], u[k + 4], 0x31));
+	}
+}
+
+TENSOR_DEFINE_TRANSPOSE_SIMD(sse2, , 64, 2, Tensor_transposeBlock_sse2_64)
+TENSOR_DEFINE_TRANSPOSE_SIMD(sse2, , 32, 4, Tensor_transposeBlock_sse2_32)
+TENSOR_DEFINE_TRANSPOSE_SIMD(avx2, __attribute__((target("avx2"))), 64, 4, Tensor_transposeBlock_avx2_64)
+TENSOR_DEFINE_TRANSPOSE_SIMD(avx2, __attribute__((target("avx2"))), 32, 8, Tensor_transposeBlock_avx2_32)
+#endif
+
+// The best kernel for elements of item_size bytes. AVX-512 has no wider shuffles worth it here, it uses AVX2.
+static TensorTransposeKernel Tensor_transposeKernel(size_t item_size) {
+	const enum TensorSimd level = Tensor_simd_level();
+	(void)level;
+	switch(item_size) {
+		case 1:
+			return Tensor_transpose_c8;
+		case 2:
+			return Tensor_transpose_c16;
+		case 4:
+			#ifdef TENSOR_X86
+				if(level >= TENSOR_SIMD_AVX2) return Tensor_transpose_avx2_32;
+				if(level >= TENSOR_SIMD_SSE2) return Tensor_transpose_sse2_32;
+			#endif
+			return Tensor_transpose_c32;
+		default:
+			#ifdef TENSOR_X86
+				if(level >= TENSOR_SIMD_AVX2) return Tensor_transpose_avx2_64;
+				if(level >= TENSOR_SIMD_SSE2) return Tensor_transpose_sse2_64;
+			#endif
+			return Tensor_transpose_c64;
+	}
+}
+
+// ---Copies---
+
+/**
+ * A copy of src into the contiguous dst, walked by an iterator over both.
+ * When src is contiguous along an outer dimension of the iterator, the copy is a batch of
+ * rows x cols transposes: rows is that dimension, cols the inner run of dst,
+ * and every other outer dimension is a batch.
+*/
+struct TensorLayoutTask {
+	TensorIter iter;
+	TensorTransposeKernel kernel;
+	TensorIndex_t rows;
+	TensorIndex_t cols;
+	TensorIndex_t row_tiles;
+	TensorIndex_t col_tiles;
+	TensorIndex_t dst_row_stride;
+	TensorIndex_t src_col_stride;
+	TensorShape_t nbatch;
+	TensorIndex_t batch_shape[TENSOR_ITER_MAX_NDIM];
+	TensorIndex_t batch_strides[2][TENSOR_ITER_MAX_NDIM];
+};
+
+static void* TensorLayout_transposeTiles(void *args) {
+	struct range_args *range = (struct range_args*)args;
+	const struct TensorLayoutTask *task = (const struct TensorLayoutTask*)range->args;
+	const size_t item_size = task->iter.item_size[0];
+	for(TensorIndex_t t = range->begin; t < range->end; t++) {
+		// consecutive tiles go along a row of dst, which is written sequentially.
+		const TensorIndex_t c = t % task->col_tiles * TENSOR_TRANSPOSE_TILE;
+		const TensorIndex_t r = t / task->col_tiles % task->row_tiles * TENSOR_TRANSPOSE_TILE;
+		TensorIndex_t batch = t / task->col_tiles / task->row_tiles;
+		TensorIndex_t dst_offset = r * task->dst_row_stride + c;
+		TensorIndex_t src_offset = c * task->src_col_stride + r;
+		for(TensorShape_t j = 0; j < task->nbatch; j++) {
+			const TensorIndex_t idx = batch % task->batch_shape[j];
+			batch /= task->batch_shape[j];
+			dst_offset += idx * task->batch_strides[0][j];
+			src_offset += idx * task->batch_strides[1][j];
+		}
+		const TensorIndex_t rows = task->rows - r < TENSOR_TRANSPOSE_TILE ? task->rows - r : TENSOR_TRANSPOSE_TILE;
+		const TensorIndex_t cols = task->cols - c < TENSOR_TRANSPOSE_TILE ? task->cols - c : TENSOR_TRANSPOSE_TILE;
+		task->kernel((char*)task->iter.base[0] + dst_offset * item_size, task->dst_row_stride,
+			(const char*)task->iter.base[1] + src_offset * item_size, task->src_col_stride, rows, cols);
+	}
+	return NULL;
+}
+
+static void* TensorLayout_copyRange(void *args) {
+	struct range_args *range = (struct range_args*)args;
+	const struct TensorLayoutTask *task = (const struct TensorLayoutTask*)range->args;
+	TensorIter iter = task->iter;
+	TensorIter_range(&iter, range->begin, range->end);
+	while(TensorIter_next(&iter)) {
+		Tensor_dtype_convert(iter.ptr[0], iter.dtype[0], iter.inner_strides[0],
+			iter.ptr[1], iter.dtype[1], iter.inner_strides[1], iter.count);
+	}
+	return NULL;
+}
+
+// Runs func over count units of work, on the calling thread when the copy is small.
+static void TensorLayout_run(struct TensorLayoutTask *task, TensorIndex_t count, void* (*func)(void *args)) {
+	if(task->iter.size < TENSOR_MATH_PARALLEL_THRESHOLD) {
+		struct range_args range = {.begin = 0, .end = count, .args = task};
+		func(&range);
+		return;
+	}
+	Tensor_parallel_for(count, 0, func, task);
+}
+
+// Copies tensor into a new contiguous tensor of the same shape and dtype.
+static TensorObject Tensor_layoutCopy(TensorObject tensor) {
+	TensorObject copy = Tensor_empty(tensor.ndim, tensor.shape, tensor.dtype);
+	if(copy.storage == NULL) {
+		return copy;
+	}
+	struct TensorLayoutTask task;
+	TensorIter_init(&task.iter, 2, (TensorObject*[]){&copy, &tensor});
+	TensorShape_t rows_dim = task.iter.ndim;
+	if(task.iter.inner_strides[1] != 1) {
+		for(TensorShape_t j = 0; j < task.iter.ndim && rows_dim == task.iter.ndim; j++) {
+			if(task.iter.strides[1][j] == 1) {
+				rows_dim = j;
+			}
+		}
+	}
+	if(rows_dim == task.iter.ndim) {
+		// src is contiguous along the inner run, or nowhere: copy run by run.
+		TensorLayout_run(&task, task.iter.size, TensorLayout_copyRange);
+		return copy;
+	}
+	task.kernel = Tensor_transposeKernel(task.iter.item_size[0]);
+	task.rows = task.iter.shape[rows_dim];
+	task.cols = task.iter.inner_size;
+	task.row_tiles = (task.rows + TENSOR_TRANSPOSE_TILE - 1) / TENSOR_TRANSPOSE_TILE;
+	task.col_tiles = (task.cols + TENSOR_TRANSPOSE_TILE - 1) / TENSOR_TRANSPOSE_TILE;
+	task.dst_row_stride = task.iter.strides[0][rows_dim];
+	task.src_col_stride = task.iter.inner_strides[1];
+	task.nbatch = 0;
+	TensorIndex_t tiles = task.row_tiles * task.col_tiles;
+	for(TensorShape_t j = 0; j < task.iter.ndim; j++) {
+		if(j == rows_dim) {
+			continue;
+		}
+		task.batch_shape[task.nbatch] = task.iter.shape[j];
+		task.batch_strides[0][task.nbatch] = task.iter.strides[0][j];
+		task.batch_strides[1][task.nbatch] = task.iter.strides[1][j];
+		tiles *= task.iter.shape[j];
+		task.nbatch++;
+	}
+	TensorLayout_run(&task, tiles, TensorLayout_transposeTiles);
+	return copy;
+}
+
+int Tensor_is_contiguous(const TensorObject *tensor) {
+	TensorIndex_t stride = 1;
+	for(int i = (int)tensor->ndim - 1; i >= 0; i--) {
+		if(tensor->shape[i] == 0) {
+			return 1;
+		}
+		if(tensor->shape[i] != 1 && tensor->strides[i] != stride) {
+			return 0;
+		}
+		stride *= tensor->shape[i];
+	}
+	return 1;
+}
+
+TensorObject Tensor_contiguous(TensorObject tensor) {
+	if(tensor.storage != NULL && !Tensor_is_contiguous(&tensor)) {
+		return Tensor_layoutCopy(tensor);
+	}
+	if(tensor.storage != NULL) {
+		atomic_fetch_add_explicit(&tensor.storage->ref_count, 1, memory_order_relaxed);
+	}
+	tensor.data = Tensor_data(&tensor);
+	return tensor;
+}
+
+TensorObject Tensor_transpose_copy(TensorObject tensor, const TensorShape_t axis1, const TensorShape_t axis2) {
+	if(Tensor_swapaxis(&tensor, axis1, axis2) != 0) {
+		return (TensorObject){0};
+	}
+	return Tensor_layoutCopy(tensor);
+}
@@ -0,0 +1,357 @@
+#include "tensor.h"
+#include "tensor/linalg.h"
+#include "tensor/math.h"
+#include "tensor/parallel.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#define TENSOR_X86 1
+#include <immintrin.h>
+#endif
+
+// ---Micro-kernels---
+// A micro-kernel multiplies a packed MR x k panel of A by a packed k x NR panel of B
+// and stores the MR x NR product, row-major, in tile.
+// The packed panels of B and the tile are aligned to TENSOR_ALIGNMENT, every row of them to its vector width.
+
+#define TENSOR_MATMUL_MAX_MR 8
+#define TENSOR_MATMUL_MAX_NR 16
+
+typedef void (*TensorGemmKernel)(size_t k, const TensorData_t *a, const TensorData_t *b, TensorData_t *tile);
+
+static void Tensor_gemm_c(size_t k, const TensorData_t *a, const TensorData_t *b, TensorData_t *tile) {
+	TensorData_t acc[4][4] = {{0}};
+	for(size_t p = 0; p < k; p++) {
+		for(int i = 0; i < 4; i++) {
+			for(int j = 0; j < 4; j++) {
+				acc[i][j] += a[i] * b[j];
+			}
+		}
+		a += 4;
+		b += 4;
+	}
+	memcpy(tile, acc, sizeof(acc));
+}
+
+#ifdef TENSOR_X86
+static void Tensor_gemm_sse2(size_t k, const TensorData_t *a, const TensorData_t *b, TensorData_t *tile) {
+	__m128d c00 = _mm_setzero_pd(), c01 = _mm_setzero_pd();
+	__m128d c10 = _mm_setzero_pd(), c11 = _mm_setzero_pd();
+	__m128d c20 = _mm_setzero_pd(), c21 = _mm_setzero_pd();
+	__m128d c30 = _mm_setzero_pd(), c31 = _mm_setzero_pd();
+	for(size_t p = 0; p < k; p++) {
+		__m128d b0 = _mm_load_pd(b), b1 = _mm_load_pd(b + 2);
+		__m128d a0 = _mm_set1_pd(a[0]), a1 = _mm_set1_pd(a[1]), a2 = _mm_set1_pd(a[2]), a3 = _mm_set1_pd(a[3]);
+		c00 = _mm_add_pd(c00, _mm_mul_pd(a0, b0)); c01 = _mm_add_pd(c01, _mm_mul_pd(a0, b1));
+		c10 = _mm_add_pd(c10, _mm_mul_pd(a1, b0)); c11 = _mm_add_pd(c11, _mm_mul_pd(a1, b1));
+		c20 = _mm_add_pd(c20, _mm_mul_pd(a2, b0)); c21 = _mm_add_pd(c21, _mm_mul_pd(a2, b1));
+		c30 = _mm_add_pd(c30, _mm_mul_pd(a3, b0)); c31 = _mm_add_pd(c31, _mm_mul_pd(a3, b1));
+		a += 4;
+		b += 4;
+	}
+	_mm_store_pd(tile + 0, c00); _mm_store_pd(tile + 2, c01);
+	_mm_store_pd(tile + 4, c10); _mm_store_pd(tile + 6, c11);
+	_mm_store_pd(tile + 8, c20); _mm_store_pd(tile + 10, c21);
+	_mm_store_pd(tile + 12, c30); _mm_store_pd(tile + 14, c31);
+}
+
+__attribute__((target("avx2,fma")))
+static void Tensor_gemm_avx2(size_t k, const TensorData_t *a, const TensorData_t *b, TensorData_t *tile) {
+	__m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd();
+	__m256d c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+	__m256d c20 = _mm256_setzero_pd(), c21 = _mm256_setzero_pd();
+	__m256d c30 = _mm256_setzero_pd(), c31 = _mm256_setzero_pd();
+	for(size_t p = 0; p < k; p++) {
+		__m256d b0 = _mm256_load_pd(b), b1 = _mm256_load_pd(b + 4);
+		__m256d ai = _mm256_broadcast_sd(a + 0);
+		c00 = _mm256_fmadd_pd(ai, b0, c00); c01 = _mm256_fmadd_pd(ai, b1, c01);
+		ai = _mm256_broadcast_sd(a + 1);
+		c10 = _mm256_fmadd_pd(ai, b0, c10); c11 = _mm256_fmadd_pd(ai, b1, c11);
+		ai = _mm256_broadcast_sd(a + 2);
+		c20 = _mm256_fmadd_pd(ai, b0, c20); c21 = _mm256_fmadd_pd(ai, b1, c21);
+		ai = _mm256_broadcast_sd(a + 3);
+		c30 = _mm256_fmadd_pd(ai, b0, c30); c31 = _mm256_fmadd_pd(ai, b1, c31);
+		a += 4;
+		b += 8;
+	}
+	_mm256_store_pd(tile + 0, c00); _mm256_store_pd(tile + 4, c01);
+	_mm256_store_pd(tile + 8, c10); _mm256_store_pd(tile + 12, c11);
+	_mm256_store_pd(tile + 16, c20); _mm256_store_pd(tile + 20, c21);
+	_mm256_store_pd(tile + 24, c30); _mm256_store_pd(tile + 28, c31);
+}
+
+__attribute__((target("avx512f")))
+static void Tensor_gemm_avx512(size_t k, const TensorData_t *a, const TensorData_t *b, TensorData_t *tile) {
+	__m512d c0 = _mm512_setzero_pd(), c1 = _mm512_setzero_pd(), c2 = _mm512_setzero_pd(), c3 = _mm512_setzero_pd();
+	__m512d c4 = _mm512_setzero_pd(), c5 = _mm512_setzero_pd(), c6 = _mm512_setzero_pd(), c7 = _mm512_setzero_pd();
+	for(size_t p = 0; p < k; p++) {
+		__m512d b0 = _mm512_load_pd(b);
+		c0 = _mm512_fmadd_pd(_mm512_set1_pd(a[0]), b0, c0);
+		c1 = _mm512_fmadd_pd(_mm512_set1_pd(a[1]), b0, c1);
+		c2 = _mm512_fmadd_pd(_mm512_set1_pd(a[2]), b0, c2);
+		c3 = _mm512_fmadd_pd(_mm512_set1_pd(a[3]), b0, c3);
+		c4 = _mm512_fmadd_pd(_mm512_set1_pd(a[4]), b0, c4);
+		c5 = _mm512_fmadd_pd(_mm512_set1_pd(a[5]), b0, c5);
+		c6 = _mm512_fmadd_pd(_mm512_set1_pd(a[6]), b0, c6);
+		c7 = _mm512_fmadd_pd(_mm512_set1_pd(a[7]), b0, c7);
+		a += 8;
+		b += 8;
+	}
+	_mm512_store_pd(tile + 0, c0); _mm512_store_pd(tile + 8, c1);
+	_mm512_store_pd(tile + 16, c2); _mm512_store_pd(tile + 24, c3);
+	_mm512_store_pd(tile + 32, c4); _mm512_store_pd(tile + 40, c5);
+	_mm512_store_pd(tile + 48, c6); _mm512_store_pd(tile + 56, c7);
+}
+#endif
+
+static const struct TensorGemmKernelInfo {
+	TensorGemmKernel kernel;
+	size_t mr;
+	size_t nr;
+} gemmKernels[] = {
+	[TENSOR_SIMD_SCALAR] = {Tensor_gemm_c, 4, 4},
+#ifdef TENSOR_X86
+	[TENSOR_SIMD_SSE2] = {Tensor_gemm_sse2, 4, 4},
+	[TENSOR_SIMD_AVX2] = {Tensor_gemm_avx2, 4, 8},
+	[TENSOR_SIMD_AVX512] = {Tensor_gemm_avx512, 8, 8},
+#endif
+};
+
+// ---Packing---
+
+// A strided matrix view, elements are at data[i * rs + j * cs].
+struct TensorMatrix {
+	TensorData_t *data;
+	TensorIndex_t rs;
+	TensorIndex_t cs;
+};
+
+// Packs rows [i0, i0 + mc) and columns [p0, p0 + kc) of A into row panels of mr rows,
+// each stored column by column. Rows past the end of A are zero.
+static void Tensor_packA(const struct TensorMatrix *a, size_t m, size_t i0, size_t mc, size_t p0, size_t kc, size_t mr, TensorData_t *packed) {
+	for(size_t ir = 0; ir < mc; ir += mr) {
+		for(size_t p = 0; p < kc; p++) {
+			const TensorData_t *col = a->data + (p0 + p) * a->cs;
+			for(size_t i = 0; i < mr; i++) {
+				size_t row = i0 + ir + i;
+				*packed++ = row < m ? col[row * a->rs] : 0;
+			}
+		}
+	}
+}
+
+// Packs rows [p0, p0 + kc) and columns [j0, j0 + nc) of B into column panels of nr columns,
+// each stored row by row. Columns past the end of B are zero.
+static void Tensor_packB(const struct TensorMatrix *b, size_t n, size_t j0, size_t nc, size_t p0, size_t kc, size_t nr, TensorData_t *packed) {
+	for(size_t jr = 0; jr < nc; jr += nr) {
+		for(size_t p = 0; p < kc; p++) {
+			const TensorData_t *row = b->data + (p0 + p) * b->rs;
+			for(size_t j = 0; j < nr; j++) {
+				size_t col = j0 + jr + j;
+				*packed++ = col < n ? row[col * b->cs] : 0;
+			}
+		}
+	}
+}
+
+// ---Driver---
+
+struct TensorMatmulTask {
+	struct TensorMatrix a, b, c;
+	TensorData_t *a_base, *b_base, *c_base;
+	TensorIndex_t a_batch_stride, b_batch_stride, c_batch_stride;
+	size_t m, n, k;
+	size_t m_tiles, n_tiles;
+	struct TensorGemmKernelInfo kernel;
+	atomic_int failed; ///< Set by a job that couldn't allocate its packing buffers.
+};
+
+// Multiplies a packed mc x kc block of A by a packed kc x nc panel of B, into dst at row i0 and column j0.
+// The first panel of the depth stores its product, the following ones add to it.
+static void Tensor_matmulBlock(const struct TensorMatmulTask *task, const struct TensorMatrix *c, size_t i0, size_t mc, size_t j0, size_t nc, size_t kc, int first, const TensorData_t *packed_a, const TensorData_t *packed_b) {
+	const size_t mr = task->kernel.mr, nr = task->kernel.nr;
+	_Alignas(TENSOR_ALIGNMENT) TensorData_t tile[TENSOR_MATMUL_MAX_MR * TENSOR_MATMUL_MAX_NR];
+	for(size_t jr = 0; jr < nc; jr += nr) {
+		for(size_t ir = 0; ir < mc; ir += mr) {
+			task->kernel.kernel(kc, packed_a + ir * kc, packed_b + jr * kc, tile);
+			const size_t rows = mc - ir < mr ? mc - ir : mr;
+			const size_t cols = nc - jr < nr ? nc - jr : nr;
+			TensorData_t *out = c->data + (i0 + ir) * c->rs + (j0 + jr) * c->cs;
+			for(size_t i = 0; i < rows; i++) {
+				for(size_t j = 0; j < cols; j++) {
+					if(first) {
+						out[i * c->rs + j * c->cs] = tile[i * nr + j];
+					} else {
+						out[i * c->rs + j * c->cs] += tile[i * nr + j];
+					}
+				}
+			}
+		}
+	}
+}
+
+// Computes the row tiles [i_begin, i_end) of the column tile at j0 of one batch of dst.
+// Every panel of B is packed once and used for all of these row tiles.
+static void Tensor_matmulColumn(const struct TensorMatmulTask *task, size_t batch, size_t j0, size_t i_begin, size_t i_end, TensorData_t *packed_a, TensorData_t *packed_b) {
+	const size_t mr = task->kernel.mr, nr = task->kernel.nr;
+	struct TensorMatrix a = task->a, b = task->b, c = task->c;
+	a.data = task->a_base + batch * task->a_batch_stride;
+	b.data = task->b_base + batch * task->b_batch_stride;
+	c.data = task->c_base + batch * task->c_batch_stride;
+	const size_t nc = task->n - j0 < TENSOR_MATMUL_NC ? task->n - j0 : TENSOR_MATMUL_NC;
+	// panels are padded to whole micro-tiles.
+	const size_t nc_padded = (nc + nr - 1) / nr * nr;
+	for(size_t p0 = 0; p0 < task->k; p0 += TENSOR_MATMUL_KC) {
+		const size_t kc = task->k - p0 < TENSOR_MATMUL_KC ? task->k - p0 : TENSOR_MATMUL_KC;
+		Tensor_packB(&b, task->n, j0, nc_padded, p0, kc, nr, packed_b);
+		for(size_t it = i_begin; it < i_end; it++) {
+			const size_t i0 = it * TENSOR_MATMUL_MC;
+			const size_t mc = task->m - i0 < TENSOR_MATMUL_MC ? task->m - i0 : TENSOR_MATMUL_MC;
+			const size_t mc_padded = (mc + mr - 1) / mr * mr;
+			Tensor_packA(&a, task->m, i0, mc_padded, p0, kc, mr, packed_a);
+			Tensor_matmulBlock(task, &c, i0, mc, j0, nc, kc, p0 == 0, packed_a, packed_b);
+		}
+	}
+}
+
+// ---Packing scratch---
+// Every thread keeps the buffer its packed panels live in between jobs and calls,
+// it only grows when a deeper panel is needed and is freed when the thread exits.
+
+struct TensorMatmulScratch {
+	size_t size;
+	TensorData_t *data;
+};
+
+static pthread_key_t scratchKey;
+static pthread_once_t scratchOnce = PTHREAD_ONCE_INIT;
+
+static void Tensor_matmulScratchFree(void *scratch) {
+	free(((struct TensorMatmulScratch*)scratch)->data);
+	free(scratch);
+}
+
+static void Tensor_matmulScratchKey(void) {
+	pthread_key_create(&scratchKey, Tensor_matmulScratchFree);
+}
+
+// Gets at least size elements of scratch of the calling thread, aligned to TENSOR_ALIGNMENT. NULL if it can't grow.
+static TensorData_t* Tensor_matmulScratch(size_t size) {
+	pthread_once(&scratchOnce, Tensor_matmulScratchKey);
+	struct TensorMatmulScratch *scratch = pthread_getspecific(scratchKey);
+	if(scratch == NULL) {
+		scratch = calloc(1, sizeof(struct TensorMatmulScratch));
+		if(scratch == NULL || pthread_setspecific(scratchKey, scratch) != 0) {
+			free(scratch);
+			return NULL;
+		}
+	}
+	if(scratch->size < size) {
+		// aligned_alloc requires a multiple of the alignment.
+		size_t bytes = (size * sizeof(TensorData_t) + TENSOR_ALIGNMENT - 1) / TENSOR_ALIGNMENT * TENSOR_ALIGNMENT;
+		TensorData_t *data = aligned_alloc(TENSOR_ALIGNMENT, bytes);
+		if(data == NULL) {
+			return NULL;
+		}
+		free(scratch->data);
+		scratch->data = data;
+		scratch->size = size;
+	}
+	return scratch->data;
+}
+
+static void* Tensor_matmulJob(void *args) {
+	struct range_args *range = (struct range_args*)args;
+	struct TensorMatmulTask *task = (struct TensorMatmulTask*)range->args;
+	const size_t kc = task->k < TENSOR_MATMUL_KC ? task->k : TENSOR_MATMUL_KC;
+	// the block of A comes first, its size keeps the panel of B after it aligned.
+	TensorData_t *packed_a = Tensor_matmulScratch((TENSOR_MATMUL_MC + TENSOR_MATMUL_NC) * kc);
+	if(packed_a == NULL) {
+		atomic_store(&task->failed, 1);
+	} else {
+		TensorData_t *packed_b = packed_a + TENSOR_MATMUL_MC * kc;
+		// row tiles are the fastest changing index of a tile, so the range is cut into runs of row tiles
+		// sharing a column of B.
+		for(TensorIndex_t t = range->begin; t < range->end;) {
+			const size_t column = t / task->m_tiles;
+			const size_t i_begin = t % task->m_tiles;
+			const size_t i_end = range->end - t < task->m_tiles - i_begin ? i_begin + (range->end - t) : task->m_tiles;
+			Tensor_matmulColumn(task, column / task->n_tiles, column % task->n_tiles * TENSOR_MATMUL_NC, i_begin, i_end, packed_a, packed_b);
+			t += i_end - i_begin;
+		}
+	}
+	return NULL;
+}
+
+int Tensor_matmul(TensorObject *a, TensorObject *b, TensorObject *dst) {
+	const TensorShape_t ndim = a->ndim;
+	if((ndim != 2 && ndim != 3) || b->ndim != ndim || dst->ndim != ndim) {
+		return -1;
+	}
+	// batch dimension, if any, comes first.
+	const TensorShape_t r = ndim - 2, cl = ndim - 1;
+	if(a->shape[cl] != b->shape[r] || dst->shape[r] != a->shape[r] || dst->shape[cl] != b->shape[cl]) {
+		return -1;
+	}
+	if(ndim == 3 && (a->shape[0] != b->shape[0] || dst->shape[0] != a->shape[0])) {
+		return -1;
+	}
+	if(Tensor_make_writable(dst) != 0 || Tensor_data(dst) == Tensor_data(a) || Tensor_data(dst) == Tensor_data(b)) {
+		return -1;
+	}
+	if(a->dtype != TENSOR_FLOAT64 || b->dtype != TENSOR_FLOAT64 || dst->dtype != TENSOR_FLOAT64) {
+		// the micro-kernels work on TensorData_t, other dtypes are multiplied as converted copies.
+		TensorObject a_copy = Tensor_astype(*a, TENSOR_FLOAT64);
+		TensorObject b_copy = Tensor_astype(*b, TENSOR_FLOAT64);
+		TensorObject dst_copy = Tensor_new(ndim, dst->shape);
+		int status = -1;
+		if(a_copy.storage != NULL && b_copy.storage != NULL && dst_copy.storage != NULL) {
+			status = Tensor_matmul(&a_copy, &b_copy, &dst_copy);
+		}
+		if(status == 0) {
+			status = Tensor_write_to(&dst_copy, dst);
+		}
+		Tensor_free(&a_copy);
+		Tensor_free(&b_copy);
+		Tensor_free(&dst_copy);
+		return status;
+	}
+	struct TensorMatmulTask task = {
+		.a = {.rs = a->strides[r], .cs = a->strides[cl]},
+		.b = {.rs = b->strides[r], .cs = b->strides[cl]},
+		.c = {.rs = dst->strides[r], .cs = dst->strides[cl]},
+		.a_base = Tensor_data(a) + a->offset,
+		.b_base = Tensor_data(b) + b->offset,
+		.c_base = dst->data + dst->offset,
+		.a_batch_stride = ndim == 3 ? a->strides[0] : 0,
+		.b_batch_stride = ndim == 3 ? b->strides[0] : 0,
+		.c_batch_stride = ndim == 3 ? dst->strides[0] : 0,
+		.m = a->shape[r],
+		.n = b->shape[cl],
+		.k = a->shape[cl],
+		.kernel = gemmKernels[Tensor_simd_level()],
+	};
+	const size_t batches = ndim == 3 ? a->shape[0] : 1;
+	if(task.m == 0 || task.n == 0 || batches == 0) {
+		return 0;
+	}
+	if(task.k == 0) {
+		for(size_t batch = 0; batch < batches; batch++) {
+			for(size_t i = 0; i < task.m; i++) {
+				for(size_t j = 0; j < task.n; j++) {
+					task.c_base[batch * task.c_batch_stride + i * task.c.rs + j * task.c.cs] = 0;
+				}
+			}
+		}
+		return 0;
+	}
+	task.m_tiles = (task.m + TENSOR_MATMUL_MC - 1) / TENSOR_MATMUL_MC;
+	task.n_tiles = (task.n + TENSOR_MATMUL_NC - 1) / TENSOR_MATMUL_NC;
+	atomic_init(&task.failed, 0);
+	// tiles are ordered batch, column, row, so the automatic grain gives every job runs of row tiles
+	// that share their packed panels of B.
+	Tensor_parallel_for(batches * task.m_tiles * task.n_tiles, 0, Tensor_matmulJob, &task);
+	return atomic_load(&task.failed) ? -1 : 0;
+}
@@ -0,0 +1,322 @@
+#include "tensor.h"
+#include "tensor/math.h"
+#include "tensor/parallel.h"
+#include "tensor/dtype.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#define TENSOR_X86 1
+#include <immintrin.h>
+#endif
+
+// ---SIMD dispatch---
+
+static enum TensorSimd simdLevel = TENSOR_SIMD_SCALAR;
+static pthread_once_t simdOnce = PTHREAD_ONCE_INIT;
+
+static void Tensor_detectSimd(void) {
+	enum TensorSimd level = TENSOR_SIMD_SCALAR;
+	#ifdef TENSOR_X86
+		__builtin_cpu_init();
+		if(__builtin_cpu_supports("sse2")) level = TENSOR_SIMD_SSE2;
+		if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) level = TENSOR_SIMD_AVX2;
+		if(__builtin_cpu_supports("avx512f")) level = TENSOR_SIMD_AVX512;
+	#endif
+	const char* env = getenv("TENSOR_SIMD");
+	enum TensorSimd cap = level;
+	if(env != NULL) {
+		if(strcmp(env, "scalar") == 0) cap = TENSOR_SIMD_SCALAR;
+		else if(strcmp(env, "sse2") == 0) cap = TENSOR_SIMD_SSE2;
+		else if(strcmp(env, "avx2") == 0) cap = TENSOR_SIMD_AVX2;
+		else if(strcmp(env, "avx512") == 0) cap = TENSOR_SIMD_AVX512;
+	}
+	simdLevel = cap < level ? cap : level;
+}
+
+enum TensorSimd Tensor_simd_level(void) {
+	pthread_once(&simdOnce, Tensor_detectSimd);
+	return simdLevel;
+}
+
+// ---Kernels---
+// Every kernel works on n dense elements of one dtype. dst may be equal to any of the inputs.
+
+typedef void (*TensorBinaryKernel)(void *dst, const void *a, const void *b, size_t n);
+typedef void (*TensorScalarKernel)(void *dst, const void *a, TensorData_t value, size_t n);
+typedef void (*TensorFmaKernel)(void *dst, const void *a, const void *b, const void *c, size_t n);
+
+#define TENSOR_C_ADD(x, y) ((x) + (y))
+#define TENSOR_C_SUB(x, y) ((x) - (y))
+#define TENSOR_C_MUL(x, y) ((x) * (y))
+#define TENSOR_C_DIV(x, y) ((x) / (y))
+#define TENSOR_C_FMA(x, y, z) ((x) * (y) + (z))
+
+// Defines the binary and scalar kernels of one operation for one instruction set and element type.
+#define TENSOR_DEFINE_KERNELS(isa, name, attr, type, width, vtype, loadu, storeu, set1, vop, cop) \
+	attr static void Tensor_##name##_##isa(void *dst_, const void *a_, const void *b_, size_t n) { \
+		type *dst = dst_; \
+		const type *a = a_, *b = b_; \
+		size_t i = 0; \
+		for(; i + width <= n; i += width) storeu(dst + i, vop(loadu(a + i), loadu(b + i))); \
+		for(; i < n; i++) dst[i] = cop(a[i], b[i]); \
+	} \
+	attr static void Tensor_##name##_scalar_##isa(void *dst_, const void *a_, TensorData_t value_, size_t n) { \
+		type *dst = dst_; \
+		const type *a = a_; \
+		const type value = (type)value_; \
+		size_t i = 0; \
+		vtype v = set1(value); \
+		for(; i + width <= n; i += width) storeu(dst + i, vop(loadu(a + i), v)); \
+		for(; i < n; i++) dst[i] = cop(a[i], value); \
+	}
+
+#define TENSOR_DEFINE_FMA(isa, attr, type, width, loadu, storeu, vfma, cfma) \
+	attr static void Tensor_fma_##isa(void *dst_, const void *a_, const void *b_, const void *c_, size_t n) { \
+		type *dst = dst_; \
+		const type *a = a_, *b = b_, *c = c_; \
+		size_t i = 0; \
+		for(; i + width <= n; i += width) storeu(dst + i, vfma(loadu(a + i), loadu(b + i), loadu(c + i))); \
+		for(; i < n; i++) dst[i] = cfma(a[i], b[i], c[i]); \
+	}
+
+#define TENSOR_DEFINE_ISA(isa, attr, type, width, vtype, loadu, storeu, set1, vadd, vsub, vmul, vdiv, vfma, cfma) \
+	TENSOR_DEFINE_KERNELS(isa, add, attr, type, width, vtype, loadu, storeu, set1, vadd, TENSOR_C_ADD) \
+	TENSOR_DEFINE_KERNELS(isa, sub, attr, type, width, vtype, loadu, storeu, set1, vsub, TENSOR_C_SUB) \
+	TENSOR_DEFINE_KERNELS(isa, mul, attr, type, width, vtype, loadu, storeu, set1, vmul, TENSOR_C_MUL) \
+	TENSOR_DEFINE_KERNELS(isa, div, attr, type, width, vtype, loadu, storeu, set1, vdiv, TENSOR_C_DIV) \
+	TENSOR_DEFINE_FMA(isa, attr, type, width, loadu, storeu, vfma, cfma)
+
+// The plain C kernels are written as width 1 vectors, so they share the macros above.
+#define TENSOR_C_LOAD(p) (*(p))
+#define TENSOR_C_STORE(p, v) (*(p) = (v))
+#define TENSOR_C_SET1(v) (v)
+TENSOR_DEFINE_ISA(c, , double, 1, double, TENSOR_C_LOAD, TENSOR_C_STORE, TENSOR_C_SET1, TENSOR_C_ADD, TENSOR_C_SUB, TENSOR_C_MUL, TENSOR_C_DIV, TENSOR_C_FMA, TENSOR_C_FMA)
+TENSOR_DEFINE_ISA(c_f32, , float, 1, float, TENSOR_C_LOAD, TENSOR_C_STORE, TENSOR_C_SET1, TENSOR_C_ADD, TENSOR_C_SUB, TENSOR_C_MUL, TENSOR_C_DIV, TENSOR_C_FMA, TENSOR_C_FMA)
+
+#ifdef TENSOR_X86
+// SSE2 has no fused multiply-add.
+#define TENSOR_SSE2_FMA_PD(x, y, z) _mm_add_pd(_mm_mul_pd(x, y), z)
+#define TENSOR_SSE2_FMA_PS(x, y, z) _mm_add_ps(_mm_mul_ps(x, y), z)
+TENSOR_DEFINE_ISA(sse2, , double, 2, __m128d, _mm_loadu_pd, _mm_storeu_pd, _mm_set1_pd, _mm_add_pd, _mm_sub_pd, _mm_mul_pd, _mm_div_pd, TENSOR_SSE2_FMA_PD, TENSOR_C_FMA)
+TENSOR_DEFINE_ISA(avx2, __attribute__((target("avx2,fma"))), double, 4, __m256d, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_set1_pd, _mm256_add_pd, _mm256_sub_pd, _mm256_mul_pd, _mm256_div_pd, _mm256_fmadd_pd, fma)
+TENSOR_DEFINE_ISA(avx512, __attribute__((target("avx512f"))), double, 8, __m512d, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_set1_pd, _mm512_add_pd, _mm512_sub_pd, _mm512_mul_pd, _mm512_div_pd, _mm512_fmadd_pd, fma)
+TENSOR_DEFINE_ISA(sse2_f32, , float, 4, __m128, _mm_loadu_ps, _mm_storeu_ps, _mm_set1_ps, _mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_div_ps, TENSOR_SSE2_FMA_PS, TENSOR_C_FMA)
+TENSOR_DEFINE_ISA(avx2_f32, __attribute__((target("avx2,fma"))), float, 8, __m256, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_set1_ps, _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps, _mm256_div_ps, _mm256_fmadd_ps, fmaf)
+TENSOR_DEFINE_ISA(avx512_f32, __attribute__((target("avx512f"))), float, 16, __m512, _mm512_loadu_ps, _mm512_storeu_ps, _mm512_set1_ps, _mm512_add_ps, _mm512_sub_ps, _mm512_mul_ps, _mm512_div_ps, _mm512_fmadd_ps, fmaf)
+#endif
+
+#define TENSOR_KERNEL_TABLE(isa) { \
+	.binary = {Tensor_add_##isa, Tensor_sub_##isa, Tensor_mul_##isa, Tensor_div_##isa}, \
+	.scalar = {Tensor_add_scalar_##isa, Tensor_sub_scalar_##isa, Tensor_mul_scalar_##isa, Tensor_div_scalar_##isa}, \
+	.fma = Tensor_fma_##isa }
+
+// Indexed by dtype, then instruction set. Dtypes without kernels are left empty and use the generic loop.
+static const struct TensorMathKernels {
+	TensorBinaryKernel binary[4];
+	TensorScalarKernel scalar[4];
+	TensorFmaKernel fma;
+} kernels[TENSOR_DTYPE_COUNT][TENSOR_SIMD_AVX512 + 1] = {
+	[TENSOR_FLOAT64] = {
+		[TENSOR_SIMD_SCALAR] = TENSOR_KERNEL_TABLE(c),
+#ifdef TENSOR_X86
+		[TENSOR_SIMD_SSE2] = TENSOR_KERNEL_TABLE(sse2),
+		[TENSOR_SIMD_AVX2] = TENSOR_KERNEL_TABLE(avx2),
+		[TENSOR_SIMD_AVX512] = TENSOR_KERNEL_TABLE(avx512),
+#endif
+	},
+	[TENSOR_FLOAT32] = {
+		[TENSOR_SIMD_SCALAR] = TENSOR_KERNEL_TABLE(c_f32),
+#ifdef TENSOR_X86
+		[TENSOR_SIMD_SSE2] = TENSOR_KERNEL_TABLE(sse2_f32),
+		[TENSOR_SIMD_AVX2] = TENSOR_KERNEL_TABLE(avx2_f32),
+		[TENSOR_SIMD_AVX512] = TENSOR_KERNEL_TABLE(avx512_f32),
+#endif
+	},
+};
+
+// ---Strided fallbacks---
+
+static TensorData_t Tensor_applyOp(enum TensorBinaryOp op, TensorData_t x, TensorData_t y) {
+	switch(op) {
+		case TENSOR_OP_ADD: return x + y;
+		case TENSOR_OP_SUB: return x - y;
+		case TENSOR_OP_MUL: return x * y;
+		case TENSOR_OP_DIV: return x / y;
+	}
+	return 0;
+}
+
+// ---Dispatch---
+
+enum TensorMathKind {
+	TENSOR_MATH_BINARY,
+	TENSOR_MATH_SCALAR,
+	TENSOR_MATH_FMA,
+};
+
+struct TensorMathTask {
+	TensorIter iter; ///< Operand 0 is the destination.
+	enum TensorMathKind kind;
+	enum TensorBinaryOp op;
+	TensorData_t value;
+	const struct TensorMathKernels* kernels; ///< Kernels of the dtype shared by every operand, NULL if there are none.
+	int float64; ///< 1 if every operand is TENSOR_FLOAT64.
+	int fused; ///< 1 if the kernels of the SIMD level fuse multiply-adds, the strided and mixed dtype paths then fuse too.
+};
+
+// Multiply-add of the paths without kernels, rounded like the kernels of the SIMD level.
+static TensorData_t TensorMath_fma(const struct TensorMathTask *task, TensorData_t x, TensorData_t y, TensorData_t z) {
+	return task->fused ? fma(x, y, z) : x * y + z;
+}
+
+// Any dtypes and strides, every element is computed as TensorData_t.
+static void TensorMath_runGeneric(const struct TensorMathTask *task, const TensorIter *iter) {
+	char *p[TENSOR_ITER_MAX_OPERANDS];
+	TensorIndex_t step[TENSOR_ITER_MAX_OPERANDS];
+	for(TensorShape_t k = 0; k < iter->noperands; k++) {
+		p[k] = iter->ptr[k];
+		step[k] = iter->inner_strides[k] * iter->item_size[k];
+	}
+	const enum TensorDType *t = iter->dtype;
+	for(TensorIndex_t i = 0; i < iter->count; i++) {
+		const TensorData_t x = Tensor_dtype_load(t[1], p[1] + i * step[1]);
+		TensorData_t result = 0;
+		switch(task->kind) {
+			case TENSOR_MATH_BINARY: result = Tensor_applyOp(task->op, x, Tensor_dtype_load(t[2], p[2] + i * step[2])); break;
+			case TENSOR_MATH_SCALAR: result = Tensor_applyOp(task->op, x, task->value); break;
+			case TENSOR_MATH_FMA: result = TensorMath_fma(task, x, Tensor_dtype_load(t[2], p[2] + i * step[2]), Tensor_dtype_load(t[3], p[3] + i * step[3])); break;
+		}
+		Tensor_dtype_store(t[0], p[0] + i * step[0], result);
+	}
+}
+
+static void TensorMath_runIter(const struct TensorMathTask *task, TensorIter *iter) {
+	while(TensorIter_next(iter)) {
+		void **p = iter->ptr;
+		const TensorIndex_t *s = iter->inner_strides;
+		const TensorIndex_t n = iter->count;
+		if(task->kernels != NULL && iter->contiguous) {
+			switch(task->kind) {
+				case TENSOR_MATH_BINARY: task->kernels->binary[task->op](p[0], p[1], p[2], n); break;
+				case TENSOR_MATH_SCALAR: task->kernels->scalar[task->op](p[0], p[1], task->value, n); break;
+				case TENSOR_MATH_FMA: task->kernels->fma(p[0], p[1], p[2], p[3], n); break;
+			}
+			continue;
+		}
+		if(task->kernels != NULL && task->kind == TENSOR_MATH_BINARY && s[0] == 1) {
+			// an operand broadcast along the run is a scalar for it.
+			if(s[1] == 1 && s[2] == 0) {
+				task->kernels->scalar[task->op](p[0], p[1], Tensor_dtype_load(iter->dtype[2], p[2]), n);
+				continue;
+			}
+			if(s[1] == 0 && s[2] == 1 && (task->op == TENSOR_OP_ADD || task->op == TENSOR_OP_MUL)) {
+				task->kernels->scalar[task->op](p[0], p[2], Tensor_dtype_load(iter->dtype[1], p[1]), n);
+				continue;
+			}
+		}
+		if(!task->float64) {
+			TensorMath_runGeneric(task, iter);
+			continue;
+		}
+		TensorData_t *d = p[0];
+		const TensorData_t *a = p[1], *b = p[2], *c = p[3];
+		switch(task->kind) {
+			case TENSOR_MATH_BINARY:
+				for(TensorIndex_t i = 0; i < n; i++) d[i * s[0]] = Tensor_applyOp(task->op, a[i * s[1]], b[i * s[2]]);
+				break;
+			case TENSOR_MATH_SCALAR:
+				for(TensorIndex_t i = 0; i < n; i++) d[i * s[0]] = Tensor_applyOp(task->op, a[i * s[1]], task->value);
+				break;
+			case TENSOR_MATH_FMA:
+				for(TensorIndex_t i = 0; i < n; i++) d[i * s[0]] = TensorMath_fma(task, a[i * s[1]], b[i * s[2]], c[i * s[3]]);
+				break;
+		}
+	}
+}
+
+static void* TensorMath_job(void *args) {
+	struct range_args *range = (struct range_args*)args;
+	const struct TensorMathTask *task = (const struct TensorMathTask*)range->args;
+	TensorIter iter = task->iter;
+	TensorIter_range(&iter, range->begin, range->end);
+	TensorMath_runIter(task, &iter);
+	return NULL;
+}
+
+static int TensorMath_run(struct TensorMathTask *task, const TensorShape_t noperands, TensorObject *const *operands) {
+	if(Tensor_make_writable(operands[0]) != 0 || TensorIter_init(&task->iter, noperands, operands) != 0) {
+		return -1;
+	}
+	// the kernels need every operand in the same dtype, mixed dtypes are converted element by element.
+	const enum TensorDType dtype = operands[0]->dtype;
+	int uniform = 1;
+	for(TensorShape_t k = 1; k < noperands; k++) {
+		uniform &= operands[k]->dtype == dtype;
+	}
+	task->kernels = uniform && kernels[dtype][TENSOR_SIMD_SCALAR].fma != NULL ? &kernels[dtype][Tensor_simd_level()] : NULL;
+	task->float64 = uniform && dtype == TENSOR_FLOAT64;
+	task->fused = Tensor_simd_level() >= TENSOR_SIMD_AVX2;
+	if(task->iter.size < TENSOR_MATH_PARALLEL_THRESHOLD) {
+		TensorMath_runIter(task, &task->iter);
+		return 0;
+	}
+	// chunks are kept large enough to amortize the dispatch, and a multiple of a cache line.
+	TensorIndex_t grain = Tensor_loop_grain(task->iter.size, 0);
+	if(grain < TENSOR_MATH_PARALLEL_THRESHOLD / 4) {
+		grain = TENSOR_MATH_PARALLEL_THRESHOLD / 4;
+	}
+	grain = (grain + 7) & ~(TensorIndex_t)7;
+	Tensor_parallel_for(task->iter.size, grain, TensorMath_job, task);
+	return 0;
+}
+
+// ---Public API---
+
+int Tensor_binary_op(enum TensorBinaryOp op, TensorObject *a, TensorObject *b, TensorObject *dst) {
+	struct TensorMathTask task = {.kind = TENSOR_MATH_BINARY, .op = op};
+	return TensorMath_run(&task, 3, (TensorObject*[]){dst, a, b});
+}
+
+int Tensor_scalar_op(enum TensorBinaryOp op, TensorObject *a, const TensorData_t value, TensorObject *dst) {
+	struct TensorMathTask task = {.kind = TENSOR_MATH_SCALAR, .op = op, .value = value};
+	return TensorMath_run(&task, 2, (TensorObject*[]){dst, a});
+}
+
+int Tensor_add(TensorObject *a, TensorObject *b, TensorObject *dst) {
+	return Tensor_binary_op(TENSOR_OP_ADD, a, b, dst);
+}
+
+int Tensor_sub(TensorObject *a, TensorObject *b, TensorObject *dst) {
+	return Tensor_binary_op(TENSOR_OP_SUB, a, b, dst);
+}
+
+int Tensor_mul(TensorObject *a, TensorObject *b, TensorObject *dst) {
+	return Tensor_binary_op(TENSOR_OP_MUL, a, b, dst);
+}
+
+int Tensor_div(TensorObject *a, TensorObject *b, TensorObject *dst) {
+	return Tensor_binary_op(TENSOR_OP_DIV, a, b, dst);
+}
+
+int Tensor_add_scalar(TensorObject *a, const TensorData_t value, TensorObject *dst) {
+	return Tensor_scalar_op(TENSOR_OP_ADD, a, value, dst);
+}
+
+int Tensor_sub_scalar(TensorObject *a, const TensorData_t value, TensorObject *dst) {
+	return Tensor_scalar_op(TENSOR_OP_SUB, a, value, dst);
+}
+
+int Tensor_mul_scalar(TensorObject *a, const TensorData_t value, TensorObject *dst) {
+	return Tensor_scalar_op(TENSOR_OP_MUL, a, value, dst);
+}
+
+int Tensor_div_scalar(TensorObject *a, const TensorData_t value, TensorObject *dst) {
+	return Tensor_scalar_op(TENSOR_OP_DIV, a, value, dst);
+}
+
+int Tensor_fma(TensorObject *a, TensorObject *b, TensorObject *c, TensorObject *dst) {
+	struct TensorMathTask task = {.kind = TENSOR_MATH_FMA};
+	return TensorMath_run(&task, 4, (TensorObject*[]){dst, a, b, c});
+}
@@ -1,206 +1,818 @@
-
+#define _GNU_SOURCE
 #include "tensor.h"
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include "tensor/parallel.h"
 // Loopies
 
-static int killThreads=0;
+static atomic_int killThreads = 0;
+
+// What the pool records, read once per event so that it costs a single load when nothing is.
+#define TENSOR_RECORD_STATS 1
+#define TENSOR_RECORD_TRACE 2
+static atomic_int recording = 0;
+
+static atomic_uint_fast64_t jobsSubmitted = 0;
+static atomic_uint_fast64_t queueDepthMax = 0;
+static atomic_uint_fast64_t lockContended = 0;
+static atomic_uint_fast64_t lockWaitNs = 0;
 
-static struct Job {
+// Job spans recorded between Tensor_trace_begin and Tensor_trace_end. Spans past capacity are dropped.
+struct TraceEvent {
+	uint64_t submitted;
+	uint64_t start;
+	uint64_t end;
 	void* (*func)(void *args);
-	void* args;
-	pthread_mutex_t* jobFinishedMutex;
-	pthread_cond_t* jobFinished;
-} Job;
-static struct JobQueueElem {
-	struct Job job;
-	struct JobQueueElem* next;
-} JobQueueElem;
-static struct JobQueue {
-	struct JobQueueElem* next;
-	struct JobQueueElem* last;
+	size_t worker;
+};
+
+static struct TraceEvent* traceEvents = NULL;
+static size_t traceCapacity = 0;
+static atomic_size_t traceCount = 0;
+static atomic_size_t traceWriters = 0; ///< Workers between checking that tracing is on and writing their span.
+static uint64_t traceOrigin = 0;
+
+static uint64_t Tensor_nanotime(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Locks mutex, timing the wait when it is contended and statistics are on.
+static void Tensor_lockTimed(pthread_mutex_t* mutex) {
+	if(!(atomic_load_explicit(&recording, memory_order_relaxed) & TENSOR_RECORD_STATS)) {
+		pthread_mutex_lock(mutex);
+		return;
+	}
+	if(pthread_mutex_trylock(mutex) == 0) {
+		return;
+	}
+	uint64_t start = Tensor_nanotime();
+	pthread_mutex_lock(mutex);
+	atomic_fetch_add_explicit(&lockContended, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&lockWaitNs, Tensor_nanotime() - start, memory_order_relaxed);
+}
+
+/**
+ * Counting latch, released when count reaches zero.
+ * done is only set under the mutex, so a waiter that saw it set may free the latch.
+*/
+struct Latch {
+	atomic_size_t count;
+	atomic_int done;
 	pthread_mutex_t mutex;
 	pthread_cond_t cond;
-} jobQueue = {
-	.next = NULL,
-	.last = NULL
 };
 
-static void JobQueue_push(struct Job job) {
-	struct JobQueueElem* elem = malloc(sizeof(struct JobQueueElem));
-	elem->job = job;
-	elem->next = NULL;
-	if(jobQueue.next == NULL) {
-		jobQueue.next = elem;
-		jobQueue.last = elem;
-	} else {
-		jobQueue.last->next = elem;
-		jobQueue.last = elem;
-	}
-	pthread_cond_signal(&jobQueue.cond);
+struct Job {
+	void* (*func)(void *args);
+	void* args;
+	struct Latch* latch;
+	uint64_t submitted; ///< When the job was queued, 0 if nothing was recording.
+};
+
+static void Latch_init(struct Latch* latch, size_t count) {
+	atomic_init(&latch->count, count);
+	atomic_init(&latch->done, count == 0);
+	pthread_mutex_init(&latch->mutex, NULL);
+	pthread_cond_init(&latch->cond, NULL);
 }
 
-static struct Job JobQueue_pop(void) {
-	if(jobQueue.next == NULL) {
-		pthread_mutex_unlock(&jobQueue.mutex);
-		return (struct Job){NULL, NULL, NULL};
-	}
-	struct JobQueueElem* elem = jobQueue.next;
-	jobQueue.next = elem->next;
-	if(jobQueue.next == NULL) {
-		jobQueue.last = NULL;
+static void Latch_destroy(struct Latch* latch) {
+	pthread_mutex_destroy(&latch->mutex);
+	pthread_cond_destroy(&latch->cond);
+}
+
+static void Latch_countDown(struct Latch* latch) {
+	if(atomic_fetch_sub_explicit(&latch->count, 1, memory_order_acq_rel) != 1) {
+		return;
 	}
-	struct Job job = elem->job;
-	free(elem);
-	return job;
+	pthread_mutex_lock(&latch->mutex);
+	atomic_store(&latch->done, 1);
+	pthread_cond_broadcast(&latch->cond);
+	pthread_mutex_unlock(&latch->mutex);
 }
 
+/**
+ * @brief Initial number of preallocated job slots per worker.
+ * @details Must be a power of two. The ring buffer doubles when it runs full,
+ * so steady-state dispatch never allocates.
+*/
+#define JOB_DEQUE_INITIAL_CAPACITY 256
+
+/**
+ * Per-worker double ended job queue.
+ * The owner pushes and pops at the tail, other workers steal from the head.
+ * head and tail are atomic so that thieves can skip empty deques without taking the lock.
+*/
+struct JobDeque {
+	struct Job* slots;
+	size_t capacity;
+	atomic_size_t head;
+	atomic_size_t tail;
+	pthread_mutex_t mutex;
+};
+
+// Counters of a worker, only written by the worker itself.
+struct WorkerStats {
+	atomic_uint_fast64_t jobs;
+	atomic_uint_fast64_t stolen;
+	atomic_uint_fast64_t busy_ns;
+	atomic_uint_fast64_t idle_ns;
+	atomic_uint_fast64_t queue_wait_ns;
+};
+
 static struct WorkerThread {
 	pthread_t thread;
 	size_t id;
+	struct JobDeque deque;
+	struct WorkerStats stats;
+	size_t depth; ///< Number of jobs being run, more than one while waiting on a nested loop.
 } *available_threads = NULL;
 
-static const struct timespec THREAD_SLEEP = {
-	.tv_sec = 10,
-	.tv_nsec = 100000000
-};
+static size_t num_threads = 0;
+
+// Serializes building and tearing down the pool. poolReady lets the lazy initialization skip the mutex
+// once the pool exists, and holds the workers back until num_threads counts only the ones that started.
+static pthread_mutex_t poolMutex = PTHREAD_MUTEX_INITIALIZER;
+static atomic_int poolReady = 0;
+
+// Number of jobs sitting in any deque. Idle workers only sleep when this is zero.
+static atomic_size_t pendingJobs = 0;
+static atomic_size_t sleepingThreads = 0;
+static pthread_mutex_t sleepMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sleepCond = PTHREAD_COND_INITIALIZER;
+
+// Round robin cursor used by threads outside the pool to pick a deque.
+static atomic_size_t nextDeque = 0;
+static _Thread_local struct WorkerThread* currentWorker = NULL;
+
+static void JobDeque_init(struct JobDeque* dq) {
+	dq->slots = calloc(JOB_DEQUE_INITIAL_CAPACITY, sizeof(struct Job));
+	dq->capacity = JOB_DEQUE_INITIAL_CAPACITY;
+	atomic_init(&dq->head, 0);
+	atomic_init(&dq->tail, 0);
+	pthread_mutex_init(&dq->mutex, NULL);
+}
+
+static void JobDeque_destroy(struct JobDeque* dq) {
+	free(dq->slots);
+	dq->slots = NULL;
+	pthread_mutex_destroy(&dq->mutex);
+}
+
+static size_t JobDeque_size(struct JobDeque* dq) {
+	return atomic_load_explicit(&dq->tail, memory_order_relaxed) - atomic_load_explicit(&dq->head, memory_order_relaxed);
+}
+
+// Grows the ring buffer, keeping the jobs in order. Must hold dq->mutex.
+static void JobDeque_grow(struct JobDeque* dq) {
+	size_t head = atomic_load_explicit(&dq->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&dq->tail, memory_order_relaxed);
+	struct Job* slots = calloc(dq->capacity * 2, sizeof(struct Job));
+	for(size_t i = head; i < tail; i++) {
+		slots[i & (dq->capacity * 2 - 1)] = dq->slots[i & (dq->capacity - 1)];
+	}
+	free(dq->slots);
+	dq->slots = slots;
+	dq->capacity *= 2;
+}
+
+static void JobDeque_push(struct JobDeque* dq, struct Job job) {
+	Tensor_lockTimed(&dq->mutex);
+	size_t tail = atomic_load_explicit(&dq->tail, memory_order_relaxed);
+	if(tail - atomic_load_explicit(&dq->head, memory_order_relaxed) == dq->capacity) {
+		JobDeque_grow(dq);
+	}
+	dq->slots[tail & (dq->capacity - 1)] = job;
+	atomic_store_explicit(&dq->tail, tail + 1, memory_order_relaxed);
+	// counted before the lock is released so that a thief can never take the job first.
+	uint_fast64_t depth = atomic_fetch_add(&pendingJobs, 1) + 1;
+	pthread_mutex_unlock(&dq->mutex);
+	if(atomic_load_explicit(&recording, memory_order_relaxed) & TENSOR_RECORD_STATS) {
+		uint_fast64_t max = atomic_load_explicit(&queueDepthMax, memory_order_relaxed);
+		while(depth > max && !atomic_compare_exchange_weak_explicit(&queueDepthMax, &max, depth, memory_order_relaxed, memory_order_relaxed));
+	}
+}
+
+// Takes the most recently pushed job, used by the owning worker.
+static int JobDeque_pop(struct JobDeque* dq, struct Job* job) {
+	if(JobDeque_size(dq) == 0) {
+		return 0;
+	}
+	Tensor_lockTimed(&dq->mutex);
+	size_t head = atomic_load_explicit(&dq->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&dq->tail, memory_order_relaxed);
+	if(head == tail) {
+		pthread_mutex_unlock(&dq->mutex);
+		return 0;
+	}
+	tail--;
+	*job = dq->slots[tail & (dq->capacity - 1)];
+	atomic_store_explicit(&dq->tail, tail, memory_order_relaxed);
+	atomic_fetch_sub(&pendingJobs, 1);
+	pthread_mutex_unlock(&dq->mutex);
+	return 1;
+}
+
+// Takes the oldest job, used by workers that ran out of their own work.
+static int JobDeque_steal(struct JobDeque* dq, struct Job* job) {
+	if(JobDeque_size(dq) == 0) {
+		return 0;
+	}
+	Tensor_lockTimed(&dq->mutex);
+	size_t head = atomic_load_explicit(&dq->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&dq->tail, memory_order_relaxed);
+	if(head == tail) {
+		pthread_mutex_unlock(&dq->mutex);
+		return 0;
+	}
+	*job = dq->slots[head & (dq->capacity - 1)];
+	atomic_store_explicit(&dq->head, head + 1, memory_order_relaxed);
+	atomic_fetch_sub(&pendingJobs, 1);
+	pthread_mutex_unlock(&dq->mutex);
+	return 1;
+}
+
+// Looks for work in the worker's own deque first, then tries to steal from the others.
+static int WorkerThread_findJob(struct WorkerThread* wt, struct Job* job) {
+	if(JobDeque_pop(&wt->deque, job)) {
+		return 1;
+	}
+	for(size_t i = 1; i < num_threads; i++) {
+		struct WorkerThread* victim = &available_threads[(wt->id + i) % num_threads];
+		if(JobDeque_steal(&victim->deque, job)) {
+			if(atomic_load_explicit(&recording, memory_order_relaxed) & TENSOR_RECORD_STATS) {
+				atomic_fetch_add_explicit(&wt->stats.stolen, 1, memory_order_relaxed);
+			}
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Runs a job and counts the latch down, recording the job first so that waiters see it counted.
+static void WorkerThread_run(struct WorkerThread* wt, struct Job* job) {
+	// acquire pairs with Tensor_trace_begin, which sets up the buffer before turning tracing on.
+	int record = atomic_load_explicit(&recording, memory_order_acquire);
+	uint64_t start = record ? Tensor_nanotime() : 0;
+	// depth is kept for unrecorded jobs too, statistics turned on during a nested loop still see it.
+	wt->depth++;
+	job->func(job->args);
+	wt->depth--;
+	if(!record) {
+		Latch_countDown(job->latch);
+		return;
+	}
+	uint64_t end = Tensor_nanotime();
+	if(record & TENSOR_RECORD_STATS) {
+		atomic_fetch_add_explicit(&wt->stats.jobs, 1, memory_order_relaxed);
+		if(wt->depth == 0) {
+			// nested jobs already count towards the job that waits on them.
+			atomic_fetch_add_explicit(&wt->stats.busy_ns, end - start, memory_order_relaxed);
+		}
+		if(job->submitted != 0) {
+			atomic_fetch_add_explicit(&wt->stats.queue_wait_ns, start - job->submitted, memory_order_relaxed);
+		}
+	}
+	if(record & TENSOR_RECORD_TRACE) {
+		// the writer is counted before tracing is checked again, so Tensor_trace_end either waits for
+		// this span or the span sees tracing off and isn't written.
+		atomic_fetch_add(&traceWriters, 1);
+		if(atomic_load(&recording) & TENSOR_RECORD_TRACE) {
+			size_t i = atomic_fetch_add_explicit(&traceCount, 1, memory_order_relaxed);
+			if(i < traceCapacity) {
+				traceEvents[i] = (struct TraceEvent){
+					.submitted = job->submitted,
+					.start = start,
+					.end = end,
+					.func = job->func,
+					.worker = wt->id};
+			}
+		}
+		atomic_fetch_sub(&traceWriters, 1);
+	}
+	Latch_countDown(job->latch);
+}
 
 static void* WorkerThread_main(void* args) {
 	struct WorkerThread* at = (struct WorkerThread*)args;
+	currentWorker = at;
+	pthread_mutex_lock(&sleepMutex);
+	while(!atomic_load(&poolReady) && !atomic_load(&killThreads)) {
+		pthread_cond_wait(&sleepCond, &sleepMutex);
+	}
+	pthread_mutex_unlock(&sleepMutex);
 	while(1) {
-		#ifdef DEBUG
-			printf("Thread %lu waiting for queue lock\n", at->id);
-		#endif
-		
-		pthread_mutex_lock(&jobQueue.mutex);
-		
-		#ifdef DEBUG
-			printf("Thread %lu acquired queue lock\n", at->id);
-		#endif
-		
-		while(jobQueue.next == NULL) {
-			
-			#ifdef DEBUG
-				printf("Thread %lu queue empty\n", at->id);
-				printf("Thread %lu releasing queue lock and waiting\n", at->id);
-			#endif
-			
-			pthread_cond_timedwait(&jobQueue.cond, &jobQueue.mutex, &THREAD_SLEEP);
-			if(killThreads) {
-				pthread_mutex_unlock(&jobQueue.mutex);
-				#ifdef DEBUG
-					printf("Thread %lu exiting\n", at->id);
-				#endif
+		struct Job job;
+		if(!WorkerThread_findJob(at, &job)) {
+			uint64_t sleep_start = atomic_load_explicit(&recording, memory_order_relaxed) & TENSOR_RECORD_STATS ? Tensor_nanotime() : 0;
+			pthread_mutex_lock(&sleepMutex);
+			atomic_fetch_add(&sleepingThreads, 1);
+			while(atomic_load(&pendingJobs) == 0 && !atomic_load(&killThreads)) {
+				pthread_cond_wait(&sleepCond, &sleepMutex);
+			}
+			atomic_fetch_sub(&sleepingThreads, 1);
+			pthread_mutex_unlock(&sleepMutex);
+			if(sleep_start != 0) {
+				atomic_fetch_add_explicit(&at->stats.idle_ns, Tensor_nanotime() - sleep_start, memory_order_relaxed);
+			}
+			if(atomic_load(&killThreads) && atomic_load(&pendingJobs) == 0) {
 				return NULL;
 			}
+			continue;
 		}
-		struct Job job = JobQueue_pop();
-		
-		#ifdef DEBUG
-			printf("Thread %lu got a job\n", at->id);
-		#endif
-		
-		pthread_mutex_unlock(&jobQueue.mutex);
-		
-		#ifdef DEBUG
-			printf("Thread %lu released queue lock, executing job.\n", at->id);
-		#endif
 
 		if(job.func == NULL) {
 			// should not happen, but just in case.
 			continue;
 		}
-		job.func(job.args);
-		pthread_mutex_lock(job.jobFinishedMutex);
-		pthread_cond_broadcast(job.jobFinished);
-		pthread_mutex_unlock(job.jobFinishedMutex);
-
-		#ifdef DEBUG
-			printf("Thread %lu broadcasted job finished\n", at->id);
-		#endif
-		continue;
+		WorkerThread_run(at, &job);
 	}
-	#ifdef DEBUG
-		printf("Thread %lu exiting\n", at->id);
-	#endif
 	return NULL;
 }
 
+// Parses a sysfs cpulist such as "0-3,8,10-11" into set. Returns the number of cpus added.
+static int Tensor_parseCpuList(const char* list, cpu_set_t* set) {
+	int added = 0;
+	const char* p = list;
+	while(*p != '\0' && *p != '\n') {
+		char* end;
+		long first = strtol(p, &end, 10);
+		if(end == p) {
+			break;
+		}
+		long last = first;
+		p = end;
+		if(*p == '-') {
+			last = strtol(p + 1, &end, 10);
+			p = end;
+		}
+		for(long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+			CPU_SET(cpu, set);
+			added++;
+		}
+		if(*p == ',') {
+			p++;
+		}
+	}
+	return added;
+}
+
+// Reads the cpus of every NUMA node, restricted to the cpus this process may run on.
+// Falls back to a single node holding every allowed cpu when sysfs is unavailable.
+static size_t Tensor_numaNodes(cpu_set_t* nodes, size_t max_nodes, const cpu_set_t* allowed) {
+	size_t count = 0;
+	for(size_t node = 0; node < 1024 && count < max_nodes; node++) {
+		char path[64];
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%zu/cpulist", node);
+		FILE* f = fopen(path, "r");
+		if(f == NULL) {
+			// node numbers may have holes, but not large ones.
+			if(node > count + 64) {
+				break;
+			}
+			continue;
+		}
+		char line[4096];
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		if(fgets(line, sizeof(line), f) != NULL) {
+			Tensor_parseCpuList(line, &cpus);
+		}
+		fclose(f);
+		CPU_AND(&nodes[count], &cpus, allowed);
+		if(CPU_COUNT(&nodes[count]) > 0) {
+			count++;
+		}
+	}
+	if(count == 0) {
+		nodes[0] = *allowed;
+		count = 1;
+	}
+	return count;
+}
+
+// Picks the cpus a worker is pinned to. Returns 0 if the worker should not be pinned.
+static int Tensor_workerCpus(size_t worker, enum TensorAffinity affinity, cpu_set_t* cpus) {
+	cpu_set_t allowed;
+	CPU_ZERO(cpus);
+	if(affinity == TENSOR_AFFINITY_NONE || sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+		return 0;
+	}
+	if(affinity == TENSOR_AFFINITY_CORE) {
+		// the n-th allowed cpu, wrapping around when there are more workers than cpus.
+		size_t target = worker % CPU_COUNT(&allowed);
+		for(int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			if(CPU_ISSET(cpu, &allowed) && target-- == 0) {
+				CPU_SET(cpu, cpus);
+				return 1;
+			}
+		}
+		return 0;
+	}
+	// Neighbouring workers get neighbouring chunks of a loop, so they are kept on the same node.
+	static cpu_set_t nodes[TENSOR_MAX_NUMA_NODES];
+	size_t node_count = Tensor_numaNodes(nodes, TENSOR_MAX_NUMA_NODES, &allowed);
+	*cpus = nodes[worker * node_count / num_threads];
+	return 1;
+}
+
+static TensorShape_t Tensor_defaultNumThreads(void) {
+	const char* env = getenv("TENSOR_NUM_THREADS");
+	if(env != NULL && atol(env) > 0) {
+		return (TensorShape_t)atol(env);
+	}
+	long online = sysconf(_SC_NPROCESSORS_ONLN);
+	return online > 0 ? (TensorShape_t)online : TENSOR_LOOP_NUM_THREADS;
+}
+
+static enum TensorAffinity Tensor_defaultAffinity(void) {
+	const char* env = getenv("TENSOR_AFFINITY");
+	if(env == NULL) {
+		return TENSOR_AFFINITY_NONE;
+	}
+	if(strcmp(env, "core") == 0) {
+		return TENSOR_AFFINITY_CORE;
+	}
+	if(strcmp(env, "numa") == 0) {
+		return TENSOR_AFFINITY_NUMA;
+	}
+	return TENSOR_AFFINITY_NONE;
+}
+
 void Tensor_init(void) {
-	available_threads = calloc(TENSOR_LOOP_NUM_THREADS, sizeof(struct WorkerThread));
-	for(int i = 0; i < TENSOR_LOOP_NUM_THREADS; i++) {
+	Tensor_init_threads(0, Tensor_defaultAffinity());
+}
+
+// Builds the pool once, however many threads make their first call at the same time.
+static void Tensor_ensurePool(void) {
+	if(!atomic_load_explicit(&poolReady, memory_order_acquire)) {
+		Tensor_init();
+	}
+}
+
+void Tensor_init_threads(TensorShape_t thread_count, enum TensorAffinity affinity) {
+	pthread_mutex_lock(&poolMutex);
+	if(atomic_load(&poolReady)) {
+		pthread_mutex_unlock(&poolMutex);
+		return;
+	}
+	atomic_store(&killThreads, 0);
+	num_threads = thread_count != 0 ? thread_count : Tensor_defaultNumThreads();
+	available_threads = calloc(num_threads, sizeof(struct WorkerThread));
+	if(available_threads == NULL) {
+		num_threads = 0;
+	}
+	for(size_t i = 0; i < num_threads; i++) {
 		available_threads[i].id = i;
-		pthread_create(&available_threads[i].thread, NULL, WorkerThread_main, &available_threads[i]);
-		
+		JobDeque_init(&available_threads[i].deque);
+	}
+	// deques must all exist before any worker starts stealing.
+	size_t started = 0;
+	for(size_t i = 0; i < num_threads; i++) {
+		pthread_attr_t attr;
+		cpu_set_t cpus;
+		pthread_attr_init(&attr);
+		if(Tensor_workerCpus(i, affinity, &cpus)) {
+			// pinned before the thread starts, so that everything it touches stays local.
+			pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+		}
+		int created = pthread_create(&available_threads[i].thread, &attr, WorkerThread_main, &available_threads[i]);
+		pthread_attr_destroy(&attr);
+		if(created != 0) {
+			break;
+		}
+		started++;
+	}
+	// the pool keeps the workers that started, they are still waiting and never see the other deques.
+	for(size_t i = started; i < num_threads; i++) {
+		JobDeque_destroy(&available_threads[i].deque);
 	}
+	pthread_mutex_lock(&sleepMutex);
+	num_threads = started;
+	atomic_store_explicit(&poolReady, 1, memory_order_release);
+	pthread_cond_broadcast(&sleepCond);
+	pthread_mutex_unlock(&sleepMutex);
+	pthread_mutex_unlock(&poolMutex);
+}
+
+TensorShape_t Tensor_num_threads(void) {
+	Tensor_ensurePool();
+	return num_threads;
 }
 
 
 void Tensor_cleanup(void) {
-	killThreads = 1;
-	for(int i = 0; i < TENSOR_LOOP_NUM_THREADS; i++) {
+	pthread_mutex_lock(&poolMutex);
+	if(!atomic_load(&poolReady)) {
+		pthread_mutex_unlock(&poolMutex);
+		return;
+	}
+	pthread_mutex_lock(&sleepMutex);
+	atomic_store(&killThreads, 1);
+	pthread_cond_broadcast(&sleepCond);
+	pthread_mutex_unlock(&sleepMutex);
+	for(size_t i = 0; i < num_threads; i++) {
 		pthread_join(available_threads[i].thread, NULL);
 	}
+	for(size_t i = 0; i < num_threads; i++) {
+		JobDeque_destroy(&available_threads[i].deque);
+	}
 	free(available_threads);
 	available_threads = NULL;
+	num_threads = 0;
+	atomic_store(&poolReady, 0);
+	pthread_mutex_unlock(&poolMutex);
 }
 
-static void Tensor_addTask(void* (*func)(void *args), void* args, pthread_mutex_t* jobFinishedMutex, pthread_cond_t* jobFinished) {
-	// if available_threads is NULL, then we need to initialize it.
-	if(available_threads == NULL) {
-		Tensor_init();
+static void Tensor_addTask(void* (*func)(void *args), void* args, struct Latch* latch) {
+	Tensor_ensurePool();
+	if(num_threads == 0) {
+		// no worker could be started, the caller runs the job itself.
+		func(args);
+		Latch_countDown(latch);
+		return;
 	}
-	// construct the job and push it to the queue.
-	pthread_mutex_lock(&jobQueue.mutex);
-
-	#ifdef DEBUG
-		printf("addTask acquired queue lock\n");
-	#endif
-	JobQueue_push((struct Job){
+	// jobs submitted from a worker stay local to it, others are spread round robin.
+	struct WorkerThread* target = currentWorker;
+	if(target == NULL) {
+		target = &available_threads[atomic_fetch_add_explicit(&nextDeque, 1, memory_order_relaxed) % num_threads];
+	}
+	int record = atomic_load_explicit(&recording, memory_order_relaxed);
+	uint64_t submitted = record ? Tensor_nanotime() : 0;
+	if(record & TENSOR_RECORD_STATS) {
+		atomic_fetch_add_explicit(&jobsSubmitted, 1, memory_order_relaxed);
+	}
+	JobDeque_push(&target->deque, (struct Job){
 		.func = func, 
 		.args = args, 
-		.jobFinished = jobFinished,
-		.jobFinishedMutex = jobFinishedMutex});
-	pthread_mutex_unlock(&jobQueue.mutex);
-	#ifdef DEBUG
-		printf("addTask released queue lock\n");
-	#endif
+		.latch = latch,
+		.submitted = submitted});
+	if(atomic_load(&sleepingThreads) > 0) {
+		Tensor_lockTimed(&sleepMutex);
+		pthread_cond_signal(&sleepCond);
+		pthread_mutex_unlock(&sleepMutex);
+	}
+}
+
+static void Latch_wait(struct Latch* latch) {
+	// A worker waiting on a nested loop keeps running jobs, so the pool cannot deadlock on itself.
+	struct WorkerThread* wt = currentWorker;
+	while(!atomic_load(&latch->done)) {
+		struct Job job;
+		if(wt != NULL && WorkerThread_findJob(wt, &job)) {
+			WorkerThread_run(wt, &job);
+			continue;
+		}
+		pthread_mutex_lock(&latch->mutex);
+		if(!atomic_load(&latch->done)) {
+			pthread_cond_wait(&latch->cond, &latch->mutex);
+		}
+		pthread_mutex_unlock(&latch->mutex);
+	}
+	// the last count down releases the mutex after setting done, wait until it is out of it.
+	pthread_mutex_lock(&latch->mutex);
+	pthread_mutex_unlock(&latch->mutex);
 }
 
+struct TensorLoopHandle {
+	struct Latch latch;
+	void* args_array; ///< Per job arguments, freed once the loop is waited on.
+	struct loop_args* slices; ///< Slices owned by the loop, NULL for chunked loops.
+	TensorIndex_t slice_count;
+};
 
-void Tensor_loop_over_dim(TensorObject obj, const TensorShape_t axis, void *(*func)(void *args), void* args) {
+// Submits func once for every element of args_array, the handle takes ownership of args_array.
+static TensorLoopHandle* Tensor_submitTasks(size_t count, void* (*func)(void *args), void* args_array, size_t args_size) {
+	TensorLoopHandle* handle = calloc(1, sizeof(TensorLoopHandle));
+	handle->args_array = args_array;
+	Latch_init(&handle->latch, count);
+	for(size_t i = 0; i < count; i++) {
+		Tensor_addTask(func, (char*)args_array + i * args_size, &handle->latch);
+	}
+	return handle;
+}
+
+int Tensor_loop_test(TensorLoopHandle* handle) {
+	return atomic_load(&handle->latch.done);
+}
+
+void Tensor_loop_wait(TensorLoopHandle* handle) {
+	Latch_wait(&handle->latch);
+	Latch_destroy(&handle->latch);
+	for(TensorIndex_t i = 0; i < handle->slice_count; i++) {
+		Tensor_free(&handle->slices[i].obj);
+	}
+	free(handle->args_array);
+	free(handle);
+}
+
+void Tensor_loop_wait_all(TensorLoopHandle** handles, size_t count) {
+	for(size_t i = 0; i < count; i++) {
+		Tensor_loop_wait(handles[i]);
+	}
+}
+
+TensorLoopHandle* Tensor_loop_over_dim_async(TensorObject obj, const TensorShape_t axis, void *(*func)(void *args), void* args) {
 	// This should work, since no slice shares data with a different slice and by declaring The tensor non-thread safe,
 	// we can guarantee that no other thread will access the tensor while this function is running.
 
-	// allocate loop_args, threads and job finish flags.
+	// func may write to its slice, so data shared with a lazy clone is copied first.
+	Tensor_make_writable(&obj);
+	// allocate loop_args and generate the slices.
 	struct loop_args* loop_args = calloc(obj.shape[axis], sizeof(struct loop_args));
-	pthread_cond_t* jobsFinished = calloc(obj.shape[axis], sizeof(pthread_cond_t));
-	pthread_mutex_t* jobsFinishedMutex = calloc(obj.shape[axis], sizeof(pthread_mutex_t));
-	{
-		// alloc
-		for(TensorShape_t i = 0; i < obj.shape[axis]; i++) {
-			// generate the slices, fill in the loop_args and create threads.
-			TensorObject slice = Tensor_slice(&obj, axis, i);
-			loop_args[i].obj = slice;
-			loop_args[i].idx = i;
-			loop_args[i].args = args;
-			//pthread_create(&threads[i], NULL, func, &loop_args[i]);
-			pthread_mutex_init(&jobsFinishedMutex[i], NULL);
-			pthread_cond_init(&jobsFinished[i], NULL);
-			pthread_mutex_lock(&jobsFinishedMutex[i]);
-			Tensor_addTask( func, &loop_args[i], &jobsFinishedMutex[i], &jobsFinished[i]);
-		}
-		// join
-		for(TensorShape_t i = 0; i < obj.shape[axis]; i++) {
-			// wait for the threads to complete all jobs and free the slices right after.
-			pthread_cond_wait(&jobsFinished[i], &jobsFinishedMutex[i]);
-			Tensor_free(&loop_args[i].obj);
-		}
-	}
-	// free loop_args and threads.
-	free(loop_args);
-	free(jobsFinished);
-	free(jobsFinishedMutex);
+	for(TensorIndex_t i = 0; i < obj.shape[axis]; i++) {
+		loop_args[i].obj = Tensor_slice(&obj, axis, i);
+		loop_args[i].idx = i;
+		loop_args[i].args = args;
+	}
+	TensorLoopHandle* handle = Tensor_submitTasks(obj.shape[axis], func, loop_args, sizeof(struct loop_args));
+	handle->slices = loop_args;
+	handle->slice_count = obj.shape[axis];
+	return handle;
+}
+
+void Tensor_loop_over_dim(TensorObject obj, const TensorShape_t axis, void *(*func)(void *args), void* args) {
+	Tensor_loop_wait(Tensor_loop_over_dim_async(obj, axis, func, args));
+}
+
+TensorIndex_t Tensor_loop_grain(TensorIndex_t count, TensorIndex_t grain) {
+	if(grain != 0) {
+		return grain;
+	}
+	Tensor_ensurePool();
+	// a pool without workers runs everything on the caller, in a single chunk.
+	TensorIndex_t chunks = num_threads * TENSOR_LOOP_CHUNKS_PER_THREAD;
+	if(chunks == 0) {
+		return count == 0 ? 1 : count;
+	}
+	grain = (count + chunks - 1) / chunks;
+	return grain == 0 ? 1 : grain;
+}
+
+void Tensor_parallel_for(TensorIndex_t count, TensorIndex_t grain, void* (*func)(void *args), void* args) {
+	if(count == 0) {
+		return;
+	}
+	grain = Tensor_loop_grain(count, grain);
+	TensorIndex_t chunks = (count + grain - 1) / grain;
+	if(chunks == 1) {
+		// not worth a round trip through the pool.
+		struct range_args range = {.begin = 0, .end = count, .args = args};
+		func(&range);
+		return;
+	}
+	struct range_args* range_args = calloc(chunks, sizeof(struct range_args));
+	for(TensorIndex_t i = 0; i < chunks; i++) {
+		range_args[i].begin = i * grain;
+		range_args[i].end = i == chunks - 1 ? count : (i + 1) * grain;
+		range_args[i].args = args;
+	}
+	Tensor_loop_wait(Tensor_submitTasks(chunks, func, range_args, sizeof(struct range_args)));
+}
+
+TensorLoopHandle* Tensor_loop_over_dim_chunked_async(TensorObject obj, const TensorShape_t axis, TensorIndex_t grain, void *(*func)(void *args), void* args) {
+	TensorIndex_t count = obj.shape[axis];
+	Tensor_make_writable(&obj);
+	grain = Tensor_loop_grain(count, grain);
+	TensorIndex_t chunks = (count + grain - 1) / grain;
+	struct loop_range_args* loop_args = calloc(chunks, sizeof(struct loop_range_args));
+	for(TensorIndex_t i = 0; i < chunks; i++) {
+		loop_args[i].obj = obj;
+		loop_args[i].axis = axis;
+		loop_args[i].begin = i * grain;
+		loop_args[i].end = i == chunks - 1 ? count : (i + 1) * grain;
+		loop_args[i].args = args;
+	}
+	return Tensor_submitTasks(chunks, func, loop_args, sizeof(struct loop_range_args));
+}
+
+void Tensor_loop_over_dim_chunked(TensorObject obj, const TensorShape_t axis, TensorIndex_t grain, void *(*func)(void *args), void* args) {
+	TensorIndex_t count = obj.shape[axis];
+	if(count == 0) {
+		return;
+	}
+	grain = Tensor_loop_grain(count, grain);
+	if(grain >= count) {
+		// not worth a round trip through the pool.
+		Tensor_make_writable(&obj);
+		struct loop_range_args range = {.obj = obj, .axis = axis, .begin = 0, .end = count, .args = args};
+		func(&range);
+		return;
+	}
+	Tensor_loop_wait(Tensor_loop_over_dim_chunked_async(obj, axis, grain, func, args));
+}
+
+void Tensor_stats_enable(int enabled) {
+	if(enabled) {
+		atomic_fetch_or(&recording, TENSOR_RECORD_STATS);
+	} else {
+		atomic_fetch_and(&recording, ~TENSOR_RECORD_STATS);
+	}
+}
+
+void Tensor_stats_reset(void) {
+	atomic_store(&jobsSubmitted, 0);
+	atomic_store(&queueDepthMax, 0);
+	atomic_store(&lockContended, 0);
+	atomic_store(&lockWaitNs, 0);
+	for(size_t i = 0; i < num_threads; i++) {
+		struct WorkerStats* stats = &available_threads[i].stats;
+		atomic_store(&stats->jobs, 0);
+		atomic_store(&stats->stolen, 0);
+		atomic_store(&stats->busy_ns, 0);
+		atomic_store(&stats->idle_ns, 0);
+		atomic_store(&stats->queue_wait_ns, 0);
+	}
+}
+
+int Tensor_stats_worker(TensorShape_t worker, struct TensorWorkerStats* stats) {
+	if(worker >= num_threads) {
+		return -1;
+	}
+	struct WorkerStats* counters = &available_threads[worker].stats;
+	stats->jobs = atomic_load_explicit(&counters->jobs, memory_order_relaxed);
+	stats->stolen = atomic_load_explicit(&counters->stolen, memory_order_relaxed);
+	stats->busy_ns = atomic_load_explicit(&counters->busy_ns, memory_order_relaxed);
+	stats->idle_ns = atomic_load_explicit(&counters->idle_ns, memory_order_relaxed);
+	stats->queue_wait_ns = atomic_load_explicit(&counters->queue_wait_ns, memory_order_relaxed);
+	return 0;
+}
+
+void Tensor_stats_get(struct TensorPoolStats* stats) {
+	memset(stats, 0, sizeof(*stats));
+	stats->num_threads = num_threads;
+	stats->jobs_submitted = atomic_load_explicit(&jobsSubmitted, memory_order_relaxed);
+	stats->queue_depth = atomic_load_explicit(&pendingJobs, memory_order_relaxed);
+	stats->queue_depth_max = atomic_load_explicit(&queueDepthMax, memory_order_relaxed);
+	stats->lock_contended = atomic_load_explicit(&lockContended, memory_order_relaxed);
+	stats->lock_wait_ns = atomic_load_explicit(&lockWaitNs, memory_order_relaxed);
+	for(TensorShape_t i = 0; i < num_threads; i++) {
+		struct TensorWorkerStats worker;
+		Tensor_stats_worker(i, &worker);
+		stats->jobs_completed += worker.jobs;
+		stats->jobs_stolen += worker.stolen;
+		stats->busy_ns += worker.busy_ns;
+		stats->idle_ns += worker.idle_ns;
+		stats->queue_wait_ns += worker.queue_wait_ns;
+	}
+}
+
+int Tensor_trace_begin(size_t max_events) {
+	if(traceEvents != NULL || max_events == 0) {
+		return -1;
+	}
+	traceEvents = malloc(max_events * sizeof(struct TraceEvent));
+	if(traceEvents == NULL) {
+		return -1;
+	}
+	traceCapacity = max_events;
+	atomic_store(&traceCount, 0);
+	traceOrigin = Tensor_nanotime();
+	atomic_fetch_or(&recording, TENSOR_RECORD_TRACE);
+	return 0;
+}
+
+int Tensor_trace_end(const char* path) {
+	if(traceEvents == NULL) {
+		return -1;
+	}
+	atomic_fetch_and(&recording, ~TENSOR_RECORD_TRACE);
+	// jobs still running finish without a span, the ones writing theirs are waited for.
+	while(atomic_load(&traceWriters) != 0) {
+		sched_yield();
+	}
+	size_t count = atomic_load(&traceCount);
+	size_t recorded = count < traceCapacity ? count : traceCapacity;
+	FILE* file = fopen(path, "w");
+	int status = file != NULL ? 0 : -1;
+	if(file != NULL) {
+		// Chrome trace event format, timestamps in microseconds since Tensor_trace_begin.
+		fprintf(file, "{\"displayTimeUnit\": \"ns\", \"otherData\": {\"dropped_events\": %zu}, \"traceEvents\": [\n", count - recorded);
+		for(size_t i = 0; i < num_threads; i++) {
+			fprintf(file, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": %zu, \"args\": {\"name\": \"worker %zu\"}},\n", i, i);
+		}
+		for(size_t i = 0; i < recorded; i++) {
+			struct TraceEvent* event = &traceEvents[i];
+			double queued = event->submitted != 0 ? (event->start - event->submitted) / 1e3 : 0;
+			fprintf(file, "{\"name\": \"job\", \"cat\": \"tensor\", \"ph\": \"X\", \"pid\": 0, \"tid\": %zu, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"func\": \"%p\", \"queued_us\": %.3f}},\n",
+				event->worker, (event->start - traceOrigin) / 1e3, (event->end - event->start) / 1e3, (void*)(uintptr_t)event->func, queued);
+		}
+		// the trailing event closes the list without a dangling comma.
+		fprintf(file, "{\"name\": \"trace_end\", \"ph\": \"i\", \"s\": \"g\", \"pid\": 0, \"tid\": 0, \"ts\": %.3f}\n]}\n", (Tensor_nanotime() - traceOrigin) / 1e3);
+		if(fclose(file) != 0) {
+			status = -1;
+		}
+	}
+	free(traceEvents);
+	traceEvents = NULL;
+	traceCapacity = 0;
+	return status;
 }
@@ -0,0 +1,425 @@
+#include "tensor.h"
+#include "tensor/reduce.h"
+#include "tensor/math.h"
+#include "tensor/parallel.h"
+#include "tensor_acc.h"
+#include <math.h>
+#include <stdlib.h>
+#if defined(__x86_64__) || defined(__i386__)
+#define TENSOR_X86 1
+#include <immintrin.h>
+#endif
+
+// Number of outputs reduced together when the reduced axis is not the contiguous one.
+#define TENSOR_REDUCE_BLOCK 256
+
+// ---Contiguous kernels---
+// Sums keep 8 running sums and their compensations, in lanes for the vector kernels.
+// The error of each addition is recovered exactly with Knuth's branchless TwoSum.
+
+static void Tensor_sum_c(const TensorData_t *x, size_t n, struct TensorReduceAcc *acc) {
+	TensorData_t s[8] = {0}, c[8] = {0};
+	size_t i = 0;
+	for(; i + 8 <= n; i += 8) {
+		for(int j = 0; j < 8; j++) {
+			TensorData_t t = s[j] + x[i + j];
+			TensorData_t z = t - s[j];
+			c[j] += (s[j] - (t - z)) + (x[i + j] - z);
+			s[j] = t;
+		}
+	}
+	for(int j = 0; j < 8; j++) {
+		TensorReduce_addCompensated(acc, s[j]);
+		acc->comp += c[j];
+	}
+	for(; i < n; i++) TensorReduce_addCompensated(acc, x[i]);
+}
+
+static TensorData_t Tensor_max_c(const TensorData_t *x, size_t n) {
+	TensorData_t m = -INFINITY;
+	for(size_t i = 0; i < n; i++) m = x[i] > m ? x[i] : m;
+	return m;
+}
+
+static TensorData_t Tensor_min_c(const TensorData_t *x, size_t n) {
+	TensorData_t m = INFINITY;
+	for(size_t i = 0; i < n; i++) m = x[i] < m ? x[i] : m;
+	return m;
+}
+
+#ifdef TENSOR_X86
+#define TENSOR_TWO_SUM(add, sub, s, c, x) do { \
+		t = add(s, x); \
+		z = sub(t, s); \
+		c = add(c, add(sub(s, sub(t, z)), sub(x, z))); \
+		s = t; \
+	} while(0)
+
+__attribute__((target("avx2")))
+static void Tensor_sum_avx2(const TensorData_t *x, size_t n, struct TensorReduceAcc *acc) {
+	__m256d s0 = _mm256_setzero_pd(), s1 = s0, c0 = s0, c1 = s0, t, z;
+	size_t i = 0;
+	for(; i + 8 <= n; i += 8) {
+		TENSOR_TWO_SUM(_mm256_add_pd, _mm256_sub_pd, s0, c0, _mm256_loadu_pd(x + i));
+		TENSOR_TWO_SUM(_mm256_add_pd, _mm256_sub_pd, s1, c1, _mm256_loadu_pd(x + i + 4));
+	}
+	TensorData_t s[8], c[8];
+	_mm256_storeu_pd(s, s0);
+	_mm256_storeu_pd(s + 4, s1);
+	_mm256_storeu_pd(c, c0);
+	_mm256_storeu_pd(c + 4, c1);
+	for(int j = 0; j < 8; j++) {
+		TensorReduce_addCompensated(acc, s[j]);
+		acc->comp += c[j];
+	}
+	for(; i < n; i++) TensorReduce_addCompensated(acc, x[i]);
+}
+
+__attribute__((target("avx512f")))
+static void Tensor_sum_avx512(const TensorData_t *x, size_t n, struct TensorReduceAcc *acc) {
+	__m512d s0 = _mm512_setzero_pd(), c0 = s0, t, z;
+	size_t i = 0;
+	for(; i + 8 <= n; i += 8) {
+		TENSOR_TWO_SUM(_mm512_add_pd, _mm512_sub_pd, s0, c0, _mm512_loadu_pd(x + i));
+	}
+	TensorData_t s[8], c[8];
+	_mm512_storeu_pd(s, s0);
+	_mm512_storeu_pd(c, c0);
+	for(int j = 0; j < 8; j++) {
+		TensorReduce_addCompensated(acc, s[j]);
+		acc->comp += c[j];
+	}
+	for(; i < n; i++) TensorReduce_addCompensated(acc, x[i]);
+}
+
+// _mm256_max_pd returns its second operand when comparing to NaN, like the C kernels.
+__attribute__((target("avx2")))
+static TensorData_t Tensor_max_avx2(const TensorData_t *x, size_t n) {
+	__m256d m = _mm256_set1_pd(-INFINITY);
+	size_t i = 0;
+	for(; i + 4 <= n; i += 4) m = _mm256_max_pd(_mm256_loadu_pd(x + i), m);
+	TensorData_t r[4];
+	_mm256_storeu_pd(r, m);
+	TensorData_t result = Tensor_max_c(r, 4);
+	for(; i < n; i++) result = x[i] > result ? x[i] : result;
+	return result;
+}
+
+__attribute__((target("avx2")))
+static TensorData_t Tensor_min_avx2(const TensorData_t *x, size_t n) {
+	__m256d m = _mm256_set1_pd(INFINITY);
+	size_t i = 0;
+	for(; i + 4 <= n; i += 4) m = _mm256_min_pd(_mm256_loadu_pd(x + i), m);
+	TensorData_t r[4];
+	_mm256_storeu_pd(r, m);
+	TensorData_t result = Tensor_min_c(r, 4);
+	for(; i < n; i++) result = x[i] < result ? x[i] : result;
+	return result;
+}
+#endif
+
+static const struct TensorReduceKernels {
+	void (*sum)(const TensorData_t *x, size_t n, struct TensorReduceAcc *acc);
+	TensorData_t (*max)(const TensorData_t *x, size_t n);
+	TensorData_t (*min)(const TensorData_t *x, size_t n);
+} reduceKernels[] = {
+	[TENSOR_SIMD_SCALAR] = {Tensor_sum_c, Tensor_max_c, Tensor_min_c},
+#ifdef TENSOR_X86
+	[TENSOR_SIMD_SSE2] = {Tensor_sum_c, Tensor_max_c, Tensor_min_c},
+	[TENSOR_SIMD_AVX2] = {Tensor_sum_avx2, Tensor_max_avx2, Tensor_min_avx2},
+	[TENSOR_SIMD_AVX512] = {Tensor_sum_avx512, Tensor_max_avx2, Tensor_min_avx2},
+#endif
+};
+
+// Reduces n dense elements, the first of which has the given index.
+static void TensorReduce_addDense(const struct TensorReduceKernels *k, enum TensorReduceOp op, struct TensorReduceAcc *acc, const TensorData_t *x, size_t n, TensorIndex_t index) {
+	if(op == TENSOR_REDUCE_SUM || op == TENSOR_REDUCE_MEAN) {
+		k->sum(x, n, acc);
+		return;
+	}
+	const TensorData_t m = op == TENSOR_REDUCE_MIN ? k->min(x, n) : k->max(x, n);
+	if(op == TENSOR_REDUCE_MIN ? m < acc->value : m > acc->value) {
+		// the extreme is known, so the scan for its first position can stop early.
+		size_t i = 0;
+		while(i + 1 < n && x[i] != m) i++;
+		acc->value = m;
+		acc->index = index + i;
+	}
+}
+
+static void TensorReduce_addStrided(const struct TensorReduceKernels *k, enum TensorReduceOp op, struct TensorReduceAcc *acc, const TensorData_t *x, size_t n, TensorIndex_t stride, TensorIndex_t index) {
+	if(stride == 1) {
+		TensorReduce_addDense(k, op, acc, x, n, index);
+		return;
+	}
+	for(size_t i = 0; i < n; i++) {
+		TensorReduce_addOne(op, acc, x[i * stride], index + i);
+	}
+}
+
+// ---Reduce all---
+
+struct TensorReduceAllTask {
+	enum TensorReduceOp op;
+	TensorIter iter;
+	const struct TensorReduceKernels *kernels;
+	struct TensorReduceAcc *partials;
+	TensorIndex_t grain;
+};
+
+static void TensorReduce_allRange(const struct TensorReduceAllTask *task, TensorIter *iter, struct TensorReduceAcc *acc) {
+	TensorReduce_init(task->op, acc);
+	while(TensorIter_next(iter)) {
+		TensorReduce_addStrided(task->kernels, task->op, acc, iter->ptr[0], iter->count, iter->inner_strides[0], iter->pos);
+	}
+}
+
+static void* TensorReduce_allJob(void *args) {
+	struct range_args *range = (struct range_args*)args;
+	const struct TensorReduceAllTask *task = (const struct TensorReduceAllTask*)range->args;
+	TensorIter iter = task->iter;
+	TensorIter_range(&iter, range->begin, range->end);
+	TensorReduce_allRange(task, &iter, &task->partials[range->begin / task->grain]);
+	return NULL;
+}
+
+TensorData_t Tensor_reduce_all(enum TensorReduceOp op, TensorObject *a) {
+	if(a->dtype != TENSOR_FLOAT64) {
+		// the kernels read TensorData_t, other dtypes are reduced from a converted copy.
+		TensorObject copy = Tensor_astype(*a, TENSOR_FLOAT64);
+		const TensorData_t result = copy.storage != NULL ? Tensor_reduce_all(op, &copy) : NAN;
+		Tensor_free(&copy);
+		return result;
+	}
+	struct TensorReduceAllTask task = {.op = op, .kernels = &reduceKernels[Tensor_simd_level()]};
+	struct TensorReduceAcc acc;
+	TensorIter_init(&task.iter, 1, (TensorObject*[]){a});
+	const TensorIndex_t size = task.iter.size;
+	if(size < TENSOR_REDUCE_PARALLEL_THRESHOLD) {
+		TensorReduce_allRange(&task, &task.iter, &acc);
+		return TensorReduce_result(op, &acc, size);
+	}
+	task.grain = Tensor_loop_grain(size, 0);
+	if(task.grain < TENSOR_REDUCE_PARALLEL_THRESHOLD / 4) {
+		task.grain = TENSOR_REDUCE_PARALLEL_THRESHOLD / 4;
+	}
+	const size_t chunks = (size + task.grain - 1) / task.grain;
+	task.partials = calloc(chunks, sizeof(struct TensorReduceAcc));
+	if(task.partials == NULL) {
+		return NAN;
+	}
+	Tensor_parallel_for(size, task.grain, TensorReduce_allJob, &task);
+	TensorReduce_tree(op, task.partials, chunks, 1);
+	acc = task.partials[0];
+	free(task.partials);
+	return TensorReduce_result(op, &acc, size);
+}
+
+// ---Reduce along an axis---
+
+struct TensorReduceAxisTask {
+	enum TensorReduceOp op;
+	TensorIter iter; ///< Over dst and a at index 0 along axis, both with axis of size 1.
+	const struct TensorReduceKernels *kernels;
+	TensorIndex_t length; ///< Size of the reduced axis.
+	TensorIndex_t stride; ///< Stride of the reduced axis in a.
+	TensorIndex_t axis_grain; ///< Axis indices per partial result when the axis is split.
+	TensorIndex_t outputs; ///< Number of elements of dst.
+	struct TensorReduceAcc *partials; ///< axis chunks x outputs partial results, NULL if the axis is not split.
+};
+
+// Reduces axis indices [l0, l1) for the outputs walked by iter.
+// Results are written to dst, or to out, indexed by output position, if it isn't NULL.
+static void TensorReduce_axisRange(const struct TensorReduceAxisTask *task, TensorIter *iter, TensorIndex_t l0, TensorIndex_t l1, struct TensorReduceAcc *out) {
+	const enum TensorReduceOp op = task->op;
+	struct TensorReduceAcc acc[TENSOR_REDUCE_BLOCK];
+	while(TensorIter_next(iter)) {
+		TensorData_t *dst = iter->ptr[0];
+		const TensorData_t *src = iter->ptr[1];
+		const TensorIndex_t dst_stride = iter->inner_strides[0];
+		const TensorIndex_t src_stride = iter->inner_strides[1];
+		for(TensorIndex_t e0 = 0; e0 < iter->count; e0 += TENSOR_REDUCE_BLOCK) {
+			const TensorIndex_t block = iter->count - e0 < TENSOR_REDUCE_BLOCK ? iter->count - e0 : TENSOR_REDUCE_BLOCK;
+			for(TensorIndex_t e = 0; e < block; e++) {
+				TensorReduce_init(op, &acc[e]);
+			}
+			if(task->stride == 1) {
+				// the reduced axis is contiguous, reduce each output on its own.
+				for(TensorIndex_t e = 0; e < block; e++) {
+					TensorReduce_addDense(task->kernels, op, &acc[e], src + (e0 + e) * src_stride + l0, l1 - l0, l0);
+				}
+			} else {
+				// walk the axis in the outer loop, so that the inner loop reads neighbouring outputs.
+				for(TensorIndex_t l = l0; l < l1; l++) {
+					const TensorData_t *row = src + l * task->stride + e0 * src_stride;
+					for(TensorIndex_t e = 0; e < block; e++) {
+						TensorReduce_addOne(op, &acc[e], row[e * src_stride], l);
+					}
+				}
+			}
+			for(TensorIndex_t e = 0; e < block; e++) {
+				if(out != NULL) {
+					out[iter->pos + e0 + e] = acc[e];
+				} else {
+					dst[(e0 + e) * dst_stride] = TensorReduce_result(op, &acc[e], task->length);
+				}
+			}
+		}
+	}
+}
+
+// Splits the outputs between jobs.
+static void* TensorReduce_outputJob(void *args) {
+	struct range_args *range = (struct range_args*)args;
+	const struct TensorReduceAxisTask *task = (const struct TensorReduceAxisTask*)range->args;
+	TensorIter iter = task->iter;
+	TensorIter_range(&iter, range->begin, range->end);
+	TensorReduce_axisRange(task, &iter, 0, task->length, NULL);
+	return NULL;
+}
+
+// Splits the reduced axis between jobs, each computing partial results for every output.
+static void* TensorReduce_axisJob(void *args) {
+	struct range_args *range = (struct range_args*)args;
+	const struct TensorReduceAxisTask *task = (const struct TensorReduceAxisTask*)range->args;
+	TensorIter iter = task->iter;
+	for(TensorIndex_t chunk = range->begin; chunk < range->end; chunk++) {
+		TensorIndex_t l0 = chunk * task->axis_grain;
+		TensorIndex_t l1 = l0 + task->axis_grain < task->length ? l0 + task->axis_grain : task->length;
+		TensorIter_range(&iter, 0, task->outputs);
+		TensorReduce_axisRange(task, &iter, l0, l1, &task->partials[chunk * task->outputs]);
+	}
+	return NULL;
+}
+
+// Reduces TENSOR_FLOAT64 copies of a and dst, and converts the result back into dst.
+static int TensorReduce_converted(enum TensorReduceOp op, TensorObject *a, const TensorShape_t axis, TensorObject *dst) {
+	TensorObject src_copy = Tensor_astype(*a, TENSOR_FLOAT64);
+	TensorObject dst_copy = Tensor_astype(*dst, TENSOR_FLOAT64);
+	int status = -1;
+	if(src_copy.storage != NULL && dst_copy.storage != NULL) {
+		status = Tensor_reduce(op, &src_copy, axis, &dst_copy);
+	}
+	if(status == 0) {
+		status = Tensor_write_to(&dst_copy, dst);
+	}
+	Tensor_free(&src_copy);
+	Tensor_free(&dst_copy);
+	return status;
+}
+
+int Tensor_reduce(enum TensorReduceOp op, TensorObject *a, const TensorShape_t axis, TensorObject *dst) {
+	if(a->dtype != TENSOR_FLOAT64 || dst->dtype != TENSOR_FLOAT64) {
+		return TensorReduce_converted(op, a, axis, dst);
+	}
+	if(axis >= a->ndim || a->ndim > TENSOR_ITER_MAX_NDIM || Tensor_make_writable(dst) != 0) {
+		return -1;
+	}
+	// View both tensors with a's dimensions and the reduced axis of size 1.
+	const int keepdims = dst->ndim == a->ndim;
+	if(!keepdims && dst->ndim + 1 != a->ndim) {
+		return -1;
+	}
+	TensorObject src_view = *a, dst_view = *dst;
+	dst_view.ndim = a->ndim;
+	for(TensorShape_t d = 0, j = 0; d < a->ndim; d++) {
+		if(d == axis) {
+			src_view.shape[d] = 1;
+			dst_view.shape[d] = 1;
+			dst_view.strides[d] = 0;
+			if(keepdims && dst->shape[d] != 1) {
+				return -1;
+			}
+			j += keepdims;
+			continue;
+		}
+		if(dst->shape[j] != a->shape[d]) {
+			return -1;
+		}
+		dst_view.shape[d] = a->shape[d];
+		dst_view.strides[d] = dst->strides[j++];
+	}
+
+	struct TensorReduceAxisTask task = {
+		.op = op,
+		.kernels = &reduceKernels[Tensor_simd_level()],
+		.length = a->shape[axis],
+		.stride = a->strides[axis],
+	};
+	TensorIter_init(&task.iter, 2, (TensorObject*[]){&dst_view, &src_view});
+	task.outputs = task.iter.size;
+	const size_t work = (size_t)task.outputs * task.length;
+	if(work < TENSOR_REDUCE_PARALLEL_THRESHOLD) {
+		TensorReduce_axisRange(&task, &task.iter, 0, task.length, NULL);
+		return 0;
+	}
+	const TensorIndex_t threads = Tensor_num_threads();
+	if(task.outputs >= threads * TENSOR_LOOP_CHUNKS_PER_THREAD || task.length < 2 * TENSOR_REDUCE_BLOCK) {
+		Tensor_parallel_for(task.outputs, 0, TensorReduce_outputJob, &task);
+		return 0;
+	}
+	// Few outputs along a long axis: every job reduces part of the axis, the parts are combined afterwards.
+	task.axis_grain = Tensor_loop_grain(task.length, 0);
+	if(task.axis_grain < TENSOR_REDUCE_BLOCK) {
+		task.axis_grain = TENSOR_REDUCE_BLOCK;
+	}
+	const TensorIndex_t chunks = (task.length + task.axis_grain - 1) / task.axis_grain;
+	task.partials = calloc((size_t)chunks * task.outputs, sizeof(struct TensorReduceAcc));
+	if(task.partials == NULL) {
+		return -1;
+	}
+	Tensor_parallel_for(chunks, 1, TensorReduce_axisJob, &task);
+	for(TensorIndex_t o = 0; o < task.outputs; o++) {
+		TensorReduce_tree(op, &task.partials[o], chunks, task.outputs);
+	}
+	TensorIter_range(&task.iter, 0, task.outputs);
+	while(TensorIter_next(&task.iter)) {
+		for(TensorIndex_t e = 0; e < task.iter.count; e++) {
+			((TensorData_t*)task.iter.ptr[0])[e * task.iter.inner_strides[0]] = TensorReduce_result(op, &task.partials[task.iter.pos + e], task.length);
+		}
+	}
+	free(task.partials);
+	return 0;
+}
+
+// ---Public API---
+
+int Tensor_sum(TensorObject *a, const TensorShape_t axis, TensorObject *dst) {
+	return Tensor_reduce(TENSOR_REDUCE_SUM, a, axis, dst);
+}
+
+int Tensor_mean(TensorObject *a, const TensorShape_t axis, TensorObject *dst) {
+	return Tensor_reduce(TENSOR_REDUCE_MEAN, a, axis, dst);
+}
+
+int Tensor_max(TensorObject *a, const TensorShape_t axis, TensorObject *dst) {
+	return Tensor_reduce(TENSOR_REDUCE_MAX, a, axis, dst);
+}
+
+int Tensor_min(TensorObject *a, const TensorShape_t axis, TensorObject *dst) {
+	return Tensor_reduce(TENSOR_REDUCE_MIN, a, axis, dst);
+}
+
+int Tensor_argmax(TensorObject *a, const TensorShape_t axis, TensorObject *dst) {
+	return Tensor_reduce(TENSOR_REDUCE_ARGMAX, a, axis, dst);
+}
+
+TensorData_t Tensor_sum_all(TensorObject *a) {
+	return Tensor_reduce_all(TENSOR_REDUCE_SUM, a);
+}
+
+TensorData_t Tensor_mean_all(TensorObject *a) {
+	return Tensor_reduce_all(TENSOR_REDUCE_MEAN, a);
+}
+
+TensorData_t Tensor_max_all(TensorObject *a) {
+	return Tensor_reduce_all(TENSOR_REDUCE_MAX, a);
+}
+
+TensorData_t Tensor_min_all(TensorObject *a) {
+	return Tensor_reduce_all(TENSOR_REDUCE_MIN, a);
+}
+
+TensorIndex_t Tensor_argmax_all(TensorObject *a) {
+	return (TensorIndex_t)Tensor_reduce_all(TENSOR_REDUCE_ARGMAX, a);
+}
@@ -1,23 +1,29 @@
 #include "tensor.h"
 #include <CUnit/CUnit.h>
+#include "tensor/alloc.h"
+#include "tensor/parallel.h"
+#include <stdint.h>
 
 // Test 2 dimensional tensor allocation
 static void test_tensor_alloc() {
-	TensorObject tensor = Tensor_new(2, (TensorShape_t[]){2, 3});
+	TensorObject tensor = Tensor_new(2, (TensorIndex_t[]){2, 3});
 	CU_ASSERT_EQUAL(tensor.ndim, 2);
 	CU_ASSERT_EQUAL(tensor.shape[0], 2);
 	CU_ASSERT_EQUAL(tensor.shape[1], 3);
 	CU_ASSERT_EQUAL(tensor.strides[0], 3);
 	CU_ASSERT_EQUAL(tensor.strides[1], 1);
+	CU_ASSERT_EQUAL(tensor.data, tensor.storage->buffer);
+	CU_ASSERT_EQUAL(tensor.storage->ref_count, 1);
+	CU_ASSERT_EQUAL(tensor.storage->size, 6 * sizeof(TensorData_t));
 	Tensor_free(&tensor);
-	CU_ASSERT_PTR_NULL(tensor.shape);
-	CU_ASSERT_PTR_NULL(tensor.strides);
+	CU_ASSERT_EQUAL(tensor.ndim, 0);
+	CU_ASSERT_PTR_NULL(tensor.storage);
 	CU_ASSERT_PTR_NULL(tensor.data);
 }
 
 // Test 3 dimensional tensor allocation
 static void test_tensor_alloc_2() {
-	TensorObject tensor = Tensor_new(3, (TensorShape_t[]){2, 3, 4});
+	TensorObject tensor = Tensor_new(3, (TensorIndex_t[]){2, 3, 4});
 	CU_ASSERT_EQUAL(tensor.ndim, 3);
 	CU_ASSERT_EQUAL(tensor.shape[0], 2);
 	CU_ASSERT_EQUAL(tensor.shape[1], 3);
@@ -26,56 +32,278 @@ static void test_tensor_alloc_2() {
 	CU_ASSERT_EQUAL(tensor.strides[1], 4);
 	CU_ASSERT_EQUAL(tensor.strides[2], 1);
 	Tensor_free(&tensor);
-	CU_ASSERT_PTR_NULL(tensor.shape);
-	CU_ASSERT_PTR_NULL(tensor.strides);
+	CU_ASSERT_EQUAL(tensor.ndim, 0);
+	CU_ASSERT_PTR_NULL(tensor.storage);
 	CU_ASSERT_PTR_NULL(tensor.data);
 }
 
 // Test that the allocations are the same after cloning
 static void test_tensor_clone_allocations() {
-	TensorObject tensor = Tensor_new(2, (TensorShape_t[]){2, 3});
+	TensorObject tensor = Tensor_new(2, (TensorIndex_t[]){2, 3});
 	TensorObject clone = Tensor_clone(tensor);
 	CU_ASSERT_EQUAL(clone.ndim, 2);
 	CU_ASSERT_EQUAL(clone.shape[0], 2);
 	CU_ASSERT_EQUAL(clone.shape[1], 3);
 	CU_ASSERT_EQUAL(clone.strides[0], 3);
 	CU_ASSERT_EQUAL(clone.strides[1], 1);
+	CU_ASSERT_NOT_EQUAL(clone.storage, tensor.storage);
 	Tensor_free(&tensor);
-	CU_ASSERT_PTR_NULL(tensor.shape);
-	CU_ASSERT_PTR_NULL(tensor.strides);
+	CU_ASSERT_EQUAL(tensor.ndim, 0);
+	CU_ASSERT_PTR_NULL(tensor.storage);
 	CU_ASSERT_PTR_NULL(tensor.data);
 	Tensor_free(&clone);
-	CU_ASSERT_PTR_NULL(clone.shape);
-	CU_ASSERT_PTR_NULL(clone.strides);
+	CU_ASSERT_EQUAL(clone.ndim, 0);
+	CU_ASSERT_PTR_NULL(clone.storage);
 	CU_ASSERT_PTR_NULL(clone.data);
 }
 
 // Test that the data is the same after cloning
 static void test_tensor_clone_data() {
-	TensorObject tensor = Tensor_new(2, (TensorShape_t[]){2, 3});
-	Tensor_set(&tensor, (TensorShape_t[]){0, 0}, 1.0);
-	Tensor_set(&tensor, (TensorShape_t[]){0, 1}, 2.0);
-	Tensor_set(&tensor, (TensorShape_t[]){0, 2}, 3.0);
-	Tensor_set(&tensor, (TensorShape_t[]){1, 0}, 4.0);
-	Tensor_set(&tensor, (TensorShape_t[]){1, 1}, 5.0);
-	Tensor_set(&tensor, (TensorShape_t[]){1, 2}, 6.0);
+	TensorObject tensor = Tensor_new(2, (TensorIndex_t[]){2, 3});
+	Tensor_set(&tensor, (TensorIndex_t[]){0, 0}, 1.0);
+	Tensor_set(&tensor, (TensorIndex_t[]){0, 1}, 2.0);
+	Tensor_set(&tensor, (TensorIndex_t[]){0, 2}, 3.0);
+	Tensor_set(&tensor, (TensorIndex_t[]){1, 0}, 4.0);
+	Tensor_set(&tensor, (TensorIndex_t[]){1, 1}, 5.0);
+	Tensor_set(&tensor, (TensorIndex_t[]){1, 2}, 6.0);
 	TensorObject clone = Tensor_clone(tensor);
 	// test that the data is the same
-	CU_ASSERT_EQUAL(*Tensor_get(&clone, (TensorShape_t[]){0, 0}), 1.0);
-	CU_ASSERT_EQUAL(*Tensor_get(&clone, (TensorShape_t[]){0, 1}), 2.0);
-	CU_ASSERT_EQUAL(*Tensor_get(&clone, (TensorShape_t[]){0, 2}), 3.0);
-	CU_ASSERT_EQUAL(*Tensor_get(&clone, (TensorShape_t[]){1, 0}), 4.0);
-	CU_ASSERT_EQUAL(*Tensor_get(&clone, (TensorShape_t[]){1, 1}), 5.0);
-	CU_ASSERT_EQUAL(*Tensor_get(&clone, (TensorShape_t[]){1, 2}), 6.0);
+	CU_ASSERT_EQUAL(*Tensor_get(&clone, (TensorIndex_t[]){0, 0}), 1.0);
+	CU_ASSERT_EQUAL(*Tensor_get(&clone, (TensorIndex_t[]){0, 1}), 2.0);
+	CU_ASSERT_EQUAL(*Tensor_get(&clone, (TensorIndex_t[]){0, 2}), 3.0);
+	CU_ASSERT_EQUAL(*Tensor_get(&clone, (TensorIndex_t[]){1, 0}), 4.0);
+	CU_ASSERT_EQUAL(*Tensor_get(&clone, (TensorIndex_t[]){1, 1}), 5.0);
+	CU_ASSERT_EQUAL(*Tensor_get(&clone, (TensorIndex_t[]){1, 2}), 6.0);
 	Tensor_free(&tensor);
 	Tensor_free(&clone);
 	
 }
 
+// Test that cloning a swapped view produces a contiguous copy in the view's order
+static void test_tensor_clone_swapped() {
+	TensorObject tensor = Tensor_new(3, (TensorIndex_t[]){2, 3, 4});
+	for(TensorIndex_t i = 0; i < 2 * 3 * 4; i++) {
+		tensor.data[i] = i;
+	}
+	Tensor_swapaxis(&tensor, 0, 2);
+	TensorObject clone = Tensor_clone(tensor);
+	CU_ASSERT_EQUAL(clone.strides[0], 6);
+	CU_ASSERT_EQUAL(clone.strides[1], 2);
+	CU_ASSERT_EQUAL(clone.strides[2], 1);
+	for(TensorIndex_t i = 0; i < 4; i++) {
+		for(TensorIndex_t j = 0; j < 3; j++) {
+			for(TensorIndex_t k = 0; k < 2; k++) {
+				CU_ASSERT_EQUAL(*Tensor_get(&clone, (TensorIndex_t[]){i, j, k}), *Tensor_get(&tensor, (TensorIndex_t[]){i, j, k}));
+			}
+		}
+	}
+	Tensor_free(&tensor);
+	Tensor_free(&clone);
+}
+
+// A lazy clone shares the data until one side writes.
+static void test_tensor_clone_lazy() {
+	TensorObject tensor = Tensor_new(2, (TensorIndex_t[]){3, 4});
+	for(TensorIndex_t i = 0; i < 12; i++) tensor.data[i] = i;
+	TensorObject clone = Tensor_clone_lazy(tensor);
+	TensorObject clone_row = Tensor_slice(&clone, 0, 1);
+	CU_ASSERT_EQUAL(Tensor_data(&clone), Tensor_data(&tensor));
+	CU_ASSERT_EQUAL(*Tensor_get_const(&clone, (TensorIndex_t[]){2, 3}), 11);
+	CU_ASSERT_EQUAL(Tensor_data(&clone), Tensor_data(&tensor));
+	// writing to the clone copies, the slice of the clone follows.
+	Tensor_set(&clone, (TensorIndex_t[]){1, 2}, 100);
+	CU_ASSERT_NOT_EQUAL(Tensor_data(&clone), Tensor_data(&tensor));
+	CU_ASSERT_EQUAL(*Tensor_get_const(&clone_row, (TensorIndex_t[]){2}), 100);
+	CU_ASSERT_EQUAL(*Tensor_get_const(&tensor, (TensorIndex_t[]){1, 2}), 6);
+	// the parent isn't shared anymore, so it writes in place.
+	TensorData_t *data = Tensor_data(&tensor);
+	*Tensor_get(&tensor, (TensorIndex_t[]){0, 0}) = -1;
+	CU_ASSERT_EQUAL(Tensor_data(&tensor), data);
+	CU_ASSERT_EQUAL(*Tensor_get_const(&clone, (TensorIndex_t[]){0, 0}), 0);
+	Tensor_free(&clone_row);
+	Tensor_free(&clone);
+	Tensor_free(&tensor);
+}
+
+// Writing to the parent copies the parent, and a clone left alone takes over the buffer.
+static void test_tensor_clone_lazy_parent() {
+	TensorObject tensor = Tensor_new(2, (TensorIndex_t[]){3, 4});
+	for(TensorIndex_t i = 0; i < 12; i++) tensor.data[i] = i;
+	TensorObject clone = Tensor_clone_lazy(tensor);
+	TensorObject clone2 = Tensor_clone_lazy(clone);
+	TensorData_t *data = Tensor_data(&tensor);
+	TensorObject zeros = Tensor_new(1, (TensorIndex_t[]){4});
+	CU_ASSERT_EQUAL(Tensor_write_to(&zeros, &tensor), 0);
+	CU_ASSERT_NOT_EQUAL(Tensor_data(&tensor), data);
+	CU_ASSERT_EQUAL(Tensor_data(&clone), data);
+	CU_ASSERT_EQUAL(*Tensor_get_const(&clone2, (TensorIndex_t[]){2, 1}), 9);
+	Tensor_free(&clone2);
+	Tensor_set(&clone, (TensorIndex_t[]){2, 1}, 0);
+	CU_ASSERT_EQUAL(Tensor_data(&clone), data);
+	CU_ASSERT_EQUAL(*Tensor_get_const(&tensor, (TensorIndex_t[]){2, 2}), 0);
+	// slices don't cover their buffer, their clones are copied right away.
+	TensorObject row = Tensor_slice(&tensor, 0, 1);
+	TensorObject row_clone = Tensor_clone_lazy(row);
+	CU_ASSERT_NOT_EQUAL(Tensor_data(&row_clone), Tensor_data(&tensor));
+	CU_ASSERT_EQUAL(row_clone.storage->size, 4 * sizeof(TensorData_t));
+	Tensor_free(&row_clone);
+	Tensor_free(&row);
+	Tensor_free(&zeros);
+	Tensor_free(&clone);
+	Tensor_free(&tensor);
+}
+
+// Freed buffers are reused for tensors of the same size class, and zeroed again.
+static void test_tensor_alloc_pool() {
+	struct TensorAllocStats before, after;
+	Tensor_alloc_configure(1, 0, 0);
+	Tensor_alloc_stats(&before);
+	TensorObject a = Tensor_new(2, (TensorIndex_t[]){100, 100});
+	TensorData_t *data = a.data;
+	a.data[9999] = 1;
+	Tensor_free(&a);
+	TensorObject b = Tensor_new(2, (TensorIndex_t[]){99, 101});
+	CU_ASSERT_EQUAL(b.data, data);
+	CU_ASSERT_EQUAL(b.data[9998], 0);
+	Tensor_alloc_stats(&after);
+	CU_ASSERT_EQUAL(after.hits, before.hits + 1);
+	CU_ASSERT_EQUAL(after.misses, before.misses + 1);
+	Tensor_free(&b);
+	Tensor_alloc_stats(&after);
+	CU_ASSERT_EQUAL(after.cached_buffers, before.cached_buffers + 1);
+	CU_ASSERT(Tensor_alloc_trim(0) >= 100 * 100 * sizeof(TensorData_t));
+	Tensor_alloc_stats(&after);
+	CU_ASSERT_EQUAL(after.cached_bytes, 0);
+	CU_ASSERT_EQUAL(after.cached_buffers, 0);
+	Tensor_alloc_configure(0, 0, 0);
+}
+
+static void test_tensor_alloc_pool_limits() {
+	struct TensorAllocStats stats;
+	Tensor_alloc_configure(1, 4096, 1024);
+	TensorObject small = Tensor_new(1, (TensorIndex_t[]){100});
+	TensorObject large = Tensor_new(1, (TensorIndex_t[]){200});
+	Tensor_free(&small);
+	Tensor_free(&large);
+	Tensor_alloc_stats(&stats);
+	CU_ASSERT_EQUAL(stats.cached_buffers, 1);
+	Tensor_alloc_trim(0);
+	// only four buffers of 1024 bytes fit under the cap.
+	TensorObject tensors[6];
+	for(int i = 0; i < 6; i++) tensors[i] = Tensor_new(1, (TensorIndex_t[]){128});
+	for(int i = 0; i < 6; i++) Tensor_free(&tensors[i]);
+	Tensor_alloc_stats(&stats);
+	CU_ASSERT(stats.cached_bytes <= 4096);
+	CU_ASSERT_EQUAL(stats.cached_buffers, 4);
+	Tensor_alloc_configure(0, 0, 0);
+	Tensor_alloc_stats(&stats);
+	CU_ASSERT_EQUAL(stats.cached_buffers, 0);
+}
+
+static void* alloc_job(void *args) {
+	struct range_args *range = (struct range_args*)args;
+	int *ok = (int*)range->args;
+	for(TensorIndex_t i = range->begin; i < range->end; i++) {
+		TensorObject t = Tensor_new(1, (TensorIndex_t[]){1 + i % 37});
+		TensorObject c = Tensor_clone(t);
+		if(t.data[i % 37] != 0) *ok = 0;
+		t.data[i % 37] = i;
+		Tensor_free(&c);
+		Tensor_free(&t);
+	}
+	return NULL;
+}
+
+static void test_tensor_alloc_pool_threads() {
+	int ok = 1;
+	Tensor_alloc_configure(1, 0, 0);
+	Tensor_parallel_for(4000, 10, alloc_job, &ok);
+	CU_ASSERT(ok);
+	Tensor_alloc_configure(0, 0, 0);
+}
+
+// Every buffer starts on TENSOR_ALIGNMENT, whatever its size, dtype and origin.
+static void test_tensor_alloc_aligned() {
+	for(int pooled = 0; pooled < 2; pooled++) {
+		Tensor_alloc_configure(pooled, 0, 0);
+		int ok = 1;
+		for(TensorIndex_t n = 1; n < 300; n += 7) {
+			TensorObject tensor = Tensor_new_dtype(1, (TensorIndex_t[]){n}, n % 2 ? TENSOR_INT8 : TENSOR_FLOAT64);
+			TensorObject clone = Tensor_clone(tensor);
+			TensorObject lazy = Tensor_clone_lazy(tensor);
+			Tensor_make_writable(&lazy);
+			ok &= (uintptr_t)Tensor_data(&tensor) % TENSOR_ALIGNMENT == 0;
+			ok &= (uintptr_t)Tensor_data(&clone) % TENSOR_ALIGNMENT == 0;
+			ok &= (uintptr_t)Tensor_data(&lazy) % TENSOR_ALIGNMENT == 0;
+			Tensor_free(&lazy);
+			Tensor_free(&clone);
+			Tensor_free(&tensor);
+		}
+		CU_ASSERT(ok);
+	}
+	Tensor_alloc_configure(0, 0, 0);
+}
+
+// Large buffers get a zeroed mapping of their own, aligned on a huge page.
+static void test_tensor_alloc_huge() {
+	Tensor_alloc_configure_huge(1, 1 << 20);
+	struct TensorAllocStats stats;
+	TensorObject small = Tensor_new(1, (TensorIndex_t[]){1000});
+	TensorObject large = Tensor_new(2, (TensorIndex_t[]){512, 512});
+	Tensor_alloc_stats(&stats);
+	if(stats.huge_buffers != 0) {
+		// mmap may be unavailable, the buffer then comes from the usual allocator.
+		CU_ASSERT_EQUAL(stats.huge_buffers, 1);
+		CU_ASSERT_EQUAL(stats.huge_bytes, 2 * TENSOR_ALLOC_HUGE_PAGE);
+		CU_ASSERT_EQUAL((uintptr_t)large.storage % TENSOR_ALLOC_HUGE_PAGE, 0);
+	}
+	CU_ASSERT_EQUAL((uintptr_t)large.data % TENSOR_ALIGNMENT, 0);
+	int ok = 1;
+	for(TensorIndex_t i = 0; i < 512 * 512; i++) ok &= large.data[i] == 0;
+	CU_ASSERT(ok);
+	for(TensorIndex_t i = 0; i < 512 * 512; i++) large.data[i] = i;
+	TensorObject clone = Tensor_clone(large);
+	CU_ASSERT_EQUAL(clone.data[512 * 512 - 1], 512 * 512 - 1);
+	Tensor_alloc_configure_huge(0, 0);
+	Tensor_free(&clone);
+	Tensor_free(&large);
+	Tensor_free(&small);
+	Tensor_alloc_stats(&stats);
+	CU_ASSERT_EQUAL(stats.huge_buffers, 0);
+	CU_ASSERT_EQUAL(stats.huge_bytes, 0);
+}
+
+// Sizes whose byte count doesn't fit in size_t give tensors without storage instead of small buffers.
+static void test_tensor_alloc_overflow() {
+	TensorObject wrapped = Tensor_new(2, (TensorIndex_t[]){1ULL << 62, 8});
+	CU_ASSERT_PTR_NULL(wrapped.storage);
+	CU_ASSERT_PTR_NULL(wrapped.data);
+	CU_ASSERT_EQUAL(wrapped.shape[0], 1ULL << 62);
+	// fits in size_t, but not with the header and the alignment padding.
+	TensorObject padded = Tensor_new_dtype(1, (TensorIndex_t[]){SIZE_MAX - 8}, TENSOR_INT8);
+	CU_ASSERT_PTR_NULL(padded.storage);
+	Tensor_alloc_configure_huge(1, 1 << 20);
+	TensorObject mapped = Tensor_empty(1, (TensorIndex_t[]){SIZE_MAX - 8}, TENSOR_INT8);
+	CU_ASSERT_PTR_NULL(mapped.storage);
+	Tensor_alloc_configure_huge(0, 0);
+	Tensor_free(&wrapped);
+	Tensor_free(&padded);
+	Tensor_free(&mapped);
+}
+
 void tensor_alloc_suite_builder(void) {
 	CU_pSuite suite = CU_add_suite("tensor_alloc", NULL, NULL);
 	CU_add_test(suite, "tensor_alloc_2d", test_tensor_alloc);
 	CU_add_test(suite, "tensor_alloc_3d", test_tensor_alloc_2);
 	CU_add_test(suite, "tensor_clone", test_tensor_clone_allocations);
 	CU_add_test(suite, "tensor_clone_data", test_tensor_clone_data);
+	CU_add_test(suite, "tensor_clone_swapped", test_tensor_clone_swapped);
+	CU_add_test(suite, "tensor_clone_lazy", test_tensor_clone_lazy);
+	CU_add_test(suite, "tensor_clone_lazy_parent", test_tensor_clone_lazy_parent);
+	CU_add_test(suite, "tensor_alloc_pool", test_tensor_alloc_pool);
+	CU_add_test(suite, "tensor_alloc_pool_limits", test_tensor_alloc_pool_limits);
+	CU_add_test(suite, "tensor_alloc_pool_threads", test_tensor_alloc_pool_threads);
+	CU_add_test(suite, "tensor_alloc_aligned", test_tensor_alloc_aligned);
+	CU_add_test(suite, "tensor_alloc_huge", test_tensor_alloc_huge);
+	CU_add_test(suite, "tensor_alloc_overflow", test_tensor_alloc_overflow);
 }
\ No newline at end of file
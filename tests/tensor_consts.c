@@ -0,0 +1,130 @@
+#include "tensor.h"
+#include <CUnit/CUnit.h>
+#include <math.h>
+#include <string.h>
+#include "tensor/constants.h"
+#include "tensor/parallel.h"
+#include "tensor/reduce.h"
+
+// The same seed gives the same values, whatever the number of threads.
+static void test_tensor_random_reproducible(void) {
+	const TensorIndex_t shape[] = {301, 299};
+	Tensor_random_seed(42);
+	TensorObject first = Tensor_random_uniform(2, shape, -1, 1);
+	TensorObject second = Tensor_random_uniform(2, shape, -1, 1);
+	CU_ASSERT_NOT_EQUAL(memcmp(first.data, second.data, first.storage->size), 0);
+	Tensor_cleanup();
+	Tensor_init_threads(1, TENSOR_AFFINITY_NONE);
+	Tensor_random_seed(42);
+	TensorObject serial = Tensor_random_uniform(2, shape, -1, 1);
+	Tensor_cleanup();
+	Tensor_init_threads(3, TENSOR_AFFINITY_NONE);
+	Tensor_random_seed(42);
+	TensorObject parallel = Tensor_random_uniform(2, shape, -1, 1);
+	Tensor_cleanup();
+	Tensor_init();
+	CU_ASSERT_EQUAL(memcmp(first.data, serial.data, first.storage->size), 0);
+	CU_ASSERT_EQUAL(memcmp(first.data, parallel.data, first.storage->size), 0);
+	Tensor_random_seed(43);
+	TensorObject other = Tensor_random_uniform(2, shape, -1, 1);
+	CU_ASSERT_NOT_EQUAL(memcmp(first.data, other.data, first.storage->size), 0);
+	Tensor_free(&first);
+	Tensor_free(&second);
+	Tensor_free(&serial);
+	Tensor_free(&parallel);
+	Tensor_free(&other);
+}
+
+static void test_tensor_random_uniform(void) {
+	TensorObject tensor = Tensor_random_uniform(1, (TensorIndex_t[]){100001}, 2, 5);
+	int ok = 1;
+	for(TensorIndex_t i = 0; i < 100001; i++) ok &= tensor.data[i] >= 2 && tensor.data[i] < 5;
+	CU_ASSERT(ok);
+	CU_ASSERT(fabs(Tensor_reduce_all(TENSOR_REDUCE_MEAN, &tensor) - 3.5) < 0.02);
+	// the last element of an odd size is set too.
+	CU_ASSERT_NOT_EQUAL(tensor.data[100000], 0);
+	TensorObject template = Tensor_new_dtype(1, (TensorIndex_t[]){7}, TENSOR_FLOAT32);
+	TensorObject like = Tensor_random_uniform_like(template, 0, 1);
+	CU_ASSERT_EQUAL(like.dtype, TENSOR_FLOAT32);
+	ok = 1;
+	for(TensorIndex_t i = 0; i < 7; i++) ok &= ((float*)like.data)[i] >= 0 && ((float*)like.data)[i] <= 1;
+	CU_ASSERT(ok);
+	ok = 1;
+	for(int i = 0; i < 1000; i++) {
+		const float x = generate_random_uniform(-3, -2);
+		ok &= x >= -3 && x <= -2;
+	}
+	CU_ASSERT(ok);
+	Tensor_free(&like);
+	Tensor_free(&template);
+	Tensor_free(&tensor);
+}
+
+static void test_tensor_random_normal(void) {
+	TensorObject tensor = Tensor_random_normal(2, (TensorIndex_t[]){400, 500}, 1, 3);
+	const TensorData_t mean = Tensor_reduce_all(TENSOR_REDUCE_MEAN, &tensor);
+	TensorData_t variance = 0;
+	for(TensorIndex_t i = 0; i < 200000; i++) variance += (tensor.data[i] - mean) * (tensor.data[i] - mean);
+	variance /= 200000;
+	CU_ASSERT(fabs(mean - 1) < 0.03);
+	CU_ASSERT(fabs(sqrt(variance) - 3) < 0.03);
+	int ok = 1;
+	for(TensorIndex_t i = 0; i < 200000; i++) ok &= isfinite(tensor.data[i]);
+	CU_ASSERT(ok);
+	Tensor_free(&tensor);
+}
+
+// Large constants are filled by the pool, small ones on the calling thread.
+static void test_tensor_consts_fill(void) {
+	const TensorIndex_t shapes[][3] = {{3, 4, 5}, {7, 300, 211}, {1, 1, 100003}};
+	for(int s = 0; s < 3; s++) {
+		const TensorIndex_t total = shapes[s][0] * shapes[s][1] * shapes[s][2];
+		TensorObject zeros = Tensor_zeros(3, shapes[s]);
+		TensorObject ones = Tensor_ones(3, shapes[s]);
+		int ok = 1;
+		for(TensorIndex_t i = 0; i < total; i++) ok &= zeros.data[i] == 0 && ones.data[i] == 1;
+		CU_ASSERT(ok);
+		Tensor_free(&zeros);
+		Tensor_free(&ones);
+	}
+	// a single long row is split in pages between several jobs.
+	Tensor_stats_enable(1);
+	Tensor_stats_reset();
+	TensorObject row = Tensor_ones(1, (TensorIndex_t[]){100003});
+	struct TensorPoolStats stats;
+	Tensor_stats_get(&stats);
+	Tensor_stats_enable(0);
+	CU_ASSERT(stats.jobs_submitted > 1);
+	int ok = 1;
+	for(TensorIndex_t i = 0; i < 100003; i++) ok &= row.data[i] == 1;
+	CU_ASSERT(ok);
+	Tensor_free(&row);
+	TensorObject scalar = Tensor_ones(0, NULL);
+	CU_ASSERT_EQUAL(scalar.data[0], 1);
+	Tensor_free(&scalar);
+	TensorObject empty = Tensor_ones(2, (TensorIndex_t[]){0, 5});
+	CU_ASSERT_EQUAL(empty.shape[0], 0);
+	Tensor_free(&empty);
+}
+
+static void test_tensor_consts_eye(void) {
+	const TensorIndex_t sizes[][3] = {{3, 4, 2}, {300, 400, 3}};
+	for(int s = 0; s < 2; s++) {
+		const TensorIndex_t size = sizes[s][0], cols = sizes[s][1], batch = sizes[s][2];
+		TensorObject eye = Tensor_eye(size, cols, batch);
+		CU_ASSERT_EQUAL(eye.ndim, 3);
+		int ok = 1;
+		for(TensorIndex_t i = 0; i < batch * size * cols; i++) ok &= eye.data[i] == (i % (size * cols) / cols == i % cols);
+		CU_ASSERT(ok);
+		Tensor_free(&eye);
+	}
+}
+
+void tensor_consts_suite_builder(void) {
+	CU_pSuite suite = CU_add_suite("tensor_consts", NULL, NULL);
+	CU_add_test(suite, "tensor_random_reproducible", test_tensor_random_reproducible);
+	CU_add_test(suite, "tensor_random_uniform", test_tensor_random_uniform);
+	CU_add_test(suite, "tensor_random_normal", test_tensor_random_normal);
+	CU_add_test(suite, "tensor_consts_fill", test_tensor_consts_fill);
+	CU_add_test(suite, "tensor_consts_eye", test_tensor_consts_eye);
+}
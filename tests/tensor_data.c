@@ -2,11 +2,11 @@
 #include <CUnit/CUnit.h>
 
 static void test_tensor_pointer_access(void) {
-	TensorObject tensor = Tensor_new(3, (TensorShape_t[]){2, 18, 5});
-	for(TensorShape_t i = 0; i < 2; i++) {
-		for(TensorShape_t j = 0; j < 18; j++) {
-			for(TensorShape_t k = 0; k < 5; k++) {
-				TensorData_t* x = Tensor_get(&tensor, (TensorShape_t[]){i, j, k});
+	TensorObject tensor = Tensor_new(3, (TensorIndex_t[]){2, 18, 5});
+	for(TensorIndex_t i = 0; i < 2; i++) {
+		for(TensorIndex_t j = 0; j < 18; j++) {
+			for(TensorIndex_t k = 0; k < 5; k++) {
+				TensorData_t* x = Tensor_get(&tensor, (TensorIndex_t[]){i, j, k});
 				CU_ASSERT_EQUAL(x, tensor.data + tensor.offset + k + 5 * j + 5 * 18 * i);
 			}
 		}
@@ -15,18 +15,18 @@ static void test_tensor_pointer_access(void) {
 }
 
 static void test_tensor_set(void) {
-	TensorObject tensor = Tensor_new(3, (TensorShape_t[]){2, 18, 5});
-	for(TensorShape_t i = 0; i < 2; i++) {
-		for(TensorShape_t j = 0; j < 18; j++) {
-			for(TensorShape_t k = 0; k < 5; k++) {
-				Tensor_set(&tensor, (TensorShape_t[]){i, j, k}, k + 5 * j + 5 * 18 * i);
+	TensorObject tensor = Tensor_new(3, (TensorIndex_t[]){2, 18, 5});
+	for(TensorIndex_t i = 0; i < 2; i++) {
+		for(TensorIndex_t j = 0; j < 18; j++) {
+			for(TensorIndex_t k = 0; k < 5; k++) {
+				Tensor_set(&tensor, (TensorIndex_t[]){i, j, k}, k + 5 * j + 5 * 18 * i);
 			}
 		}
 	}
-	for(TensorShape_t i = 0; i < 2; i++) {
-		for(TensorShape_t j = 0; j < 18; j++) {
-			for(TensorShape_t k = 0; k < 5; k++) {
-				TensorData_t* x = Tensor_get(&tensor, (TensorShape_t[]){i, j, k});
+	for(TensorIndex_t i = 0; i < 2; i++) {
+		for(TensorIndex_t j = 0; j < 18; j++) {
+			for(TensorIndex_t k = 0; k < 5; k++) {
+				TensorData_t* x = Tensor_get(&tensor, (TensorIndex_t[]){i, j, k});
 				CU_ASSERT_EQUAL(*x, k + 5 * j + 5 * 18 * i);
 			}
 		}
@@ -35,20 +35,20 @@ static void test_tensor_set(void) {
 }
 
 static void test_tensor_write_to(void) {
-	TensorObject tensor = Tensor_new(3, (TensorShape_t[]){2, 3, 5});
-	TensorObject tensor2 = Tensor_new(3, (TensorShape_t[]){2, 3, 5});
-	for(TensorShape_t i = 0; i < 2; i++) {
-		for(TensorShape_t j = 0; j < 3; j++) {
-			for(TensorShape_t k = 0; k < 5; k++) {
-				Tensor_set(&tensor, (TensorShape_t[]){i, j, k}, k + 5 * j + 5 * 3 * i);
+	TensorObject tensor = Tensor_new(3, (TensorIndex_t[]){2, 3, 5});
+	TensorObject tensor2 = Tensor_new(3, (TensorIndex_t[]){2, 3, 5});
+	for(TensorIndex_t i = 0; i < 2; i++) {
+		for(TensorIndex_t j = 0; j < 3; j++) {
+			for(TensorIndex_t k = 0; k < 5; k++) {
+				Tensor_set(&tensor, (TensorIndex_t[]){i, j, k}, k + 5 * j + 5 * 3 * i);
 			}
 		}
 	}
 	Tensor_write_to(&tensor, &tensor2);
-	for(TensorShape_t i = 0; i < 2; i++) {
-		for(TensorShape_t j = 0; j < 3; j++) {
-			for(TensorShape_t k = 0; k < 5; k++) {
-				TensorData_t* x = Tensor_get(&tensor2, (TensorShape_t[]){i, j, k});
+	for(TensorIndex_t i = 0; i < 2; i++) {
+		for(TensorIndex_t j = 0; j < 3; j++) {
+			for(TensorIndex_t k = 0; k < 5; k++) {
+				TensorData_t* x = Tensor_get(&tensor2, (TensorIndex_t[]){i, j, k});
 				CU_ASSERT_EQUAL(*x, k + 5 * j + 5 * 3 * i);
 			}
 		}
@@ -57,9 +57,65 @@ static void test_tensor_write_to(void) {
 	Tensor_free(&tensor2);
 }
 
+// Writing between a swapped view and a slice must respect strides and offsets
+static void test_tensor_write_to_views(void) {
+	TensorObject tensor = Tensor_new(2, (TensorIndex_t[]){3, 4});
+	TensorObject tensor2 = Tensor_new(3, (TensorIndex_t[]){2, 4, 3});
+	for(TensorIndex_t i = 0; i < 3 * 4; i++) {
+		tensor.data[i] = i;
+	}
+	Tensor_swapaxis(&tensor, 0, 1);
+	TensorObject slice = Tensor_slice(&tensor2, 0, 1);
+	CU_ASSERT_EQUAL(Tensor_write_to(&tensor, &slice), 0);
+	for(TensorIndex_t i = 0; i < 4; i++) {
+		for(TensorIndex_t j = 0; j < 3; j++) {
+			CU_ASSERT_EQUAL(*Tensor_get(&tensor2, (TensorIndex_t[]){1, i, j}), j * 4 + i);
+			CU_ASSERT_EQUAL(*Tensor_get(&tensor2, (TensorIndex_t[]){0, i, j}), 0);
+		}
+	}
+	CU_ASSERT_EQUAL(Tensor_write_to(&tensor2, &slice), -1);
+	Tensor_free(&slice);
+	Tensor_free(&tensor);
+	Tensor_free(&tensor2);
+}
+
+static void test_tensor_iter_coalesce(void) {
+	TensorObject tensor = Tensor_new(4, (TensorIndex_t[]){2, 3, 1, 5});
+	TensorIter iter;
+	CU_ASSERT_EQUAL(TensorIter_init(&iter, 1, (TensorObject*[]){&tensor}), 0);
+	CU_ASSERT_EQUAL(iter.ndim, 0);
+	CU_ASSERT_EQUAL(iter.inner_size, 30);
+	CU_ASSERT_EQUAL(iter.contiguous, 1);
+	// a slice along the middle axis splits the tensor into 2 runs of 5
+	TensorObject slice = Tensor_slice(&tensor, 1, 2);
+	CU_ASSERT_EQUAL(TensorIter_init(&iter, 2, (TensorObject*[]){&slice, &slice}), 0);
+	CU_ASSERT_EQUAL(iter.ndim, 1);
+	CU_ASSERT_EQUAL(iter.inner_size, 5);
+	TensorIndex_t runs = 0;
+	while(TensorIter_next(&iter)) {
+		CU_ASSERT_EQUAL(iter.ptr[0], tensor.data + runs * 15 + 10);
+		CU_ASSERT_EQUAL(iter.count, 5);
+		runs++;
+	}
+	CU_ASSERT_EQUAL(runs, 2);
+	// a range starting inside a run
+	TensorIter_range(&iter, 3, 8);
+	CU_ASSERT_EQUAL(TensorIter_next(&iter), 1);
+	CU_ASSERT_EQUAL(iter.ptr[0], tensor.data + 13);
+	CU_ASSERT_EQUAL(iter.count, 2);
+	CU_ASSERT_EQUAL(TensorIter_next(&iter), 1);
+	CU_ASSERT_EQUAL(iter.ptr[0], tensor.data + 25);
+	CU_ASSERT_EQUAL(iter.count, 3);
+	CU_ASSERT_EQUAL(TensorIter_next(&iter), 0);
+	Tensor_free(&slice);
+	Tensor_free(&tensor);
+}
+
 void tensor_data_suite_builder(void) {
 	CU_pSuite suite = CU_add_suite("tensor_data_access", NULL, NULL);
 	CU_add_test(suite, "tensor_pointer_access", test_tensor_pointer_access);
 	CU_add_test(suite, "tensor_set", test_tensor_set);
 	CU_add_test(suite, "tensor_write_to", test_tensor_write_to);
+	CU_add_test(suite, "tensor_write_to_views", test_tensor_write_to_views);
+	CU_add_test(suite, "tensor_iter_coalesce", test_tensor_iter_coalesce);
 }
\ No newline at end of file
@@ -0,0 +1,163 @@
+#include "tensor.h"
+#include <CUnit/CUnit.h>
+#include <math.h>
+#include "tensor/dtype.h"
+#include "tensor/math.h"
+#include "tensor/reduce.h"
+#include "tensor/linalg.h"
+
+static void test_tensor_dtype_half(void) {
+	CU_ASSERT_EQUAL(Tensor_to_half(1), 0x3C00);
+	CU_ASSERT_EQUAL(Tensor_to_half(-2), 0xC000);
+	CU_ASSERT_EQUAL(Tensor_to_half(65504), 0x7BFF);
+	CU_ASSERT_EQUAL(Tensor_to_half(65520), 0x7C00);
+	CU_ASSERT_EQUAL(Tensor_to_half(ldexp(1, -24)), 0x0001);
+	CU_ASSERT_EQUAL(Tensor_to_half(ldexp(1, -26)), 0x0000);
+	// ties go to even.
+	CU_ASSERT_EQUAL(Tensor_to_half(1 + ldexp(1, -11)), 0x3C00);
+	CU_ASSERT_EQUAL(Tensor_to_half(1 + 3 * ldexp(1, -11)), 0x3C02);
+	// just above a tie, rounding through float would land on the tie and round down.
+	CU_ASSERT_EQUAL(Tensor_to_half(1 + ldexp(1, -11) + ldexp(1, -40)), 0x3C01);
+	CU_ASSERT_EQUAL(Tensor_from_half(0x7BFF), 65504);
+	CU_ASSERT_EQUAL(Tensor_from_half(0x0001), ldexp(1, -24));
+	CU_ASSERT_EQUAL(Tensor_from_half(0xFC00), -INFINITY);
+	CU_ASSERT(isnan(Tensor_from_half(Tensor_to_half(NAN))));
+	int ok = 1;
+	for(unsigned bits = 0; bits < 0x7C00; bits++) ok &= Tensor_to_half(Tensor_from_half(bits)) == bits;
+	CU_ASSERT(ok);
+}
+
+static void test_tensor_dtype_bfloat16(void) {
+	CU_ASSERT_EQUAL(Tensor_to_bfloat16(1), 0x3F80);
+	CU_ASSERT_EQUAL(Tensor_to_bfloat16(3.140625), 0x4049);
+	CU_ASSERT_EQUAL(Tensor_from_bfloat16(0x4049), 3.140625);
+	CU_ASSERT_EQUAL(Tensor_to_bfloat16(1 + ldexp(1, -8)), 0x3F80);
+	CU_ASSERT_EQUAL(Tensor_to_bfloat16(1e39), 0x7F80);
+	CU_ASSERT(isnan(Tensor_from_bfloat16(Tensor_to_bfloat16(NAN))));
+	int ok = 1;
+	for(unsigned bits = 0; bits < 0x7F80; bits++) ok &= Tensor_to_bfloat16(Tensor_from_bfloat16(bits)) == bits;
+	CU_ASSERT(ok);
+}
+
+static void test_tensor_dtype_integers(void) {
+	int8_t i8;
+	int32_t i32;
+	Tensor_dtype_store(TENSOR_INT8, &i8, 300);
+	CU_ASSERT_EQUAL(i8, 127);
+	Tensor_dtype_store(TENSOR_INT8, &i8, -1000);
+	CU_ASSERT_EQUAL(i8, -128);
+	Tensor_dtype_store(TENSOR_INT8, &i8, -2.5);
+	CU_ASSERT_EQUAL(i8, -2);
+	Tensor_dtype_store(TENSOR_INT8, &i8, NAN);
+	CU_ASSERT_EQUAL(i8, 0);
+	Tensor_dtype_store(TENSOR_INT32, &i32, 1e12);
+	CU_ASSERT_EQUAL(i32, INT32_MAX);
+	Tensor_dtype_store(TENSOR_INT32, &i32, 2.6);
+	CU_ASSERT_EQUAL(i32, 3);
+	CU_ASSERT_EQUAL(Tensor_dtype_load(TENSOR_INT32, &i32), 3);
+}
+
+static void test_tensor_dtype_tensors(void) {
+	const enum TensorDType dtypes[] = {TENSOR_FLOAT64, TENSOR_FLOAT32, TENSOR_FLOAT16, TENSOR_BFLOAT16, TENSOR_INT32, TENSOR_INT8};
+	for(int t = 0; t < TENSOR_DTYPE_COUNT; t++) {
+		TensorObject tensor = Tensor_new_dtype(2, (TensorIndex_t[]){3, 5}, dtypes[t]);
+		CU_ASSERT_EQUAL(tensor.dtype, dtypes[t]);
+		CU_ASSERT_EQUAL(tensor.storage->size, 15 * Tensor_dtype_size(dtypes[t]));
+		CU_ASSERT_EQUAL(Tensor_get_value(&tensor, (TensorIndex_t[]){2, 4}), 0);
+		for(TensorIndex_t i = 0; i < 3; i++) {
+			for(TensorIndex_t j = 0; j < 5; j++) {
+				Tensor_set(&tensor, (TensorIndex_t[]){i, j}, i * 5.0 + j);
+			}
+		}
+		CU_ASSERT_EQUAL(Tensor_get(&tensor, (TensorIndex_t[]){0, 0}) == NULL, dtypes[t] != TENSOR_FLOAT64);
+		TensorObject row = Tensor_slice(&tensor, 0, 2);
+		CU_ASSERT_EQUAL(row.dtype, dtypes[t]);
+		CU_ASSERT_EQUAL(Tensor_get_value(&row, (TensorIndex_t[]){3}), 13);
+		TensorObject clone = Tensor_clone(row);
+		CU_ASSERT_EQUAL(clone.dtype, dtypes[t]);
+		CU_ASSERT_EQUAL(Tensor_get_value(&clone, (TensorIndex_t[]){4}), 14);
+		Tensor_swapaxis(&tensor, 0, 1);
+		TensorObject wide = Tensor_astype(tensor, TENSOR_FLOAT64);
+		CU_ASSERT_EQUAL(wide.dtype, TENSOR_FLOAT64);
+		for(TensorIndex_t i = 0; i < 15; i++) CU_ASSERT_EQUAL(wide.data[i], i % 3 * 5 + i / 3);
+		TensorObject narrow = Tensor_astype(wide, dtypes[t]);
+		CU_ASSERT_EQUAL(Tensor_get_value(&narrow, (TensorIndex_t[]){4, 1}), 9);
+		Tensor_free(&narrow);
+		Tensor_free(&wide);
+		Tensor_free(&clone);
+		Tensor_free(&row);
+		Tensor_free(&tensor);
+	}
+}
+
+// float32 operands use their own kernels, mixed dtypes are converted element by element.
+static void test_tensor_dtype_math(void) {
+	TensorObject a = Tensor_new_dtype(2, (TensorIndex_t[]){300, 1001}, TENSOR_FLOAT32);
+	TensorObject b = Tensor_new_dtype(1, (TensorIndex_t[]){1001}, TENSOR_FLOAT32);
+	float *fa = (float*)a.data, *fb = (float*)b.data;
+	for(TensorIndex_t i = 0; i < 300 * 1001; i++) fa[i] = i % 1001 * 0.5f;
+	for(TensorIndex_t i = 0; i < 1001; i++) fb[i] = 1.0f + i;
+	CU_ASSERT_EQUAL(Tensor_add(&a, &b, &a), 0);
+	CU_ASSERT_EQUAL(Tensor_mul_scalar(&a, 2, &a), 0);
+	CU_ASSERT_EQUAL(Tensor_fma(&a, &a, &b, &a), 0);
+	int ok = 1;
+	for(TensorIndex_t i = 0; i < 300 * 1001; i++) {
+		const float x = (i % 1001 * 0.5f + 1.0f + i % 1001) * 2;
+		ok &= fa[i] == fmaf(x, x, 1.0f + i % 1001) || fa[i] == x * x + (1.0f + i % 1001);
+	}
+	CU_ASSERT(ok);
+	TensorObject x = Tensor_new(1, (TensorIndex_t[]){4});
+	TensorObject y = Tensor_new_dtype(1, (TensorIndex_t[]){4}, TENSOR_INT32);
+	TensorObject dst = Tensor_new_dtype(1, (TensorIndex_t[]){4}, TENSOR_INT8);
+	for(TensorIndex_t i = 0; i < 4; i++) {
+		x.data[i] = i * 50.4;
+		Tensor_set(&y, (TensorIndex_t[]){i}, i);
+	}
+	CU_ASSERT_EQUAL(Tensor_add(&x, &y, &dst), 0);
+	const int8_t *d = (const int8_t*)dst.data;
+	CU_ASSERT_EQUAL(d[0], 0);
+	CU_ASSERT_EQUAL(d[1], 51);
+	CU_ASSERT_EQUAL(d[2], 103);
+	CU_ASSERT_EQUAL(d[3], 127);
+	Tensor_free(&x);
+	Tensor_free(&y);
+	Tensor_free(&dst);
+	Tensor_free(&a);
+	Tensor_free(&b);
+}
+
+// Reductions and products of other dtypes give the same results as on float64.
+static void test_tensor_dtype_reduce_matmul(void) {
+	TensorObject a = Tensor_new_dtype(2, (TensorIndex_t[]){4, 3}, TENSOR_BFLOAT16);
+	TensorObject b = Tensor_new_dtype(2, (TensorIndex_t[]){3, 2}, TENSOR_INT8);
+	for(TensorIndex_t i = 0; i < 12; i++) Tensor_set(&a, (TensorIndex_t[]){i / 3, i % 3}, i);
+	for(TensorIndex_t i = 0; i < 6; i++) Tensor_set(&b, (TensorIndex_t[]){i / 2, i % 2}, i - 2.0);
+	CU_ASSERT_EQUAL(Tensor_sum_all(&a), 66);
+	CU_ASSERT_EQUAL(Tensor_argmax_all(&a), 11);
+	TensorObject sums = Tensor_new_dtype(1, (TensorIndex_t[]){4}, TENSOR_FLOAT32);
+	CU_ASSERT_EQUAL(Tensor_sum(&a, 1, &sums), 0);
+	for(TensorIndex_t i = 0; i < 4; i++) CU_ASSERT_EQUAL(((float*)sums.data)[i], 9 * i + 3);
+	TensorObject c = Tensor_new_dtype(2, (TensorIndex_t[]){4, 2}, TENSOR_INT32);
+	CU_ASSERT_EQUAL(Tensor_matmul(&a, &b, &c), 0);
+	for(TensorIndex_t i = 0; i < 4; i++) {
+		for(TensorIndex_t j = 0; j < 2; j++) {
+			TensorData_t expected = 0;
+			for(TensorIndex_t p = 0; p < 3; p++) expected += (3.0 * i + p) * (2.0 * p + j - 2);
+			CU_ASSERT_EQUAL(Tensor_get_value(&c, (TensorIndex_t[]){i, j}), expected);
+		}
+	}
+	Tensor_free(&a);
+	Tensor_free(&b);
+	Tensor_free(&sums);
+	Tensor_free(&c);
+}
+
+void tensor_dtype_suite_builder(void) {
+	CU_pSuite suite = CU_add_suite("tensor_dtype", NULL, NULL);
+	CU_add_test(suite, "tensor_dtype_half", test_tensor_dtype_half);
+	CU_add_test(suite, "tensor_dtype_bfloat16", test_tensor_dtype_bfloat16);
+	CU_add_test(suite, "tensor_dtype_integers", test_tensor_dtype_integers);
+	CU_add_test(suite, "tensor_dtype_tensors", test_tensor_dtype_tensors);
+	CU_add_test(suite, "tensor_dtype_math", test_tensor_dtype_math);
+	CU_add_test(suite, "tensor_dtype_reduce_matmul", test_tensor_dtype_reduce_matmul);
+}
@@ -0,0 +1,129 @@
+#include "tensor.h"
+#include <CUnit/CUnit.h>
+#include <math.h>
+#include "tensor/expr.h"
+
+// a * b + c with b broadcast along the rows, evaluated in parallel against the separate operations.
+static void test_tensor_expr_eval(void) {
+	TensorObject a = Tensor_new(2, (TensorIndex_t[]){300, 701});
+	TensorObject b = Tensor_new(1, (TensorIndex_t[]){701});
+	TensorObject c = Tensor_new(2, (TensorIndex_t[]){300, 701});
+	for(TensorIndex_t i = 0; i < 300 * 701; i++) {
+		a.data[i] = i % 97 * 0.25;
+		c.data[i] = i % 13 - 6.0;
+	}
+	for(TensorIndex_t i = 0; i < 701; i++) b.data[i] = i * 0.5 - 100;
+	TensorExpr expr;
+	Tensor_expr_init(&expr);
+	const int x = Tensor_expr_input(&expr, &a);
+	const int y = Tensor_expr_binary(&expr, TENSOR_OP_MUL, x, Tensor_expr_input(&expr, &b));
+	const int z = Tensor_expr_binary(&expr, TENSOR_OP_ADD, y, Tensor_expr_input(&expr, &c));
+	const int w = Tensor_expr_binary(&expr, TENSOR_OP_DIV, z, Tensor_expr_scalar(&expr, 4));
+	CU_ASSERT_EQUAL(w, 6);
+	TensorObject fused = Tensor_new(2, (TensorIndex_t[]){300, 701});
+	CU_ASSERT_EQUAL(Tensor_expr_eval(&expr, w, &fused), 0);
+	TensorObject expected = Tensor_new(2, (TensorIndex_t[]){300, 701});
+	Tensor_mul(&a, &b, &expected);
+	Tensor_add(&expected, &c, &expected);
+	Tensor_div_scalar(&expected, 4, &expected);
+	int ok = 1;
+	for(TensorIndex_t i = 0; i < 300 * 701; i++) ok &= fused.data[i] == expected.data[i];
+	CU_ASSERT(ok);
+	// a binary root written straight into one of its dense inputs.
+	Tensor_expr_init(&expr);
+	const int d = Tensor_expr_binary(&expr, TENSOR_OP_SUB, Tensor_expr_input(&expr, &fused), Tensor_expr_input(&expr, &expected));
+	CU_ASSERT_EQUAL(Tensor_expr_eval(&expr, d, &fused), 0);
+	ok = 1;
+	for(TensorIndex_t i = 0; i < 300 * 701; i++) ok &= fused.data[i] == 0;
+	CU_ASSERT(ok);
+	// in-place into a transposed view of an input.
+	Tensor_swapaxis(&a, 0, 1);
+	Tensor_swapaxis(&c, 0, 1);
+	Tensor_expr_init(&expr);
+	const int t = Tensor_expr_fma(&expr, Tensor_expr_input(&expr, &a), Tensor_expr_scalar(&expr, 2), Tensor_expr_input(&expr, &c));
+	CU_ASSERT_EQUAL(Tensor_expr_eval(&expr, t, &c), 0);
+	ok = 1;
+	for(TensorIndex_t i = 0; i < 300 * 701; i++) ok &= c.data[i] == i % 97 * 0.5 + (i % 13 - 6.0);
+	CU_ASSERT(ok);
+	Tensor_free(&a);
+	Tensor_free(&b);
+	Tensor_free(&c);
+	Tensor_free(&fused);
+	Tensor_free(&expected);
+}
+
+// Reductions of an expression match reducing the evaluated tensor.
+static void test_tensor_expr_reduce(void) {
+	TensorObject a = Tensor_new(2, (TensorIndex_t[]){400, 250});
+	TensorObject b = Tensor_new_dtype(2, (TensorIndex_t[]){400, 1}, TENSOR_FLOAT32);
+	for(TensorIndex_t i = 0; i < 400 * 250; i++) a.data[i] = sin(i * 0.01);
+	for(TensorIndex_t i = 0; i < 400; i++) Tensor_set(&b, (TensorIndex_t[]){i, 0}, i % 7);
+	TensorExpr expr;
+	Tensor_expr_init(&expr);
+	const int x = Tensor_expr_input(&expr, &a);
+	const int y = Tensor_expr_binary(&expr, TENSOR_OP_MUL, x, Tensor_expr_input(&expr, &b));
+	const int z = Tensor_expr_binary(&expr, TENSOR_OP_SUB, y, x);
+	TensorObject evaluated = Tensor_new(2, (TensorIndex_t[]){400, 250});
+	CU_ASSERT_EQUAL(Tensor_expr_eval(&expr, z, &evaluated), 0);
+	const enum TensorReduceOp ops[] = {TENSOR_REDUCE_SUM, TENSOR_REDUCE_MEAN, TENSOR_REDUCE_MAX, TENSOR_REDUCE_MIN, TENSOR_REDUCE_ARGMAX};
+	for(int k = 0; k < 5; k++) {
+		TensorData_t result = NAN;
+		CU_ASSERT_EQUAL(Tensor_expr_reduce_all(&expr, ops[k], z, &result), 0);
+		const TensorData_t reference = Tensor_reduce_all(ops[k], &evaluated);
+		CU_ASSERT(fabs(result - reference) <= 1e-9 * fabs(reference));
+	}
+	// nodes z doesn't need are skipped, and a node can be reduced on its own.
+	TensorData_t sum = 0;
+	CU_ASSERT_EQUAL(Tensor_expr_reduce_all(&expr, TENSOR_REDUCE_SUM, Tensor_expr_input(&expr, &b), &sum), 0);
+	CU_ASSERT_EQUAL(sum, 250 * 57 * 21);
+	Tensor_free(&a);
+	Tensor_free(&b);
+	Tensor_free(&evaluated);
+}
+
+// Expressions with other dtypes are computed as TensorData_t and stored in the dtype of dst.
+static void test_tensor_expr_dtypes(void) {
+	TensorObject a = Tensor_new_dtype(1, (TensorIndex_t[]){5}, TENSOR_INT32);
+	TensorObject dst = Tensor_new_dtype(1, (TensorIndex_t[]){5}, TENSOR_INT8);
+	for(TensorIndex_t i = 0; i < 5; i++) Tensor_set(&a, (TensorIndex_t[]){i}, i * 30.0);
+	TensorExpr expr;
+	Tensor_expr_init(&expr);
+	const int x = Tensor_expr_input(&expr, &a);
+	const int y = Tensor_expr_binary(&expr, TENSOR_OP_SUB, Tensor_expr_binary(&expr, TENSOR_OP_MUL, x, x), Tensor_expr_scalar(&expr, 100));
+	CU_ASSERT_EQUAL(Tensor_expr_eval(&expr, y, &dst), 0);
+	CU_ASSERT_EQUAL(Tensor_get_value(&dst, (TensorIndex_t[]){0}), -100);
+	CU_ASSERT_EQUAL(Tensor_get_value(&dst, (TensorIndex_t[]){1}), 127);
+	CU_ASSERT_EQUAL(Tensor_expr_eval(&expr, x, &dst), 0);
+	CU_ASSERT_EQUAL(Tensor_get_value(&dst, (TensorIndex_t[]){3}), 90);
+	Tensor_free(&a);
+	Tensor_free(&dst);
+}
+
+static void test_tensor_expr_errors(void) {
+	TensorObject a = Tensor_new(1, (TensorIndex_t[]){4});
+	TensorObject b = Tensor_new(1, (TensorIndex_t[]){3});
+	TensorExpr expr;
+	Tensor_expr_init(&expr);
+	TensorData_t result = 0;
+	CU_ASSERT_EQUAL(Tensor_expr_reduce_all(&expr, TENSOR_REDUCE_SUM, 0, &result), -1);
+	const int x = Tensor_expr_input(&expr, &a);
+	CU_ASSERT_EQUAL(Tensor_expr_binary(&expr, TENSOR_OP_ADD, x, 5), -1);
+	CU_ASSERT_EQUAL(Tensor_expr_fma(&expr, x, -1, x), -1);
+	CU_ASSERT_EQUAL(Tensor_expr_eval(&expr, 1, &a), -1);
+	CU_ASSERT_EQUAL(Tensor_expr_eval(&expr, x, &b), -1);
+	const int y = Tensor_expr_binary(&expr, TENSOR_OP_ADD, x, Tensor_expr_input(&expr, &b));
+	CU_ASSERT_EQUAL(Tensor_expr_reduce_all(&expr, TENSOR_REDUCE_SUM, y, &result), -1);
+	int node = x;
+	for(int i = 0; i < TENSOR_EXPR_MAX_NODES; i++) node = Tensor_expr_binary(&expr, TENSOR_OP_MUL, node, x);
+	CU_ASSERT_EQUAL(node, -1);
+	Tensor_free(&a);
+	Tensor_free(&b);
+}
+
+void tensor_expr_suite_builder(void) {
+	CU_pSuite suite = CU_add_suite("tensor_expr", NULL, NULL);
+	CU_add_test(suite, "tensor_expr_eval", test_tensor_expr_eval);
+	CU_add_test(suite, "tensor_expr_reduce", test_tensor_expr_reduce);
+	CU_add_test(suite, "tensor_expr_dtypes", test_tensor_expr_dtypes);
+	CU_add_test(suite, "tensor_expr_errors", test_tensor_expr_errors);
+}
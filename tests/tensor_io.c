@@ -0,0 +1,210 @@
+#include "tensor.h"
+#include <CUnit/CUnit.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "tensor/io.h"
+
+static const char* test_tensor_io_path(void) {
+	static char path[64];
+	snprintf(path, sizeof(path), "/tmp/tensor_io_%d.npy", (int)getpid());
+	return path;
+}
+
+// Every dtype with a .npy type comes back with its shape and values, from a mapping of the file.
+static void test_tensor_io_round_trip(void) {
+	const char *path = test_tensor_io_path();
+	const enum TensorDType dtypes[] = {TENSOR_FLOAT64, TENSOR_FLOAT32, TENSOR_FLOAT16, TENSOR_INT32, TENSOR_INT8};
+	for(size_t t = 0; t < sizeof(dtypes) / sizeof(dtypes[0]); t++) {
+		TensorObject tensor = Tensor_new_dtype(3, (TensorIndex_t[]){2, 3, 7}, dtypes[t]);
+		for(TensorIndex_t i = 0; i < 42; i++) Tensor_set(&tensor, (TensorIndex_t[]){i / 21, i / 7 % 3, i % 7}, i - 20.0);
+		CU_ASSERT_EQUAL(Tensor_save_npy(path, &tensor), 0);
+		TensorObject loaded;
+		CU_ASSERT_EQUAL(Tensor_load_npy(path, &loaded), 0);
+		CU_ASSERT_EQUAL(loaded.dtype, dtypes[t]);
+		CU_ASSERT_EQUAL(loaded.ndim, 3);
+		CU_ASSERT_EQUAL(loaded.shape[2], 7);
+		CU_ASSERT_EQUAL(loaded.strides[0], 21);
+		CU_ASSERT_EQUAL((uintptr_t)loaded.data % TENSOR_ALIGNMENT, 0);
+		CU_ASSERT_EQUAL(memcmp(loaded.data, tensor.data, tensor.storage->size), 0);
+		CU_ASSERT_EQUAL(Tensor_get_value(&loaded, (TensorIndex_t[]){1, 2, 6}), 21);
+		// private mappings can be written without touching the file.
+		Tensor_set(&loaded, (TensorIndex_t[]){0, 0, 0}, 5);
+		CU_ASSERT_EQUAL(Tensor_get_value(&loaded, (TensorIndex_t[]){0, 0, 0}), 5);
+		Tensor_free(&loaded);
+		CU_ASSERT_EQUAL(Tensor_load_npy(path, &loaded), 0);
+		CU_ASSERT_EQUAL(Tensor_get_value(&loaded, (TensorIndex_t[]){0, 0, 0}), -20);
+		Tensor_free(&loaded);
+		Tensor_free(&tensor);
+	}
+	TensorObject bf16 = Tensor_new_dtype(1, (TensorIndex_t[]){4}, TENSOR_BFLOAT16);
+	CU_ASSERT_EQUAL(Tensor_save_npy(path, &bf16), -1);
+	Tensor_free(&bf16);
+	unlink(path);
+}
+
+// Views are saved in their logical order, and small ranks keep their shape.
+static void test_tensor_io_views(void) {
+	const char *path = test_tensor_io_path();
+	TensorObject tensor = Tensor_new(2, (TensorIndex_t[]){3, 4});
+	for(TensorIndex_t i = 0; i < 12; i++) tensor.data[i] = i;
+	Tensor_swapaxis(&tensor, 0, 1);
+	CU_ASSERT_EQUAL(Tensor_save_npy(path, &tensor), 0);
+	TensorObject loaded;
+	CU_ASSERT_EQUAL(Tensor_load_npy(path, &loaded), 0);
+	CU_ASSERT_EQUAL(loaded.shape[0], 4);
+	CU_ASSERT_EQUAL(loaded.shape[1], 3);
+	for(TensorIndex_t i = 0; i < 12; i++) CU_ASSERT_EQUAL(loaded.data[i], i % 3 * 4 + i / 3);
+	Tensor_free(&loaded);
+	TensorObject row = Tensor_slice(&tensor, 0, 2);
+	CU_ASSERT_EQUAL(Tensor_save_npy(path, &row), 0);
+	CU_ASSERT_EQUAL(Tensor_load_npy(path, &loaded), 0);
+	CU_ASSERT_EQUAL(loaded.ndim, 1);
+	CU_ASSERT_EQUAL(loaded.shape[0], 3);
+	CU_ASSERT_EQUAL(loaded.data[2], 10);
+	Tensor_free(&loaded);
+	TensorObject scalar = Tensor_new(0, NULL);
+	scalar.data[0] = 2.5;
+	CU_ASSERT_EQUAL(Tensor_save_npy(path, &scalar), 0);
+	CU_ASSERT_EQUAL(Tensor_load_npy(path, &loaded), 0);
+	CU_ASSERT_EQUAL(loaded.ndim, 0);
+	CU_ASSERT_EQUAL(loaded.data[0], 2.5);
+	Tensor_free(&loaded);
+	Tensor_free(&scalar);
+	Tensor_free(&row);
+	Tensor_free(&tensor);
+	unlink(path);
+}
+
+// Files written by NumPy in Fortran order, with an unaligned header, are read into a buffer of their own.
+static void test_tensor_io_fortran_order(void) {
+	const char *path = test_tensor_io_path();
+	const char header[] = "{'descr': '<i4', 'fortran_order': True, 'shape': (2, 3), }      \n";
+	FILE *file = fopen(path, "wb");
+	fwrite("\x93NUMPY\x01\x00", 1, 8, file);
+	fputc(sizeof(header) - 1, file);
+	fputc(0, file);
+	fwrite(header, 1, sizeof(header) - 1, file);
+	const int32_t data[] = {0, 3, 1, 4, 2, 5};
+	fwrite(data, sizeof(int32_t), 6, file);
+	fclose(file);
+	TensorObject loaded;
+	CU_ASSERT_EQUAL(Tensor_load_npy(path, &loaded), 0);
+	CU_ASSERT_EQUAL(loaded.dtype, TENSOR_INT32);
+	CU_ASSERT_EQUAL(loaded.strides[0], 1);
+	CU_ASSERT_EQUAL(loaded.strides[1], 2);
+	CU_ASSERT_EQUAL((uintptr_t)loaded.data % TENSOR_ALIGNMENT, 0);
+	for(TensorIndex_t i = 0; i < 6; i++) CU_ASSERT_EQUAL(Tensor_get_value(&loaded, (TensorIndex_t[]){i / 3, i % 3}), i);
+	Tensor_free(&loaded);
+	unlink(path);
+}
+
+// Writes to an opened file reach it, and lazy clones keep their own copy.
+static void test_tensor_io_open(void) {
+	const char *path = test_tensor_io_path();
+	TensorObject tensor = Tensor_new_dtype(1, (TensorIndex_t[]){1000}, TENSOR_FLOAT32);
+	CU_ASSERT_EQUAL(Tensor_save_npy(path, &tensor), 0);
+	Tensor_free(&tensor);
+	TensorObject mapped;
+	CU_ASSERT_EQUAL(Tensor_open_npy(path, &mapped), 0);
+	TensorObject clone = Tensor_clone_lazy(mapped);
+	Tensor_set(&clone, (TensorIndex_t[]){7}, 100);
+	for(TensorIndex_t i = 0; i < 1000; i++) Tensor_set(&mapped, (TensorIndex_t[]){i}, i * 0.5);
+	CU_ASSERT_EQUAL(Tensor_sync(&mapped), 0);
+	CU_ASSERT_EQUAL(Tensor_sync(&clone), 0);
+	Tensor_free(&mapped);
+	TensorObject loaded;
+	CU_ASSERT_EQUAL(Tensor_load_npy(path, &loaded), 0);
+	int ok = 1;
+	for(TensorIndex_t i = 0; i < 1000; i++) ok &= Tensor_get_value(&loaded, (TensorIndex_t[]){i}) == i * 0.5;
+	CU_ASSERT(ok);
+	CU_ASSERT_EQUAL(Tensor_get_value(&clone, (TensorIndex_t[]){7}), 100);
+	CU_ASSERT_EQUAL(Tensor_get_value(&clone, (TensorIndex_t[]){8}), 0);
+	Tensor_free(&loaded);
+	Tensor_free(&clone);
+	unlink(path);
+}
+
+static void test_tensor_io_errors(void) {
+	const char *path = test_tensor_io_path();
+	TensorObject tensor = {0};
+	CU_ASSERT_EQUAL(Tensor_load_npy("/nonexistent/tensor.npy", &tensor), -1);
+	CU_ASSERT_PTR_NULL(tensor.storage);
+	FILE *file = fopen(path, "wb");
+	fputs("not a tensor", file);
+	fclose(file);
+	CU_ASSERT_EQUAL(Tensor_load_npy(path, &tensor), -1);
+	// a file shorter than its shape.
+	TensorObject saved = Tensor_new(1, (TensorIndex_t[]){16});
+	CU_ASSERT_EQUAL(Tensor_save_npy(path, &saved), 0);
+	CU_ASSERT_EQUAL(truncate(path, 64 + 15 * sizeof(TensorData_t)), 0);
+	CU_ASSERT_EQUAL(Tensor_load_npy(path, &tensor), -1);
+	CU_ASSERT_EQUAL(Tensor_open_npy(path, &tensor), -1);
+	CU_ASSERT_PTR_NULL(tensor.storage);
+	Tensor_free(&saved);
+	unlink(path);
+}
+
+struct test_tensor_io_stream_args {
+	TensorIndex_t next;
+	double sum;
+	int ok;
+};
+
+// Checks the slabs come in order, sums them and adds their first row index to every element.
+static void* test_tensor_io_stream_func(void *args) {
+	struct loop_range_args *range = args;
+	struct test_tensor_io_stream_args *stream = range->args;
+	stream->ok &= range->begin == stream->next && range->obj.shape[0] == range->end - range->begin;
+	stream->ok &= range->obj.dtype == TENSOR_FLOAT32 && range->obj.shape[1] == 37 && range->obj.strides[0] == 37;
+	stream->next = range->end;
+	float *data = (float*)range->obj.data;
+	for(TensorIndex_t i = 0; i < (range->end - range->begin) * 37; i++) {
+		stream->sum += data[i];
+		data[i] += range->begin;
+	}
+	return NULL;
+}
+
+// Slabs are read in order, and written back when writable.
+static void test_tensor_io_stream(void) {
+	const char *path = test_tensor_io_path();
+	TensorObject tensor = Tensor_new_dtype(2, (TensorIndex_t[]){1000, 37}, TENSOR_FLOAT32);
+	for(TensorIndex_t i = 0; i < 1000 * 37; i++) ((float*)tensor.data)[i] = i % 37;
+	CU_ASSERT_EQUAL(Tensor_save_npy(path, &tensor), 0);
+	Tensor_free(&tensor);
+	struct test_tensor_io_stream_args stream = {.ok = 1};
+	CU_ASSERT_EQUAL(Tensor_loop_over_npy(path, 64, 0, test_tensor_io_stream_func, &stream), 0);
+	CU_ASSERT(stream.ok);
+	CU_ASSERT_EQUAL(stream.next, 1000);
+	CU_ASSERT_EQUAL(stream.sum, 1000 * 666);
+	// the previous pass wasn't written back.
+	stream = (struct test_tensor_io_stream_args){.ok = 1};
+	CU_ASSERT_EQUAL(Tensor_loop_over_npy(path, 64, 1, test_tensor_io_stream_func, &stream), 0);
+	CU_ASSERT_EQUAL(stream.sum, 1000 * 666);
+	CU_ASSERT(stream.ok);
+	TensorObject loaded;
+	CU_ASSERT_EQUAL(Tensor_load_npy(path, &loaded), 0);
+	int ok = 1;
+	for(TensorIndex_t i = 0; i < 1000 * 37; i++) ok &= ((float*)loaded.data)[i] == i % 37 + i / 37 / 64 * 64;
+	CU_ASSERT(ok);
+	Tensor_free(&loaded);
+	// a single slab holds the whole file.
+	stream = (struct test_tensor_io_stream_args){.ok = 1};
+	CU_ASSERT_EQUAL(Tensor_loop_over_npy(path, 0, 0, test_tensor_io_stream_func, &stream), 0);
+	CU_ASSERT(stream.ok);
+	CU_ASSERT_EQUAL(stream.next, 1000);
+	CU_ASSERT_EQUAL(Tensor_loop_over_npy("/nonexistent/tensor.npy", 0, 0, test_tensor_io_stream_func, &stream), -1);
+	unlink(path);
+}
+
+void tensor_io_suite_builder(void) {
+	CU_pSuite suite = CU_add_suite("tensor_io", NULL, NULL);
+	CU_add_test(suite, "tensor_io_round_trip", test_tensor_io_round_trip);
+	CU_add_test(suite, "tensor_io_views", test_tensor_io_views);
+	CU_add_test(suite, "tensor_io_fortran_order", test_tensor_io_fortran_order);
+	CU_add_test(suite, "tensor_io_open", test_tensor_io_open);
+	CU_add_test(suite, "tensor_io_errors", test_tensor_io_errors);
+	CU_add_test(suite, "tensor_io_stream", test_tensor_io_stream);
+}
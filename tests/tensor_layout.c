@@ -0,0 +1,102 @@
+#include "tensor.h"
+#include <CUnit/CUnit.h>
+#include "tensor/layout.h"
+
+// Compares every element of two tensors of the same shape, through their strides.
+static int equal_elements(const TensorObject *a, const TensorObject *b) {
+	TensorIndex_t idx[TENSOR_MAX_NDIM] = {0};
+	TensorIndex_t size = 1;
+	for(TensorShape_t i = 0; i < a->ndim; i++) size *= a->shape[i];
+	for(TensorIndex_t n = 0; n < size; n++) {
+		if(Tensor_get_value(a, idx) != Tensor_get_value(b, idx)) return 0;
+		for(TensorShape_t i = a->ndim; i-- > 0;) {
+			if(++idx[i] < a->shape[i]) break;
+			idx[i] = 0;
+		}
+	}
+	return 1;
+}
+
+static TensorObject numbered(TensorShape_t ndim, const TensorIndex_t *shape, enum TensorDType dtype) {
+	TensorObject tensor = Tensor_new_dtype(ndim, shape, dtype);
+	const TensorIndex_t size = tensor.storage->size / Tensor_dtype_size(dtype);
+	for(TensorIndex_t i = 0; i < size; i++) {
+		TensorIndex_t idx[TENSOR_MAX_NDIM], rest = i;
+		for(TensorShape_t d = ndim; d-- > 0;) {
+			idx[d] = rest % shape[d];
+			rest /= shape[d];
+		}
+		Tensor_set(&tensor, idx, i % 120);
+	}
+	return tensor;
+}
+
+// Swapped matrices of every element size, with edges that don't fill a tile or a SIMD block.
+static void test_tensor_transpose_copy(void) {
+	const enum TensorDType dtypes[] = {TENSOR_FLOAT64, TENSOR_INT32, TENSOR_FLOAT32, TENSOR_FLOAT16, TENSOR_INT8};
+	const TensorIndex_t shapes[][2] = {{1, 1}, {3, 5}, {37, 53}, {64, 96}, {301, 517}};
+	for(int d = 0; d < 5; d++) {
+		for(int s = 0; s < 5; s++) {
+			TensorObject tensor = numbered(2, shapes[s], dtypes[d]);
+			TensorObject copy = Tensor_transpose_copy(tensor, 0, 1);
+			CU_ASSERT_EQUAL(copy.dtype, dtypes[d]);
+			CU_ASSERT_EQUAL(copy.shape[0], shapes[s][1]);
+			CU_ASSERT(Tensor_is_contiguous(&copy));
+			CU_ASSERT_NOT_EQUAL(copy.storage, tensor.storage);
+			Tensor_swapaxis(&tensor, 0, 1);
+			CU_ASSERT(equal_elements(&copy, &tensor));
+			Tensor_free(&copy);
+			Tensor_free(&tensor);
+		}
+	}
+	TensorObject tensor = Tensor_new(2, (TensorIndex_t[]){2, 3});
+	CU_ASSERT_PTR_NULL(Tensor_transpose_copy(tensor, 0, 2).storage);
+	Tensor_free(&tensor);
+}
+
+// Higher ranks become batches of transposes, or strided copies when no axis is contiguous.
+static void test_tensor_contiguous(void) {
+	const TensorIndex_t shape[] = {6, 35, 3, 41};
+	const TensorShape_t swaps[][2] = {{0, 3}, {1, 3}, {2, 3}, {0, 1}, {1, 2}};
+	for(int s = 0; s < 5; s++) {
+		TensorObject tensor = numbered(4, shape, TENSOR_FLOAT64);
+		Tensor_swapaxis(&tensor, swaps[s][0], swaps[s][1]);
+		CU_ASSERT_FALSE(Tensor_is_contiguous(&tensor));
+		TensorObject copy = Tensor_contiguous(tensor);
+		CU_ASSERT(Tensor_is_contiguous(&copy));
+		CU_ASSERT(equal_elements(&copy, &tensor));
+		// a slice along the last axis has no contiguous axis left.
+		TensorObject slice = Tensor_slice(&tensor, 3, 1);
+		TensorObject sliced = Tensor_contiguous(slice);
+		CU_ASSERT(Tensor_is_contiguous(&sliced));
+		CU_ASSERT(equal_elements(&sliced, &slice));
+		Tensor_free(&sliced);
+		Tensor_free(&slice);
+		Tensor_free(&copy);
+		Tensor_free(&tensor);
+	}
+	// contiguous tensors are shared, not copied.
+	TensorObject tensor = numbered(3, shape, TENSOR_INT32);
+	TensorObject slice = Tensor_slice(&tensor, 0, 2);
+	CU_ASSERT(Tensor_is_contiguous(&slice));
+	TensorObject same = Tensor_contiguous(slice);
+	CU_ASSERT_EQUAL(same.storage, tensor.storage);
+	CU_ASSERT_EQUAL(same.offset, slice.offset);
+	CU_ASSERT_EQUAL(tensor.storage->ref_count, 3);
+	TensorObject broadcast;
+	Tensor_broadcast_to(&slice, 3, (TensorIndex_t[]){4, 35, 3}, &broadcast);
+	CU_ASSERT_FALSE(Tensor_is_contiguous(&broadcast));
+	TensorObject expanded = Tensor_contiguous(broadcast);
+	CU_ASSERT(equal_elements(&expanded, &broadcast));
+	Tensor_free(&expanded);
+	Tensor_free(&broadcast);
+	Tensor_free(&same);
+	Tensor_free(&slice);
+	Tensor_free(&tensor);
+}
+
+void tensor_layout_suite_builder(void) {
+	CU_pSuite suite = CU_add_suite("tensor_layout", NULL, NULL);
+	CU_add_test(suite, "tensor_transpose_copy", test_tensor_transpose_copy);
+	CU_add_test(suite, "tensor_contiguous", test_tensor_contiguous);
+}
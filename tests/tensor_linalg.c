@@ -0,0 +1,109 @@
+#include "tensor.h"
+#include <CUnit/CUnit.h>
+#include "tensor/linalg.h"
+#include <math.h>
+
+static void fill(TensorObject *tensor, TensorIndex_t seed) {
+	TensorIndex_t total_size = 1;
+	for(TensorShape_t i = 0; i < tensor->ndim; i++) {
+		total_size *= tensor->shape[i];
+	}
+	for(TensorIndex_t i = 0; i < total_size; i++) {
+		tensor->data[i] = (TensorData_t)((i * 7919 + seed) % 17) - 8;
+	}
+}
+
+// Compares dst against a naive triple loop over the (possibly strided) operands.
+static int matches_naive(TensorObject *a, TensorObject *b, TensorObject *dst) {
+	TensorIndex_t batches = a->ndim == 3 ? a->shape[0] : 1;
+	TensorShape_t r = a->ndim - 2, c = a->ndim - 1;
+	for(TensorIndex_t batch = 0; batch < batches; batch++) {
+		for(TensorIndex_t i = 0; i < a->shape[r]; i++) {
+			for(TensorIndex_t j = 0; j < b->shape[c]; j++) {
+				TensorData_t expected = 0;
+				for(TensorIndex_t p = 0; p < a->shape[c]; p++) {
+					TensorIndex_t ai[3] = {batch, i, p}, bi[3] = {batch, p, j};
+					expected += *Tensor_get(a, ai + 3 - a->ndim) * *Tensor_get(b, bi + 3 - b->ndim);
+				}
+				TensorIndex_t di[3] = {batch, i, j};
+				if(fabs(*Tensor_get(dst, di + 3 - dst->ndim) - expected) > 1e-9) {
+					return 0;
+				}
+			}
+		}
+	}
+	return 1;
+}
+
+static void test_tensor_matmul_2d(void) {
+	TensorObject a = Tensor_new(2, (TensorIndex_t[]){2, 3});
+	TensorObject b = Tensor_new(2, (TensorIndex_t[]){3, 2});
+	TensorObject dst = Tensor_new(2, (TensorIndex_t[]){2, 2});
+	for(TensorIndex_t i = 0; i < 6; i++) {
+		a.data[i] = i + 1;
+		b.data[i] = i + 7;
+	}
+	CU_ASSERT_EQUAL(Tensor_matmul(&a, &b, &dst), 0);
+	CU_ASSERT_EQUAL(dst.data[0], 58);
+	CU_ASSERT_EQUAL(dst.data[1], 64);
+	CU_ASSERT_EQUAL(dst.data[2], 139);
+	CU_ASSERT_EQUAL(dst.data[3], 154);
+	CU_ASSERT_EQUAL(Tensor_matmul(&a, &a, &dst), -1);
+	CU_ASSERT_EQUAL(Tensor_matmul(&a, &b, &a), -1);
+	Tensor_free(&a);
+	Tensor_free(&b);
+	Tensor_free(&dst);
+}
+
+// Sizes that are not multiples of the tile sizes and a depth spanning several packed panels.
+static void test_tensor_matmul_edges(void) {
+	TensorObject a = Tensor_new(2, (TensorIndex_t[]){101, 300});
+	TensorObject b = Tensor_new(2, (TensorIndex_t[]){300, 37});
+	TensorObject dst = Tensor_new(2, (TensorIndex_t[]){101, 37});
+	fill(&a, 1);
+	fill(&b, 2);
+	CU_ASSERT_EQUAL(Tensor_matmul(&a, &b, &dst), 0);
+	CU_ASSERT(matches_naive(&a, &b, &dst));
+	Tensor_free(&a);
+	Tensor_free(&b);
+	Tensor_free(&dst);
+}
+
+// Swapped views are multiplied in place, and the result can be written into a swapped view.
+static void test_tensor_matmul_batched_swapped(void) {
+	TensorObject a = Tensor_new(3, (TensorIndex_t[]){3, 20, 13});
+	TensorObject b = Tensor_new(3, (TensorIndex_t[]){3, 11, 20});
+	TensorObject dst = Tensor_new(3, (TensorIndex_t[]){3, 11, 13});
+	fill(&a, 3);
+	fill(&b, 4);
+	Tensor_swapaxis(&a, 1, 2);
+	Tensor_swapaxis(&b, 1, 2);
+	Tensor_swapaxis(&dst, 1, 2);
+	CU_ASSERT_EQUAL(Tensor_matmul(&a, &b, &dst), 0);
+	CU_ASSERT(matches_naive(&a, &b, &dst));
+	Tensor_free(&a);
+	Tensor_free(&b);
+	Tensor_free(&dst);
+}
+
+// Several row and column tiles in every batch, so packed panels of B are shared between row tiles.
+static void test_tensor_matmul_tiles(void) {
+	TensorObject a = Tensor_new(3, (TensorIndex_t[]){2, 2 * TENSOR_MATMUL_MC + 5, 20});
+	TensorObject b = Tensor_new(3, (TensorIndex_t[]){2, 20, TENSOR_MATMUL_NC + 3});
+	TensorObject dst = Tensor_new(3, (TensorIndex_t[]){2, 2 * TENSOR_MATMUL_MC + 5, TENSOR_MATMUL_NC + 3});
+	fill(&a, 5);
+	fill(&b, 6);
+	CU_ASSERT_EQUAL(Tensor_matmul(&a, &b, &dst), 0);
+	CU_ASSERT(matches_naive(&a, &b, &dst));
+	Tensor_free(&a);
+	Tensor_free(&b);
+	Tensor_free(&dst);
+}
+
+void tensor_linalg_suite_builder(void) {
+	CU_pSuite suite = CU_add_suite("tensor_linalg", NULL, NULL);
+	CU_add_test(suite, "tensor_matmul_2d", test_tensor_matmul_2d);
+	CU_add_test(suite, "tensor_matmul_edges", test_tensor_matmul_edges);
+	CU_add_test(suite, "tensor_matmul_batched_swapped", test_tensor_matmul_batched_swapped);
+	CU_add_test(suite, "tensor_matmul_tiles", test_tensor_matmul_tiles);
+}
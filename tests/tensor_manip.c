@@ -2,27 +2,27 @@
 #include <CUnit/CUnit.h>
 
 static void test_tensor_swapaxis(void) {
-	TensorObject tensor = Tensor_new(2, (TensorShape_t[]){2, 3});
-	TensorData_t* x = Tensor_get(&tensor, (TensorShape_t[]){1, 2});
+	TensorObject tensor = Tensor_new(2, (TensorIndex_t[]){2, 3});
+	TensorData_t* x = Tensor_get(&tensor, (TensorIndex_t[]){1, 2});
 	Tensor_swapaxis(&tensor, 0, 1);
-	TensorData_t* y = Tensor_get(&tensor, (TensorShape_t[]){2, 1});
+	TensorData_t* y = Tensor_get(&tensor, (TensorIndex_t[]){2, 1});
 	CU_ASSERT_EQUAL(x, y);
 	Tensor_free(&tensor);
 }
 
 // Test if tensor slice is a view of the original tensor from different axis
 static void test_tensor_slice(void) {
-	TensorObject tensor = Tensor_new(2, (TensorShape_t[]){2, 3});
-	TensorData_t* x = Tensor_get(&tensor, (TensorShape_t[]){1, 2});
+	TensorObject tensor = Tensor_new(2, (TensorIndex_t[]){2, 3});
+	TensorData_t* x = Tensor_get(&tensor, (TensorIndex_t[]){1, 2});
 	TensorObject slice = Tensor_slice(&tensor, 0, 1);
-	TensorData_t* y = Tensor_get(&slice, (TensorShape_t[]){2});
+	TensorData_t* y = Tensor_get(&slice, (TensorIndex_t[]){2});
 	CU_ASSERT_EQUAL(tensor.data, slice.data);
-	CU_ASSERT_EQUAL(tensor.ref_count, slice.ref_count);
+	CU_ASSERT_EQUAL(tensor.storage, slice.storage);
 	CU_ASSERT_EQUAL(tensor.offset + tensor.strides[0], slice.offset);
 	TensorObject slice2 = Tensor_slice(&tensor, 1, 2);
-	TensorData_t* z = Tensor_get(&slice2, (TensorShape_t[]){1});
+	TensorData_t* z = Tensor_get(&slice2, (TensorIndex_t[]){1});
 	CU_ASSERT_EQUAL(tensor.data, slice2.data);
-	CU_ASSERT_EQUAL(tensor.ref_count, slice2.ref_count);
+	CU_ASSERT_EQUAL(tensor.storage, slice2.storage);
 	CU_ASSERT_EQUAL(tensor.offset + 2 * tensor.strides[1], slice2.offset);
 	CU_ASSERT_EQUAL(x, y);
 	CU_ASSERT_EQUAL(x, z);
@@ -32,22 +32,192 @@ static void test_tensor_slice(void) {
 }
 
 static void test_tensor_slice_of_slice(void) {
-	TensorObject tensor = Tensor_new(2, (TensorShape_t[]){2, 3});
-	TensorData_t* x = Tensor_get(&tensor, (TensorShape_t[]){1, 1});
+	TensorObject tensor = Tensor_new(2, (TensorIndex_t[]){2, 3});
+	TensorData_t* x = Tensor_get(&tensor, (TensorIndex_t[]){1, 1});
 	TensorObject slice = Tensor_slice(&tensor, 0, 1);
 	TensorObject slice2 = Tensor_slice(&slice, 0, 1);
-	TensorData_t* y = Tensor_get(&slice2, (TensorShape_t[]){1});
+	TensorData_t* y = Tensor_get(&slice2, (TensorIndex_t[]){1});
 	CU_ASSERT_EQUAL(tensor.data, slice2.data);
-	CU_ASSERT_EQUAL(tensor.ref_count, slice2.ref_count);
+	CU_ASSERT_EQUAL(tensor.storage, slice2.storage);
 	CU_ASSERT_EQUAL(x, y);
 	Tensor_free(&tensor);
 	Tensor_free(&slice);
 	Tensor_free(&slice2);
 }
 
+static void test_tensor_broadcast_to(void) {
+	TensorObject tensor = Tensor_new(2, (TensorIndex_t[]){3, 1});
+	for(TensorIndex_t i = 0; i < 3; i++) tensor.data[i] = i;
+	TensorObject view;
+	CU_ASSERT_EQUAL(Tensor_broadcast_to(&tensor, 3, (TensorIndex_t[]){2, 3, 4}, &view), 0);
+	CU_ASSERT_EQUAL(view.data, tensor.data);
+	CU_ASSERT_EQUAL(view.storage->ref_count, 2);
+	CU_ASSERT_EQUAL(view.strides[0], 0);
+	CU_ASSERT_EQUAL(view.strides[1], 1);
+	CU_ASSERT_EQUAL(view.strides[2], 0);
+	CU_ASSERT_EQUAL(*Tensor_get(&view, (TensorIndex_t[]){1, 2, 3}), 2);
+	TensorObject copy = Tensor_clone(view);
+	for(TensorIndex_t i = 0; i < 24; i++) CU_ASSERT_EQUAL(copy.data[i], i / 4 % 3);
+	CU_ASSERT_EQUAL(Tensor_broadcast_to(&tensor, 2, (TensorIndex_t[]){4, 3}, &view), -1);
+	CU_ASSERT_EQUAL(Tensor_broadcast_to(&tensor, 1, (TensorIndex_t[]){3}, &view), -1);
+	TensorShape_t ndim;
+	TensorIndex_t shape[3];
+	CU_ASSERT_EQUAL(Tensor_broadcast_shape(&tensor, &copy, &ndim, shape), 0);
+	CU_ASSERT_EQUAL(ndim, 3);
+	CU_ASSERT_EQUAL(shape[0], 2);
+	CU_ASSERT_EQUAL(shape[1], 3);
+	CU_ASSERT_EQUAL(shape[2], 4);
+	Tensor_free(&view);
+	Tensor_free(&copy);
+	Tensor_free(&tensor);
+}
+
+// Broadcast views may describe more than 2^32 elements without allocating them.
+static void test_tensor_broadcast_large(void) {
+	TensorObject tensor = Tensor_new(2, (TensorIndex_t[]){2, 1});
+	tensor.data[0] = 1;
+	tensor.data[1] = 2;
+	const TensorIndex_t n = (TensorIndex_t)3 << 32;
+	TensorObject view;
+	CU_ASSERT_EQUAL(Tensor_broadcast_to(&tensor, 2, (TensorIndex_t[]){2, n}, &view), 0);
+	CU_ASSERT_EQUAL(view.shape[1], n);
+	CU_ASSERT_EQUAL(*Tensor_get(&view, (TensorIndex_t[]){1, n - 1}), 2);
+	TensorIter iter;
+	CU_ASSERT_EQUAL(TensorIter_init(&iter, 1, (TensorObject *[]){&view}), 0);
+	CU_ASSERT_EQUAL(iter.size, 2 * n);
+	CU_ASSERT_EQUAL(iter.inner_size, n);
+	Tensor_free(&view);
+	Tensor_free(&tensor);
+}
+
+// x[1:7:2, 3:] of a 8 x 5 matrix, and ranges clamped to the axis.
+static void test_tensor_slice_range(void) {
+	TensorObject tensor = Tensor_new(2, (TensorIndex_t[]){8, 5});
+	for(TensorIndex_t i = 0; i < 40; i++) tensor.data[i] = i;
+	TensorObject rows, view;
+	CU_ASSERT_EQUAL(Tensor_slice_range(&tensor, 0, 1, 7, 2, &rows), 0);
+	CU_ASSERT_EQUAL(Tensor_slice_range(&rows, 1, 3, 100, 1, &view), 0);
+	CU_ASSERT_EQUAL(rows.shape[0], 3);
+	CU_ASSERT_EQUAL(view.shape[0], 3);
+	CU_ASSERT_EQUAL(view.shape[1], 2);
+	CU_ASSERT_EQUAL(view.storage, tensor.storage);
+	CU_ASSERT_EQUAL(tensor.storage->ref_count, 3);
+	int ok = 1;
+	for(TensorIndex_t i = 0; i < 3; i++) {
+		for(TensorIndex_t j = 0; j < 2; j++) ok &= Tensor_get_value(&view, (TensorIndex_t[]){i, j}) == (1 + 2 * i) * 5 + 3 + j;
+	}
+	CU_ASSERT(ok);
+	// writes through the view land in the original.
+	Tensor_set(&view, (TensorIndex_t[]){2, 1}, -1);
+	CU_ASSERT_EQUAL(tensor.data[5 * 5 + 4], -1);
+	TensorObject empty;
+	CU_ASSERT_EQUAL(Tensor_slice_range(&tensor, 1, 9, 12, 1, &empty), 0);
+	CU_ASSERT_EQUAL(empty.shape[1], 0);
+	TensorObject single;
+	CU_ASSERT_EQUAL(Tensor_slice_range(&tensor, 0, 0, 10, UINT64_MAX - 2, &single), 0);
+	CU_ASSERT_EQUAL(single.shape[0], 1);
+	Tensor_free(&single);
+	CU_ASSERT_EQUAL(Tensor_slice_range(&tensor, 0, 0, 8, 0, &view), -1);
+	CU_ASSERT_EQUAL(Tensor_slice_range(&tensor, 2, 0, 8, 1, &view), -1);
+	Tensor_free(&empty);
+	Tensor_free(&view);
+	Tensor_free(&rows);
+	Tensor_free(&tensor);
+}
+
+static void test_tensor_permute(void) {
+	TensorObject tensor = Tensor_new(3, (TensorIndex_t[]){2, 3, 4});
+	for(TensorIndex_t i = 0; i < 24; i++) tensor.data[i] = i;
+	TensorObject view;
+	CU_ASSERT_EQUAL(Tensor_permute(&tensor, (TensorShape_t[]){2, 0, 1}, &view), 0);
+	CU_ASSERT_EQUAL(view.shape[0], 4);
+	CU_ASSERT_EQUAL(view.shape[1], 2);
+	CU_ASSERT_EQUAL(view.shape[2], 3);
+	CU_ASSERT_EQUAL(Tensor_get_value(&view, (TensorIndex_t[]){3, 1, 2}), 1 * 12 + 2 * 4 + 3);
+	CU_ASSERT_EQUAL(Tensor_permute(&tensor, (TensorShape_t[]){2, 0, 2}, &view), -1);
+	CU_ASSERT_EQUAL(Tensor_permute(&tensor, (TensorShape_t[]){0, 1, 3}, &view), -1);
+	CU_ASSERT_EQUAL(tensor.storage->ref_count, 2);
+	Tensor_free(&view);
+	Tensor_free(&tensor);
+}
+
+static void test_tensor_reshape(void) {
+	TensorObject tensor = Tensor_new(3, (TensorIndex_t[]){2, 3, 4});
+	for(TensorIndex_t i = 0; i < 24; i++) tensor.data[i] = i;
+	TensorObject view;
+	CU_ASSERT_EQUAL(Tensor_reshape(&tensor, 4, (TensorIndex_t[]){6, 1, 2, 2}, &view), 0);
+	int ok = 1;
+	for(TensorIndex_t i = 0; i < 24; i++) ok &= Tensor_get_value(&view, (TensorIndex_t[]){i / 4, 0, i / 2 % 2, i % 2}) == i;
+	CU_ASSERT(ok);
+	CU_ASSERT_EQUAL(view.storage, tensor.storage);
+	Tensor_free(&view);
+	CU_ASSERT_EQUAL(Tensor_reshape(&tensor, 2, (TensorIndex_t[]){5, 5}, &view), -1);
+	// a range along the last axis keeps the first two axes mergeable, but not the last with them.
+	TensorObject range, merged;
+	Tensor_slice_range(&tensor, 2, 1, 3, 1, &range);
+	CU_ASSERT_EQUAL(Tensor_reshape(&range, 3, (TensorIndex_t[]){3, 2, 2}, &merged), 0);
+	ok = 1;
+	for(TensorIndex_t i = 0; i < 12; i++) ok &= Tensor_get_value(&merged, (TensorIndex_t[]){i / 4, i / 2 % 2, i % 2}) == i / 2 * 4 + 1 + i % 2;
+	CU_ASSERT(ok);
+	CU_ASSERT_EQUAL(Tensor_reshape(&range, 1, (TensorIndex_t[]){12}, &view), -1);
+	Tensor_free(&merged);
+	Tensor_free(&range);
+	// a swapped view can only be split along its own axes.
+	Tensor_swapaxis(&tensor, 0, 2);
+	CU_ASSERT_EQUAL(Tensor_reshape(&tensor, 4, (TensorIndex_t[]){2, 2, 3, 2}, &view), 0);
+	CU_ASSERT_EQUAL(Tensor_get_value(&view, (TensorIndex_t[]){1, 1, 2, 1}), Tensor_get_value(&tensor, (TensorIndex_t[]){3, 2, 1}));
+	Tensor_free(&view);
+	CU_ASSERT_EQUAL(Tensor_reshape(&tensor, 1, (TensorIndex_t[]){24}, &view), -1);
+	CU_ASSERT_EQUAL(tensor.storage->ref_count, 1);
+	Tensor_free(&tensor);
+}
+
+static void test_tensor_squeeze(void) {
+	TensorObject tensor = Tensor_new(2, (TensorIndex_t[]){3, 4});
+	TensorObject wide, narrow;
+	CU_ASSERT_EQUAL(Tensor_unsqueeze(&tensor, 1, &wide), 0);
+	CU_ASSERT_EQUAL(wide.ndim, 3);
+	CU_ASSERT_EQUAL(wide.shape[1], 1);
+	CU_ASSERT_EQUAL(Tensor_get(&wide, (TensorIndex_t[]){2, 0, 3}), Tensor_get(&tensor, (TensorIndex_t[]){2, 3}));
+	CU_ASSERT_EQUAL(Tensor_squeeze(&wide, 0, &narrow), -1);
+	CU_ASSERT_EQUAL(Tensor_squeeze(&wide, 1, &narrow), 0);
+	CU_ASSERT_EQUAL(narrow.ndim, 2);
+	CU_ASSERT_EQUAL(narrow.strides[0], tensor.strides[0]);
+	CU_ASSERT_EQUAL(narrow.strides[1], tensor.strides[1]);
+	CU_ASSERT_EQUAL(Tensor_unsqueeze(&tensor, 3, &wide), -1);
+	CU_ASSERT_EQUAL(tensor.storage->ref_count, 3);
+	Tensor_free(&narrow);
+	Tensor_free(&wide);
+	Tensor_free(&tensor);
+}
+
+// A tensor whose allocation failed still gives views, without storage.
+static void test_tensor_views_without_storage(void) {
+	TensorObject tensor = {.ndim = 2, .shape = {3, 4}, .strides = {4, 1}};
+	TensorObject slice = Tensor_slice(&tensor, 0, 1);
+	CU_ASSERT_PTR_NULL(slice.storage);
+	CU_ASSERT_EQUAL(slice.ndim, 1);
+	TensorObject range, wide;
+	CU_ASSERT_EQUAL(Tensor_slice_range(&tensor, 1, 1, 3, 1, &range), 0);
+	CU_ASSERT_PTR_NULL(range.storage);
+	CU_ASSERT_EQUAL(Tensor_broadcast_to(&tensor, 3, (TensorIndex_t[]){2, 3, 4}, &wide), 0);
+	CU_ASSERT_PTR_NULL(wide.storage);
+	CU_ASSERT_EQUAL(wide.strides[0], 0);
+	Tensor_free(&slice);
+	Tensor_free(&range);
+	Tensor_free(&wide);
+}
+
 void tensor_manip_suite_builder(void) {
 	CU_pSuite suite = CU_add_suite("tensor_manipulation", NULL, NULL);
 	CU_add_test(suite, "tensor_swapaxis", test_tensor_swapaxis);
 	CU_add_test(suite, "tensor_slice", test_tensor_slice);
 	CU_add_test(suite, "tensor_slice_of_slice", test_tensor_slice_of_slice);
+	CU_add_test(suite, "tensor_broadcast_to", test_tensor_broadcast_to);
+	CU_add_test(suite, "tensor_broadcast_large", test_tensor_broadcast_large);
+	CU_add_test(suite, "tensor_slice_range", test_tensor_slice_range);
+	CU_add_test(suite, "tensor_permute", test_tensor_permute);
+	CU_add_test(suite, "tensor_reshape", test_tensor_reshape);
+	CU_add_test(suite, "tensor_squeeze", test_tensor_squeeze);
+	CU_add_test(suite, "tensor_views_without_storage", test_tensor_views_without_storage);
 }
\ No newline at end of file
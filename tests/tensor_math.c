@@ -0,0 +1,154 @@
+#include "tensor.h"
+#include <CUnit/CUnit.h>
+#include "tensor/math.h"
+#include <math.h>
+
+static void fill(TensorObject *tensor, TensorData_t start) {
+	TensorIndex_t total_size = 1;
+	for(TensorShape_t i = 0; i < tensor->ndim; i++) {
+		total_size *= tensor->shape[i];
+	}
+	for(TensorIndex_t i = 0; i < total_size; i++) {
+		tensor->data[i] = start + i;
+	}
+}
+
+static void test_tensor_binary_ops(void) {
+	TensorObject a = Tensor_new(2, (TensorIndex_t[]){3, 7});
+	TensorObject b = Tensor_new(2, (TensorIndex_t[]){3, 7});
+	TensorObject dst = Tensor_new(2, (TensorIndex_t[]){3, 7});
+	fill(&a, 1);
+	fill(&b, 2);
+	CU_ASSERT_EQUAL(Tensor_add(&a, &b, &dst), 0);
+	for(TensorIndex_t i = 0; i < 21; i++) CU_ASSERT_EQUAL(dst.data[i], 2 * i + 3);
+	CU_ASSERT_EQUAL(Tensor_sub(&a, &b, &dst), 0);
+	for(TensorIndex_t i = 0; i < 21; i++) CU_ASSERT_EQUAL(dst.data[i], -1);
+	CU_ASSERT_EQUAL(Tensor_mul(&a, &b, &dst), 0);
+	for(TensorIndex_t i = 0; i < 21; i++) CU_ASSERT_EQUAL(dst.data[i], (i + 1.0) * (i + 2.0));
+	CU_ASSERT_EQUAL(Tensor_div(&a, &b, &dst), 0);
+	for(TensorIndex_t i = 0; i < 21; i++) CU_ASSERT_DOUBLE_EQUAL(dst.data[i], (i + 1.0) / (i + 2.0), 1e-15);
+	CU_ASSERT_EQUAL(Tensor_fma(&a, &b, &b, &dst), 0);
+	for(TensorIndex_t i = 0; i < 21; i++) CU_ASSERT_EQUAL(dst.data[i], (i + 1.0) * (i + 2.0) + i + 2.0);
+	Tensor_free(&a);
+	Tensor_free(&b);
+	Tensor_free(&dst);
+}
+
+static void test_tensor_scalar_ops_inplace(void) {
+	TensorObject a = Tensor_new(1, (TensorIndex_t[]){19});
+	fill(&a, 0);
+	CU_ASSERT_EQUAL(Tensor_mul_scalar(&a, 2, &a), 0);
+	CU_ASSERT_EQUAL(Tensor_add_scalar(&a, 1, &a), 0);
+	for(TensorIndex_t i = 0; i < 19; i++) CU_ASSERT_EQUAL(a.data[i], 2 * i + 1);
+	CU_ASSERT_EQUAL(Tensor_sub_scalar(&a, 1, &a), 0);
+	CU_ASSERT_EQUAL(Tensor_div_scalar(&a, 2, &a), 0);
+	for(TensorIndex_t i = 0; i < 19; i++) CU_ASSERT_EQUAL(a.data[i], i);
+	Tensor_free(&a);
+}
+
+// Swapped views and slices go through the strided path.
+static void test_tensor_binary_ops_strided(void) {
+	TensorObject a = Tensor_new(2, (TensorIndex_t[]){5, 4});
+	TensorObject b = Tensor_new(2, (TensorIndex_t[]){4, 5});
+	TensorObject dst = Tensor_new(3, (TensorIndex_t[]){2, 4, 5});
+	fill(&a, 0);
+	fill(&b, 0);
+	Tensor_swapaxis(&a, 0, 1);
+	TensorObject slice = Tensor_slice(&dst, 0, 1);
+	CU_ASSERT_EQUAL(Tensor_add(&a, &b, &slice), 0);
+	for(TensorIndex_t i = 0; i < 4; i++) {
+		for(TensorIndex_t j = 0; j < 5; j++) {
+			CU_ASSERT_EQUAL(*Tensor_get(&dst, (TensorIndex_t[]){1, i, j}), (j * 4 + i) + (i * 5 + j));
+			CU_ASSERT_EQUAL(*Tensor_get(&dst, (TensorIndex_t[]){0, i, j}), 0);
+		}
+	}
+	CU_ASSERT_EQUAL(Tensor_add(&a, &dst, &slice), -1);
+	Tensor_free(&slice);
+	Tensor_free(&a);
+	Tensor_free(&b);
+	Tensor_free(&dst);
+}
+
+// Large enough to be split between the threads of the pool.
+static void test_tensor_binary_ops_parallel(void) {
+	TensorObject a = Tensor_new(2, (TensorIndex_t[]){300, 1001});
+	TensorObject b = Tensor_new(2, (TensorIndex_t[]){300, 1001});
+	fill(&a, 0);
+	fill(&b, 5);
+	CU_ASSERT_EQUAL(Tensor_sub(&b, &a, &a), 0);
+	int ok = 1;
+	for(TensorIndex_t i = 0; i < 300 * 1001; i++) ok &= a.data[i] == 5;
+	CU_ASSERT(ok);
+	Tensor_free(&a);
+	Tensor_free(&b);
+}
+
+// Rows, columns and leading dimensions are broadcast without copying.
+static void test_tensor_binary_ops_broadcast(void) {
+	TensorObject a = Tensor_new(2, (TensorIndex_t[]){3, 5});
+	TensorObject row = Tensor_new(1, (TensorIndex_t[]){5});
+	TensorObject col = Tensor_new(2, (TensorIndex_t[]){3, 1});
+	TensorObject dst = Tensor_new(3, (TensorIndex_t[]){2, 3, 5});
+	fill(&a, 0);
+	fill(&row, 100);
+	fill(&col, 1);
+	CU_ASSERT_EQUAL(Tensor_add(&a, &row, &dst), 0);
+	for(TensorIndex_t i = 0; i < 30; i++) CU_ASSERT_EQUAL(dst.data[i], i % 15 + 100 + i % 5);
+	CU_ASSERT_EQUAL(Tensor_sub(&col, &a, &dst), 0);
+	for(TensorIndex_t i = 0; i < 30; i++) CU_ASSERT_EQUAL(dst.data[i], i % 15 / 5 + 1.0 - i % 15);
+	CU_ASSERT_EQUAL(Tensor_div(&a, &col, &a), 0);
+	for(TensorIndex_t i = 0; i < 15; i++) CU_ASSERT_EQUAL(a.data[i], i / (i / 5 + 1.0));
+	CU_ASSERT_EQUAL(Tensor_mul(&col, &row, &a), 0);
+	for(TensorIndex_t i = 0; i < 15; i++) CU_ASSERT_EQUAL(a.data[i], (i / 5 + 1.0) * (i % 5 + 100));
+	CU_ASSERT_EQUAL(Tensor_fma(&col, &row, &a, &dst), 0);
+	for(TensorIndex_t i = 0; i < 30; i++) CU_ASSERT_EQUAL(dst.data[i], 2 * a.data[i % 15]);
+	CU_ASSERT_EQUAL(Tensor_add(&a, &dst, &row), -1);
+	CU_ASSERT_EQUAL(Tensor_add(&a, &col, &row), -1);
+	Tensor_free(&a);
+	Tensor_free(&row);
+	Tensor_free(&col);
+	Tensor_free(&dst);
+}
+
+// The product is rounded the same way whether the operands are contiguous, strided or of mixed dtypes.
+static void test_tensor_fma_rounding(void) {
+	TensorObject a = Tensor_new(2, (TensorIndex_t[]){4, 4});
+	TensorObject b = Tensor_new(2, (TensorIndex_t[]){4, 4});
+	TensorObject c = Tensor_new(2, (TensorIndex_t[]){4, 4});
+	TensorObject dst = Tensor_new(2, (TensorIndex_t[]){4, 4});
+	TensorObject dst_swapped = Tensor_new(2, (TensorIndex_t[]){4, 4});
+	TensorObject dst_mixed = Tensor_new(2, (TensorIndex_t[]){4, 4});
+	for(TensorIndex_t i = 0; i < 16; i++) {
+		a.data[i] = 1 + ldexp(1, -30);
+		b.data[i] = 1 - ldexp(1, -30);
+		c.data[i] = -1;
+	}
+	TensorObject c_int = Tensor_astype(c, TENSOR_INT32);
+	CU_ASSERT_EQUAL(Tensor_fma(&a, &b, &c, &dst), 0);
+	CU_ASSERT_EQUAL(Tensor_fma(&a, &b, &c_int, &dst_mixed), 0);
+	Tensor_swapaxis(&a, 0, 1);
+	CU_ASSERT_EQUAL(Tensor_fma(&a, &b, &c, &dst_swapped), 0);
+	const TensorData_t expected = Tensor_simd_level() >= TENSOR_SIMD_AVX2 ? -ldexp(1, -60) : 0;
+	for(TensorIndex_t i = 0; i < 16; i++) {
+		CU_ASSERT_EQUAL(dst.data[i], expected);
+		CU_ASSERT_EQUAL(dst_swapped.data[i], expected);
+		CU_ASSERT_EQUAL(dst_mixed.data[i], expected);
+	}
+	Tensor_free(&a);
+	Tensor_free(&b);
+	Tensor_free(&c);
+	Tensor_free(&c_int);
+	Tensor_free(&dst);
+	Tensor_free(&dst_swapped);
+	Tensor_free(&dst_mixed);
+}
+
+void tensor_math_suite_builder(void) {
+	CU_pSuite suite = CU_add_suite("tensor_math", NULL, NULL);
+	CU_add_test(suite, "tensor_binary_ops", test_tensor_binary_ops);
+	CU_add_test(suite, "tensor_scalar_ops_inplace", test_tensor_scalar_ops_inplace);
+	CU_add_test(suite, "tensor_binary_ops_strided", test_tensor_binary_ops_strided);
+	CU_add_test(suite, "tensor_binary_ops_parallel", test_tensor_binary_ops_parallel);
+	CU_add_test(suite, "tensor_binary_ops_broadcast", test_tensor_binary_ops_broadcast);
+	CU_add_test(suite, "tensor_fma_rounding", test_tensor_fma_rounding);
+}
@@ -3,6 +3,11 @@
 #include "tensor/parallel.h"
 #include <pthread.h>
 #include <math.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 struct ThreadCounter {
 	pthread_mutex_t mutex;
@@ -19,7 +24,7 @@ static void* _loop_over_dim_thread_count(void* args) {
 }
 
 static void test_loop_over_thread_count(void) {
-	TensorObject to = Tensor_new(3, (TensorShape_t[]){6,2,23});
+	TensorObject to = Tensor_new(3, (TensorIndex_t[]){6,2,23});
 	struct ThreadCounter thc;
 	thc.count=0;
 	pthread_mutex_init(&thc.mutex, NULL);
@@ -62,26 +67,323 @@ static TensorData_t findNthPrime(int n) {
 static void* _loop_over_dim_write(void* args) {
 	struct loop_args* loop_args = (struct loop_args*)args;
 	TensorObject to = loop_args->obj;
-	for(TensorShape_t i=0;i<to.shape[0];i++){
-		*Tensor_get(&to, (TensorShape_t[]){i}) = i;
+	for(TensorIndex_t i=0;i<to.shape[0];i++){
+		*Tensor_get(&to, (TensorIndex_t[]){i}) = i;
 	}
 	return NULL;
 }
 
 static void test_loop_over_write(void) {
-	TensorObject to = Tensor_new(2, (TensorShape_t[]){640, 16});
+	TensorObject to = Tensor_new(2, (TensorIndex_t[]){640, 16});
 	Tensor_loop_over_dim(to, 1, _loop_over_dim_write, (void*)&to);
-	for(TensorShape_t j=0;j<to.shape[1];j++){
-		for(TensorShape_t i=0;i<to.shape[0];i++){
-			CU_ASSERT_EQUAL(*Tensor_get(&to, (TensorShape_t[]){i, j}), i);
+	for(TensorIndex_t j=0;j<to.shape[1];j++){
+		for(TensorIndex_t i=0;i<to.shape[0];i++){
+			CU_ASSERT_EQUAL(*Tensor_get(&to, (TensorIndex_t[]){i, j}), i);
 		}
 	}
 	Tensor_free(&to);
 }
 
+// More slices than a worker deque has preallocated slots, forcing the deques to grow.
+static void test_loop_over_many_jobs(void) {
+	TensorObject to = Tensor_new(2, (TensorIndex_t[]){3000, 2});
+	struct ThreadCounter thc;
+	thc.count=0;
+	pthread_mutex_init(&thc.mutex, NULL);
+	Tensor_loop_over_dim(to, 0, _loop_over_dim_thread_count, (void*)&thc);
+	CU_ASSERT_EQUAL(thc.count, 3000);
+	pthread_mutex_destroy(&thc.mutex);
+	Tensor_free(&to);
+}
+
+static void* _loop_over_dim_chunk_count(void* args) {
+	struct loop_range_args* loop_args = (struct loop_range_args*)args;
+	struct ThreadCounter* thc = (struct ThreadCounter*)loop_args->args;
+	pthread_mutex_lock(&thc->mutex);
+	thc->count += loop_args->end - loop_args->begin;
+	pthread_mutex_unlock(&thc->mutex);
+	return NULL;
+}
+
+static void test_loop_over_chunked_count(void) {
+	TensorObject to = Tensor_new(3, (TensorIndex_t[]){6,2,23});
+	struct ThreadCounter thc;
+	pthread_mutex_init(&thc.mutex, NULL);
+
+	thc.count=0;
+	Tensor_loop_over_dim_chunked(to, 2, 0, _loop_over_dim_chunk_count, (void*)&thc);
+	CU_ASSERT_EQUAL(thc.count, 23);
+
+	thc.count=0;
+	Tensor_loop_over_dim_chunked(to, 2, 5, _loop_over_dim_chunk_count, (void*)&thc);
+	CU_ASSERT_EQUAL(thc.count, 23);
+
+	thc.count=0;
+	Tensor_loop_over_dim_chunked(to, 0, 100, _loop_over_dim_chunk_count, (void*)&thc);
+	CU_ASSERT_EQUAL(thc.count, 6);
+
+	pthread_mutex_destroy(&thc.mutex);
+	Tensor_free(&to);
+}
+
+static void* _loop_over_dim_chunk_write(void* args) {
+	struct loop_range_args* loop_args = (struct loop_range_args*)args;
+	TensorObject to = loop_args->obj;
+	for(TensorIndex_t i=0;i<to.shape[0];i++){
+		for(TensorIndex_t j=loop_args->begin;j<loop_args->end;j++){
+			*Tensor_get(&to, (TensorIndex_t[]){i, j}) = i * j;
+		}
+	}
+	return NULL;
+}
+
+static void test_loop_over_chunked_write(void) {
+	TensorObject to = Tensor_new(2, (TensorIndex_t[]){64, 1000});
+	Tensor_loop_over_dim_chunked(to, 1, 7, _loop_over_dim_chunk_write, NULL);
+	for(TensorIndex_t i=0;i<to.shape[0];i++){
+		for(TensorIndex_t j=0;j<to.shape[1];j++){
+			CU_ASSERT_EQUAL(*Tensor_get(&to, (TensorIndex_t[]){i, j}), i * j);
+		}
+	}
+	Tensor_free(&to);
+}
+
+static void test_loop_over_async(void) {
+	TensorObject a = Tensor_new(2, (TensorIndex_t[]){640, 16});
+	TensorObject b = Tensor_new(2, (TensorIndex_t[]){64, 1000});
+	TensorLoopHandle* handles[2];
+	handles[0] = Tensor_loop_over_dim_async(a, 1, _loop_over_dim_write, NULL);
+	handles[1] = Tensor_loop_over_dim_chunked_async(b, 1, 0, _loop_over_dim_chunk_write, NULL);
+	Tensor_loop_wait_all(handles, 2);
+	for(TensorIndex_t j=0;j<a.shape[1];j++){
+		for(TensorIndex_t i=0;i<a.shape[0];i++){
+			CU_ASSERT_EQUAL(*Tensor_get(&a, (TensorIndex_t[]){i, j}), i);
+		}
+	}
+	for(TensorIndex_t i=0;i<b.shape[0];i++){
+		for(TensorIndex_t j=0;j<b.shape[1];j++){
+			CU_ASSERT_EQUAL(*Tensor_get(&b, (TensorIndex_t[]){i, j}), i * j);
+		}
+	}
+	TensorLoopHandle* handle = Tensor_loop_over_dim_async(a, 0, _loop_over_dim_write, NULL);
+	while(!Tensor_loop_test(handle));
+	CU_ASSERT_EQUAL(Tensor_loop_test(handle), 1);
+	Tensor_loop_wait(handle);
+	Tensor_free(&a);
+	Tensor_free(&b);
+}
+
+static void* _loop_over_dim_nested(void* args) {
+	struct loop_args* loop_args = (struct loop_args*)args;
+	Tensor_loop_over_dim_chunked(loop_args->obj, 0, 1, _loop_over_dim_chunk_count, loop_args->args);
+	return NULL;
+}
+
+// Loops started from inside a loop must not deadlock the pool, even with a single worker.
+static void test_loop_over_nested(void) {
+	TensorObject to = Tensor_new(2, (TensorIndex_t[]){16, 32});
+	struct ThreadCounter thc;
+	thc.count=0;
+	pthread_mutex_init(&thc.mutex, NULL);
+	Tensor_loop_over_dim(to, 0, _loop_over_dim_nested, (void*)&thc);
+	CU_ASSERT_EQUAL(thc.count, 16 * 32);
+	Tensor_cleanup();
+	Tensor_init_threads(1, TENSOR_AFFINITY_NONE);
+	thc.count=0;
+	Tensor_loop_over_dim(to, 0, _loop_over_dim_nested, (void*)&thc);
+	CU_ASSERT_EQUAL(thc.count, 16 * 32);
+	Tensor_cleanup();
+	Tensor_init();
+	pthread_mutex_destroy(&thc.mutex);
+	Tensor_free(&to);
+}
+
+struct SliceJob {
+	TensorObject tensor;
+	TensorObject *slices;
+};
+
+static void* _slice_job(void* args) {
+	struct range_args* range = (struct range_args*)args;
+	struct SliceJob* job = (struct SliceJob*)range->args;
+	for(TensorIndex_t i = range->begin; i < range->end; i++) {
+		TensorObject slice = Tensor_slice(&job->tensor, 0, i % job->tensor.shape[0]);
+		job->slices[i] = Tensor_slice(&slice, 0, i % slice.shape[0]);
+		Tensor_free(&slice);
+	}
+	return NULL;
+}
+
+static void* _free_job(void* args) {
+	struct range_args* range = (struct range_args*)args;
+	struct SliceJob* job = (struct SliceJob*)range->args;
+	for(TensorIndex_t i = range->begin; i < range->end; i++) {
+		Tensor_free(&job->slices[i]);
+	}
+	return NULL;
+}
+
+// Views of a shared tensor are created on some threads and freed on others.
+static void test_slice_from_threads(void) {
+	struct SliceJob job;
+	job.tensor = Tensor_new(3, (TensorIndex_t[]){7, 5, 3});
+	job.slices = calloc(5000, sizeof(TensorObject));
+	Tensor_cleanup();
+	Tensor_init_threads(4, TENSOR_AFFINITY_NONE);
+	Tensor_parallel_for(5000, 1, _slice_job, &job);
+	CU_ASSERT_EQUAL(job.tensor.storage->ref_count, 5001);
+	Tensor_parallel_for(5000, 3, _free_job, &job);
+	CU_ASSERT_EQUAL(job.tensor.storage->ref_count, 1);
+	Tensor_cleanup();
+	Tensor_init();
+	free(job.slices);
+	Tensor_free(&job.tensor);
+}
+
+static void test_init_threads(void) {
+	Tensor_cleanup();
+	Tensor_init_threads(3, TENSOR_AFFINITY_CORE);
+	CU_ASSERT_EQUAL(Tensor_num_threads(), 3);
+	test_loop_over_thread_count();
+	Tensor_cleanup();
+	Tensor_init_threads(2, TENSOR_AFFINITY_NUMA);
+	CU_ASSERT_EQUAL(Tensor_num_threads(), 2);
+	test_loop_over_thread_count();
+	Tensor_cleanup();
+	Tensor_init();
+	CU_ASSERT(Tensor_num_threads() > 0);
+}
+
+static void* _busy_job(void* args) {
+	struct range_args* range = (struct range_args*)args;
+	volatile double sum = 0;
+	for(TensorIndex_t i = range->begin * 1000; i < range->end * 1000; i++) {
+		sum += sqrt((double)i);
+	}
+	return NULL;
+}
+
+// Statistics count every job of a loop, and the trace has a span for each of them.
+static void test_stats(void) {
+	Tensor_cleanup();
+	Tensor_init_threads(3, TENSOR_AFFINITY_NONE);
+	Tensor_stats_enable(1);
+	Tensor_stats_reset();
+	Tensor_parallel_for(64, 1, _busy_job, NULL);
+	struct TensorPoolStats stats;
+	Tensor_stats_get(&stats);
+	CU_ASSERT_EQUAL(stats.num_threads, 3);
+	CU_ASSERT_EQUAL(stats.jobs_submitted, 64);
+	CU_ASSERT_EQUAL(stats.jobs_completed, 64);
+	CU_ASSERT_EQUAL(stats.queue_depth, 0);
+	CU_ASSERT(stats.queue_depth_max >= 1 && stats.queue_depth_max <= 64);
+	CU_ASSERT(stats.busy_ns > 0);
+	uint64_t jobs = 0, busy = 0;
+	struct TensorWorkerStats worker;
+	for(TensorShape_t i = 0; i < 3; i++) {
+		CU_ASSERT_EQUAL(Tensor_stats_worker(i, &worker), 0);
+		jobs += worker.jobs;
+		busy += worker.busy_ns;
+	}
+	CU_ASSERT_EQUAL(jobs, 64);
+	CU_ASSERT_EQUAL(busy, stats.busy_ns);
+	CU_ASSERT_EQUAL(Tensor_stats_worker(3, &worker), -1);
+
+	char path[64];
+	snprintf(path, sizeof(path), "/tmp/tensor_trace_%d.json", (int)getpid());
+	CU_ASSERT_EQUAL(Tensor_trace_end(path), -1);
+	CU_ASSERT_EQUAL(Tensor_trace_begin(40), 0);
+	CU_ASSERT_EQUAL(Tensor_trace_begin(40), -1);
+	Tensor_parallel_for(64, 1, _busy_job, NULL);
+	CU_ASSERT_EQUAL(Tensor_trace_end(path), 0);
+	FILE* file = fopen(path, "r");
+	CU_ASSERT_PTR_NOT_NULL(file);
+	char line[512];
+	int spans = 0, dropped = -1;
+	while(file != NULL && fgets(line, sizeof(line), file) != NULL) {
+		spans += strstr(line, "\"ph\": \"X\"") != NULL;
+		char* field = strstr(line, "\"dropped_events\": ");
+		if(field != NULL) dropped = atoi(field + strlen("\"dropped_events\": "));
+	}
+	if(file != NULL) fclose(file);
+	remove(path);
+	CU_ASSERT_EQUAL(spans, 40);
+	CU_ASSERT_EQUAL(dropped, 24);
+
+	Tensor_stats_enable(0);
+	Tensor_stats_reset();
+	Tensor_parallel_for(64, 1, _busy_job, NULL);
+	Tensor_stats_get(&stats);
+	CU_ASSERT_EQUAL(stats.jobs_submitted, 0);
+	CU_ASSERT_EQUAL(stats.jobs_completed, 0);
+	Tensor_cleanup();
+	Tensor_init();
+}
+
+static void* _loop_thread(void* args) {
+	atomic_int* stop = (atomic_int*)args;
+	while(!atomic_load(stop)) {
+		Tensor_parallel_for(200, 1, _busy_job, NULL);
+	}
+	return NULL;
+}
+
+static void* _first_loop(void* args) {
+	Tensor_parallel_for(64, 1, _busy_job, NULL);
+	*(TensorShape_t*)args = Tensor_num_threads();
+	return NULL;
+}
+
+// Threads making their first parallel call at the same time share one pool.
+static void test_lazy_init_threads(void) {
+	Tensor_cleanup();
+	pthread_t threads[4];
+	TensorShape_t counts[4];
+	for(int i = 0; i < 4; i++) {
+		pthread_create(&threads[i], NULL, _first_loop, &counts[i]);
+	}
+	for(int i = 0; i < 4; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	for(int i = 0; i < 4; i++) {
+		CU_ASSERT_EQUAL(counts[i], Tensor_num_threads());
+	}
+	Tensor_cleanup();
+	Tensor_init();
+}
+
+// Tracing stops and restarts while a loop is running on the pool.
+static void test_trace_during_loop(void) {
+	char path[64];
+	snprintf(path, sizeof(path), "/tmp/tensor_trace_loop_%d.json", (int)getpid());
+	atomic_int stop = 0;
+	pthread_t thread;
+	pthread_create(&thread, NULL, _loop_thread, &stop);
+	int ok = 1;
+	for(int i = 0; i < 200; i++) {
+		ok &= Tensor_trace_begin(1 << 16) == 0;
+		usleep(i % 4 * 50);
+		ok &= Tensor_trace_end(path) == 0;
+	}
+	atomic_store(&stop, 1);
+	pthread_join(thread, NULL);
+	remove(path);
+	CU_ASSERT(ok);
+}
+
 void tensor_parallel_suite_builder(void) {
 	CU_pSuite suite = CU_add_suite("tensor_manipulation", NULL, NULL);
 	CU_add_test(suite, "loop_over_dim_thread_count", test_loop_over_thread_count);
 	CU_add_test(suite, "loop_over_dim_write", test_loop_over_write);
+	CU_add_test(suite, "loop_over_dim_many_jobs", test_loop_over_many_jobs);
+	CU_add_test(suite, "loop_over_dim_chunked_count", test_loop_over_chunked_count);
+	CU_add_test(suite, "loop_over_dim_chunked_write", test_loop_over_chunked_write);
+	CU_add_test(suite, "loop_over_dim_async", test_loop_over_async);
+	CU_add_test(suite, "loop_over_dim_nested", test_loop_over_nested);
+	CU_add_test(suite, "slice_from_threads", test_slice_from_threads);
+	CU_add_test(suite, "init_threads", test_init_threads);
+	CU_add_test(suite, "stats", test_stats);
+	CU_add_test(suite, "lazy_init_threads", test_lazy_init_threads);
+	CU_add_test(suite, "trace_during_loop", test_trace_during_loop);
 
 }
\ No newline at end of file
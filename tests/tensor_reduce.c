@@ -0,0 +1,158 @@
+#include "tensor.h"
+#include <CUnit/CUnit.h>
+#include <math.h>
+#include "tensor/reduce.h"
+
+// Small, repeating values so that some maxima tie.
+static void fill(TensorObject *tensor) {
+	TensorIndex_t total_size = 1;
+	for(TensorShape_t i = 0; i < tensor->ndim; i++) {
+		total_size *= tensor->shape[i];
+	}
+	for(TensorIndex_t i = 0; i < total_size; i++) {
+		tensor->data[i] = (TensorData_t)((i * 7) % 11) - 5;
+	}
+}
+
+// Naive reduction of element (i, j, k) of a 3-D tensor, with the value along axis replaced.
+static TensorData_t naive(enum TensorReduceOp op, TensorObject *a, TensorShape_t axis, TensorIndex_t *index) {
+	TensorIndex_t idx[3] = {index[0], index[1], index[2]};
+	TensorData_t result = op == TENSOR_REDUCE_MAX || op == TENSOR_REDUCE_ARGMAX ? -INFINITY : op == TENSOR_REDUCE_MIN ? INFINITY : 0;
+	TensorIndex_t arg = 0;
+	for(idx[axis] = 0; idx[axis] < a->shape[axis]; idx[axis]++) {
+		TensorData_t x = *Tensor_get(a, idx);
+		if(op == TENSOR_REDUCE_SUM || op == TENSOR_REDUCE_MEAN) {
+			result += x;
+		} else if(op == TENSOR_REDUCE_MIN ? x < result : x > result) {
+			result = x;
+			arg = idx[axis];
+		}
+	}
+	if(op == TENSOR_REDUCE_MEAN) return result / a->shape[axis];
+	if(op == TENSOR_REDUCE_ARGMAX) return arg;
+	return result;
+}
+
+static void check_axes(TensorObject *a) {
+	for(int op = TENSOR_REDUCE_SUM; op <= TENSOR_REDUCE_ARGMAX; op++) {
+		for(TensorShape_t axis = 0; axis < 3; axis++) {
+			TensorIndex_t shape[2];
+			for(TensorIndex_t d = 0, j = 0; d < 3; d++) {
+				if(d != axis) shape[j++] = a->shape[d];
+			}
+			TensorObject dst = Tensor_new(2, shape);
+			CU_ASSERT_EQUAL(Tensor_reduce(op, a, axis, &dst), 0);
+			int ok = 1;
+			TensorIndex_t idx[3];
+			for(idx[0] = 0; idx[0] < a->shape[0]; idx[0]++) {
+				for(idx[1] = 0; idx[1] < a->shape[1]; idx[1]++) {
+					for(idx[2] = 0; idx[2] < a->shape[2]; idx[2]++) {
+						if(idx[axis] != 0) continue;
+						TensorIndex_t out[2];
+						for(TensorIndex_t d = 0, j = 0; d < 3; d++) {
+							if(d != axis) out[j++] = idx[d];
+						}
+						ok &= fabs(*Tensor_get(&dst, out) - naive(op, a, axis, idx)) < 1e-9;
+					}
+				}
+			}
+			CU_ASSERT(ok);
+			Tensor_free(&dst);
+		}
+	}
+}
+
+static void test_tensor_reduce_axes(void) {
+	TensorObject a = Tensor_new(3, (TensorIndex_t[]){4, 5, 19});
+	fill(&a);
+	check_axes(&a);
+	Tensor_swapaxis(&a, 0, 2);
+	check_axes(&a);
+	Tensor_free(&a);
+}
+
+static void test_tensor_reduce_keepdims(void) {
+	TensorObject a = Tensor_new(2, (TensorIndex_t[]){3, 4});
+	TensorObject dst = Tensor_new(2, (TensorIndex_t[]){1, 4});
+	fill(&a);
+	CU_ASSERT_EQUAL(Tensor_sum(&a, 0, &dst), 0);
+	for(TensorIndex_t j = 0; j < 4; j++) {
+		CU_ASSERT_EQUAL(dst.data[j], a.data[j] + a.data[4 + j] + a.data[8 + j]);
+	}
+	CU_ASSERT_EQUAL(Tensor_sum(&a, 1, &dst), -1);
+	CU_ASSERT_EQUAL(Tensor_sum(&a, 2, &dst), -1);
+	Tensor_free(&a);
+	Tensor_free(&dst);
+}
+
+// Large enough to split the outputs, or the reduced axis, between the threads of the pool.
+static void test_tensor_reduce_parallel(void) {
+	TensorObject a = Tensor_new(2, (TensorIndex_t[]){3, 200001});
+	TensorObject rows = Tensor_new(1, (TensorIndex_t[]){3});
+	TensorObject cols = Tensor_new(1, (TensorIndex_t[]){200001});
+	for(TensorIndex_t i = 0; i < 3 * 200001; i++) a.data[i] = i % 200001;
+	a.data[200001 + 123456] = 1e6;
+	a.data[2 * 200001 + 7] = 1e6;
+	CU_ASSERT_EQUAL(Tensor_sum(&a, 1, &rows), 0);
+	CU_ASSERT_EQUAL(rows.data[0], 200000.0 * 200001 / 2);
+	CU_ASSERT_EQUAL(Tensor_argmax(&a, 1, &rows), 0);
+	CU_ASSERT_EQUAL(rows.data[0], 200000);
+	CU_ASSERT_EQUAL(rows.data[1], 123456);
+	CU_ASSERT_EQUAL(rows.data[2], 7);
+	CU_ASSERT_EQUAL(Tensor_max(&a, 0, &cols), 0);
+	int ok = 1;
+	for(TensorIndex_t j = 0; j < 200001; j++) ok &= cols.data[j] == (j == 123456 || j == 7 ? 1e6 : j);
+	CU_ASSERT(ok);
+	// the reduced axis is strided here.
+	Tensor_swapaxis(&a, 0, 1);
+	CU_ASSERT_EQUAL(Tensor_min(&a, 0, &rows), 0);
+	CU_ASSERT_EQUAL(rows.data[0], 0);
+	CU_ASSERT_EQUAL(rows.data[2], 0);
+	CU_ASSERT_EQUAL(Tensor_argmax(&a, 0, &rows), 0);
+	CU_ASSERT_EQUAL(rows.data[1], 123456);
+	CU_ASSERT_EQUAL(Tensor_argmax_all(&a), 7 * 3 + 2);
+	Tensor_free(&a);
+	Tensor_free(&rows);
+	Tensor_free(&cols);
+}
+
+// Naive summation of these loses most of the small values.
+static void test_tensor_reduce_accuracy(void) {
+	TensorObject a = Tensor_new(1, (TensorIndex_t[]){1000001});
+	TensorObject dst = Tensor_new(1, (TensorIndex_t[]){1});
+	for(TensorIndex_t i = 0; i < 1000001; i++) a.data[i] = 0.1;
+	CU_ASSERT_DOUBLE_EQUAL(Tensor_sum_all(&a), 100000.1, 1e-9);
+	a.data[0] = 1e16;
+	for(TensorIndex_t i = 1; i < 1000001; i++) a.data[i] = i % 2 ? 1 : 3;
+	CU_ASSERT_EQUAL(Tensor_sum_all(&a), 1e16 + 2000000);
+	TensorObject view = Tensor_new(2, (TensorIndex_t[]){1, 1000001});
+	for(TensorIndex_t i = 0; i < 1000001; i++) view.data[i] = a.data[i];
+	CU_ASSERT_EQUAL(Tensor_sum(&view, 1, &dst), 0);
+	CU_ASSERT_EQUAL(dst.data[0], 1e16 + 2000000);
+	Tensor_free(&a);
+	Tensor_free(&view);
+	Tensor_free(&dst);
+}
+
+static void test_tensor_reduce_all(void) {
+	TensorObject a = Tensor_new(2, (TensorIndex_t[]){6, 5});
+	for(TensorIndex_t i = 0; i < 30; i++) a.data[i] = i;
+	CU_ASSERT_EQUAL(Tensor_sum_all(&a), 435);
+	CU_ASSERT_EQUAL(Tensor_mean_all(&a), 14.5);
+	CU_ASSERT_EQUAL(Tensor_max_all(&a), 29);
+	CU_ASSERT_EQUAL(Tensor_min_all(&a), 0);
+	Tensor_swapaxis(&a, 0, 1);
+	CU_ASSERT_EQUAL(Tensor_argmax_all(&a), 29);
+	a.data[5] = 100;
+	CU_ASSERT_EQUAL(Tensor_argmax_all(&a), 1);
+	Tensor_free(&a);
+}
+
+void tensor_reduce_suite_builder(void) {
+	CU_pSuite suite = CU_add_suite("tensor_reduce", NULL, NULL);
+	CU_add_test(suite, "tensor_reduce_axes", test_tensor_reduce_axes);
+	CU_add_test(suite, "tensor_reduce_keepdims", test_tensor_reduce_keepdims);
+	CU_add_test(suite, "tensor_reduce_parallel", test_tensor_reduce_parallel);
+	CU_add_test(suite, "tensor_reduce_accuracy", test_tensor_reduce_accuracy);
+	CU_add_test(suite, "tensor_reduce_all", test_tensor_reduce_all);
+}
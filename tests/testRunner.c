@@ -8,6 +8,14 @@ extern void tensor_alloc_suite_builder(void);
 extern void tensor_manip_suite_builder(void);
 extern void tensor_data_suite_builder(void);
 extern void tensor_parallel_suite_builder(void);
+extern void tensor_math_suite_builder(void);
+extern void tensor_linalg_suite_builder(void);
+extern void tensor_reduce_suite_builder(void);
+extern void tensor_dtype_suite_builder(void);
+extern void tensor_io_suite_builder(void);
+extern void tensor_expr_suite_builder(void);
+extern void tensor_consts_suite_builder(void);
+extern void tensor_layout_suite_builder(void);
 
 
 
@@ -16,6 +24,14 @@ void (*constructors[])(void) = {
 	tensor_manip_suite_builder,
 	tensor_data_suite_builder,
 	tensor_parallel_suite_builder,
+	tensor_math_suite_builder,
+	tensor_linalg_suite_builder,
+	tensor_reduce_suite_builder,
+	tensor_dtype_suite_builder,
+	tensor_io_suite_builder,
+	tensor_expr_suite_builder,
+	tensor_consts_suite_builder,
+	tensor_layout_suite_builder,
 
 	(void(*)(void))NULL /*Sentinel*/
 };